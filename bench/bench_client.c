@@ -0,0 +1,508 @@
+/*
+ * bench_client.c - Synthetic Wayland load client for compositor-bench
+ *
+ * Runs in a forked child, so nothing here touches compositor state. All
+ * buffers live in one memfd: wl_shm clients share it as a pool, dmabuf
+ * clients wrap it in a udmabuf and describe each buffer as a linear
+ * DMA-BUF at an offset, which keeps the client free of GBM and a GPU.
+ *
+ * SPDX-License-Identifier: MIT
+ * Copyright (c) 2024
+ */
+#define _GNU_SOURCE
+
+#include "bench_client.h"
+#include "xdg-shell-client-protocol.h"
+#include "linux-dmabuf-unstable-v1-client-protocol.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/timerfd.h>
+#include <linux/udmabuf.h>
+
+#include <drm_fourcc.h>
+#include <wayland-client.h>
+
+/* Buffers per client - enough that the compositor never starves it */
+#define CLIENT_BUFFERS 3
+
+/* Geometry of the box and rows damage patterns */
+#define BOX_SIZE 128
+#define ROWS_HEIGHT 16
+
+struct client_buffer {
+    struct wl_buffer* buffer;
+    uint32_t* data;
+    bool busy;
+};
+
+struct client {
+    const struct bench_client_config* config;
+    struct wl_display* display;
+    struct wl_registry* registry;
+    struct wl_compositor* compositor;
+    struct wl_shm* shm;
+    struct xdg_wm_base* wm_base;
+    struct zwp_linux_dmabuf_v1* linux_dmabuf;
+
+    struct wl_surface* surface;
+    struct xdg_surface* xdg_surface;
+    struct xdg_toplevel* toplevel;
+    struct wl_callback* frame_callback;
+
+    struct client_buffer buffers[CLIENT_BUFFERS];
+    void* map;
+    size_t map_size;
+    int mem_fd;
+    int dmabuf_fd;
+    uint32_t stride;
+
+    bool configured;
+    bool closed;
+    bool want_frame;        /* Frame callback done, draw the next one */
+    uint64_t frame;
+    struct bench_client_stats stats;
+};
+
+static uint64_t now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+static void stamp_encode(uint32_t* row, uint64_t ts) {
+    /* 24 bits per pixel, alpha stays opaque so conversion keeps them */
+    for (int i = 0; i < BENCH_STAMP_PIXELS; i++) {
+        row[i] = 0xff000000u | (uint32_t)((ts >> (24 * i)) & 0xffffff);
+    }
+}
+
+uint64_t bench_stamp_decode(const uint32_t* row) {
+    uint64_t ts = 0;
+    for (int i = 0; i < BENCH_STAMP_PIXELS; i++) {
+        ts |= (uint64_t)(row[i] & 0xffffff) << (24 * i);
+    }
+    return ts;
+}
+
+/* Position bouncing between 0 and range */
+static uint32_t bounce(uint64_t pos, uint32_t range) {
+    if (range == 0) return 0;
+    uint64_t m = pos % (2 * (uint64_t)range);
+    return (uint32_t)(m < range ? m : 2 * (uint64_t)range - m);
+}
+
+static void fill_rect(struct client* c, uint32_t* data, uint32_t x, uint32_t y,
+                      uint32_t w, uint32_t h, uint32_t color) {
+    for (uint32_t row = y; row < y + h; row++) {
+        uint32_t* line = data + (size_t)row * (c->stride / 4);
+        for (uint32_t col = x; col < x + w; col++) {
+            line[col] = color;
+        }
+    }
+    wl_surface_damage_buffer(c->surface, (int32_t)x, (int32_t)y, (int32_t)w, (int32_t)h);
+    c->stats.bytes_drawn += (uint64_t)w * h * 4;
+}
+
+static void draw(struct client* c, struct client_buffer* buffer) {
+    uint32_t width = c->config->width;
+    uint32_t height = c->config->height;
+    uint32_t color = 0xff000000u | (uint32_t)((c->frame * 0x030507) & 0xffffff);
+
+    switch (c->config->damage) {
+    case BENCH_DAMAGE_FULL:
+        fill_rect(c, buffer->data, 0, 0, width, height, color);
+        break;
+    case BENCH_DAMAGE_BOX: {
+        uint32_t size_x = width < BOX_SIZE ? width : BOX_SIZE;
+        uint32_t size_y = height < BOX_SIZE ? height : BOX_SIZE;
+        /* The buffer still shows an older box - clear where the last one was */
+        if (c->frame > 0) {
+            fill_rect(c, buffer->data, bounce((c->frame - 1) * 7, width - size_x),
+                      bounce((c->frame - 1) * 5, height - size_y), size_x, size_y, 0xff202020u);
+        }
+        fill_rect(c, buffer->data, bounce(c->frame * 7, width - size_x),
+                  bounce(c->frame * 5, height - size_y), size_x, size_y, color);
+        break;
+    }
+    case BENCH_DAMAGE_ROWS: {
+        uint32_t rows = height < ROWS_HEIGHT ? height : ROWS_HEIGHT;
+        uint32_t y = (uint32_t)((c->frame * ROWS_HEIGHT) % (height - rows + 1));
+        fill_rect(c, buffer->data, 0, y, width, rows, color);
+        break;
+    }
+    }
+}
+
+static void handle_frame_done(void* data, struct wl_callback* callback, uint32_t time) {
+    struct client* c = data;
+    (void)time;
+    wl_callback_destroy(callback);
+    c->frame_callback = NULL;
+    c->want_frame = true;
+}
+
+static const struct wl_callback_listener frame_listener = {
+    .done = handle_frame_done,
+};
+
+/* Draw and commit into a released buffer. Returns false if all are busy. */
+static bool client_commit(struct client* c) {
+    struct client_buffer* buffer = NULL;
+    for (int i = 0; i < CLIENT_BUFFERS; i++) {
+        if (!c->buffers[i].busy) {
+            buffer = &c->buffers[i];
+            break;
+        }
+    }
+    if (!buffer) return false;
+
+    draw(c, buffer);
+    wl_surface_attach(c->surface, buffer->buffer, 0, 0);
+    wl_surface_damage_buffer(c->surface, 0, 0, BENCH_STAMP_PIXELS, 1);
+
+    if (c->config->rate <= 0) {
+        c->frame_callback = wl_surface_frame(c->surface);
+        wl_callback_add_listener(c->frame_callback, &frame_listener, c);
+    }
+
+    /* Stamp last so the latency covers nothing but the compositor */
+    stamp_encode(buffer->data, now_ns());
+    wl_surface_commit(c->surface);
+
+    buffer->busy = true;
+    c->frame++;
+    c->stats.commits++;
+    return true;
+}
+
+static void handle_buffer_release(void* data, struct wl_buffer* wl_buffer) {
+    struct client_buffer* buffer = data;
+    (void)wl_buffer;
+    buffer->busy = false;
+}
+
+static const struct wl_buffer_listener buffer_listener = {
+    .release = handle_buffer_release,
+};
+
+static void handle_wm_base_ping(void* data, struct xdg_wm_base* wm_base, uint32_t serial) {
+    (void)data;
+    xdg_wm_base_pong(wm_base, serial);
+}
+
+static const struct xdg_wm_base_listener wm_base_listener = {
+    .ping = handle_wm_base_ping,
+};
+
+static void handle_xdg_surface_configure(void* data, struct xdg_surface* xdg_surface,
+                                         uint32_t serial) {
+    struct client* c = data;
+    xdg_surface_ack_configure(xdg_surface, serial);
+    c->configured = true;
+}
+
+static const struct xdg_surface_listener xdg_surface_listener = {
+    .configure = handle_xdg_surface_configure,
+};
+
+static void handle_toplevel_configure(void* data, struct xdg_toplevel* toplevel,
+                                      int32_t width, int32_t height, struct wl_array* states) {
+    /* The buffer size is part of the load - keep it fixed */
+    (void)data;
+    (void)toplevel;
+    (void)width;
+    (void)height;
+    (void)states;
+}
+
+static void handle_toplevel_close(void* data, struct xdg_toplevel* toplevel) {
+    struct client* c = data;
+    (void)toplevel;
+    c->closed = true;
+}
+
+static void handle_toplevel_configure_bounds(void* data, struct xdg_toplevel* toplevel,
+                                             int32_t width, int32_t height) {
+    (void)data;
+    (void)toplevel;
+    (void)width;
+    (void)height;
+}
+
+static void handle_toplevel_wm_capabilities(void* data, struct xdg_toplevel* toplevel,
+                                            struct wl_array* capabilities) {
+    (void)data;
+    (void)toplevel;
+    (void)capabilities;
+}
+
+static const struct xdg_toplevel_listener toplevel_listener = {
+    .configure = handle_toplevel_configure,
+    .close = handle_toplevel_close,
+    .configure_bounds = handle_toplevel_configure_bounds,
+    .wm_capabilities = handle_toplevel_wm_capabilities,
+};
+
+static void handle_global(void* data, struct wl_registry* registry, uint32_t name,
+                          const char* interface, uint32_t version) {
+    struct client* c = data;
+
+    if (strcmp(interface, wl_compositor_interface.name) == 0 && version >= 4) {
+        /* 4 for damage_buffer */
+        c->compositor = wl_registry_bind(registry, name, &wl_compositor_interface, 4);
+    } else if (strcmp(interface, wl_shm_interface.name) == 0) {
+        c->shm = wl_registry_bind(registry, name, &wl_shm_interface, 1);
+    } else if (strcmp(interface, xdg_wm_base_interface.name) == 0) {
+        c->wm_base = wl_registry_bind(registry, name, &xdg_wm_base_interface, 1);
+        xdg_wm_base_add_listener(c->wm_base, &wm_base_listener, c);
+    } else if (strcmp(interface, zwp_linux_dmabuf_v1_interface.name) == 0 && version >= 2) {
+        /* 2 for create_immed */
+        c->linux_dmabuf = wl_registry_bind(registry, name, &zwp_linux_dmabuf_v1_interface, 2);
+    }
+}
+
+static void handle_global_remove(void* data, struct wl_registry* registry, uint32_t name) {
+    (void)data;
+    (void)registry;
+    (void)name;
+}
+
+static const struct wl_registry_listener registry_listener = {
+    .global = handle_global,
+    .global_remove = handle_global_remove,
+};
+
+static int create_udmabuf(int mem_fd, size_t size) {
+    int dev = open("/dev/udmabuf", O_RDWR | O_CLOEXEC);
+    if (dev < 0) return -1;
+
+    struct udmabuf_create create = {
+        .memfd = (uint32_t)mem_fd,
+        .flags = UDMABUF_FLAGS_CLOEXEC,
+        .offset = 0,
+        .size = size,
+    };
+    int fd = ioctl(dev, UDMABUF_CREATE, &create);
+    close(dev);
+    return fd;
+}
+
+static bool create_buffers(struct client* c) {
+    const struct bench_client_config* config = c->config;
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+
+    c->stride = config->width * 4;
+    /* Page-aligned so every buffer can be mapped on its own */
+    size_t buffer_size = ((size_t)c->stride * config->height + page - 1) & ~(page - 1);
+    c->map_size = buffer_size * CLIENT_BUFFERS;
+
+    c->mem_fd = memfd_create("bench-client", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (c->mem_fd < 0 || ftruncate(c->mem_fd, (off_t)c->map_size) < 0) {
+        return false;
+    }
+    c->map = mmap(NULL, c->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, c->mem_fd, 0);
+    if (c->map == MAP_FAILED) {
+        c->map = NULL;
+        return false;
+    }
+
+    if (config->buffer == BENCH_BUFFER_SHM) {
+        struct wl_shm_pool* pool = wl_shm_create_pool(c->shm, c->mem_fd, (int32_t)c->map_size);
+        for (int i = 0; i < CLIENT_BUFFERS; i++) {
+            c->buffers[i].buffer = wl_shm_pool_create_buffer(
+                pool, (int32_t)(i * buffer_size), (int32_t)config->width, (int32_t)config->height,
+                (int32_t)c->stride, config->opaque ? WL_SHM_FORMAT_XRGB8888 : WL_SHM_FORMAT_ARGB8888);
+        }
+        wl_shm_pool_destroy(pool);
+    } else {
+        /* udmabuf wants the memfd unable to shrink */
+        fcntl(c->mem_fd, F_ADD_SEALS, F_SEAL_SHRINK);
+        c->dmabuf_fd = create_udmabuf(c->mem_fd, c->map_size);
+        if (c->dmabuf_fd < 0) {
+            return false;
+        }
+        for (int i = 0; i < CLIENT_BUFFERS; i++) {
+            struct zwp_linux_buffer_params_v1* params =
+                zwp_linux_dmabuf_v1_create_params(c->linux_dmabuf);
+            zwp_linux_buffer_params_v1_add(params, c->dmabuf_fd, 0, (uint32_t)(i * buffer_size),
+                                           c->stride, (uint32_t)(DRM_FORMAT_MOD_LINEAR >> 32),
+                                           (uint32_t)(DRM_FORMAT_MOD_LINEAR & 0xffffffff));
+            c->buffers[i].buffer = zwp_linux_buffer_params_v1_create_immed(
+                params, (int32_t)config->width, (int32_t)config->height,
+                config->opaque ? DRM_FORMAT_XRGB8888 : DRM_FORMAT_ARGB8888, 0);
+            zwp_linux_buffer_params_v1_destroy(params);
+        }
+    }
+
+    for (int i = 0; i < CLIENT_BUFFERS; i++) {
+        if (!c->buffers[i].buffer) return false;
+        c->buffers[i].data = (uint32_t*)((uint8_t*)c->map + i * buffer_size);
+        memset(c->buffers[i].data, 0x20, (size_t)c->stride * config->height);
+        wl_buffer_add_listener(c->buffers[i].buffer, &buffer_listener, &c->buffers[i]);
+    }
+    return true;
+}
+
+static void client_destroy(struct client* c) {
+    for (int i = 0; i < CLIENT_BUFFERS; i++) {
+        if (c->buffers[i].buffer) wl_buffer_destroy(c->buffers[i].buffer);
+    }
+    if (c->frame_callback) wl_callback_destroy(c->frame_callback);
+    if (c->toplevel) xdg_toplevel_destroy(c->toplevel);
+    if (c->xdg_surface) xdg_surface_destroy(c->xdg_surface);
+    if (c->surface) wl_surface_destroy(c->surface);
+    if (c->linux_dmabuf) zwp_linux_dmabuf_v1_destroy(c->linux_dmabuf);
+    if (c->wm_base) xdg_wm_base_destroy(c->wm_base);
+    if (c->shm) wl_shm_destroy(c->shm);
+    if (c->compositor) wl_compositor_destroy(c->compositor);
+    if (c->registry) wl_registry_destroy(c->registry);
+    if (c->display) wl_display_disconnect(c->display);
+
+    if (c->map) munmap(c->map, c->map_size);
+    if (c->dmabuf_fd >= 0) close(c->dmabuf_fd);
+    if (c->mem_fd >= 0) close(c->mem_fd);
+}
+
+/* Connect, create the toplevel and its buffers */
+static int client_setup(struct client* c, int fd) {
+    c->display = wl_display_connect_to_fd(fd);
+    if (!c->display) {
+        close(fd);
+        return BENCH_CLIENT_ERR_CONNECT;
+    }
+
+    c->registry = wl_display_get_registry(c->display);
+    wl_registry_add_listener(c->registry, &registry_listener, c);
+    if (wl_display_roundtrip(c->display) < 0) {
+        return BENCH_CLIENT_ERR_PROTOCOL;
+    }
+
+    bool dmabuf = c->config->buffer == BENCH_BUFFER_DMABUF;
+    if (!c->compositor || !c->wm_base || (dmabuf ? !c->linux_dmabuf : !c->shm)) {
+        return BENCH_CLIENT_ERR_GLOBALS;
+    }
+
+    c->surface = wl_compositor_create_surface(c->compositor);
+    c->xdg_surface = xdg_wm_base_get_xdg_surface(c->wm_base, c->surface);
+    xdg_surface_add_listener(c->xdg_surface, &xdg_surface_listener, c);
+    c->toplevel = xdg_surface_get_toplevel(c->xdg_surface);
+    xdg_toplevel_add_listener(c->toplevel, &toplevel_listener, c);
+    xdg_toplevel_set_title(c->toplevel, "compositor-bench");
+    wl_surface_commit(c->surface);
+
+    while (!c->configured && !c->closed) {
+        if (wl_display_dispatch(c->display) < 0) {
+            return BENCH_CLIENT_ERR_PROTOCOL;
+        }
+    }
+
+    if (!create_buffers(c)) {
+        return BENCH_CLIENT_ERR_BUFFER;
+    }
+    return 0;
+}
+
+int bench_client_run(int fd, int stats_fd, const struct bench_client_config* config) {
+    struct client c = {
+        .config = config,
+        .mem_fd = -1,
+        .dmabuf_fd = -1,
+        .want_frame = true,
+    };
+    int timer = -1;
+
+    c.stats.error = client_setup(&c, fd);
+    if (c.stats.error) goto out;
+
+    if (config->rate > 0) {
+        timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+        uint64_t interval = (uint64_t)(1e9 / config->rate);
+        struct itimerspec spec = {
+            .it_interval = { (time_t)(interval / 1000000000ull), (long)(interval % 1000000000ull) },
+            .it_value = { 0, 1 },
+        };
+        if (timer < 0 || timerfd_settime(timer, 0, &spec, NULL) < 0) {
+            c.stats.error = BENCH_CLIENT_ERR_BUFFER;
+            goto out;
+        }
+    }
+
+    uint64_t deadline = now_ns() + (uint64_t)(config->duration * 1e9);
+    int display_fd = wl_display_get_fd(c.display);
+
+    while (!c.closed) {
+        /* Frame-callback driven: draw as soon as the compositor asks */
+        if (config->rate <= 0 && c.want_frame && client_commit(&c)) {
+            c.want_frame = false;
+        }
+
+        bool failed = false;
+        while (!failed && wl_display_prepare_read(c.display) != 0) {
+            failed = wl_display_dispatch_pending(c.display) < 0;
+        }
+        if (failed) {
+            c.stats.error = BENCH_CLIENT_ERR_PROTOCOL;
+            break;
+        }
+        wl_display_flush(c.display);
+
+        uint64_t now = now_ns();
+        if (now >= deadline) {
+            wl_display_cancel_read(c.display);
+            break;
+        }
+
+        struct pollfd fds[2] = {
+            { .fd = display_fd, .events = POLLIN },
+            { .fd = timer, .events = POLLIN },
+        };
+        int timeout_ms = (int)((deadline - now) / 1000000) + 1;
+        if (poll(fds, timer >= 0 ? 2 : 1, timeout_ms) < 0 && errno != EINTR) {
+            wl_display_cancel_read(c.display);
+            c.stats.error = BENCH_CLIENT_ERR_PROTOCOL;
+            break;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            if (wl_display_read_events(c.display) < 0) {
+                c.stats.error = BENCH_CLIENT_ERR_PROTOCOL;
+                break;
+            }
+        } else {
+            wl_display_cancel_read(c.display);
+        }
+        if (fds[0].revents & (POLLERR | POLLHUP)) {
+            break;
+        }
+        if (wl_display_dispatch_pending(c.display) < 0) {
+            c.stats.error = BENCH_CLIENT_ERR_PROTOCOL;
+            break;
+        }
+
+        if (timer >= 0 && (fds[1].revents & POLLIN)) {
+            uint64_t expirations = 0;
+            if (read(timer, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+                /* Missed ticks count as stalls too - the client fell behind */
+                if (expirations > 1) c.stats.stalls += expirations - 1;
+                if (!client_commit(&c)) c.stats.stalls++;
+            }
+        }
+    }
+
+out:
+    if (timer >= 0) close(timer);
+    client_destroy(&c);
+
+    ssize_t written = write(stats_fd, &c.stats, sizeof(c.stats));
+    (void)written;
+    close(stats_fd);
+    return c.stats.error ? 1 : 0;
+}
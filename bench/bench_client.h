@@ -0,0 +1,64 @@
+/*
+ * bench_client.h - Synthetic Wayland load client for compositor-bench
+ *
+ * A minimal xdg-shell client that commits wl_shm or linux-dmabuf buffers
+ * at a fixed rate (or as fast as frame callbacks allow) with a chosen
+ * damage pattern. Every commit stamps CLOCK_MONOTONIC into the first
+ * three pixels so the compositor side can measure commit-to-capture
+ * latency without a side channel.
+ *
+ * SPDX-License-Identifier: MIT
+ * Copyright (c) 2024
+ */
+#ifndef BENCH_CLIENT_H
+#define BENCH_CLIENT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+enum bench_damage {
+    BENCH_DAMAGE_FULL,      /* Redraw and damage the whole buffer */
+    BENCH_DAMAGE_BOX,       /* A bouncing 128x128 box */
+    BENCH_DAMAGE_ROWS,      /* 16 rows scrolling down, like a terminal */
+};
+
+enum bench_buffer {
+    BENCH_BUFFER_SHM,
+    BENCH_BUFFER_DMABUF,    /* Linear udmabuf, needs the GLES2 renderer */
+};
+
+struct bench_client_config {
+    uint32_t width;
+    uint32_t height;
+    double rate;            /* Commits per second, 0 to follow frame callbacks */
+    double duration;        /* Seconds until the client disconnects */
+    bool opaque;            /* XRGB8888 instead of ARGB8888 */
+    enum bench_damage damage;
+    enum bench_buffer buffer;
+};
+
+/* What a client did, written back to the bench when it exits */
+struct bench_client_stats {
+    uint64_t commits;
+    uint64_t stalls;        /* Ticks skipped because no buffer was released */
+    uint64_t bytes_drawn;
+    int32_t error;          /* 0, or a BENCH_CLIENT_ERR_* code */
+};
+
+#define BENCH_CLIENT_ERR_CONNECT    1
+#define BENCH_CLIENT_ERR_GLOBALS    2
+#define BENCH_CLIENT_ERR_BUFFER     3
+#define BENCH_CLIENT_ERR_PROTOCOL   4
+
+/* Pixels carrying the commit timestamp, top-left of the buffer */
+#define BENCH_STAMP_PIXELS 3
+
+/* Decode a timestamp from the first row of an ARGB8888 frame */
+uint64_t bench_stamp_decode(const uint32_t* row);
+
+/* Run a client on the connected socket fd until config->duration ends or
+ * the compositor goes away. Stats are written to stats_fd on exit.
+ * Returns the process exit code. */
+int bench_client_run(int fd, int stats_fd, const struct bench_client_config* config);
+
+#endif /* BENCH_CLIENT_H */
@@ -0,0 +1,667 @@
+/*
+ * compositor_bench.c - Headless load benchmark for the compositor core
+ *
+ * Drives comp_server through the C API the Qt wrapper uses, with the
+ * bench standing in for Qt: it captures each view's new frame the way an
+ * EmbeddedView would and then sends frame done. The synthetic clients are
+ * forked before the server exists and reach it over socketpairs, so the
+ * process's own CPU time is the compositor's alone.
+ *
+ * Results go to stdout (or --output) as JSON, a summary to stderr.
+ *
+ * SPDX-License-Identifier: MIT
+ * Copyright (c) 2024
+ */
+#define _GNU_SOURCE
+
+#include "compositor_core.h"
+#include "frame_trace.h"
+#include "pixel_convert.h"
+#include "bench_client.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <linux/dma-buf.h>
+
+#include <wlr/util/log.h>
+
+#define BENCH_MAX_CLIENTS 256
+
+/* Clients keep committing a little past the measurement */
+#define BENCH_CLIENT_GRACE_S 0.5
+
+struct bench_options {
+    struct bench_client_config client;
+    int clients;
+    double warmup;
+    bool hardware;
+    bool per_view_outputs;
+    bool render_outputs;    /* Let the core render outputs and send frame done */
+    const char* output_path;
+};
+
+struct bench_child {
+    pid_t pid;
+    int server_fd;          /* Our end of its socketpair, until handed over */
+    int stats_fd;
+    struct bench_client_stats stats;
+    bool reported;
+};
+
+struct bench_view {
+    struct comp_view* view;
+    bool dirty;
+    uint64_t last_stamp;
+};
+
+struct bench {
+    struct bench_options opts;
+    struct comp_server* server;
+    bool hardware_rendering;
+    struct bench_child children[BENCH_MAX_CLIENTS];
+    struct bench_view views[BENCH_MAX_CLIENTS];
+    int n_views;
+
+    bool measuring;
+    uint64_t measure_start_ns;
+    uint64_t measure_end_ns;
+    struct rusage usage_start;
+    struct rusage usage_end;
+    struct frame_trace_stats trace_start;
+    struct frame_trace_stats trace_end;
+
+    uint64_t* latency;
+    size_t n_latency;
+    size_t latency_cap;
+    uint64_t captured;
+    uint64_t capture_failures;
+};
+
+static const char* const damage_names[] = { "full", "box", "rows" };
+static const char* const buffer_names[] = { "shm", "dmabuf" };
+
+static void print_usage(void) {
+    fprintf(stderr,
+        "Usage: compositor-bench [options]\n"
+        "\n"
+        "Options:\n"
+        "  --clients N          Synthetic clients [4]\n"
+        "  --size WxH           Buffer size of each client [1280x720]\n"
+        "  --rate HZ            Commits per second, 0 to follow frame callbacks [60]\n"
+        "  --damage PATTERN     full, box or rows [full]\n"
+        "  --buffer TYPE        shm or dmabuf (implies --hardware) [shm]\n"
+        "  --opaque             Commit XRGB8888 instead of ARGB8888\n"
+        "  --duration S         Measured seconds [10]\n"
+        "  --warmup S           Seconds before measuring starts [1]\n"
+        "  --hardware           Use the GLES2 renderer\n"
+        "  --per-view-outputs   Give every client its own output\n"
+        "  --render-outputs     Render outputs on commit instead of pacing like Qt\n"
+        "  --output FILE        Write the JSON results to FILE instead of stdout\n"
+        "  --help               Show this help\n");
+}
+
+static int parse_enum(const char* value, const char* const* names, int count) {
+    for (int i = 0; i < count; i++) {
+        if (strcmp(value, names[i]) == 0) return i;
+    }
+    return -1;
+}
+
+static bool parse_options(int argc, char* argv[], struct bench_options* opts) {
+    enum {
+        OPT_CLIENTS = 256, OPT_SIZE, OPT_RATE, OPT_DAMAGE, OPT_BUFFER, OPT_OPAQUE,
+        OPT_DURATION, OPT_WARMUP, OPT_HARDWARE, OPT_PER_VIEW_OUTPUTS, OPT_RENDER_OUTPUTS,
+        OPT_OUTPUT, OPT_HELP,
+    };
+    static const struct option long_options[] = {
+        { "clients", required_argument, NULL, OPT_CLIENTS },
+        { "size", required_argument, NULL, OPT_SIZE },
+        { "rate", required_argument, NULL, OPT_RATE },
+        { "damage", required_argument, NULL, OPT_DAMAGE },
+        { "buffer", required_argument, NULL, OPT_BUFFER },
+        { "opaque", no_argument, NULL, OPT_OPAQUE },
+        { "duration", required_argument, NULL, OPT_DURATION },
+        { "warmup", required_argument, NULL, OPT_WARMUP },
+        { "hardware", no_argument, NULL, OPT_HARDWARE },
+        { "per-view-outputs", no_argument, NULL, OPT_PER_VIEW_OUTPUTS },
+        { "render-outputs", no_argument, NULL, OPT_RENDER_OUTPUTS },
+        { "output", required_argument, NULL, OPT_OUTPUT },
+        { "help", no_argument, NULL, OPT_HELP },
+        { NULL, 0, NULL, 0 },
+    };
+
+    *opts = (struct bench_options){
+        .client = {
+            .width = 1280,
+            .height = 720,
+            .rate = 60.0,
+            .damage = BENCH_DAMAGE_FULL,
+            .buffer = BENCH_BUFFER_SHM,
+        },
+        .clients = 4,
+        .warmup = 1.0,
+    };
+    double duration = 10.0;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        int value;
+        switch (opt) {
+        case OPT_CLIENTS:
+            opts->clients = atoi(optarg);
+            if (opts->clients < 1 || opts->clients > BENCH_MAX_CLIENTS) {
+                fprintf(stderr, "--clients must be 1-%d\n", BENCH_MAX_CLIENTS);
+                return false;
+            }
+            break;
+        case OPT_SIZE:
+            if (sscanf(optarg, "%ux%u", &opts->client.width, &opts->client.height) != 2 ||
+                opts->client.width < BENCH_STAMP_PIXELS || opts->client.height == 0 ||
+                opts->client.width > 16384 || opts->client.height > 16384) {
+                fprintf(stderr, "Invalid --size %s\n", optarg);
+                return false;
+            }
+            break;
+        case OPT_RATE:
+            opts->client.rate = atof(optarg);
+            if (opts->client.rate < 0) {
+                fprintf(stderr, "Invalid --rate %s\n", optarg);
+                return false;
+            }
+            break;
+        case OPT_DAMAGE:
+            value = parse_enum(optarg, damage_names, 3);
+            if (value < 0) {
+                fprintf(stderr, "Unknown --damage %s\n", optarg);
+                return false;
+            }
+            opts->client.damage = (enum bench_damage)value;
+            break;
+        case OPT_BUFFER:
+            value = parse_enum(optarg, buffer_names, 2);
+            if (value < 0) {
+                fprintf(stderr, "Unknown --buffer %s\n", optarg);
+                return false;
+            }
+            opts->client.buffer = (enum bench_buffer)value;
+            break;
+        case OPT_OPAQUE:
+            opts->client.opaque = true;
+            break;
+        case OPT_DURATION:
+            duration = atof(optarg);
+            break;
+        case OPT_WARMUP:
+            opts->warmup = atof(optarg);
+            break;
+        case OPT_HARDWARE:
+            opts->hardware = true;
+            break;
+        case OPT_PER_VIEW_OUTPUTS:
+            opts->per_view_outputs = true;
+            break;
+        case OPT_RENDER_OUTPUTS:
+            opts->render_outputs = true;
+            break;
+        case OPT_OUTPUT:
+            opts->output_path = optarg;
+            break;
+        case OPT_HELP:
+        default:
+            print_usage();
+            return false;
+        }
+    }
+
+    if (duration <= 0 || opts->warmup < 0) {
+        fprintf(stderr, "--duration must be positive and --warmup not negative\n");
+        return false;
+    }
+
+    /* linux-dmabuf is only advertised by the GLES2 renderer */
+    if (opts->client.buffer == BENCH_BUFFER_DMABUF) {
+        opts->hardware = true;
+    }
+
+    /* The measured time - clients get the warmup and a grace period on top */
+    opts->client.duration = duration;
+    return true;
+}
+
+/* Fork the clients before any compositor state exists */
+static bool spawn_clients(struct bench* b) {
+    struct bench_client_config config = b->opts.client;
+    config.duration = b->opts.warmup + b->opts.client.duration + BENCH_CLIENT_GRACE_S;
+
+    fflush(stdout);
+    fflush(stderr);
+
+    for (int i = 0; i < b->opts.clients; i++) {
+        int sv[2];
+        int stats[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0) {
+            perror("socketpair");
+            return false;
+        }
+        if (pipe2(stats, O_CLOEXEC) < 0) {
+            perror("pipe2");
+            close(sv[0]);
+            close(sv[1]);
+            return false;
+        }
+
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            close(sv[0]);
+            close(sv[1]);
+            close(stats[0]);
+            close(stats[1]);
+            return false;
+        }
+        if (pid == 0) {
+            /* Holding another client's server end would keep it alive */
+            for (int k = 0; k < i; k++) {
+                close(b->children[k].server_fd);
+                close(b->children[k].stats_fd);
+            }
+            close(sv[0]);
+            close(stats[0]);
+            _exit(bench_client_run(sv[1], stats[1], &config));
+        }
+
+        close(sv[1]);
+        close(stats[1]);
+        b->children[i].pid = pid;
+        b->children[i].server_fd = sv[0];
+        b->children[i].stats_fd = stats[0];
+    }
+    return true;
+}
+
+/* Collect what the clients report, then reap them */
+static void finish_clients(struct bench* b) {
+    for (int i = 0; i < b->opts.clients; i++) {
+        struct bench_child* child = &b->children[i];
+        if (!child->pid) continue;
+
+        if (child->server_fd >= 0) {
+            close(child->server_fd);
+            child->server_fd = -1;
+        }
+
+        ssize_t n;
+        do {
+            n = read(child->stats_fd, &child->stats, sizeof(child->stats));
+        } while (n < 0 && errno == EINTR);
+        child->reported = n == (ssize_t)sizeof(child->stats);
+        close(child->stats_fd);
+        child->stats_fd = -1;
+
+        int status;
+        while (waitpid(child->pid, &status, 0) < 0 && errno == EINTR) {
+        }
+        child->pid = 0;
+    }
+}
+
+static void view_callback(void* user_data, struct comp_view* view, bool added) {
+    struct bench* b = user_data;
+
+    if (added) {
+        if (b->n_views >= BENCH_MAX_CLIENTS) return;
+        b->views[b->n_views++] = (struct bench_view){ .view = view };
+        comp_view_request_size(view, b->opts.client.width, b->opts.client.height);
+        if (b->opts.per_view_outputs) {
+            comp_view_set_output_size(view, b->opts.client.width, b->opts.client.height, 1.0f);
+        }
+        return;
+    }
+
+    for (int i = 0; i < b->n_views; i++) {
+        if (b->views[i].view == view) {
+            b->views[i] = b->views[--b->n_views];
+            return;
+        }
+    }
+}
+
+static void view_commit_callback(void* user_data, struct comp_view* view,
+                                 const struct comp_rect* damage, int n_damage) {
+    struct bench* b = user_data;
+    (void)damage;
+    (void)n_damage;
+
+    for (int i = 0; i < b->n_views; i++) {
+        if (b->views[i].view == view) {
+            b->views[i].dirty = true;
+            return;
+        }
+    }
+}
+
+static void add_latency(struct bench* b, uint64_t latency) {
+    if (b->n_latency == b->latency_cap) {
+        size_t cap = b->latency_cap ? b->latency_cap * 2 : 4096;
+        uint64_t* samples = realloc(b->latency, cap * sizeof(*samples));
+        if (!samples) return;
+        b->latency = samples;
+        b->latency_cap = cap;
+    }
+    b->latency[b->n_latency++] = latency;
+}
+
+/* Read the commit stamp through a mapping of the DMA-BUF */
+static uint64_t dmabuf_stamp(const struct comp_dmabuf* dmabuf) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    off_t base = (off_t)(dmabuf->offset[0] & ~(page - 1));
+    size_t delta = dmabuf->offset[0] - (size_t)base;
+    size_t length = delta + BENCH_STAMP_PIXELS * 4;
+
+    void* map = mmap(NULL, length, PROT_READ, MAP_SHARED, dmabuf->fd[0], base);
+    if (map == MAP_FAILED) return 0;
+
+    struct dma_buf_sync sync = { .flags = DMA_BUF_SYNC_START | DMA_BUF_SYNC_READ };
+    ioctl(dmabuf->fd[0], DMA_BUF_IOCTL_SYNC, &sync);
+    uint64_t stamp = bench_stamp_decode((const uint32_t*)((const uint8_t*)map + delta));
+    sync.flags = DMA_BUF_SYNC_END | DMA_BUF_SYNC_READ;
+    ioctl(dmabuf->fd[0], DMA_BUF_IOCTL_SYNC, &sync);
+
+    munmap(map, length);
+    return stamp;
+}
+
+/* Take the view's new frame like an EmbeddedView would */
+static void capture_view(struct bench* b, struct bench_view* bv) {
+    bv->dirty = false;
+
+    uint64_t stamp = 0;
+    if (b->opts.client.buffer == BENCH_BUFFER_DMABUF) {
+        struct comp_dmabuf dmabuf;
+        if (!comp_view_export_dmabuf(bv->view, &dmabuf)) {
+            b->capture_failures++;
+            return;
+        }
+        stamp = dmabuf_stamp(&dmabuf);
+        comp_dmabuf_close(&dmabuf);
+    } else {
+        struct comp_frame frame;
+        if (!comp_view_acquire_frame(bv->view, &frame)) {
+            b->capture_failures++;
+            return;
+        }
+        stamp = bench_stamp_decode(frame.data);
+        comp_frame_release(frame.handle);
+    }
+
+    uint64_t now = frame_trace_now_ns();
+    if (stamp != bv->last_stamp) {
+        bv->last_stamp = stamp;
+        frame_trace_mark(bv->view, FRAME_TRACE_PRESENT, 0, 0);
+        if (b->measuring && stamp && stamp <= now) {
+            add_latency(b, now - stamp);
+            b->captured++;
+        }
+    }
+
+    if (!b->opts.render_outputs) {
+        comp_view_send_frame_done(bv->view, now);
+    }
+}
+
+static void measure_begin(struct bench* b, uint64_t now) {
+    b->measuring = true;
+    b->measure_start_ns = now;
+    getrusage(RUSAGE_SELF, &b->usage_start);
+    frame_trace_get_stats(NULL, &b->trace_start);
+}
+
+static void measure_end(struct bench* b, uint64_t now) {
+    b->measuring = false;
+    b->measure_end_ns = now;
+    getrusage(RUSAGE_SELF, &b->usage_end);
+    frame_trace_get_stats(NULL, &b->trace_end);
+}
+
+static void run(struct bench* b) {
+    uint64_t start = frame_trace_now_ns();
+    uint64_t warmup_end = start + (uint64_t)(b->opts.warmup * 1e9);
+    uint64_t end = warmup_end + (uint64_t)(b->opts.client.duration * 1e9);
+    int fd = comp_server_get_event_fd(b->server);
+
+    if (warmup_end == start) {
+        measure_begin(b, start);
+    }
+
+    for (uint64_t now = start; now < end; now = frame_trace_now_ns()) {
+        uint64_t next = b->measuring ? end : warmup_end;
+        int timeout_ms = (int)((next - now) / 1000000) + 1;
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        poll(&pfd, 1, timeout_ms < 100 ? timeout_ms : 100);
+
+        comp_server_dispatch_events(b->server);
+
+        if (!b->measuring && frame_trace_now_ns() >= warmup_end) {
+            measure_begin(b, frame_trace_now_ns());
+        }
+        for (int i = 0; i < b->n_views; i++) {
+            if (b->views[i].dirty) {
+                capture_view(b, &b->views[i]);
+            }
+        }
+        comp_server_flush_clients(b->server);
+    }
+
+    measure_end(b, frame_trace_now_ns());
+}
+
+static int compare_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile_ms(const uint64_t* sorted, size_t n, int percent) {
+    return n ? sorted[(n - 1) * (size_t)percent / 100] / 1e6 : 0.0;
+}
+
+static double tv_seconds(const struct timeval* tv) {
+    return (double)tv->tv_sec + (double)tv->tv_usec / 1e6;
+}
+
+static void report(struct bench* b, FILE* out) {
+    const struct bench_options* opts = &b->opts;
+    double elapsed = (b->measure_end_ns - b->measure_start_ns) / 1e9;
+    double user = tv_seconds(&b->usage_end.ru_utime) - tv_seconds(&b->usage_start.ru_utime);
+    double sys = tv_seconds(&b->usage_end.ru_stime) - tv_seconds(&b->usage_start.ru_stime);
+
+    struct rusage children;
+    getrusage(RUSAGE_CHILDREN, &children);
+
+    uint64_t commits = 0, stalls = 0, drawn = 0;
+    int failed = 0;
+    for (int i = 0; i < opts->clients; i++) {
+        const struct bench_child* child = &b->children[i];
+        if (!child->reported || child->stats.error) {
+            failed++;
+            continue;
+        }
+        commits += child->stats.commits;
+        stalls += child->stats.stalls;
+        drawn += child->stats.bytes_drawn;
+    }
+
+    qsort(b->latency, b->n_latency, sizeof(uint64_t), compare_u64);
+    double mean = 0.0;
+    for (size_t i = 0; i < b->n_latency; i++) {
+        mean += b->latency[i] / 1e6;
+    }
+    if (b->n_latency) mean /= (double)b->n_latency;
+
+    uint64_t bytes = b->trace_end.bytes_copied - b->trace_start.bytes_copied;
+    uint64_t dropped = b->trace_end.dropped - b->trace_start.dropped;
+    uint64_t frame_bytes = (uint64_t)opts->client.width * opts->client.height * 4;
+    double copies = b->captured ? (double)bytes / ((double)b->captured * frame_bytes) : 0.0;
+
+    fprintf(out, "{\n");
+    fprintf(out, "  \"config\": {\"clients\": %d, \"width\": %u, \"height\": %u, "
+                 "\"rate\": %.2f, \"damage\": \"%s\", \"buffer\": \"%s\", \"opaque\": %s, "
+                 "\"duration_s\": %.3f, \"warmup_s\": %.3f, \"per_view_outputs\": %s, "
+                 "\"render_outputs\": %s},\n",
+            opts->clients, opts->client.width, opts->client.height, opts->client.rate,
+            damage_names[opts->client.damage], buffer_names[opts->client.buffer],
+            opts->client.opaque ? "true" : "false", opts->client.duration, opts->warmup,
+            opts->per_view_outputs ? "true" : "false",
+            opts->render_outputs ? "true" : "false");
+    fprintf(out, "  \"renderer\": \"%s\",\n",
+            b->hardware_rendering ? "gles2" : "pixman");
+    fprintf(out, "  \"pixel_convert\": \"%s\",\n", pixel_convert_impl_name());
+    fprintf(out, "  \"compositor\": {\"cpu_user_s\": %.3f, \"cpu_system_s\": %.3f, "
+                 "\"cpu_percent\": %.1f, \"max_rss_kib\": %ld},\n",
+            user, sys, elapsed > 0 ? (user + sys) * 100.0 / elapsed : 0.0,
+            b->usage_end.ru_maxrss);
+    fprintf(out, "  \"clients\": {\"connected\": %d, \"failed\": %d, \"commits\": %llu, "
+                 "\"stalls\": %llu, \"bytes_drawn\": %llu, \"cpu_s\": %.3f},\n",
+            opts->clients - failed, failed, (unsigned long long)commits,
+            (unsigned long long)stalls, (unsigned long long)drawn,
+            tv_seconds(&children.ru_utime) + tv_seconds(&children.ru_stime));
+    fprintf(out, "  \"frames\": {\"captured\": %llu, \"per_second\": %.2f, \"dropped\": %llu, "
+                 "\"capture_failures\": %llu, \"bytes_copied\": %llu, "
+                 "\"copies_per_frame\": %.4f},\n",
+            (unsigned long long)b->captured, elapsed > 0 ? b->captured / elapsed : 0.0,
+            (unsigned long long)dropped, (unsigned long long)b->capture_failures,
+            (unsigned long long)bytes, copies);
+    fprintf(out, "  \"latency_ms\": {\"samples\": %zu, \"mean\": %.3f, \"p50\": %.3f, "
+                 "\"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f}\n",
+            b->n_latency, mean, percentile_ms(b->latency, b->n_latency, 50),
+            percentile_ms(b->latency, b->n_latency, 90),
+            percentile_ms(b->latency, b->n_latency, 99),
+            b->n_latency ? b->latency[b->n_latency - 1] / 1e6 : 0.0);
+    fprintf(out, "}\n");
+
+    fprintf(stderr, "%d/%d clients, %.1f frames/s captured, latency p50 %.2f ms p99 %.2f ms, "
+                    "compositor CPU %.1f%%, %.2f copies/frame, max RSS %ld KiB\n",
+            opts->clients - failed, opts->clients, elapsed > 0 ? b->captured / elapsed : 0.0,
+            percentile_ms(b->latency, b->n_latency, 50),
+            percentile_ms(b->latency, b->n_latency, 99),
+            elapsed > 0 ? (user + sys) * 100.0 / elapsed : 0.0, copies,
+            b->usage_end.ru_maxrss);
+    for (int i = 0; i < opts->clients; i++) {
+        const struct bench_child* child = &b->children[i];
+        if (!child->reported) {
+            fprintf(stderr, "client %d: exited without reporting\n", i);
+        } else if (child->stats.error) {
+            fprintf(stderr, "client %d: failed (error %d)\n", i, child->stats.error);
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    struct bench* b = calloc(1, sizeof(*b));
+    if (!b) return 1;
+
+    if (!parse_options(argc, argv, &b->opts)) {
+        free(b);
+        return 2;
+    }
+    for (int i = 0; i < BENCH_MAX_CLIENTS; i++) {
+        b->children[i].server_fd = -1;
+        b->children[i].stats_fd = -1;
+    }
+
+    /* The server still adds its listening socket, which needs a runtime dir */
+    char runtime_dir[] = "/tmp/compositor-bench-XXXXXX";
+    bool own_runtime_dir = false;
+    if (!getenv("XDG_RUNTIME_DIR")) {
+        if (!mkdtemp(runtime_dir)) {
+            perror("mkdtemp");
+            free(b);
+            return 1;
+        }
+        setenv("XDG_RUNTIME_DIR", runtime_dir, 1);
+        own_runtime_dir = true;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    int status = 1;
+
+    if (!spawn_clients(b)) {
+        goto out;
+    }
+
+    b->server = comp_server_create();
+    if (!b->server) goto out;
+    wlr_log_init(WLR_ERROR, NULL);
+
+    if (!comp_server_init_backend_with_renderer(b->server, b->opts.hardware)) {
+        fprintf(stderr, "Failed to initialize the backend\n");
+        goto out;
+    }
+    b->hardware_rendering = comp_server_is_hardware_rendering(b->server);
+    if (b->opts.client.buffer == BENCH_BUFFER_DMABUF && !b->hardware_rendering) {
+        fprintf(stderr, "DMA-BUF clients need the GLES2 renderer, which is not available\n");
+        goto out;
+    }
+
+    comp_server_set_view_callback(b->server, view_callback, b);
+    comp_server_set_view_commit_callback(b->server, view_commit_callback, b);
+    comp_server_set_external_frame_clock(b->server, !b->opts.render_outputs);
+    comp_server_set_per_view_outputs(b->server, b->opts.per_view_outputs);
+    frame_trace_set_enabled(true);
+
+    if (!comp_server_start(b->server)) {
+        fprintf(stderr, "Failed to start the compositor\n");
+        goto out;
+    }
+
+    for (int i = 0; i < b->opts.clients; i++) {
+        comp_server_add_client(b->server, b->children[i].server_fd);
+        b->children[i].server_fd = -1;
+    }
+
+    run(b);
+
+    FILE* out = b->opts.output_path ? fopen(b->opts.output_path, "w") : stdout;
+    if (!out) {
+        perror(b->opts.output_path);
+        goto out;
+    }
+
+    /* Hangs up on the clients, which then report and exit */
+    comp_server_destroy(b->server);
+    b->server = NULL;
+    finish_clients(b);
+
+    report(b, out);
+    if (out != stdout) fclose(out);
+
+    status = b->captured > 0 ? 0 : 1;
+    for (int i = 0; i < b->opts.clients; i++) {
+        if (!b->children[i].reported || b->children[i].stats.error) status = 1;
+    }
+
+out:
+    if (b->server) {
+        comp_server_destroy(b->server);
+        b->server = NULL;
+    }
+    finish_clients(b);
+    if (own_runtime_dir) {
+        rmdir(runtime_dir);
+    }
+    free(b->latency);
+    free(b);
+    return status;
+}
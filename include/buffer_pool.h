@@ -0,0 +1,78 @@
+/*
+ * buffer_pool.h - Reusable page-aligned pixel buffers
+ *
+ * Buffers are bucketed by size class (quarter steps between powers of
+ * two), so a resize that stays within a class reuses the same memory and
+ * one that crosses it usually finds a released buffer of the new class.
+ * Buffers are reference counted and go back to their bucket when the last
+ * reference is dropped - from any thread.
+ *
+ * With BUFFER_POOL_MEMFD the memory is a sealed-size memfd mapping that
+ * can be handed to another process or API by fd without copying.
+ *
+ * SPDX-License-Identifier: MIT
+ * Copyright (c) 2024
+ */
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct buffer_pool;
+
+/* Pool flags */
+enum buffer_pool_flags {
+    BUFFER_POOL_MEMFD = 1 << 0,      /* Back buffers with memfds (pool_buffer.fd) */
+    BUFFER_POOL_HUGEPAGES = 1 << 1,  /* Ask for transparent hugepages on large buffers */
+};
+
+/* A pooled buffer - data is page aligned and at least the requested size */
+struct pool_buffer {
+    void* data;
+    size_t size;    /* Usable size (the size class) */
+    int fd;         /* memfd backing data, -1 without BUFFER_POOL_MEMFD */
+};
+
+/* Create a pool. It stays alive until destroyed and every buffer released. */
+struct buffer_pool* buffer_pool_create(uint32_t flags);
+
+/* Flags from WLROOTS_QT_BUFFER_POOL ("memfd", "hugepages", comma separated) */
+uint32_t buffer_pool_flags_from_env(void);
+
+/* Drop cached memory and the creator's reference */
+void buffer_pool_destroy(struct buffer_pool* pool);
+
+/* Extra pool references for long-lived users (e.g. per-view rings) */
+struct buffer_pool* buffer_pool_ref(struct buffer_pool* pool);
+void buffer_pool_unref(struct buffer_pool* pool);
+
+/* Get a buffer of at least size bytes with one reference, NULL on failure */
+struct pool_buffer* buffer_pool_acquire(struct buffer_pool* pool, size_t size);
+
+/* Reference counting - the last unref returns the buffer to its bucket */
+void pool_buffer_ref(struct pool_buffer* buffer);
+void pool_buffer_unref(struct pool_buffer* buffer);
+
+/* True if the caller holds the only reference and may write to it */
+bool pool_buffer_is_exclusive(struct pool_buffer* buffer);
+
+/* Statistics */
+struct buffer_pool_stats {
+    uint64_t allocations;   /* Fresh mappings */
+    uint64_t reuses;        /* Acquires served from a bucket */
+    size_t cached_bytes;    /* Released memory kept for reuse */
+    size_t live_bytes;      /* Memory currently handed out */
+};
+void buffer_pool_get_stats(struct buffer_pool* pool, struct buffer_pool_stats* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BUFFER_POOL_H */
@@ -0,0 +1,64 @@
+/*
+ * buffer_sync.h - Explicit synchronization for client buffers given to Qt
+ *
+ * A client DMA-BUF handed to the scene graph comes with an acquire fence
+ * (a sync_file that signals when the client's rendering is done) and a
+ * lock that keeps the wlr_buffer from being released to the client. Qt
+ * waits on the acquire fence on the GPU and hands the lock back with a
+ * release fence of its own once it is done sampling. The lock is dropped
+ * when that fence signals - watched from the event loop, nobody blocks -
+ * and only then does the client get wl_buffer.release or, for
+ * linux-drm-syncobj-v1 clients, its release point signalled by wlroots.
+ *
+ * Acquire fences come from the client's syncobj acquire point, or for
+ * implicitly synced clients from the DMA-BUF's own fences
+ * (DMA_BUF_IOCTL_EXPORT_SYNC_FILE).
+ *
+ * Locks are taken on the event loop thread; buffer_sync_unlock() may be
+ * called from any thread, also after buffer_sync_destroy().
+ *
+ * SPDX-License-Identifier: MIT
+ * Copyright (c) 2024
+ */
+#ifndef BUFFER_SYNC_H
+#define BUFFER_SYNC_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <wayland-server-core.h>
+
+struct wlr_buffer;
+struct wlr_surface;
+struct buffer_sync;
+struct comp_buffer_lock;
+
+/* Create the release queue on the compositor's event loop */
+struct buffer_sync* buffer_sync_create(struct wl_event_loop* loop);
+
+/* Unlock every buffer still held - locks handed back later are only freed */
+void buffer_sync_destroy(struct buffer_sync* sync);
+
+/* Keep buffer locked until the lock is handed back */
+struct comp_buffer_lock* buffer_sync_lock(struct buffer_sync* sync, struct wlr_buffer* buffer);
+
+/* Hand a lock back. release_fence is a sync_file that signals when the
+ * consumer is done with the buffer, or -1 if it already is; either way
+ * it is owned by buffer_sync afterwards. */
+void buffer_sync_unlock(struct comp_buffer_lock* lock, int release_fence);
+
+/* sync_file that signals when the surface's current buffer is ready to
+ * be read, -1 if there is nothing to wait for or it cannot be exported */
+int buffer_sync_export_acquire(struct wlr_surface* surface);
+
+/* Same for a DMA-BUF the compositor rendered itself, from its implicit
+ * fences */
+int buffer_sync_export_implicit(struct wlr_buffer* buffer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BUFFER_SYNC_H */
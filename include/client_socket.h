@@ -0,0 +1,44 @@
+/*
+ * client_socket.h - Wayland socket whose connections the embedder places
+ *
+ * A client that connects to a wl_display's own socket belongs to that
+ * display for good. With several servers (shards, see compositor_wrapper.h)
+ * one socket has to take clients for all of them, so this one only
+ * listens: the embedder accepts each connection and hands it to the
+ * server of its choice with comp_server_add_client().
+ *
+ * Names and lock files follow libwayland's - wayland-N and wayland-N.lock
+ * in XDG_RUNTIME_DIR - so both kinds of sockets never take the same name.
+ *
+ * SPDX-License-Identifier: MIT
+ * Copyright (c) 2024
+ */
+#ifndef CLIENT_SOCKET_H
+#define CLIENT_SOCKET_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct client_socket;
+
+/* Listen on the first free wayland-N, NULL if there is none */
+struct client_socket* client_socket_create(void);
+
+/* Stop listening and remove the socket and its lock file */
+void client_socket_destroy(struct client_socket* socket);
+
+/* Name for WAYLAND_DISPLAY */
+const char* client_socket_get_name(struct client_socket* socket);
+
+/* Readable when a client is waiting to be accepted */
+int client_socket_get_fd(struct client_socket* socket);
+
+/* Next waiting connection (CLOEXEC), owned by the caller; -1 if none */
+int client_socket_accept(struct client_socket* socket);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CLIENT_SOCKET_H */
@@ -22,11 +22,91 @@ extern "C" {
 struct comp_server;
 struct comp_output;
 struct comp_view;
+struct gpu_node;
+struct comp_buffer_lock;
+struct view_stream_config;
+struct view_stream_sink;
+
+/* DMA-BUF format (DRM fourcc) and modifier pair */
+struct comp_dmabuf_format {
+    uint32_t format;
+    uint64_t modifier;  /* DRM_FORMAT_MOD_INVALID for implicit modifiers */
+};
+
+/* Maximum number of planes in an exported DMA-BUF */
+#define COMP_DMABUF_MAX_PLANES 4
+
+/* DMA-BUF description of a client buffer.
+ * The fds are owned by whoever received the struct - see comp_dmabuf_close.
+ *
+ * acquire_fence is a sync_file to wait on (on the GPU) before sampling,
+ * -1 if there is none. lock keeps the client from reusing the buffer;
+ * an importer that keeps sampling it takes lock over and gives it back
+ * with comp_buffer_unlock() once done. */
+struct comp_dmabuf {
+    uint32_t width;
+    uint32_t height;
+    uint32_t format;    /* DRM fourcc */
+    uint64_t modifier;  /* DRM format modifier */
+    int n_planes;
+    int fd[COMP_DMABUF_MAX_PLANES];
+    uint32_t offset[COMP_DMABUF_MAX_PLANES];
+    uint32_t stride[COMP_DMABUF_MAX_PLANES];
+    int acquire_fence;
+    struct comp_buffer_lock* lock;
+};
+
+/* Damage rectangle in buffer coordinates */
+struct comp_rect {
+    int32_t x, y;
+    int32_t width, height;
+};
+
+/* Damage beyond this many rectangles is reported as its bounding box */
+#define COMP_MAX_DAMAGE_RECTS 16
+
+/* Staging buffers per view - one being written, one in upload, one shown */
+#define COMP_FRAME_SLOTS 3
+
+/* CPU frame of a view, backed by a persistent per-view staging buffer -
+ * or, for wl_shm clients drawing ARGB8888, by the client's own buffer,
+ * which the client gets back once the frame is released.
+ * The memory stays valid and unchanged until comp_frame_release(handle). */
+struct comp_frame {
+    const void* data;   /* Premultiplied ARGB32 (DRM_FORMAT_ARGB8888) */
+    bool direct;        /* data is the client's - release it once uploaded */
+    uint32_t downscale; /* Buffer pixels per side of a frame pixel, usually 1 */
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;
+    uint64_t seq;       /* Increases with every new frame of the view */
+    /* Changed since the previous acquire of this view */
+    struct comp_rect damage[COMP_MAX_DAMAGE_RECTS];
+    int n_damage;
+    void* handle;
+};
+
+/* Cursor image the client with the pointer set for its view
+ * (wl_pointer.set_cursor) */
+struct comp_cursor {
+    const void* pixels; /* Premultiplied ARGB32, NULL while the cursor is hidden */
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;
+    /* Hotspot and the size the image is shown at, in pixels of the view's
+     * frame - the same ones comp_view_send_pointer_motion takes */
+    double hotspot_x, hotspot_y;
+    double frame_width, frame_height;
+};
 
 /* Callback types for Qt integration */
 typedef void (*comp_frame_callback_t)(void* user_data, uint32_t width, uint32_t height, void* buffer);
 typedef void (*comp_view_callback_t)(void* user_data, struct comp_view* view, bool added);
 typedef void (*comp_commit_callback_t)(void* user_data);
+typedef void (*comp_view_commit_callback_t)(void* user_data, struct comp_view* view,
+                                            const struct comp_rect* damage, int n_damage);
+typedef void (*comp_cursor_callback_t)(void* user_data, struct comp_view* view,
+                                       const struct comp_cursor* cursor);
 
 /* Server lifecycle */
 struct comp_server* comp_server_create(void);
@@ -39,25 +119,61 @@ bool comp_server_init_backend(struct comp_server* server);
 /* Initialize with explicit renderer choice */
 bool comp_server_init_backend_with_renderer(struct comp_server* server, bool use_hardware);
 
+/* Renderers wlroots can draw the views with */
+enum comp_renderer {
+    COMP_RENDERER_PIXMAN,   /* CPU */
+    COMP_RENDERER_GLES2,    /* GPU through EGL */
+    COMP_RENDERER_VULKAN,   /* GPU through Vulkan, falls back to GLES2 */
+};
+
+/* Initialize with a specific renderer - unavailable GPU renderers fall
+ * back to the next one, down to Pixman */
+bool comp_server_init_backend_with_type(struct comp_server* server, enum comp_renderer renderer);
+
+/* Renderer the backend ended up with */
+enum comp_renderer comp_server_get_renderer_type(struct comp_server* server);
+
 /* Check if hardware rendering is available */
 bool comp_server_hardware_available(void);
 
+/* Render node for hardware rendering, a path or node name - call before
+ * comp_server_init_backend*(). NULL picks one automatically. */
+void comp_server_set_render_node(const char* node);
+
+/* Render node hardware rendering would use, NULL if there is none */
+const struct gpu_node* comp_server_probe_gpu(void);
+
+/* Render node the renderer runs on, NULL for software rendering */
+const struct gpu_node* comp_server_get_gpu(struct comp_server* server);
+
 /* Check if currently using hardware rendering */
 bool comp_server_is_hardware_rendering(struct comp_server* server);
 
-/* Start server - creates socket, starts event loop */
+/* Create the listening socket ahead of comp_server_start() - works right
+ * after comp_server_create(). Clients that connect are served once the
+ * event loop runs. */
+bool comp_server_add_socket(struct comp_server* server);
+
+/* Start server - creates socket unless added already, starts event loop */
 bool comp_server_start(struct comp_server* server);
 
 /* Get wayland display socket name */
 const char* comp_server_get_socket(struct comp_server* server);
 
+/* Serve an already connected socket as a new client - e.g. one end of a
+ * socketpair handed to a child process. The server owns fd afterwards. */
+bool comp_server_add_client(struct comp_server* server, int fd);
+
 /* Event loop integration - returns fd for external polling */
 int comp_server_get_event_fd(struct comp_server* server);
 
-/* Process pending events - call when fd is readable */
+/* Process pending events until none are left - call when fd is
+ * readable. Nothing is written to clients; flush once afterwards, so a
+ * burst of requests and the calls made meanwhile go out together. */
 void comp_server_dispatch_events(struct comp_server* server);
 
-/* Flush clients */
+/* Run pending idle work and write everything queued to the clients -
+ * once per iteration of the embedder's event loop, before it blocks */
 void comp_server_flush_clients(struct comp_server* server);
 
 /* Set frame callback - called when compositor has new frame */
@@ -75,6 +191,36 @@ void comp_server_set_commit_callback(struct comp_server* server,
                                       comp_commit_callback_t callback,
                                       void* user_data);
 
+/* Set view commit callback - called when a view commits new buffer content,
+ * with the buffer damage of that commit. Commits without damage are skipped. */
+void comp_server_set_view_commit_callback(struct comp_server* server,
+                                           comp_view_commit_callback_t callback,
+                                           void* user_data);
+
+/* Set cursor callback - called when the client with the pointer sets,
+ * redraws or hides the cursor over view, and with cursor NULL once view
+ * has no cursor of its own any more (the pointer left its client, or the
+ * image is not CPU-readable) and the embedder's applies again. The pixels
+ * are only valid during the call. */
+void comp_server_set_cursor_callback(struct comp_server* server,
+                                     comp_cursor_callback_t callback,
+                                     void* user_data);
+
+/* Pace frame callbacks from the embedder instead of on every commit.
+ * When enabled, clients only get frame done through comp_view_send_frame_done. */
+void comp_server_set_external_frame_clock(struct comp_server* server, bool enabled);
+
+/* Give every view its own headless output instead of one shared 1280x720
+ * output - call before comp_server_start. Resize them with
+ * comp_view_set_output_size. */
+void comp_server_set_per_view_outputs(struct comp_server* server, bool enabled);
+
+/* Logical size of the first configure of new views and the scale of their
+ * output, defaults to 640x480 at scale 1. The embedder sets it to the item
+ * the next view will show up in so its first frame has the right size. */
+void comp_server_set_initial_view_size(struct comp_server* server, uint32_t width,
+                                       uint32_t height, float scale);
+
 /* Notify frame commit - called internally when clients commit */
 void comp_server_notify_frame_commit(struct comp_server* server);
 
@@ -88,35 +234,137 @@ void comp_view_get_geometry(struct comp_view* view, int32_t* x, int32_t* y,
                             uint32_t* width, uint32_t* height);
 void comp_view_set_position(struct comp_view* view, int32_t x, int32_t y);
 void comp_view_set_size(struct comp_view* view, uint32_t width, uint32_t height);
+/* Ask the client for a new size. Only one configure is in flight per
+ * view: requests made before the client acks it are merged, and the
+ * latest size goes out with the ack. */
 void comp_view_request_size(struct comp_view* view, uint32_t width, uint32_t height);
 void comp_view_focus(struct comp_view* view);
 void comp_view_close(struct comp_view* view);
 bool comp_view_is_mapped(struct comp_view* view);
 
+/* Resize the view's own output (per-view outputs only). width/height are
+ * pixels, scale is reported to the client as the output scale. */
+bool comp_view_set_output_size(struct comp_view* view, uint32_t width, uint32_t height,
+                               float scale);
+
+/* Frame pacing - times are CLOCK_MONOTONIC nanoseconds */
+void comp_view_send_frame_done(struct comp_view* view, uint64_t time_ns);
+
+/* Send wp_presentation feedback for the content the view last committed.
+ * refresh_ns is the display refresh period, 0 if unknown. */
+void comp_view_send_presented(struct comp_view* view, uint64_t time_ns,
+                              uint32_t refresh_ns, uint64_t seq);
+
+/* Suspend a view nobody can see - clients are expected to stop drawing.
+ * Frame callbacks for it are then up to the embedder's hidden rate. */
+void comp_view_set_suspended(struct comp_view* view, bool suspended);
+bool comp_view_is_suspended(struct comp_view* view);
+
+/* The view is shown large and opaque - its linux-dmabuf-v1 feedback then
+ * leads with opaque formats fit for scanout */
+void comp_view_set_scanout_hint(struct comp_view* view, bool scanout);
+
+/* Formats the embedder samples without a conversion, e.g. what Qt's
+ * scene graph imports. Client buffers are steered towards them through
+ * linux-dmabuf-v1 feedback. No-op for software rendering. */
+void comp_server_set_import_formats(struct comp_server* server,
+                                    const struct comp_dmabuf_format* formats, int n_formats);
+
+/* Check that view is still a mapped view of server - for deferred requests
+ * that carry a view pointer across threads */
+bool comp_server_has_view(struct comp_server* server, struct comp_view* view);
+
 /* Input - keyboard */
 void comp_server_send_key(struct comp_server* server, uint32_t key, bool pressed);
 void comp_server_send_modifiers(struct comp_server* server, uint32_t mods_depressed,
                                  uint32_t mods_latched, uint32_t mods_locked, uint32_t group);
+/* Take keyboard focus, or with pointer the pointer's, from whichever view
+ * has it - e.g. when it moves on to a view of another server */
+void comp_server_clear_focus(struct comp_server* server, bool pointer);
 
-/* Input - pointer */
+/* Input - pointer. Events are grouped until comp_server_send_pointer_frame,
+ * so a motion and the button press that follows it reach the client as
+ * one logical event. */
 void comp_server_send_pointer_motion(struct comp_server* server, double x, double y);
 void comp_server_send_pointer_button(struct comp_server* server, uint32_t button, bool pressed);
-void comp_server_send_pointer_axis(struct comp_server* server, bool horizontal, double value);
+/* value120: wheel delta in 1/120ths of a notch. continuous: touchpad-style
+ * scrolling, where value 0 marks the end of the gesture. */
+void comp_server_send_pointer_axis(struct comp_server* server, bool horizontal, double value,
+                                   int32_t value120, bool continuous, bool inverted);
+void comp_server_send_pointer_frame(struct comp_server* server);
+
+/* Pointer motion over view in pixels of its frame (as handed out by
+ * comp_view_acquire_frame). Only the view's own surfaces are hit-tested. */
+void comp_view_send_pointer_motion(struct comp_view* view, double x, double y);
 
-/* Rendering - get current frame buffer */
+/* Rendering - compose the whole scene once and read it back */
 bool comp_server_render_frame(struct comp_server* server, void* buffer, 
                                uint32_t width, uint32_t height, uint32_t stride);
 
-/* Trigger frame render and notify clients - call regularly from Qt timer */
+/* Trigger frame render and notify clients - call regularly from Qt timer.
+ * Outputs are only composed for a screen capture client waiting for a
+ * frame (see screen_capture.h); otherwise only the frame callbacks go
+ * out, since views are shown from their own buffers. */
 void comp_server_render_and_notify(struct comp_server* server);
 
-/* Render a specific view to buffer (ARGB32 format) */
+/* Render a specific view to buffer (premultiplied ARGB32, converted from
+ * the client's XRGB/ABGR/XBGR8888 or RGB565 as needed) */
 bool comp_view_render_to_buffer(struct comp_view* view, void* buffer,
                                  uint32_t width, uint32_t height, uint32_t stride);
 
+/* Acquire the view's latest frame without allocating. A wl_shm buffer
+ * that needs no conversion is handed out directly, so release it as soon
+ * as it is uploaded. Otherwise only what changed since the slot was last
+ * used is copied from the client buffer. Returns
+ * false for non-CPU-readable buffers or while every slot is still held.
+ * If nothing was committed since the last acquire, the same frame is
+ * returned again with n_damage == 0. */
+bool comp_view_acquire_frame(struct comp_view* view, struct comp_frame* frame);
+
+/* Release an acquired frame - safe to call from any thread, gives a
+ * direct frame's buffer back to the client */
+void comp_frame_release(void* handle);
+
+/* Size the view is shown at in pixels, for views shown much smaller than
+ * their buffer: CPU frames are then box filtered down by the largest
+ * whole factor that stays at least that big (see comp_frame.downscale).
+ * 0x0 hands out full-size frames again. DMA-BUF exports are unaffected. */
+void comp_view_set_thumbnail_size(struct comp_view* view, uint32_t width, uint32_t height);
+
+/* Give the view's staging buffers back, e.g. while nothing shows it.
+ * The next acquire copies the whole frame again. */
+void comp_view_trim_frames(struct comp_view* view);
+
 /* Get view surface dimensions */
 void comp_view_get_surface_size(struct comp_view* view, uint32_t* width, uint32_t* height);
 
+/* Export the view's current buffer as DMA-BUF for zero-copy import.
+ * Fails for wl_shm clients - use comp_view_render_to_buffer instead.
+ * On success the fds are dup()ed and must be released with comp_dmabuf_close. */
+bool comp_view_export_dmabuf(struct comp_view* view, struct comp_dmabuf* dmabuf);
+
+/* Close the fds of an exported DMA-BUF and drop its lock (safe to call
+ * twice) */
+void comp_dmabuf_close(struct comp_dmabuf* dmabuf);
+
+/* Let the client have a buffer back once release_fence (a sync_file, -1
+ * if the GPU is done already) signals. Takes the fence. Any thread. */
+void comp_buffer_unlock(struct comp_buffer_lock* lock, int release_fence);
+
+/* Wait on the CPU for a sync_file, timeout_ms -1 for ever. True once
+ * signalled. A fallback for consumers that cannot wait on the GPU. */
+bool comp_fence_wait(int fence, int timeout_ms);
+
+/* Encode the view's DMA-BUFs whenever it has damage, see view_stream.h.
+ * The stream takes sink, also on failure; a NULL render node in config
+ * means the one in use. NULL config stops streaming. Fails for wl_shm
+ * clients and without FFmpeg. */
+bool comp_view_set_stream(struct comp_view* view, const struct view_stream_config* config,
+                          const struct view_stream_sink* sink);
+
+/* Whether clients can use linux-drm-syncobj-v1 explicit sync */
+bool comp_server_has_explicit_sync(struct comp_server* server);
+
 #ifdef __cplusplus
 }
 #endif
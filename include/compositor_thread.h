@@ -0,0 +1,171 @@
+/*
+ * compositor_thread.h - Runs the wlroots event loop on its own thread
+ *
+ * In threaded mode the GUI thread never calls into the compositor core
+ * after start. Requests (input, focus, resize, ...) go to the compositor
+ * thread through a lock-free command queue, and every new view frame
+ * comes back through a lock-free frame queue. View lifecycle events are
+ * rare and are delivered as queued calls on the GUI thread.
+ *
+ * The frame queue holds at most one frame per view; the next one is only
+ * produced after the GUI reports the previous one consumed, so a busy
+ * GUI thread never backs frames up behind a fast client.
+ *
+ * SPDX-License-Identifier: MIT
+ * Copyright (c) 2024
+ */
+#ifndef COMPOSITOR_THREAD_H
+#define COMPOSITOR_THREAD_H
+
+#include <QThread>
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QSet>
+#include <QString>
+#include <QRect>
+#include <atomic>
+#include <deque>
+
+#include "compositor_core.h"
+#include "spsc_queue.h"
+#include "view_stream.h"
+
+class CompositorWrapper;
+
+/* Request from the GUI thread */
+struct CompositorCommand {
+    enum Type : quint8 {
+        Key,
+        Modifiers,
+        PointerMotion,
+        PointerButton,
+        PointerAxis,
+        PointerFrame,
+        FocusView,
+        ClearFocus,         /* args[0]: pointer rather than keyboard */
+        CloseView,
+        ResizeView,
+        InitialViewSize,
+        FrameConsumed,
+        FrameDone,
+        SetSuspended,
+        SetScanoutHint,
+        SetThumbnailSize,
+        TrimFrames,
+        RequestFrame,       /* After TrimFrames, sent once shown again */
+        AddClient,          /* args[0]: connected fd, owned by the command */
+        ImportFormats,      /* Payload from setImportFormats() */
+        SetStream           /* Payload from setViewStream() */
+    };
+
+    Type type;
+    struct comp_view* view;     /* Re-validated on the compositor thread */
+    int viewId;                 /* Stable id of view - dropped unless it still matches */
+    quint32 args[4];
+    double x, y;
+    quint64 time;               /* CLOCK_MONOTONIC ns */
+};
+
+/* New frame of a view, owned by whoever popped it */
+struct CompositorFrame {
+    struct comp_view* view;
+    int viewId;                 /* Stable id, see CompositorWrapper::allocateViewId */
+    bool isDmabuf;
+    struct comp_frame frame;    /* CPU frame - release with comp_frame_release */
+    struct comp_dmabuf dmabuf;  /* Hardware frame - close with comp_dmabuf_close */
+};
+
+class CompositorThread : public QThread {
+    Q_OBJECT
+
+public:
+    /* server must be started; the thread takes over its callbacks */
+    CompositorThread(struct comp_server* server, CompositorWrapper* wrapper);
+    ~CompositorThread() override;
+
+    /* GUI thread: queue a request and wake the compositor */
+    void post(const CompositorCommand& command);
+
+    /* GUI thread: pop the next finished frame */
+    bool takeFrame(CompositorFrame& frame);
+
+    /* GUI thread: called before draining so later frames wake us again */
+    void clearFrameWake();
+
+    /* GUI thread: stop the loop and join */
+    void stop();
+
+    /* GUI thread: hand over import formats, too big for a command */
+    void setImportFormats(const QList<struct comp_dmabuf_format>& formats);
+
+    /* GUI thread: start (config non-null) or stop streaming view to url.
+     * The sink is opened on the compositor thread, and a stream that could
+     * not be started is reported with CompositorWrapper::streamFailed. */
+    void setViewStream(struct comp_view* view, int viewId,
+                       const struct view_stream_config* config, const QByteArray& url);
+
+protected:
+    void run() override;
+
+private:
+    struct ViewInfo {
+        QString title;
+        QRect geometry;
+    };
+
+    struct PendingStream {
+        bool start = false;
+        struct view_stream_config config = {};
+        QByteArray url;
+    };
+
+    void wake();
+    void flushOverflow();
+    void scheduleOverflowRetry();
+    void processCommands();
+    bool hasView(const CompositorCommand& command) const;
+    void queueFrame(struct comp_view* view);
+    void requestDrain();
+    static void discardCommand(const CompositorCommand& command);
+    void publishViewInfo(struct comp_view* view, bool added);
+    void startStream(struct comp_view* view, const PendingStream& pending);
+    static void releaseFrame(CompositorFrame& frame);
+
+    /* Core callbacks - invoked on the compositor thread */
+    static void viewCallback(void* userData, struct comp_view* view, bool added);
+    static void commitCallback(void* userData);
+    static void viewCommitCallback(void* userData, struct comp_view* view,
+                                   const struct comp_rect* damage, int nDamage);
+    static void cursorCallback(void* userData, struct comp_view* view,
+                               const struct comp_cursor* cursor);
+
+    struct comp_server* m_server;
+    CompositorWrapper* m_wrapper;
+    int m_wakeFd = -1;
+    std::atomic<bool> m_quit{false};
+    std::atomic<bool> m_frameWakePending{false};
+
+    SpscQueue<CompositorCommand, 1024> m_commands;
+    SpscQueue<CompositorFrame, 64> m_frames;
+
+    /* GUI thread only: commands that did not fit while the compositor was busy */
+    std::deque<CompositorCommand> m_overflow;
+    bool m_overflowRetryScheduled = false;
+
+    QMutex m_importMutex;
+    QList<struct comp_dmabuf_format> m_importFormats;
+
+    QMutex m_streamMutex;
+    QHash<int, PendingStream> m_pendingStreams;  /* By view id, guarded by m_streamMutex */
+
+    /* Compositor thread only */
+    QSet<struct comp_view*> m_inFlight;   /* Frame queued, not yet consumed */
+    QSet<struct comp_view*> m_dirty;      /* Committed while in flight */
+    QSet<struct comp_view*> m_trimmed;    /* No frames until requested */
+    QHash<struct comp_view*, ViewInfo> m_info;
+    QHash<struct comp_view*, int> m_viewIds;  /* Sent with every event, checked for every command */
+};
+
+#endif /* COMPOSITOR_THREAD_H */
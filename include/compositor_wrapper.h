@@ -15,21 +15,63 @@
 #include <QTimer>
 #include <QList>
 #include <QRect>
+#include <QSize>
+#include <QSizeF>
+#include <QStringList>
+#include <QPointF>
 #include <QImage>
+#include <QRegion>
+#include <QHash>
+#include <QSet>
+#include <QVariantMap>
+#include <atomic>
 #include <memory>
 
+#include "view_model.h"
+
 /* Forward declare C types */
 extern "C" {
     struct comp_server;
     struct comp_view;
+    struct comp_dmabuf;
+    struct comp_dmabuf_format;
+    struct comp_rect;
+    struct comp_cursor;
+    struct client_socket;
 }
 
+class CompositorThread;
+struct CompositorCommand;
+class FrameScheduler;
+class TextureBudget;
+
+/* Cursor a view's client set, in pixels of the view's frame */
+struct ViewCursor {
+    bool set = false;   /* The client's own - hidden while image is null */
+    QImage image;
+    QPointF hotspot;
+    QSizeF size;        /* Shown at, image scaled to it */
+};
+
 class CompositorWrapper : public QObject {
     Q_OBJECT
     Q_PROPERTY(QString socketName READ socketName NOTIFY socketNameChanged)
+    Q_PROPERTY(QStringList shardSockets READ shardSockets NOTIFY socketNameChanged)
     Q_PROPERTY(bool running READ isRunning NOTIFY runningChanged)
     Q_PROPERTY(int viewCount READ viewCount NOTIFY viewsChanged)
+    Q_PROPERTY(ViewModel* views READ viewModel CONSTANT)
     Q_PROPERTY(bool hardwareRendering READ isHardwareRendering NOTIFY hardwareRenderingChanged)
+    Q_PROPERTY(bool vulkanRendering READ isVulkanRendering NOTIFY hardwareRenderingChanged)
+    Q_PROPERTY(bool threaded READ isThreaded NOTIFY threadedChanged)
+    Q_PROPERTY(bool perViewOutputs READ perViewOutputs NOTIFY perViewOutputsChanged)
+    Q_PROPERTY(int hiddenFrameRate READ hiddenFrameRate WRITE setHiddenFrameRate NOTIFY hiddenFrameRateChanged)
+    Q_PROPERTY(int textureMemoryLimit READ textureMemoryLimit WRITE setTextureMemoryLimit NOTIFY textureMemoryLimitChanged)
+    Q_PROPERTY(bool tracing READ isTracing WRITE setTracing NOTIFY tracingChanged)
+    Q_PROPERTY(double frameLatencyP50 READ frameLatencyP50 NOTIFY frameStatsChanged)
+    Q_PROPERTY(double frameLatencyP99 READ frameLatencyP99 NOTIFY frameStatsChanged)
+    Q_PROPERTY(double frameRate READ frameRate NOTIFY frameStatsChanged)
+    Q_PROPERTY(qint64 droppedFrames READ droppedFrames NOTIFY frameStatsChanged)
+    Q_PROPERTY(qint64 bytesCopied READ bytesCopied NOTIFY frameStatsChanged)
 
 public:
     explicit CompositorWrapper(QObject* parent = nullptr);
@@ -37,27 +79,178 @@ public:
 
     /* Initialize compositor - optionally with hardware acceleration */
     bool initialize(bool useHardware = false);
+    
+    /* Same, but the server, backend and renderer come up on a worker
+     * thread while the GUI thread goes on loading QML. The socket listens
+     * from the start; clients connecting early wait until start().
+     * Emits initialized() on the GUI thread when done. */
+    void initializeAsync(bool useHardware = false);
+    bool isInitialized() const;
+    qint64 initializeTime() const;  /* ms spent in backend bring-up */
+    
     bool start();
     void stop();
     
+    /* Run the wlroots event loop on its own thread - set before start() */
+    void setThreaded(bool threaded);
+    
+    /* How clients find their shard: by the shard socket they connect to,
+     * or through socketName, which hands each client to the shard with
+     * the fewest views */
+    enum ShardPolicy { ShardBySocket, ShardByLoad };
+    
+    /* Run count servers (shards), each with its own socket, thread, event
+     * loop and renderer, so clients are served on several cores - set
+     * before initialize(), implies threaded mode. Views of every shard are
+     * in the one view model and work the same. */
+    void setShards(int count, ShardPolicy policy = ShardByLoad);
+    int shardCount() const;
+    
+    /* Give every view its own output sized to its EmbeddedView - set before
+     * initialize() */
+    void setPerViewOutputs(bool enabled);
+    
+    /* Hardware rendering uses wlroots' Vulkan renderer instead of GLES2,
+     * falling back to GLES2 if it cannot be created - set before
+     * initialize() */
+    void setVulkan(bool enabled);
+    
+    /* DMA-BUF formats and modifiers the scene graph imports without a
+     * conversion, preferred in clients' linux-dmabuf-v1 feedback. Works
+     * before the server exists too. */
+    void setImportFormats(const QList<struct comp_dmabuf_format>& formats);
+    
     /* Check if hardware acceleration is available */
     static bool hardwareAvailable();
+    
+    /* Render node for hardware rendering, a path or name like "renderD129"
+     * - set before initialize(). Empty picks one automatically. */
+    static void setRenderNode(const QString& node);
 
     /* Properties */
     QString socketName() const;
+    QStringList shardSockets() const;  /* One per shard, the first's first */
     bool isRunning() const;
     int viewCount() const;
     bool isHardwareRendering() const;
+    bool isVulkanRendering() const;
+    bool isThreaded() const;
+    bool perViewOutputs() const;
 
-    /* View access */
+    /* View access by row of the view model - rows shift when a view
+     * before them goes away */
     Q_INVOKABLE QString viewTitle(int index) const;
     Q_INVOKABLE QRect viewGeometry(int index) const;
     Q_INVOKABLE void focusView(int index);
     Q_INVOKABLE void closeView(int index);
-    Q_INVOKABLE void resizeView(int index, int width, int height);
+    /* Logical size; scale is the device pixel ratio of the item showing the
+     * view and sizes its per-view output */
+    Q_INVOKABLE void resizeView(int index, int width, int height, qreal scale = 1.0);
+    
+    /* Logical size of the first configure of the next view to map, sent
+     * by the EmbeddedView it will show up in */
+    void setInitialViewSize(int width, int height, qreal scale);
+    
+    /* Get the latest frame of a view without copying it. The image shares
+     * the view's staging buffer; damage receives what changed since the
+     * previous acquire. Returns a null image if no frame is available. */
+    QImage acquireViewFrame(int index, QRegion* damage = nullptr);
+    
+    /* Opaque handle of the view at index (nullptr if out of range) */
+    struct comp_view* viewHandle(int index) const;
+    
+    /* Stable id of the view at index (0 if out of range), and back */
+    Q_INVOKABLE int viewId(int index) const;
+    struct comp_view* viewById(int id) const;
+    int viewIndexOf(struct comp_view* view) const;
+    
+    /* One row per view, see view_model.h */
+    ViewModel* viewModel() const;
+    
+    /* View access by handle, for items following one view however its row
+     * moves. A handle of a view that went away is ignored. */
+    QString viewTitle(struct comp_view* view) const;
+    void focusView(struct comp_view* view);
+    void resizeView(struct comp_view* view, int width, int height, qreal scale);
+    /* downscale receives the buffer pixels per side of a frame pixel */
+    QImage acquireViewFrame(struct comp_view* view, QRegion* damage, int* downscale = nullptr);
+    bool getViewDmabuf(struct comp_view* view, struct comp_dmabuf* dmabuf);
+    void setViewVisible(struct comp_view* view, bool visible);
+    void setViewScanoutHint(struct comp_view* view, bool scanout);
+    void sendViewPointerMotion(struct comp_view* view, double x, double y, bool coalesce);
+    /* Cursor the view's client set while it has the pointer, unset when
+     * the item's own cursor applies - see viewCursorChanged */
+    ViewCursor viewCursor(struct comp_view* view) const;
+    /* Drop the staging buffers of a view nobody shows; the next acquire
+     * gets a whole new frame */
+    void trimViewFrames(struct comp_view* view);
+    /* Pixel size the view is shown at as a thumbnail - CPU frames are
+     * then downscaled to about that size. An empty size for full frames. */
+    void setViewThumbnailSize(struct comp_view* view, const QSize& size);
+    
+    /* Paces client frame callbacks to the presenting QQuickWindows */
+    FrameScheduler* frameScheduler() const;
+    
+    /* Evicts the frames of hidden views above textureMemoryLimit */
+    TextureBudget* textureBudget() const;
+    
+    /* A Qt frame finished: send frame done to all views, and presentation
+     * feedback to those whose content was part of it */
+    void completeFrame(const QList<struct comp_view*>& views,
+                       const QSet<struct comp_view*>& presented, quint64 timeNs,
+                       quint32 refreshNs, quint64 seq);
+    
+    /* Effective visibility reported by an EmbeddedView showing the view,
+     * on changes only: each show is paired with a hide. Views no host
+     * shows, new ones included, are throttled to hiddenFrameRate; the
+     * last host hiding a view also suspends it. */
+    Q_INVOKABLE void setViewVisible(int index, bool visible);
+    int hiddenFrameRate() const;
+    void setHiddenFrameRate(int hz);
     
-    /* Get rendered frame for a specific view */
-    QImage getViewFrame(int index);
+    /* Memory the EmbeddedViews may keep in frames, in MiB, 0 (default)
+     * for no limit - see texture_budget.h */
+    int textureMemoryLimit() const;
+    void setTextureMemoryLimit(int mib);
+    
+    /* Export the view's buffer as DMA-BUF (hardware clients only).
+     * Caller owns the fds - see comp_dmabuf_close. */
+    bool getViewDmabuf(int index, struct comp_dmabuf* dmabuf);
+    
+    /* Encode the view on the GPU (VAAPI) whenever it changes and send it
+     * to url - "rtp://host:port" or "shm:name", see view_stream.h. codec
+     * is "h264" or "hevc", bitrateKbps 0 for constant quality. Hardware
+     * clients only. False for an unknown view or codec. In threaded mode
+     * the view's thread opens the sink and starts the stream after this
+     * returns, so a sink or stream that could not be started is only
+     * reported with streamFailed; without threads it is reported both
+     * ways. Encoder errors with the first frame are only logged. */
+    Q_INVOKABLE bool streamView(int index, const QString& url, const QString& codec = QStringLiteral("h264"),
+                                int bitrateKbps = 0);
+    Q_INVOKABLE void stopViewStream(int index);
+    
+    /* Frame tracing - the counters cover all views, latencies in ms from
+     * commit to present, refreshed twice a second while tracing */
+    bool isTracing() const;
+    void setTracing(bool enabled);
+    double frameLatencyP50() const;
+    double frameLatencyP99() const;
+    double frameRate() const;
+    qint64 droppedFrames() const;
+    qint64 bytesCopied() const;
+    
+    /* Same counters for one view: latencyP50, latencyP99, frameRate,
+     * frames, droppedFrames, bytesCopied */
+    Q_INVOKABLE QVariantMap viewFrameStats(int index) const;
+    
+    /* GPU the renderer runs on, or would run on before initialize():
+     * renderNode, driver, vendorId, deviceId, bootVga, inUse and formats,
+     * a list of {fourcc, format, modifiers} with modifiers as hex strings
+     * that the GPU imports as DMA-BUFs. Empty without a usable GPU. */
+    Q_INVOKABLE QVariantMap gpuInfo() const;
+    
+    /* Write the recorded events as Chrome/Perfetto trace JSON */
+    Q_INVOKABLE bool writeFrameTrace(const QString& path);
 
     /* Input forwarding from Qt */
     Q_INVOKABLE void sendKey(quint32 key, bool pressed);
@@ -65,35 +258,183 @@ public:
                                    quint32 locked, quint32 group);
     Q_INVOKABLE void sendPointerMotion(double x, double y);
     Q_INVOKABLE void sendPointerButton(quint32 button, bool pressed);
-    Q_INVOKABLE void sendPointerAxis(bool horizontal, double value);
+    /* value120: wheel delta in 1/120ths of a notch, or 0 for continuous
+     * (touchpad) scrolling, which ends with a value of 0 */
+    Q_INVOKABLE void sendPointerAxis(bool horizontal, double value, int value120 = 0,
+                                     bool continuous = false, bool inverted = false);
+    
+    /* Pointer motion over a view in its frame's pixels. Coalesced motion
+     * keeps only the latest position and reaches the client right before
+     * its next frame done, or a refresh period later if nothing is drawn;
+     * buttons and scrolling send it first. Without coalescing every motion
+     * goes out at once as its own pointer frame. */
+    Q_INVOKABLE void sendViewPointerMotion(int index, double x, double y, bool coalesce = true);
 
 signals:
+    void initialized(bool ok);
     void socketNameChanged();
     void runningChanged();
     void viewsChanged();
     void viewAdded(int index);
     void viewRemoved(int index);
     void frameReady();
+    void viewCommitted(int index, const QRegion& damage);
+    void viewCursorChanged(int index);
+    void streamFailed(int index);
     void error(const QString& message);
     void hardwareRenderingChanged();
+    void threadedChanged();
+    void perViewOutputsChanged();
+    void hiddenFrameRateChanged();
+    void textureMemoryLimitChanged();
+    void tracingChanged();
+    void frameStatsChanged();
 
 private slots:
     void onWaylandEvents();
-    void onFrameTimer();
+    void onAboutToBlock();
+    void onStatsTimer();
+    void flushPointerMotion();
+    void onClientConnected();
 
 private:
+    friend class CompositorThread;
+    
+    /* Stable view id, unique across shards - any thread */
+    int allocateViewId();
+    
+    /* Threaded mode - invoked on the GUI thread by CompositorThread. The
+     * memory of a view that went away may already hold another one, so
+     * events name the view by id as well and are dropped unless both
+     * still match. */
+    void threadViewAdded(CompositorThread* thread, struct comp_view* view, int id,
+                         const QString& title, const QRect& geometry);
+    void threadViewRemoved(struct comp_view* view, int id);
+    void threadViewInfo(struct comp_view* view, int id, const QString& title,
+                        const QRect& geometry);
+    void threadViewCursor(struct comp_view* view, int id, const ViewCursor& cursor);
+    void threadStreamFailed(struct comp_view* view, int id);
+    bool isCurrentView(struct comp_view* view, int id) const;
+    void drainFrames(CompositorThread* thread);
+    /* Threaded mode: a trimmed view is acquired again - ask for a frame */
+    void requestTrimmedFrame(struct comp_view* view);
+    
+    /* Threaded mode: thread of the shard view lives on */
+    CompositorThread* viewThread(struct comp_view* view) const;
+    /* Threaded mode: requests that apply to every shard */
+    void postToShards(const CompositorCommand& command);
+    /* Threaded mode: keyboard or pointer input now goes to thread's shard.
+     * The view that had it on the previous one loses focus. */
+    void setInputThread(CompositorThread* thread, bool pointer);
+    
+    /* Startup - createServers is safe to run off the GUI thread. The first
+     * server is required, the rest are shards taken as far as they come up. */
+    static QList<struct comp_server*> createServers(int count, bool useHardware, bool vulkan,
+                                                    QString* errorMessage);
+    static struct comp_server* createServer(bool useHardware, bool vulkan,
+                                            QString* errorMessage);
+    void configureServer(struct comp_server* server);
+    bool finishInitialize();
+    
+    /* Keep m_views, the ids and the model in step */
+    void addView(struct comp_view* view, int id, const QString& title, const QRect& geometry);
+    void removeView(struct comp_view* view);
+    void updateViewInfo(struct comp_view* view, const QString& title, const QRect& geometry);
+    void updateViewCursor(struct comp_view* view, const ViewCursor& cursor);
+    /* Copy of a cursor handed out by the core, which keeps the pixels */
+    static ViewCursor cursorFromCore(const struct comp_cursor* cursor);
+    
+    /* Send the coalesced pointer motion; endFrame closes the event group */
+    void sendPendingMotion(bool endFrame);
+    void sendPointerFrame();
+    
     /* Static callbacks for C interface */
     static void frameCallback(void* userData, uint32_t width, uint32_t height, void* buffer);
     static void viewCallback(void* userData, struct comp_view* view, bool added);
     static void commitCallback(void* userData);
+    static void viewCommitCallback(void* userData, struct comp_view* view,
+                                   const struct comp_rect* damage, int nDamage);
+    static void cursorCallback(void* userData, struct comp_view* view,
+                               const struct comp_cursor* cursor);
 
     /* Internal state */
     struct comp_server* m_server = nullptr;
+    
+    /* initializeAsync() - written by m_initThread until it finished */
+    QThread* m_initThread = nullptr;
+    QList<struct comp_server*> m_initServers;
+    QString m_initError;
+    qint64 m_initMs = 0;
+    
+    /* Single-threaded mode: dispatch on the loop fd, flush before Qt blocks */
     QSocketNotifier* m_notifier = nullptr;
-    QTimer* m_frameTimer = nullptr;
+    QMetaObject::Connection m_aboutToBlock;
+    FrameScheduler* m_scheduler = nullptr;
+    TextureBudget* m_textureBudget = nullptr;
     QList<struct comp_view*> m_views;
+    QHash<struct comp_view*, int> m_viewIds;
+    QHash<int, struct comp_view*> m_viewsById;
+    std::atomic<int> m_nextViewId{1};
+    ViewModel* m_model = nullptr;
     bool m_running = false;
+    bool m_perViewOutputs = false;
+    bool m_vulkan = false;
     QString m_socketName;
+    QSize m_initialViewSize;
+    qreal m_initialViewScale = 1.0;
+    QList<struct comp_dmabuf_format> m_importFormats;
+    
+    /* Latest coalesced pointer motion, not yet sent */
+    QTimer* m_pointerTimer = nullptr;
+    struct comp_view* m_motionView = nullptr;
+    QPointF m_motionPos;
+    
+    /* Frame trace counters of all views */
+    QTimer* m_statsTimer = nullptr;
+    double m_latencyP50 = 0.0;
+    double m_latencyP99 = 0.0;
+    double m_frameRate = 0.0;
+    qint64 m_droppedFrames = 0;
+    qint64 m_bytesCopied = 0;
+    
+    /* Per-view state. Title, geometry and cursor are tracked in both
+     * modes; the rest is threaded mode only, where the core is only
+     * touched by m_thread. */
+    struct ViewState {
+        QString title;
+        QRect geometry;
+        ViewCursor cursor;
+        QImage frame;               /* Latest CPU frame */
+        bool directFrame = false;   /* frame is the client's, handed out once */
+        bool trimmed = false;       /* No frames until acquired again */
+        int downscale = 1;          /* Of frame */
+        QRegion damage;             /* Not yet picked up by acquireViewFrame */
+        struct comp_dmabuf* dmabuf = nullptr;  /* Latest hardware frame */
+        CompositorThread* thread = nullptr;    /* Of the view's shard */
+    };
+    bool m_threaded = false;
+    CompositorThread* m_thread = nullptr;
+    QHash<struct comp_view*, ViewState> m_viewState;
+    
+    /* Every server - m_server and m_thread are the first shard's */
+    struct Shard {
+        struct comp_server* server = nullptr;
+        CompositorThread* thread = nullptr;
+        int clients = 0;    /* Connections handed over through the balancer */
+    };
+    QList<Shard> m_shards;
+    int m_shardCount = 1;
+    ShardPolicy m_shardPolicy = ShardByLoad;
+    
+    /* ShardByLoad with several shards: the socket behind socketName */
+    struct client_socket* m_balancer = nullptr;
+    QSocketNotifier* m_balancerNotifier = nullptr;
+    
+    /* Threaded mode: shards keyboard and pointer input go to, and the
+     * modifiers sent last, for a shard that gets the keyboard later */
+    CompositorThread* m_keyboardThread = nullptr;
+    CompositorThread* m_pointerThread = nullptr;
+    quint32 m_modifiers[4] = {};
 };
 
 #endif /* COMPOSITOR_WRAPPER_H */
@@ -0,0 +1,56 @@
+/*
+ * dmabuf_feedback.h - linux-dmabuf-v1 feedback steered towards Qt's importer
+ *
+ * wlroots on its own advertises every format and modifier its renderer can
+ * texture from. Clients then pick whatever comes first, which may be one
+ * Qt cannot sample and has to convert - or linear, which every GPU can
+ * take but few like. Once the embedder reports what its scene graph
+ * imports directly, view surfaces get feedback with those pairs in the
+ * first tranche and the rest of the renderer's formats after them.
+ *
+ * Views shown large and opaque get an extra scanout tranche in front: the
+ * direct pairs without alpha, which the display engine can put on a plane
+ * without blending. There is no KMS device of our own to ask, so this is
+ * the closest approximation when nested.
+ *
+ * All functions must be called on the event loop thread.
+ *
+ * SPDX-License-Identifier: MIT
+ * Copyright (c) 2024
+ */
+#ifndef DMABUF_FEEDBACK_H
+#define DMABUF_FEEDBACK_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <wayland-server-core.h>
+
+struct wlr_renderer;
+struct wlr_surface;
+struct comp_dmabuf_format;
+struct dmabuf_feedback;
+
+/* Create linux-dmabuf-v1 for the renderer's main device. NULL if the
+ * renderer cannot import DMA-BUFs (pixman). */
+struct dmabuf_feedback* dmabuf_feedback_create(struct wl_display* display,
+                                               struct wlr_renderer* renderer);
+
+void dmabuf_feedback_destroy(struct dmabuf_feedback* feedback);
+
+/* Pairs the embedder samples without conversion, replacing earlier ones.
+ * Surfaces need dmabuf_feedback_update_surface() to pick them up. */
+void dmabuf_feedback_set_import_formats(struct dmabuf_feedback* feedback,
+                                        const struct comp_dmabuf_format* formats, int n_formats);
+
+/* Send the surface the feedback for how it is shown */
+void dmabuf_feedback_update_surface(struct dmabuf_feedback* feedback,
+                                    struct wlr_surface* surface, bool scanout);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DMABUF_FEEDBACK_H */
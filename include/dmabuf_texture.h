@@ -0,0 +1,68 @@
+/*
+ * dmabuf_texture.h - Zero-copy DMA-BUF import into the Qt scene graph
+ *
+ * Imports a client DMA-BUF as an EGLImage, binds it to a GL texture and
+ * wraps that texture in a QSGTexture. The pixels never touch the CPU.
+ * Only usable when the scene graph runs on OpenGL (EGL).
+ *
+ * GL waits for the buffer's acquire fence on the GPU, and the client
+ * buffer is handed back with a native fence once the frames sampling it
+ * are done (EGL_ANDROID_native_fence_sync, else CPU waits).
+ *
+ * All methods must be called on the scene graph render thread with the
+ * window's GL context current (i.e. from updatePaintNode or node dtors).
+ *
+ * SPDX-License-Identifier: MIT
+ * Copyright (c) 2024
+ */
+#ifndef DMABUF_TEXTURE_H
+#define DMABUF_TEXTURE_H
+
+#include <QList>
+#include <QSize>
+#include <QSGTexture>
+#include <QQuickWindow>
+
+struct comp_dmabuf;
+struct comp_dmabuf_format;
+struct comp_buffer_lock;
+
+class DmabufTexture {
+public:
+    DmabufTexture();
+    ~DmabufTexture();
+
+    DmabufTexture(const DmabufTexture&) = delete;
+    DmabufTexture& operator=(const DmabufTexture&) = delete;
+
+    /* Check that the window renders with GL and EGL can import DMA-BUFs */
+    static bool isSupported(QQuickWindow* window);
+
+    /* Formats and modifiers import() takes without a conversion, empty if
+     * EGL cannot list them */
+    static QList<comp_dmabuf_format> importFormats(QQuickWindow* window);
+
+    /* Whether a DRM fourcc carries alpha, i.e. may not be drawn opaque */
+    static bool formatHasAlpha(uint32_t format);
+
+    /* Import a DMA-BUF, replacing the previous image.
+     * Takes ownership of the fds (they are closed in all cases). */
+    bool import(struct comp_dmabuf* dmabuf, QQuickWindow* window);
+
+    /* Texture of the last import - owned by this object */
+    QSGTexture* texture() const { return m_texture; }
+    QSize size() const { return m_size; }
+
+private:
+    void releaseImage();
+
+    void* m_display = nullptr;   /* EGLDisplay */
+    void* m_image = nullptr;     /* EGLImageKHR */
+    unsigned int m_textureId = 0;
+    QSize m_size;
+    bool m_hasAlpha = false;
+    QSGTexture* m_texture = nullptr;
+    struct comp_buffer_lock* m_lock = nullptr;  /* Client buffer being sampled */
+};
+
+#endif /* DMABUF_TEXTURE_H */
@@ -4,6 +4,19 @@
  * EmbeddedView is a QQuickItem that renders a Wayland client surface
  * and forwards input events back to the compositor.
  *
+ * It shows the view with viewId, or without one whichever view is at row
+ * viewIndex of the compositor's view model.
+ *
+ * A cursor the client sets is drawn as a small node of its own over the
+ * frame, in place of the item's cursor: moving the pointer moves that
+ * node and leaves the frame alone.
+ *
+ * Nested on Wayland, a view shown at native size with nothing of Qt's
+ * over it is passed through: its DMA-BUFs go to the parent compositor as
+ * a subsurface of the window (see view_passthrough.h) and Qt draws
+ * nothing for the item. Anything overlapping it, a transform, a
+ * different size or a wl_shm buffer brings it back into the scene graph.
+ *
  * SPDX-License-Identifier: MIT
  * Copyright (c) 2024
  */
@@ -15,16 +28,29 @@
 #include <QSGSimpleTextureNode>
 #include <QQuickWindow>
 #include <QImage>
+#include <QRegion>
 #include <QMutex>
+#include <QModelIndex>
+#include <QElapsedTimer>
+#include <QTimer>
+
+#include "compositor_core.h"
 
 class CompositorWrapper;
-struct comp_view;
+class ViewPassthrough;
 
 class EmbeddedView : public QQuickItem {
     Q_OBJECT
     Q_PROPERTY(int viewIndex READ viewIndex WRITE setViewIndex NOTIFY viewIndexChanged)
+    Q_PROPERTY(int viewId READ viewId WRITE setViewId NOTIFY viewIdChanged)
     Q_PROPERTY(bool hasView READ hasView NOTIFY hasViewChanged)
     Q_PROPERTY(QString title READ title NOTIFY titleChanged)
+    Q_PROPERTY(bool effectivelyVisible READ isEffectivelyVisible NOTIFY effectivelyVisibleChanged)
+    Q_PROPERTY(bool coalescePointer READ coalescePointer WRITE setCoalescePointer NOTIFY coalescePointerChanged)
+    Q_PROPERTY(bool thumbnail READ isThumbnail WRITE setThumbnail NOTIFY thumbnailChanged)
+    Q_PROPERTY(int thumbnailRate READ thumbnailRate WRITE setThumbnailRate NOTIFY thumbnailRateChanged)
+    Q_PROPERTY(bool allowPassthrough READ allowPassthrough WRITE setAllowPassthrough NOTIFY allowPassthroughChanged)
+    Q_PROPERTY(bool passthroughActive READ isPassthroughActive NOTIFY passthroughActiveChanged)
     QML_ELEMENT
 
 public:
@@ -34,8 +60,40 @@ public:
     int viewIndex() const { return m_viewIndex; }
     void setViewIndex(int index);
     
+    /* Stable id from the view model, 0 to follow viewIndex instead */
+    int viewId() const { return m_viewId; }
+    void setViewId(int id);
+    
     bool hasView() const { return m_hasView; }
     QString title() const { return m_title; }
+    
+    /* Visible, not fully transparent and not clipped away in an exposed window */
+    bool isEffectivelyVisible() const { return m_effectivelyVisible; }
+    
+    /* Send at most one pointer motion per frame (default). Off, the client
+     * gets every Qt motion event, e.g. for drawing applications. */
+    bool coalescePointer() const { return m_coalescePointer; }
+    void setCoalescePointer(bool coalesce);
+    
+    /* Show the view as a tile, e.g. in an overview: the view keeps its
+     * size instead of taking the item's, CPU frames come downscaled to the
+     * item's pixel size, and new frames are fetched at most thumbnailRate
+     * times a second (default 10, 0 for every commit). */
+    bool isThumbnail() const { return m_thumbnail; }
+    void setThumbnail(bool thumbnail);
+    int thumbnailRate() const { return m_thumbnailRate; }
+    void setThumbnailRate(int hz);
+    
+    /* Hand the view to the parent compositor whenever possible (default).
+     * passthroughActive tells whether it currently is. */
+    bool allowPassthrough() const { return m_allowPassthrough; }
+    void setAllowPassthrough(bool allow);
+    bool isPassthroughActive() const { return m_passthrough != nullptr; }
+    
+    /* Drop the frame and its textures while hidden - a solid fill shows
+     * until the view is visible again and fetched anew. Called by the
+     * compositor's TextureBudget. */
+    void evictFrame();
 
     /* Set compositor reference (called from main) */
     static void setCompositor(CompositorWrapper* compositor);
@@ -43,16 +101,28 @@ public:
 
 signals:
     void viewIndexChanged();
+    void viewIdChanged();
     void hasViewChanged();
     void titleChanged();
+    void effectivelyVisibleChanged();
+    void coalescePointerChanged();
+    void thumbnailChanged();
+    void thumbnailRateChanged();
+    void allowPassthroughChanged();
+    void passthroughActiveChanged();
 
 public slots:
     void updateFrame();
     void onViewsChanged();
+    void onViewDataChanged(const QModelIndex& topLeft, const QModelIndex& bottomRight,
+                           const QList<int>& roles);
+    void onViewCommitted(int index, const QRegion& damage);
+    void onViewCursorChanged(int index);
     void onSizeChanged();
 
 protected:
     QSGNode* updatePaintNode(QSGNode* oldNode, UpdatePaintNodeData* data) override;
+    void updatePolish() override;
     void keyPressEvent(QKeyEvent* event) override;
     void keyReleaseEvent(QKeyEvent* event) override;
     void mousePressEvent(QMouseEvent* event) override;
@@ -60,6 +130,7 @@ protected:
     void mouseMoveEvent(QMouseEvent* event) override;
     void wheelEvent(QWheelEvent* event) override;
     void hoverMoveEvent(QHoverEvent* event) override;
+    void hoverLeaveEvent(QHoverEvent* event) override;
     void focusInEvent(QFocusEvent* event) override;
     void focusOutEvent(QFocusEvent* event) override;
 
@@ -67,16 +138,88 @@ private:
     quint32 qtKeyToLinux(int qtKey) const;
     quint32 qtButtonToLinux(Qt::MouseButton button) const;
     void updateViewState();
+    void updateTitle();
+    void updateCursor();
+    void scheduleFrameFetch();
+    void updateThumbnailSize();
+    bool dmabufPathEnabled() const;
+    qreal pixelRatio() const;
+    /* largeAndOpaque: fully opaque and covering much of the window */
+    bool computeEffectiveVisibility(bool* largeAndOpaque) const;
+    void updateEffectiveVisibility();
+    void trackWindow(QQuickWindow* window);
+    /* Passthrough: the view fills the item at native size, untransformed,
+     * uncovered and unclipped */
+    bool passthroughEligible() const;
+    bool isOverlapped() const;
+    QRect passthroughRect() const;
+    void setPassthrough(bool active);
+    void updatePassthrough();
+    void onPassthroughPresented();
+    void onPassthroughFailed();
+    QPointF mapToFrame(const QPointF& pos) const;
+    /* Item units per pixel of the view's buffer */
+    qreal frameScale() const;
+    void sendPointerMotion(const QPointF& pos);
 
     static CompositorWrapper* s_compositor;
     
     int m_viewIndex = -1;
+    int m_viewId = 0;
+    struct comp_view* m_view = nullptr;     /* Shown view, read on the render thread */
     bool m_hasView = false;
     QString m_title;
     
-    QImage m_frameBuffer;
+    QImage m_frameBuffer;       /* Wraps a staging slot until handed to the texture */
+    QRegion m_frameDamage;      /* Damage of m_frameBuffer not yet uploaded */
+    QSize m_frameSize;
+    int m_frameDownscale = 1;   /* Buffer pixels per side of a frame pixel */
     QMutex m_bufferMutex;
     bool m_needsUpdate = false;
+    bool m_dropTextures = false;    /* Evicted - next sync deletes the node */
+    
+    /* Next fetch uploads the whole frame (rebind, path switch) */
+    bool m_fullDamage = true;
+    bool m_frameFetchScheduled = false;
+    /* Frame evicted, not fetched again until visible */
+    bool m_evicted = false;
+    
+    /* Hardware path: DMA-BUF waiting to be imported on the render thread */
+    struct comp_dmabuf m_pendingDmabuf = {};
+    bool m_hasPendingDmabuf = false;
+    bool m_dmabufFailed = false;
+    
+    /* Visibility and scanout hint last reported to the compositor */
+    bool m_effectivelyVisible = false;
+    bool m_reportedVisible = false;     /* Counted as a host of m_reportedView */
+    bool m_scanoutHint = false;
+    struct comp_view* m_reportedView = nullptr;
+    QQuickWindow* m_trackedWindow = nullptr;
+    
+    bool m_coalescePointer = true;
+    
+    /* Shown by the parent compositor - Qt draws nothing once the first
+     * frame is there (m_passthroughShown, read on the render thread) */
+    bool m_allowPassthrough = true;
+    ViewPassthrough* m_passthrough = nullptr;
+    bool m_passthroughShown = false;
+    bool m_passthroughFailed = false;   /* Parent refused a buffer of m_view */
+    bool m_frameIsDmabuf = false;       /* Last frame fetched */
+    
+    /* Cursor the client set, in buffer pixels; a null image hides it */
+    bool m_clientCursor = false;
+    QImage m_cursorImage;
+    QPointF m_cursorHotspot;
+    QSizeF m_cursorSize;
+    bool m_cursorChanged = false;   /* Image not yet on the render thread */
+    bool m_pointerInside = false;
+    QPointF m_pointerPos;           /* Item coordinates */
+    
+    bool m_thumbnail = false;
+    int m_thumbnailRate = 10;
+    QSize m_thumbnailSize;      /* Last sent for m_view */
+    QElapsedTimer m_lastFetch;
+    QTimer m_fetchTimer;        /* Fetch held back by thumbnailRate */
 };
 
 #endif /* EMBEDDED_VIEW_H */
@@ -0,0 +1,105 @@
+/*
+ * frame_scheduler.h - Paces client frame callbacks to Qt presentation
+ *
+ * Clients get wl_surface.frame done once per presented Qt frame instead of
+ * on every commit, so they render at the window's refresh rate. Views
+ * whose new content was part of the presented frame also get
+ * wp_presentation feedback with the swap time.
+ *
+ * A commit requests a window update; the following frameSwapped completes
+ * the frame. If no window presents (hidden, minimized), a fallback timer
+ * still releases the clients so they never stall.
+ *
+ * Views that no EmbeddedView currently shows - new views included, until
+ * one shows them - are left out of presented frames and only get frame
+ * done at hiddenFrameRate (0 = never).
+ *
+ * Views passed through to the parent compositor (see view_passthrough.h)
+ * are not part of Qt's frames either: they get frame done and feedback
+ * whenever the parent has shown their latest buffer, and their commits
+ * don't make the windows render.
+ *
+ * SPDX-License-Identifier: MIT
+ * Copyright (c) 2024
+ */
+#ifndef FRAME_SCHEDULER_H
+#define FRAME_SCHEDULER_H
+
+#include <QObject>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QPointer>
+#include <QSet>
+#include <QTimer>
+#include <QQuickWindow>
+
+extern "C" {
+    struct comp_view;
+}
+
+class CompositorWrapper;
+
+class FrameScheduler : public QObject {
+    Q_OBJECT
+
+public:
+    explicit FrameScheduler(CompositorWrapper* compositor);
+
+    /* GUI thread: a window that shows embedded views */
+    void addWindow(QQuickWindow* window);
+
+    /* Render thread, during scene graph sync: new content of view is part
+     * of the frame being rendered */
+    void markPresented(struct comp_view* view);
+
+    /* One host starts or stops showing the view - calls pair up per host.
+     * Views no host shows are throttled to the hidden frame rate. */
+    void setViewVisible(struct comp_view* view, bool visible);
+    bool isViewVisible(struct comp_view* view) const;
+
+    /* Passed through views are paced by passthroughPresented instead */
+    void setViewPassthrough(struct comp_view* view, bool passthrough);
+    void passthroughPresented(struct comp_view* view);
+
+    /* Frame done rate for hidden views in Hz, 0 stops them entirely */
+    void setHiddenFrameRate(int hz);
+    int hiddenFrameRate() const { return m_hiddenFrameRate; }
+
+    /* Current CLOCK_MONOTONIC time in nanoseconds */
+    static quint64 monotonicNs();
+
+public slots:
+    /* A client committed - get a frame presented */
+    void scheduleFrame();
+
+private slots:
+    void onFrameSwapped();
+    void onFallback();
+    void onHiddenTimer();
+    void pruneViews();
+
+private:
+    quint32 refreshNs() const;
+    QList<struct comp_view*> visibleViews() const;
+    QList<struct comp_view*> hiddenViews() const;
+    void updateHiddenTimer();
+
+    /* Fallback period while no window presents */
+    static const int kFallbackIntervalMs = 100;
+
+    CompositorWrapper* m_compositor;
+    QList<QPointer<QQuickWindow>> m_windows;
+    QTimer m_fallback;
+    QTimer m_hiddenTimer;
+    quint64 m_seq = 0;
+
+    QHash<struct comp_view*, int> m_hosts;  /* Hosts showing the view, absent = 0 */
+    int m_hiddenFrameRate = 1;
+    QSet<struct comp_view*> m_passthrough;
+
+    QMutex m_mutex;
+    QSet<struct comp_view*> m_rendered;  /* Guarded by m_mutex */
+};
+
+#endif /* FRAME_SCHEDULER_H */
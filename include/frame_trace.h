@@ -0,0 +1,76 @@
+/*
+ * frame_trace.h - Frame latency tracing and per-view counters
+ *
+ * Every stage a client frame goes through is timestamped with
+ * CLOCK_MONOTONIC: commit, output render, capture into the staging
+ * buffer, fetch by the EmbeddedView, texture upload and the Qt swap that
+ * presents it. Per view this yields a rolling commit-to-present latency
+ * histogram, frame rate, frames dropped (replaced by a newer commit
+ * before being presented) and bytes copied. The raw events go to a ring
+ * that can be written out as Chrome/Perfetto trace JSON.
+ *
+ * Tracing is off by default and costs one atomic load per call site
+ * while off. All functions are thread-safe.
+ *
+ * SPDX-License-Identifier: MIT
+ * Copyright (c) 2024
+ */
+#ifndef FRAME_TRACE_H
+#define FRAME_TRACE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Stages of a frame, in pipeline order */
+enum frame_trace_stage {
+    FRAME_TRACE_COMMIT,     /* Client committed a buffer */
+    FRAME_TRACE_RENDER,     /* Headless output rendered */
+    FRAME_TRACE_CAPTURE,    /* Copied into a staging buffer */
+    FRAME_TRACE_FETCH,      /* EmbeddedView picked the frame up */
+    FRAME_TRACE_UPLOAD,     /* Texture upload queued */
+    FRAME_TRACE_PRESENT,    /* Qt swapped a frame showing it */
+    FRAME_TRACE_STAGE_COUNT
+};
+
+/* Rolling statistics of one view, or of all views together */
+struct frame_trace_stats {
+    uint64_t latency_p50_ns;    /* Commit to present */
+    uint64_t latency_p99_ns;
+    double fps;                 /* Presented frames over the last second */
+    uint64_t frames;            /* Presented frames */
+    uint64_t dropped;           /* Commits never presented */
+    uint64_t bytes_copied;      /* CPU copies and uploads */
+};
+
+/* Turn tracing on or off - WLROOTS_QT_TRACE=1 enables it at startup */
+void frame_trace_set_enabled(bool enabled);
+bool frame_trace_enabled(void);
+
+/* CLOCK_MONOTONIC in nanoseconds */
+uint64_t frame_trace_now_ns(void);
+
+/* Record a stage for view (NULL for stages not tied to a view). start_ns
+ * is when the stage began, 0 for an instantaneous event. bytes counts
+ * towards the copied bytes. */
+void frame_trace_mark(const void* view, enum frame_trace_stage stage, uint64_t start_ns,
+                      uint64_t bytes);
+
+/* Statistics for view, or for all views when view is NULL.
+ * Returns false if nothing was recorded for it. */
+bool frame_trace_get_stats(const void* view, struct frame_trace_stats* stats);
+
+/* Drop the per-view state of a destroyed view */
+void frame_trace_forget_view(const void* view);
+
+/* Write the recorded events as Chrome/Perfetto trace JSON */
+bool frame_trace_write_json(const char* path);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FRAME_TRACE_H */
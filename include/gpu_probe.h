@@ -0,0 +1,72 @@
+/*
+ * gpu_probe.h - Render node discovery and capability probing
+ *
+ * Every /dev/dri/renderD* node is probed by bringing up a GLES2 renderer
+ * on it, which needs a GBM device and an EGL display for the node, and
+ * reading back the DMA-BUF formats and modifiers it can import. That takes
+ * a while per node, so the result is kept in $XDG_RUNTIME_DIR and reused
+ * until the next boot or until the set of render nodes changes.
+ *
+ * The node used for hardware rendering is WLROOTS_QT_RENDER_NODE when set
+ * (a path or just "renderD129"), else a usable GPU that is not the boot
+ * VGA device - the dGPU on a typical hybrid laptop or multi-GPU host -
+ * else the first usable one.
+ *
+ * The probe runs once per process; all functions are thread-safe and the
+ * returned data lives until exit.
+ *
+ * SPDX-License-Identifier: MIT
+ * Copyright (c) 2024
+ */
+#ifndef GPU_PROBE_H
+#define GPU_PROBE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Render nodes looked at - the kernel numbers them from renderD128 */
+#define GPU_PROBE_MAX_NODES 16
+
+/* A DRM fourcc and the modifiers it can be imported with */
+struct gpu_format {
+    uint32_t format;
+    uint32_t n_modifiers;
+    uint64_t* modifiers;
+};
+
+struct gpu_node {
+    char path[64];          /* /dev/dri/renderD128 */
+    char driver[32];        /* Kernel driver, e.g. "amdgpu", "" if unknown */
+    uint16_t vendor_id;     /* PCI ids, 0 for non-PCI devices */
+    uint16_t device_id;
+    bool boot_vga;          /* The firmware's primary display device */
+    bool usable;            /* EGL and GLES2 came up on it */
+    uint32_t n_formats;     /* DMA-BUF texture formats */
+    struct gpu_format* formats;
+};
+
+struct gpu_probe {
+    uint32_t n_nodes;
+    struct gpu_node nodes[GPU_PROBE_MAX_NODES];
+    bool from_cache;        /* Loaded from the per-boot cache file */
+};
+
+/* Probe (or load the cached probe) on first call */
+const struct gpu_probe* gpu_probe_get(void);
+
+/* Prefer a render node over the automatic choice - a path or node name,
+ * NULL to go back to WLROOTS_QT_RENDER_NODE or the automatic choice */
+void gpu_probe_set_preferred(const char* node);
+
+/* Node hardware rendering should use, NULL when no node is usable */
+const struct gpu_node* gpu_probe_selected(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* GPU_PROBE_H */
@@ -17,6 +17,7 @@ extern "C" {
 #include <wlr/types/wlr_output_layout.h>
 
 struct comp_server;
+struct comp_view;
 
 /* Output state */
 struct comp_output {
@@ -24,10 +25,13 @@ struct comp_output {
     struct comp_server* server;
     struct wlr_output* wlr_output;
     struct wlr_scene_output* scene_output;
+    struct comp_view* view;  /* Only view shown on a per-view output, else NULL */
+    bool offscreen;          /* Not in the layout or the server scene */
     
-    /* Dimensions */
+    /* Dimensions in pixels */
     uint32_t width;
     uint32_t height;
+    float scale;
     
     /* Frame timing */
     struct wl_listener frame;
@@ -42,8 +46,11 @@ struct comp_output_manager {
     struct comp_server* server;
     struct wlr_output_layout* layout;
     struct wl_list outputs;  /* comp_output.link */
+    struct wlr_backend* backend;
+    bool adding_offscreen;   /* The next new output is offscreen */
     
     struct wl_listener new_output;
+    struct wl_listener layout_change;
 };
 
 /* Initialize output manager */
@@ -58,9 +65,35 @@ struct comp_output* comp_output_manager_get_primary(struct comp_output_manager*
 /* Output operations */
 void comp_output_get_size(struct comp_output* output, uint32_t* width, uint32_t* height);
 
-/* Manually trigger frame rendering - needed for headless backend */
+/* Per-view outputs: a headless output that only shows view. Each one is
+ * laid out next to the others and the view is kept at its origin. */
+struct comp_output* comp_output_manager_add_view_output(struct comp_output_manager* mgr,
+                                                        struct comp_view* view,
+                                                        uint32_t width, uint32_t height);
+
+/* Offscreen output: rendered to by whoever creates a scene output for it,
+ * invisible to clients and left out of the server scene and output list */
+struct comp_output* comp_output_manager_add_offscreen_output(struct comp_output_manager* mgr,
+                                                             uint32_t width, uint32_t height);
+
+/* Resize a per-view output - width/height in pixels. Returns false if the
+ * mode could not be committed. */
+bool comp_output_set_size(struct comp_output* output, uint32_t width, uint32_t height,
+                          float scale);
+
+/* Destroy an output created with comp_output_manager_add_view_output or
+ * comp_output_manager_add_offscreen_output */
+void comp_output_destroy(struct comp_output* output);
+
+/* Manually trigger frame rendering - needed for headless backend. Only
+ * composes if a capture client waits for the frame, frame done goes out
+ * either way. */
 void comp_output_render_frame(struct comp_output* output);
 
+/* Render with the output's next frame event - commits in between are
+ * composed together */
+void comp_output_schedule_frame(struct comp_output* output);
+
 #ifdef __cplusplus
 }
 #endif
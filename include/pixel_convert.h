@@ -0,0 +1,64 @@
+/*
+ * pixel_convert.h - Client buffer to Qt pixel conversion
+ *
+ * Converts the common wl_shm formats to DRM_FORMAT_ARGB8888, which is
+ * QImage::Format_ARGB32_Premultiplied on little-endian machines. X formats
+ * get an opaque alpha, ABGR/XBGR get red and blue swapped, RGB565 is
+ * expanded. Identical layouts are a plain copy, a single memcpy when the
+ * rows are contiguous in both buffers.
+ *
+ * Frames shown small can also be downscaled with a box filter, which
+ * averages premultiplied pixels and so needs no unpremultiplying.
+ *
+ * The kernels are picked once at runtime: AVX2 or SSE4.1 on x86, NEON on
+ * ARM, scalar otherwise.
+ *
+ * SPDX-License-Identifier: MIT
+ * Copyright (c) 2024
+ */
+#ifndef PIXEL_CONVERT_H
+#define PIXEL_CONVERT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Bytes per pixel of a convertible DRM format, 0 if not supported */
+uint32_t pixel_convert_bpp(uint32_t format);
+
+/* Check if a DRM format can be converted */
+bool pixel_convert_supported(uint32_t format);
+
+/* Convert a width x height block of format pixels at src into ARGB8888 at
+ * dst. Both pointers address the block's first pixel. Returns false for
+ * unsupported formats. */
+bool pixel_convert(void* dst, size_t dst_stride, const void* src, size_t src_stride,
+                   uint32_t format, uint32_t width, uint32_t height);
+
+/* Premultiply straight-alpha ARGB8888 in place. wl_shm content is already
+ * premultiplied - this is for sources that are not. */
+void pixel_premultiply(void* data, size_t stride, uint32_t width, uint32_t height);
+
+/* Largest factor pixel_downscale() takes */
+#define PIXEL_DOWNSCALE_MAX 16
+
+/* Box filter a width x height block of premultiplied ARGB8888 at src:
+ * every factor x factor block becomes one pixel of their average, so dst
+ * gets ceil(width / factor) x ceil(height / factor) pixels. Blocks cut by
+ * the edge average what they cover. Returns false for factors outside
+ * 1..PIXEL_DOWNSCALE_MAX. */
+bool pixel_downscale(void* dst, size_t dst_stride, const void* src, size_t src_stride,
+                     uint32_t width, uint32_t height, uint32_t factor);
+
+/* Name of the kernel set in use ("avx2", "sse4.1", "neon", "scalar") */
+const char* pixel_convert_impl_name(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PIXEL_CONVERT_H */
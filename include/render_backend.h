@@ -4,6 +4,7 @@
  * Provides a unified interface for different rendering backends:
  * - Software (Pixman): CPU-based, works everywhere, easier debugging
  * - Hardware (GLES2 + DMA-BUF): GPU-accelerated, zero-copy to Qt
+ * - Vulkan (+ DMA-BUF): GPU-accelerated, imported by a Vulkan Qt Quick
  *
  * SPDX-License-Identifier: MIT
  * Copyright (c) 2024
@@ -25,11 +26,15 @@ struct comp_view;
 struct wlr_backend;
 struct wlr_renderer;
 struct wlr_allocator;
+struct buffer_pool;
+struct pool_buffer;
+struct gpu_node;
 
 /* Renderer type */
 typedef enum {
     RENDER_BACKEND_SOFTWARE,  /* Pixman - CPU rendering */
     RENDER_BACKEND_HARDWARE,  /* GLES2 + DMA-BUF - GPU rendering */
+    RENDER_BACKEND_VULKAN,    /* Vulkan + DMA-BUF - GPU rendering */
 } render_backend_type_t;
 
 /* Render backend state */
@@ -38,6 +43,7 @@ struct render_backend {
     struct wlr_backend* wlr_backend;
     struct wlr_renderer* renderer;
     struct wlr_allocator* allocator;
+    const struct gpu_node* gpu;   /* Render node in use, NULL for software */
     
     /* For hardware backend: DMA-BUF file descriptors */
     int dmabuf_fd;
@@ -46,9 +52,9 @@ struct render_backend {
     uint32_t dmabuf_height;
     uint32_t dmabuf_format;
     
-    /* For software backend: pixel buffer */
-    void* pixel_buffer;
-    uint32_t buffer_size;
+    /* CPU memory for captured frames and view staging buffers */
+    struct buffer_pool* pool;
+    struct pool_buffer* capture;  /* Latest captured frame */
 };
 
 /* Create render backend */
@@ -71,9 +77,16 @@ struct wlr_renderer* render_backend_get_renderer(struct render_backend* backend)
 /* Get the allocator */
 struct wlr_allocator* render_backend_get_allocator(struct render_backend* backend);
 
+/* Get the pool for CPU pixel buffers */
+struct buffer_pool* render_backend_get_buffer_pool(struct render_backend* backend);
+
 /* Render a frame and get the result
- * For software: copies pixels to buffer
- * For hardware: returns DMA-BUF fd */
+ * For software: copies pixels to a pooled buffer
+ * For hardware: returns DMA-BUF fd
+ * If frame_out is set, the caller gets its own reference to the CPU frame
+ * (release with pool_buffer_unref) and may keep reading it while the next
+ * capture goes to another buffer. Otherwise buffer_out is only valid until
+ * the next capture. */
 bool render_backend_capture_frame(struct render_backend* backend,
                                    void* scene_output,
                                    void** buffer_out,
@@ -81,11 +94,16 @@ bool render_backend_capture_frame(struct render_backend* backend,
                                    uint32_t* width_out,
                                    uint32_t* height_out,
                                    uint32_t* stride_out,
-                                   uint32_t* format_out);
+                                   uint32_t* format_out,
+                                   struct pool_buffer** frame_out);
 
-/* Check if hardware acceleration is available */
+/* Check if hardware acceleration is available - a render node passed
+ * the GPU probe, see gpu_probe.h */
 bool render_backend_hardware_available(void);
 
+/* Get the render node in use, NULL for software rendering */
+const struct gpu_node* render_backend_get_gpu(struct render_backend* backend);
+
 /* Get backend type name */
 const char* render_backend_type_name(render_backend_type_t type);
 
@@ -0,0 +1,64 @@
+/*
+ * screen_capture.h - Screen capture protocols for recorders and VNC bridges
+ *
+ * Offers ext-image-copy-capture-v1 with output and toplevel sources, and
+ * wlr-screencopy-unstable-v1 for older tools, plus the two globals those
+ * tools look for first: ext-foreign-toplevel-list-v1, listing the mapped
+ * views as capture sources, and xdg-output.
+ *
+ * Output captures are served from the headless outputs' scene outputs.
+ * Those only compose while something reads them, and a capture client
+ * asking for a frame is such a reader: wlroots marks the output as
+ * needing a frame, and the output handler composes it for that frame
+ * only. Renders are
+ * damage-limited and the damage goes along with the frame, so a client
+ * copying just what changed pays just for that; nothing is composed
+ * while no frame is wanted.
+ *
+ * Toplevel captures render only the view's scene tree, on a scene of
+ * their own, shared by all clients capturing that view. They exist only
+ * while someone captures and need no output composition at all.
+ *
+ * Frames go into client buffers, wl_shm or DMA-BUF - a DMA-BUF only with
+ * a GPU renderer.
+ *
+ * All functions must be called on the event loop thread.
+ *
+ * SPDX-License-Identifier: MIT
+ * Copyright (c) 2024
+ */
+#ifndef SCREEN_CAPTURE_H
+#define SCREEN_CAPTURE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <wayland-server-core.h>
+
+struct wlr_allocator;
+struct wlr_output_layout;
+struct wlr_renderer;
+struct comp_view;
+struct screen_capture;
+
+/* Create the capture globals. NULL if one of them failed. */
+struct screen_capture* screen_capture_create(struct wl_display* display,
+                                             struct wlr_renderer* renderer,
+                                             struct wlr_allocator* allocator,
+                                             struct wlr_output_layout* layout);
+
+void screen_capture_destroy(struct screen_capture* capture);
+
+/* A view was mapped, unmapped or changed its title or app id - only
+ * mapped views are listed */
+void screen_capture_add_view(struct screen_capture* capture, struct comp_view* view);
+void screen_capture_remove_view(struct screen_capture* capture, struct comp_view* view);
+void screen_capture_update_view(struct screen_capture* capture, struct comp_view* view);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SCREEN_CAPTURE_H */
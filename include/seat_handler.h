@@ -36,10 +36,31 @@ struct comp_seat {
     /* Cursor state */
     double cursor_x, cursor_y;
     
+    /* View the pointer was last moved over and the surface hit in it.
+     * While that view has no subsurfaces or popups the hit test is just
+     * an input region check on the cached surface. */
+    struct comp_view* pointer_view;
+    struct wlr_surface* pointer_surface;
+    
+    /* Pointer events sent since the last wl_pointer.frame */
+    bool pointer_frame_pending;
+    
+    /* Cursor the pointer's client set over cursor_view, from its request
+     * until the pointer moves on to another client. cursor_surface is
+     * NULL while the client hides the cursor; the hotspot is in its
+     * surface coordinates. */
+    struct wlr_seat_client* cursor_client;
+    struct comp_view* cursor_view;
+    struct wlr_surface* cursor_surface;
+    int32_t cursor_hotspot_x, cursor_hotspot_y;
+    struct wl_listener cursor_commit;
+    struct wl_listener cursor_destroy;
+    
     /* Input device listeners */
     struct wl_listener new_input;
     struct wl_listener request_cursor;
     struct wl_listener request_set_selection;
+    struct wl_listener pointer_focus_change;
     
     bool initialized;
 };
@@ -62,10 +83,18 @@ void comp_seat_send_key(struct comp_seat* seat, uint32_t key, bool pressed);
 void comp_seat_send_modifiers(struct comp_seat* seat, uint32_t depressed, 
                                uint32_t latched, uint32_t locked, uint32_t group);
 
-/* Pointer input forwarding */
+/* Pointer input forwarding - none of these end the event group,
+ * comp_seat_send_pointer_frame does */
 void comp_seat_send_pointer_motion(struct comp_seat* seat, double x, double y);
+void comp_seat_send_view_pointer_motion(struct comp_seat* seat, struct comp_view* view,
+                                        double sx, double sy);
 void comp_seat_send_pointer_button(struct comp_seat* seat, uint32_t button, bool pressed);
-void comp_seat_send_pointer_axis(struct comp_seat* seat, bool horizontal, double value);
+void comp_seat_send_pointer_axis(struct comp_seat* seat, bool horizontal, double value,
+                                 int32_t value120, bool continuous, bool inverted);
+void comp_seat_send_pointer_frame(struct comp_seat* seat);
+
+/* Drop cached pointer state of a view being unmapped or destroyed */
+void comp_seat_forget_view(struct comp_seat* seat, struct comp_view* view);
 
 /* Get view at coordinates */
 struct comp_view* comp_seat_view_at(struct comp_seat* seat, double x, double y, 
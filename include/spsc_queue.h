@@ -0,0 +1,67 @@
+/*
+ * spsc_queue.h - Lock-free single-producer/single-consumer ring buffer
+ *
+ * Fixed capacity, no allocation after construction. Exactly one thread
+ * may push and exactly one (other) thread may pop. Items are copied,
+ * so T must be trivially copyable.
+ *
+ * SPDX-License-Identifier: MIT
+ * Copyright (c) 2024
+ */
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <type_traits>
+
+template <typename T, std::size_t Capacity>
+class SpscQueue {
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0,
+                  "Capacity must be a power of two");
+    static_assert(std::is_trivially_copyable_v<T>, "T must be trivially copyable");
+
+public:
+    /* Producer side - returns false if the queue is full */
+    bool push(const T& item) {
+        const std::size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_headCache == Capacity) {
+            m_headCache = m_head.load(std::memory_order_acquire);
+            if (tail - m_headCache == Capacity) {
+                return false;
+            }
+        }
+        m_items[tail & (Capacity - 1)] = item;
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /* Consumer side - returns false if the queue is empty */
+    bool pop(T& item) {
+        const std::size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tailCache) {
+            m_tailCache = m_tail.load(std::memory_order_acquire);
+            if (head == m_tailCache) {
+                return false;
+            }
+        }
+        item = m_items[head & (Capacity - 1)];
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    /* Approximate - exact only when called from the consumer */
+    bool empty() const {
+        return m_head.load(std::memory_order_acquire) == m_tail.load(std::memory_order_acquire);
+    }
+
+private:
+    /* Producer and consumer indices live on separate cache lines */
+    alignas(64) std::atomic<std::size_t> m_tail{0};
+    std::size_t m_headCache = 0;    /* Producer's view of m_head */
+    alignas(64) std::atomic<std::size_t> m_head{0};
+    std::size_t m_tailCache = 0;    /* Consumer's view of m_tail */
+    alignas(64) T m_items[Capacity];
+};
+
+#endif /* SPSC_QUEUE_H */
@@ -0,0 +1,67 @@
+/*
+ * texture_budget.h - Memory limit for the frames kept by EmbeddedViews
+ *
+ * Every EmbeddedView reports what its frame costs: the uploaded texture
+ * and, on the CPU path, the staging buffer in the core it came from.
+ * Imported DMA-BUFs are the client's memory and cost nothing here.
+ *
+ * Above the limit, views nobody sees are evicted, the one hidden the
+ * longest first: the texture and the view's staging buffers are dropped,
+ * a solid fill stands in until the view is shown again, and then the
+ * whole frame is fetched anew. Views that are visible are never evicted.
+ *
+ * SPDX-License-Identifier: MIT
+ * Copyright (c) 2024
+ */
+#ifndef TEXTURE_BUDGET_H
+#define TEXTURE_BUDGET_H
+
+#include <QObject>
+#include <QHash>
+#include <QMutex>
+
+class EmbeddedView;
+
+class TextureBudget : public QObject {
+    Q_OBJECT
+
+public:
+    explicit TextureBudget(QObject* parent = nullptr);
+
+    /* Limit in bytes, 0 (default) for none */
+    void setLimit(qint64 bytes);
+    qint64 limit() const { return m_limit; }
+
+    /* Bytes reported by all views */
+    qint64 usage() const;
+
+    /* Render thread, during scene graph sync: view now holds bytes */
+    void report(EmbeddedView* view, qint64 bytes);
+
+    /* GUI thread: view was shown or hidden - it was displayed until now */
+    void touch(EmbeddedView* view);
+
+    /* GUI thread: view is going away */
+    void remove(EmbeddedView* view);
+
+private slots:
+    /* Evict hidden views until the usage fits the limit */
+    void enforce();
+
+private:
+    struct Entry {
+        qint64 bytes = 0;
+        quint64 lastDisplayed = 0;
+    };
+
+    bool m_warned = false;
+
+    mutable QMutex m_mutex;
+    qint64 m_limit = 0;                     /* Written under m_mutex */
+    QHash<EmbeddedView*, Entry> m_entries;  /* Guarded by m_mutex */
+    qint64 m_usage = 0;                     /* Guarded by m_mutex */
+    quint64 m_clock = 0;                    /* Guarded by m_mutex */
+    bool m_enforceScheduled = false;        /* Guarded by m_mutex */
+};
+
+#endif /* TEXTURE_BUDGET_H */
@@ -0,0 +1,90 @@
+/*
+ * view_frames.h - Per-view CPU staging buffers
+ *
+ * Each view owns a small ring of persistent staging buffers. On acquire,
+ * only the region that changed since a buffer was last written is copied
+ * from the client buffer into it, and the buffer is handed to the consumer
+ * by reference. Consumers release it (from any thread) once uploaded.
+ *
+ * SPDX-License-Identifier: MIT
+ * Copyright (c) 2024
+ */
+#ifndef VIEW_FRAMES_H
+#define VIEW_FRAMES_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <pixman.h>
+
+#include "compositor_core.h"
+
+struct wlr_buffer;
+struct buffer_pool;
+struct buffer_sync;
+struct comp_frame_slot;
+
+/* Staging ring of one view */
+struct comp_view_frames {
+    struct comp_frame_slot* slots[COMP_FRAME_SLOTS];
+    struct comp_frame_slot* latest;  /* Last slot handed out */
+    /* Downscaled copies of the ring's frames, see view_frames_acquire_scaled() */
+    struct comp_frame_slot* thumbs[COMP_FRAME_SLOTS];
+    struct comp_frame_slot* latest_thumb;
+    const struct wlr_buffer* latest_direct;  /* Client buffer of the last
+                                              * direct frame - compared only */
+    struct buffer_pool* pool;        /* Slot memory, referenced */
+    pixman_region32_t damage;        /* Changed since the last acquire */
+    uint64_t seq;
+    uint32_t out_width;              /* Of the frame last handed out */
+    uint32_t out_height;
+    uint32_t out_downscale;
+    uint64_t last_copy_bytes;        /* Converted by the last acquire */
+    bool dirty;                      /* Commits since the last acquire */
+    bool initialized;
+};
+
+/* Initialize an empty ring - slots are allocated from pool on first use */
+void view_frames_init(struct comp_view_frames* frames, struct buffer_pool* pool);
+
+/* Drop the ring's references; slots still held by consumers live on */
+void view_frames_finish(struct comp_view_frames* frames);
+
+/* Drop the ring's slots so their memory goes back to the pool - slots
+ * still held by consumers go once released. The next acquire copies the
+ * whole buffer again and reports full damage. */
+void view_frames_trim(struct comp_view_frames* frames);
+
+/* Record buffer damage of a commit */
+void view_frames_damage(struct comp_view_frames* frames, pixman_region32_t* damage);
+
+/* Bring a free slot up to date with buffer and hand it out.
+ * Pixels are converted to premultiplied ARGB8888 on the way. Returns
+ * false if the buffer is not CPU-readable, has a format pixel_convert
+ * does not handle, or all slots are busy. */
+bool view_frames_acquire(struct comp_view_frames* frames, struct wlr_buffer* buffer,
+                         struct comp_frame* frame);
+
+/* Same, downscaled by a whole factor with a box filter - for views shown
+ * much smaller than their buffer. The frame goes through the ring first;
+ * only the blocks its damage touches are filtered again. factor 1 is
+ * view_frames_acquire(). */
+bool view_frames_acquire_scaled(struct comp_view_frames* frames, struct wlr_buffer* buffer,
+                                uint32_t factor, struct comp_frame* frame);
+
+/* Hand out the client's wl_shm buffer itself, locked through sync until
+ * the frame is released. Only for ARGB8888, which the consumer takes as
+ * is (XRGB needs its alpha filled in), and only while the buffer is not
+ * released to the client yet. Slots are left alone. Returns false if
+ * view_frames_acquire() is needed. */
+bool view_frames_acquire_direct(struct comp_view_frames* frames, struct wlr_buffer* buffer,
+                                struct buffer_sync* sync, struct comp_frame* frame);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* VIEW_FRAMES_H */
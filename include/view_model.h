@@ -0,0 +1,68 @@
+/*
+ * view_model.h - List model of the compositor's views
+ *
+ * One row per mapped toplevel, in the order they were mapped. Rows are
+ * inserted and removed one at a time and title or geometry changes only
+ * emit dataChanged for their row, so a Repeater over many views keeps
+ * its other delegates when a window opens or closes.
+ *
+ * Every view has an id that stays the same while it is mapped, unlike
+ * its row, which shifts as views before it go away. Delegates should
+ * bind EmbeddedView.viewId to the viewId role.
+ *
+ * SPDX-License-Identifier: MIT
+ * Copyright (c) 2024
+ */
+#ifndef VIEW_MODEL_H
+#define VIEW_MODEL_H
+
+#include <QAbstractListModel>
+
+class CompositorWrapper;
+
+class ViewModel : public QAbstractListModel {
+    Q_OBJECT
+    Q_PROPERTY(int count READ count NOTIFY countChanged)
+
+public:
+    enum Role {
+        ViewIdRole = Qt::UserRole + 1,
+        TitleRole,
+        GeometryRole,
+        FpsRole,            /* Presented frames per second, 0 unless tracing */
+    };
+    Q_ENUM(Role)
+
+    explicit ViewModel(CompositorWrapper* compositor);
+
+    int rowCount(const QModelIndex& parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const override;
+    QHash<int, QByteArray> roleNames() const override;
+
+    int count() const;
+
+    /* Row of the view with viewId, -1 if it is not mapped */
+    Q_INVOKABLE int indexOf(int viewId) const;
+    /* Id of the view in row, 0 if out of range */
+    Q_INVOKABLE int viewId(int row) const;
+
+signals:
+    void countChanged();
+
+private:
+    friend class CompositorWrapper;
+
+    /* Called by the wrapper around changes to its view list */
+    void beginInsertView(int row);
+    void endInsertView();
+    void beginRemoveView(int row);
+    void endRemoveView();
+    void beginResetViews();
+    void endResetViews();
+    void viewChanged(int row, const QList<int>& roles);
+    void frameRatesChanged();
+
+    CompositorWrapper* m_compositor;
+};
+
+#endif /* VIEW_MODEL_H */
@@ -0,0 +1,104 @@
+/*
+ * view_passthrough.h - A view's DMA-BUFs shown by the parent compositor
+ *
+ * Nested on Wayland, a view that fills its EmbeddedView with one client
+ * buffer at native size needs no composition here: its DMA-BUFs are
+ * imported on Qt's own connection to the parent compositor and attached
+ * to a wl_subsurface of the window, placed over the item with
+ * wp_viewporter. The parent can scan the buffer out or compose it once,
+ * and our import, scene graph pass and swap are skipped entirely.
+ *
+ * The first frame is synchronized with the window's next commit, so the
+ * subsurface appears in place; later frames go out on their own.
+ * Imports are asynchronous and cached per client buffer - a client
+ * cycling through its swapchain is imported once per buffer. Client
+ * buffers stay locked until the parent releases them.
+ *
+ * The subsurface takes no input, events still reach the window under it,
+ * and is declared opaque for formats without alpha.
+ *
+ * GUI thread only.
+ *
+ * SPDX-License-Identifier: MIT
+ * Copyright (c) 2024
+ */
+#ifndef VIEW_PASSTHROUGH_H
+#define VIEW_PASSTHROUGH_H
+
+#include <QObject>
+#include <QList>
+#include <QPointer>
+#include <QRect>
+#include <QQuickWindow>
+
+struct comp_dmabuf;
+struct wl_buffer;
+struct wl_callback;
+struct wl_subsurface;
+struct wl_surface;
+struct wp_viewport;
+struct zwp_linux_buffer_params_v1;
+
+class ViewPassthrough : public QObject {
+    Q_OBJECT
+
+public:
+    /* Qt runs on Wayland and the parent offers subsurfaces, viewporter
+     * and linux-dmabuf */
+    static bool isSupported(QQuickWindow* window);
+
+    explicit ViewPassthrough(QQuickWindow* window, QObject* parent = nullptr);
+    ~ViewPassthrough() override;
+
+    QQuickWindow* window() const { return m_window; }
+
+    /* The window still has the surface the subsurface hangs off - Qt
+     * makes a new one when the window is hidden and shown again */
+    bool isValid() const;
+
+    /* Where the view shows, in window coordinates */
+    void setGeometry(const QRect& rect);
+    QRect geometry() const { return m_geometry; }
+
+    /* Show a frame. Takes the fds and the lock in all cases. */
+    void present(struct comp_dmabuf* dmabuf);
+
+signals:
+    /* The parent showed the last frame - time for the client's next one */
+    void presented();
+    /* The parent could not import a buffer */
+    void failed();
+
+private:
+    struct Buffer;
+
+    void attach(Buffer* buffer);
+    void bufferFailed(Buffer* buffer);
+    void frameDone();
+    void updateOpaqueRegion();
+
+    static void handleCreated(void* data, struct zwp_linux_buffer_params_v1* params,
+                              struct wl_buffer* buffer);
+    static void handleFailed(void* data, struct zwp_linux_buffer_params_v1* params);
+    static void handleRelease(void* data, struct wl_buffer* buffer);
+    static void handleFrameDone(void* data, struct wl_callback* callback, uint32_t time);
+
+    /* Client buffers kept imported - enough for a triple-buffering client */
+    static const int kMaxBuffers = 4;
+
+    QPointer<QQuickWindow> m_window;
+    struct wl_surface* m_parent = nullptr;
+    struct wl_surface* m_surface = nullptr;
+    struct wl_subsurface* m_subsurface = nullptr;
+    struct wp_viewport* m_viewport = nullptr;
+    struct wl_callback* m_frameCallback = nullptr;
+    bool m_desync = false;
+
+    QRect m_geometry;
+    bool m_opaque = false;          /* Format of the attached buffer */
+    QSize m_opaqueSize;             /* Opaque region last declared */
+
+    QList<Buffer*> m_buffers;       /* Most recently used first */
+};
+
+#endif /* VIEW_PASSTHROUGH_H */
@@ -0,0 +1,57 @@
+/*
+ * view_scene.h - Offscreen composition of views with more than one surface
+ *
+ * The toplevel's buffer alone misses subsurfaces (video players, client
+ * widgets) and popups. A view that has any gets a wlr_scene of its own
+ * holding just its surface tree, rendered into an offscreen output sized
+ * to the view - not the whole server scene. wlroots' damage tracking
+ * keeps each render to what changed since the buffer was last drawn, and
+ * the frame damage of the render is what the staging ring copies and Qt
+ * uploads.
+ *
+ * The scene is created with the view's first subsurface or popup and
+ * lives as long as the view. Single-surface views never get one and keep
+ * handing out the client's buffer.
+ *
+ * All functions must be called on the event loop thread.
+ *
+ * SPDX-License-Identifier: MIT
+ * Copyright (c) 2024
+ */
+#ifndef VIEW_SCENE_H
+#define VIEW_SCENE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <pixman.h>
+
+struct comp_view;
+struct comp_view_scene;
+struct wlr_buffer;
+struct wlr_scene_tree;
+
+/* Give a mapped view its own scene. Popups created before are not in it. */
+struct comp_view_scene* view_scene_create(struct comp_view* view);
+
+void view_scene_destroy(struct comp_view_scene* vscene);
+
+/* Tree of the view's xdg surface - what its popups are attached under */
+struct wlr_scene_tree* view_scene_get_tree(struct comp_view_scene* vscene);
+
+/* Render what changed, resizing the output to the view first if needed.
+ * Returns false if nothing did; otherwise damage (initialized by the
+ * caller) gets the changed part in frame pixels. */
+bool view_scene_render(struct comp_view_scene* vscene, pixman_region32_t* damage);
+
+/* Latest composed frame, NULL before the first render. Valid until the
+ * next render - lock it to keep it longer. */
+struct wlr_buffer* view_scene_get_buffer(struct comp_view_scene* vscene);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* VIEW_SCENE_H */
@@ -0,0 +1,106 @@
+/*
+ * view_stream.h - Hardware video encoding of a view's frames
+ *
+ * A stream takes the DMA-BUFs a view hands out (the client's buffer, or
+ * its composed scene) and encodes them to H.264 or HEVC on the GPU with
+ * VAAPI: the buffer is imported as a VA surface, converted to NV12 by the
+ * video processor and encoded there, so pixels never pass through system
+ * memory. Only the encoded packets do, on their way to a sink.
+ *
+ * Frames are only submitted when the view has damage. Damage smaller than
+ * the frame becomes regions of interest, spending the bits where the
+ * content changed. Encoding runs on a thread of its own; a frame that
+ * arrives while the previous one is still being encoded replaces any
+ * frame still waiting, with the damage of both, so a slow encoder drops
+ * frames instead of holding client buffers.
+ *
+ * Built without FFmpeg (libavcodec, libavfilter, libavformat, libavutil)
+ * streams cannot be created and the RTP sink is unavailable.
+ *
+ * SPDX-License-Identifier: MIT
+ * Copyright (c) 2024
+ */
+#ifndef VIEW_STREAM_H
+#define VIEW_STREAM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct comp_dmabuf;
+struct comp_rect;
+struct view_stream;
+
+enum view_stream_codec {
+    VIEW_STREAM_H264,
+    VIEW_STREAM_HEVC,
+};
+
+/* Where packets go. Callbacks run on the stream's encoder thread. */
+struct view_stream_sink {
+    /* The encoder (re)started: the next packet is a keyframe of this size */
+    bool (*start)(void* data, enum view_stream_codec codec, uint32_t width, uint32_t height);
+    /* One access unit, Annex B with in-band parameter sets. pts_ns is the
+     * commit time, CLOCK_MONOTONIC. */
+    void (*packet)(void* data, const uint8_t* bytes, size_t size, uint64_t pts_ns,
+                   bool keyframe);
+    void (*destroy)(void* data);
+    void* data;
+};
+
+struct view_stream_config {
+    enum view_stream_codec codec;
+    const char* render_node;        /* VAAPI device, e.g. /dev/dri/renderD128 */
+    uint32_t bitrate_kbps;          /* 0 for the encoder's constant quality */
+    uint32_t keyframe_interval;     /* Frames between keyframes, 0 for 120 */
+};
+
+/* Start the encoder thread. The stream owns sink from here on, also when
+ * NULL is returned. The encoder itself is set up with the first frame. */
+struct view_stream* view_stream_create(const struct view_stream_config* config,
+                                       const struct view_stream_sink* sink);
+
+/* Encode what is still waiting, then stop and destroy the sink */
+void view_stream_destroy(struct view_stream* stream);
+
+/* Hand over a frame, owned by the stream afterwards. damage is in buffer
+ * pixels; time_ns is CLOCK_MONOTONIC. */
+void view_stream_submit(struct view_stream* stream, struct comp_dmabuf* dmabuf,
+                        const struct comp_rect* damage, int n_damage, uint64_t time_ns);
+
+/* Sink for url: "rtp://host:port" sends RTP (the SDP is logged once the
+ * stream starts), "shm:name" writes to a shared memory ring, see below */
+bool view_stream_sink_open(struct view_stream_sink* sink, const char* url);
+
+/* Shared memory ring in /dev/shm/name: a header, then records that never
+ * wrap - one with size 0 pads to the end of the ring. head counts the bytes
+ * written in total and is stored (release) after the record is complete;
+ * a reader more than capacity behind has lost packets. */
+#define VIEW_STREAM_SHM_MAGIC 0x4d525453u   /* "STRM" */
+#define VIEW_STREAM_SHM_SIZE (8u << 20)
+#define VIEW_STREAM_SHM_KEYFRAME 1u
+
+struct view_stream_shm_header {
+    uint32_t magic;
+    uint32_t codec;             /* enum view_stream_codec */
+    uint32_t width;
+    uint32_t height;
+    uint64_t capacity;          /* Bytes of records after the header */
+    uint64_t head;
+};
+
+struct view_stream_shm_record {
+    uint32_t size;              /* Payload bytes that follow, 8-byte padded */
+    uint32_t flags;
+    uint64_t pts_ns;
+};
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* VIEW_STREAM_H */
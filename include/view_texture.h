@@ -0,0 +1,48 @@
+/*
+ * view_texture.h - Persistent scene graph texture with partial uploads
+ *
+ * Unlike QQuickWindow::createTextureFromImage, which builds a brand-new
+ * texture per frame, a ViewTexture keeps its GPU texture across frames
+ * and only uploads the damaged rectangles of each new frame.
+ *
+ * setImage() is called during the scene graph sync (GUI thread blocked),
+ * the upload itself happens on the render thread in
+ * commitTextureOperations().
+ *
+ * SPDX-License-Identifier: MIT
+ * Copyright (c) 2024
+ */
+#ifndef VIEW_TEXTURE_H
+#define VIEW_TEXTURE_H
+
+#include <QSGTexture>
+#include <QImage>
+#include <QRegion>
+
+class QRhiTexture;
+
+class ViewTexture : public QSGTexture {
+public:
+    ViewTexture();
+    ~ViewTexture() override;
+
+    /* Queue the damaged part of image for upload. Damage accumulates until
+     * the next upload; a size change always uploads the whole image. */
+    void setImage(const QImage& image, const QRegion& damage);
+
+    qint64 comparisonKey() const override;
+    QRhiTexture* rhiTexture() const override;
+    QSize textureSize() const override;
+    bool hasAlphaChannel() const override;
+    bool hasMipmaps() const override;
+    void commitTextureOperations(QRhi* rhi, QRhiResourceUpdateBatch* resourceUpdates) override;
+
+private:
+    QRhiTexture* m_texture = nullptr;
+    QImage m_pending;
+    QRegion m_pendingDamage;
+    QSize m_size;
+    bool m_hasAlpha = true;
+};
+
+#endif /* VIEW_TEXTURE_H */
@@ -0,0 +1,98 @@
+/*
+ * vulkan_texture.h - Zero-copy DMA-BUF import into a Vulkan scene graph
+ *
+ * The Vulkan counterpart of DmabufTexture: a client DMA-BUF becomes a
+ * VkImage bound to imported memory (VK_EXT_external_memory_dma_buf with
+ * VK_EXT_image_drm_format_modifier) and is wrapped in a QSGTexture. No
+ * EGL and no pixel copies are involved.
+ *
+ * The import moves the image from the client's queue to the scene
+ * graph's, waiting for the acquire fence as a semaphore on the way; the
+ * client buffer goes back with a sync_file exported once the frames that
+ * sampled it are submitted.
+ *
+ * The device has to be created with requiredDeviceExtensions() enabled,
+ * see QQuickGraphicsConfiguration::setDeviceExtensions().
+ *
+ * All methods must be called on the scene graph render thread.
+ *
+ * SPDX-License-Identifier: MIT
+ * Copyright (c) 2024
+ */
+#ifndef VULKAN_TEXTURE_H
+#define VULKAN_TEXTURE_H
+
+#include <QByteArrayList>
+#include <QList>
+#include <QSize>
+#include <QSGTexture>
+#include <QQuickWindow>
+
+#include <deque>
+
+#if QT_CONFIG(vulkan)
+#include <QVulkanInstance>
+#endif
+
+struct comp_dmabuf;
+struct comp_dmabuf_format;
+struct comp_buffer_lock;
+
+class VulkanTexture {
+public:
+    VulkanTexture();
+    ~VulkanTexture();
+
+    VulkanTexture(const VulkanTexture&) = delete;
+    VulkanTexture& operator=(const VulkanTexture&) = delete;
+
+    /* Device extensions the import needs */
+    static QByteArrayList requiredDeviceExtensions();
+
+    /* Check that the window renders with Vulkan and the device can import
+     * DMA-BUFs */
+    static bool isSupported(QQuickWindow* window);
+
+    /* Formats and modifiers import() can take, from the device's DRM
+     * format modifier properties */
+    static QList<comp_dmabuf_format> importFormats(QQuickWindow* window);
+
+    /* Import a DMA-BUF, replacing the previous image.
+     * Takes ownership of the fds (they are closed in all cases). */
+    bool import(struct comp_dmabuf* dmabuf, QQuickWindow* window);
+
+    /* Texture of the last import - owned by this object */
+    QSGTexture* texture() const { return m_texture; }
+    QSize size() const { return m_size; }
+
+private:
+#if QT_CONFIG(vulkan)
+    struct Image {
+        VkImage image = VK_NULL_HANDLE;
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        VkSemaphore acquire = VK_NULL_HANDLE;   /* Client's acquire fence */
+        VkCommandBuffer commands[2] = {};       /* Ownership acquire, release */
+    };
+
+    void destroyImage(const Image& image);
+    bool ensureSyncObjects();
+    /* Give the current image back to the client and drop its lock */
+    void releaseCurrent();
+
+    VkDevice m_device = VK_NULL_HANDLE;
+    VkQueue m_queue = VK_NULL_HANDLE;
+    uint32_t m_queueFamily = 0;
+    QVulkanDeviceFunctions* m_functions = nullptr;
+    PFN_vkGetSemaphoreFdKHR m_getSemaphoreFd = nullptr;
+    VkCommandPool m_commandPool = VK_NULL_HANDLE;
+    VkSemaphore m_releaseSemaphore = VK_NULL_HANDLE;
+    Image m_current;
+    struct comp_buffer_lock* m_lock = nullptr;  /* Client buffer of m_current */
+    /* Replaced images, kept until no frame in flight can sample them */
+    std::deque<Image> m_retired;
+#endif
+    QSize m_size;
+    QSGTexture* m_texture = nullptr;
+};
+
+#endif /* VULKAN_TEXTURE_H */
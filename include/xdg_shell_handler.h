@@ -9,15 +9,20 @@ extern "C" {
 #endif
 
 #include <wayland-server-core.h>
+#include "view_frames.h"
 
 /* Forward declarations to avoid including wlr_xdg_shell.h in header */
 struct wlr_xdg_shell;
 struct wlr_xdg_toplevel;
+struct wlr_xdg_popup;
 struct wlr_scene_tree;
 struct wlr_xdg_decoration_manager_v1;
 
 struct comp_server;
 struct comp_view;
+struct comp_view_scene;
+struct comp_output;
+struct view_stream;
 
 /* XDG shell state */
 struct comp_xdg_shell {
@@ -29,20 +34,54 @@ struct comp_xdg_shell {
     struct comp_server* server;
 };
 
+/* Scene trees an xdg surface is shown in - the ones its popups go under.
+ * xdg_surface->data points to it. */
+struct comp_surface_trees {
+    struct comp_view* view;             /* Toplevel the surface belongs to */
+    struct wlr_scene_tree* main;        /* Server scene */
+    struct wlr_scene_tree* offscreen;   /* View scene, NULL without one */
+    
+    /* Popups only - the toplevel's are part of its view */
+    struct wlr_xdg_popup* popup;
+    struct wl_listener commit;
+    struct wl_listener destroy;
+};
+
 /* View representing an XDG toplevel */
 struct comp_view {
     struct wl_list link;  /* comp_server.views */
     struct comp_server* server;
     struct wlr_xdg_toplevel* xdg_toplevel;
     struct wlr_scene_tree* scene_tree;
+    struct comp_output* output;  /* Own output with per-view outputs, else NULL */
+    struct comp_surface_trees trees;
+    
+    /* Own scene once there is more than the toplevel surface to show,
+     * see view_scene.h */
+    struct comp_view_scene* scene;
+    bool wants_scene;     /* Got a subsurface before it was mapped */
     
     /* Position */
     int32_t x, y;
     
     /* State tracking */
     bool mapped;
+    
+    /* Configure tracking - one configure in flight at a time. Sizes asked
+     * for meanwhile merge into requested_* and go out once it is acked. */
     bool pending_configure;
     uint32_t pending_serial;
+    uint32_t configured_width, configured_height;   /* Last size sent */
+    uint32_t requested_width, requested_height;     /* 0 until requested */
+    bool suspended;       /* Not visible in any EmbeddedView */
+    bool scanout_hint;    /* Shown large and opaque, see dmabuf_feedback.h */
+    uint32_t thumbnail_width, thumbnail_height;     /* 0 for full-size frames */
+    
+    /* CPU staging buffers for frame readback */
+    struct comp_view_frames frames;
+    
+    /* Video encoder fed with every damaged frame, NULL if not streamed */
+    struct view_stream* stream;
     
     /* Listeners - with cleanup flags */
     struct wl_listener map;
@@ -54,6 +93,9 @@ struct comp_view {
     struct wl_listener request_maximize;
     struct wl_listener request_fullscreen;
     struct wl_listener set_title;
+    struct wl_listener set_app_id;
+    struct wl_listener ack_configure;
+    struct wl_listener new_subsurface;
     
     bool listeners_active;
 };
@@ -66,6 +108,10 @@ void comp_xdg_shell_finish(struct comp_xdg_shell* shell);
 
 /* View operations */
 void comp_view_focus(struct comp_view* view);
+
+/* Send the requested size unless a configure is still waiting for its ack
+ * or the client already has that size */
+void comp_view_flush_configure(struct comp_view* view);
 void comp_view_begin_interactive(struct comp_view* view, int mode);
 
 #ifdef __cplusplus
@@ -60,6 +60,20 @@ ApplicationWindow {
                 
                 Item { Layout.fillWidth: true }
                 
+                /* Frame tracing counters, see --trace */
+                Label {
+                    visible: compositor && compositor.tracing
+                    text: compositor ? "p50 " + compositor.frameLatencyP50.toFixed(1) + " ms  p99 "
+                                       + compositor.frameLatencyP99.toFixed(1) + " ms  "
+                                       + compositor.frameRate.toFixed(0) + " fps  "
+                                       + compositor.droppedFrames + " dropped  "
+                                       + (compositor.bytesCopied / 1048576).toFixed(0) + " MiB copied"
+                                     : ""
+                    font.family: "monospace"
+                    font.pixelSize: 12
+                    color: "#ffcc00"
+                }
+                
                 Label {
                     text: "Click a view to focus, then type!"
                     color: "#888"
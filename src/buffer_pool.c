@@ -0,0 +1,303 @@
+/*
+ * buffer_pool.c - Reusable page-aligned pixel buffers
+ *
+ * Size classes start at POOL_MIN_SIZE and step by a quarter of the
+ * current power of two, so rounding up never wastes more than 25%.
+ * Each class keeps a short free list; memory beyond the cache limits is
+ * unmapped right away. The free lists are guarded by a mutex since
+ * consumers release buffers from the Qt render thread.
+ *
+ * SPDX-License-Identifier: MIT
+ * Copyright (c) 2024
+ */
+#define _GNU_SOURCE
+
+#include "buffer_pool.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+
+#include <wlr/util/log.h>
+
+/* Smallest size class - 64 KiB */
+#define POOL_MIN_SHIFT 16
+#define POOL_MIN_SIZE ((size_t)1 << POOL_MIN_SHIFT)
+
+/* Largest cached size class - 1 GiB, bigger buffers are never cached */
+#define POOL_MAX_SHIFT 30
+
+/* Four classes per power of two */
+#define POOL_NUM_CLASSES ((POOL_MAX_SHIFT - POOL_MIN_SHIFT + 1) * 4)
+
+/* Released buffers kept per class, and in total */
+#define POOL_MAX_FREE_PER_CLASS 4
+#define POOL_MAX_CACHED_BYTES ((size_t)256 << 20)
+
+/* Transparent hugepages only pay off for buffers of a few of them */
+#define POOL_HUGEPAGE_MIN_SIZE ((size_t)4 << 20)
+
+struct pool_block {
+    struct pool_buffer base;    /* Must be first */
+    struct buffer_pool* pool;
+    atomic_int refs;
+    int size_class;             /* -1 if not cacheable */
+    struct pool_block* next;    /* Free list */
+};
+
+struct buffer_pool {
+    atomic_int refs;            /* 1 for the creator + 1 per buffer and user */
+    uint32_t flags;
+    bool destroyed;
+
+    pthread_mutex_t lock;
+    struct pool_block* free[POOL_NUM_CLASSES];
+    int n_free[POOL_NUM_CLASSES];
+    struct buffer_pool_stats stats;
+};
+
+/* Round size up to its class. Returns the class index, -1 if too large. */
+static int size_class(size_t size, size_t* class_size) {
+    if (size <= POOL_MIN_SIZE) {
+        *class_size = POOL_MIN_SIZE;
+        return 0;
+    }
+
+    int shift = (int)(sizeof(unsigned long long) * 8) - 1 - __builtin_clzll(size);
+    size_t step = ((size_t)1 << shift) / 4;
+    size_t rounded = (size + step - 1) & ~(step - 1);
+    *class_size = rounded;
+
+    /* Rounded up to the next power of two - that's quarter 0 of it */
+    int quarter = (int)(rounded / step) - 4;
+    if (quarter == 4) {
+        shift++;
+        quarter = 0;
+    }
+
+    if (shift > POOL_MAX_SHIFT) {
+        return -1;
+    }
+    return (shift - POOL_MIN_SHIFT) * 4 + quarter;
+}
+
+static bool block_map(struct buffer_pool* pool, struct pool_block* block, size_t size) {
+    if (pool->flags & BUFFER_POOL_MEMFD) {
+        int fd = memfd_create("wlroots-qt-pool", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        if (fd < 0 || ftruncate(fd, (off_t)size) < 0) {
+            wlr_log(WLR_ERROR, "Failed to create %zu byte memfd", size);
+            if (fd >= 0) close(fd);
+            return false;
+        }
+        /* Receivers can rely on the size never changing under them */
+        fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW);
+
+        void* data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED) {
+            wlr_log(WLR_ERROR, "Failed to map %zu byte memfd", size);
+            close(fd);
+            return false;
+        }
+        block->base.data = data;
+        block->base.fd = fd;
+    } else {
+        void* data = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (data == MAP_FAILED) {
+            wlr_log(WLR_ERROR, "Failed to map %zu byte buffer", size);
+            return false;
+        }
+        block->base.data = data;
+        block->base.fd = -1;
+    }
+
+#ifdef MADV_HUGEPAGE
+    if ((pool->flags & BUFFER_POOL_HUGEPAGES) && size >= POOL_HUGEPAGE_MIN_SIZE) {
+        madvise(block->base.data, size, MADV_HUGEPAGE);
+    }
+#endif
+
+    block->base.size = size;
+    return true;
+}
+
+static void block_free(struct pool_block* block) {
+    munmap(block->base.data, block->base.size);
+    if (block->base.fd >= 0) {
+        close(block->base.fd);
+    }
+    free(block);
+}
+
+struct buffer_pool* buffer_pool_create(uint32_t flags) {
+    struct buffer_pool* pool = calloc(1, sizeof(*pool));
+    if (!pool) {
+        wlr_log(WLR_ERROR, "Failed to allocate buffer pool");
+        return NULL;
+    }
+
+    atomic_init(&pool->refs, 1);
+    pool->flags = flags;
+    pthread_mutex_init(&pool->lock, NULL);
+    return pool;
+}
+
+uint32_t buffer_pool_flags_from_env(void) {
+    const char* env = getenv("WLROOTS_QT_BUFFER_POOL");
+    if (!env) return 0;
+
+    uint32_t flags = 0;
+    char* copy = strdup(env);
+    char* save = NULL;
+    for (char* tok = copy ? strtok_r(copy, ",", &save) : NULL; tok;
+         tok = strtok_r(NULL, ",", &save)) {
+        if (strcasecmp(tok, "memfd") == 0) {
+            flags |= BUFFER_POOL_MEMFD;
+        } else if (strcasecmp(tok, "hugepages") == 0) {
+            flags |= BUFFER_POOL_HUGEPAGES;
+        } else {
+            wlr_log(WLR_ERROR, "Unknown WLROOTS_QT_BUFFER_POOL option: %s", tok);
+        }
+    }
+    free(copy);
+    return flags;
+}
+
+static void pool_trim_locked(struct buffer_pool* pool) {
+    for (int i = 0; i < POOL_NUM_CLASSES; i++) {
+        while (pool->free[i]) {
+            struct pool_block* block = pool->free[i];
+            pool->free[i] = block->next;
+            pool->stats.cached_bytes -= block->base.size;
+            block_free(block);
+        }
+        pool->n_free[i] = 0;
+    }
+}
+
+void buffer_pool_destroy(struct buffer_pool* pool) {
+    if (!pool) return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->destroyed = true;
+    pool_trim_locked(pool);
+    pthread_mutex_unlock(&pool->lock);
+
+    buffer_pool_unref(pool);
+}
+
+struct buffer_pool* buffer_pool_ref(struct buffer_pool* pool) {
+    if (pool) {
+        atomic_fetch_add_explicit(&pool->refs, 1, memory_order_relaxed);
+    }
+    return pool;
+}
+
+void buffer_pool_unref(struct buffer_pool* pool) {
+    if (!pool) return;
+
+    if (atomic_fetch_sub_explicit(&pool->refs, 1, memory_order_acq_rel) == 1) {
+        pool_trim_locked(pool);
+        pthread_mutex_destroy(&pool->lock);
+        free(pool);
+    }
+}
+
+struct pool_buffer* buffer_pool_acquire(struct buffer_pool* pool, size_t size) {
+    if (!pool || size == 0) return NULL;
+
+    size_t class_size;
+    int idx = size_class(size, &class_size);
+
+    struct pool_block* block = NULL;
+    pthread_mutex_lock(&pool->lock);
+    if (idx >= 0 && pool->free[idx]) {
+        block = pool->free[idx];
+        pool->free[idx] = block->next;
+        pool->n_free[idx]--;
+        pool->stats.cached_bytes -= block->base.size;
+        pool->stats.reuses++;
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    if (!block) {
+        block = calloc(1, sizeof(*block));
+        if (!block) return NULL;
+
+        if (!block_map(pool, block, class_size)) {
+            free(block);
+            return NULL;
+        }
+        block->pool = pool;
+        block->size_class = idx;
+
+        pthread_mutex_lock(&pool->lock);
+        pool->stats.allocations++;
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    block->next = NULL;
+    atomic_init(&block->refs, 1);
+    buffer_pool_ref(pool);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stats.live_bytes += block->base.size;
+    pthread_mutex_unlock(&pool->lock);
+
+    return &block->base;
+}
+
+void pool_buffer_ref(struct pool_buffer* buffer) {
+    if (!buffer) return;
+    struct pool_block* block = (struct pool_block*)buffer;
+    atomic_fetch_add_explicit(&block->refs, 1, memory_order_relaxed);
+}
+
+void pool_buffer_unref(struct pool_buffer* buffer) {
+    if (!buffer) return;
+
+    struct pool_block* block = (struct pool_block*)buffer;
+    if (atomic_fetch_sub_explicit(&block->refs, 1, memory_order_acq_rel) != 1) {
+        return;
+    }
+
+    struct buffer_pool* pool = block->pool;
+    int idx = block->size_class;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stats.live_bytes -= block->base.size;
+    bool keep = !pool->destroyed && idx >= 0 &&
+                pool->n_free[idx] < POOL_MAX_FREE_PER_CLASS &&
+                pool->stats.cached_bytes + block->base.size <= POOL_MAX_CACHED_BYTES;
+    if (keep) {
+        block->next = pool->free[idx];
+        pool->free[idx] = block;
+        pool->n_free[idx]++;
+        pool->stats.cached_bytes += block->base.size;
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    if (!keep) {
+        block_free(block);
+    }
+    buffer_pool_unref(pool);
+}
+
+bool pool_buffer_is_exclusive(struct pool_buffer* buffer) {
+    if (!buffer) return false;
+    struct pool_block* block = (struct pool_block*)buffer;
+    return atomic_load_explicit(&block->refs, memory_order_acquire) == 1;
+}
+
+void buffer_pool_get_stats(struct buffer_pool* pool, struct buffer_pool_stats* stats) {
+    if (!pool || !stats) return;
+
+    pthread_mutex_lock(&pool->lock);
+    *stats = pool->stats;
+    pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,256 @@
+/*
+ * buffer_sync.c - Explicit synchronization for client buffers given to Qt
+ *
+ * Handed back locks go through a mutex-protected list and an eventfd
+ * that wakes the event loop, since the scene graph returns them from its
+ * render thread while only the loop thread may touch wlr_buffers.
+ *
+ * SPDX-License-Identifier: MIT
+ * Copyright (c) 2024
+ */
+#define _GNU_SOURCE
+
+#include "buffer_sync.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <linux/dma-buf.h>
+
+#include <wlr/render/drm_syncobj.h>
+#include <wlr/types/wlr_buffer.h>
+#include <wlr/types/wlr_compositor.h>
+#include <wlr/types/wlr_linux_drm_syncobj_v1.h>
+#include <wlr/util/log.h>
+
+struct comp_buffer_lock {
+    struct buffer_sync* sync;
+    struct wlr_buffer* buffer;          /* NULL once unlocked */
+    int fence;                          /* Release fence, -1 if none */
+    struct wl_event_source* source;     /* Waiting for the fence */
+    struct wl_list link;                /* One of the lists in buffer_sync */
+};
+
+struct buffer_sync {
+    struct wl_event_loop* loop;
+    int event_fd;
+    struct wl_event_source* event_source;
+
+    pthread_mutex_t mutex;
+    struct wl_list held;        /* Locked by a consumer */
+    struct wl_list returned;    /* Handed back, not yet seen by the loop */
+    struct wl_list waiting;     /* Waiting for their release fence - loop only */
+    int refs;                   /* 1 while alive, plus every lock not yet freed */
+    bool destroyed;
+};
+
+/* Drop a reference - under mutex, unlocks it. Returns true if freed. */
+static bool sync_unref_locked(struct buffer_sync* sync) {
+    if (--sync->refs > 0) {
+        pthread_mutex_unlock(&sync->mutex);
+        return false;
+    }
+    pthread_mutex_unlock(&sync->mutex);
+    pthread_mutex_destroy(&sync->mutex);
+    free(sync);
+    return true;
+}
+
+/* Release the buffer and free the lock - loop thread, under mutex */
+static void lock_finish(struct comp_buffer_lock* lock) {
+    if (lock->source) {
+        wl_event_source_remove(lock->source);
+        lock->source = NULL;
+    }
+    if (lock->fence >= 0) {
+        close(lock->fence);
+        lock->fence = -1;
+    }
+    if (lock->buffer) {
+        wlr_buffer_unlock(lock->buffer);
+        lock->buffer = NULL;
+    }
+    wl_list_remove(&lock->link);
+    lock->sync->refs--;
+    free(lock);
+}
+
+static int handle_fence(int fd, uint32_t mask, void* data) {
+    (void)fd;
+    (void)mask;
+    struct comp_buffer_lock* lock = data;
+    struct buffer_sync* sync = lock->sync;
+
+    pthread_mutex_lock(&sync->mutex);
+    lock_finish(lock);
+    pthread_mutex_unlock(&sync->mutex);
+    return 0;
+}
+
+static int handle_returned(int fd, uint32_t mask, void* data) {
+    (void)mask;
+    struct buffer_sync* sync = data;
+
+    uint64_t count;
+    if (read(fd, &count, sizeof(count)) < 0) {
+        /* Nothing pending - spurious wakeup */
+    }
+
+    pthread_mutex_lock(&sync->mutex);
+    struct comp_buffer_lock* lock;
+    struct comp_buffer_lock* tmp;
+    wl_list_for_each_safe(lock, tmp, &sync->returned, link) {
+        if (lock->fence < 0) {
+            lock_finish(lock);
+            continue;
+        }
+        /* A sync_file polls readable once it signalled */
+        lock->source = wl_event_loop_add_fd(sync->loop, lock->fence, WL_EVENT_READABLE,
+                                            handle_fence, lock);
+        if (!lock->source) {
+            lock_finish(lock);
+            continue;
+        }
+        wl_list_remove(&lock->link);
+        wl_list_insert(&sync->waiting, &lock->link);
+    }
+    pthread_mutex_unlock(&sync->mutex);
+    return 0;
+}
+
+struct buffer_sync* buffer_sync_create(struct wl_event_loop* loop) {
+    struct buffer_sync* sync = calloc(1, sizeof(*sync));
+    if (!sync) return NULL;
+
+    sync->loop = loop;
+    sync->refs = 1;
+    pthread_mutex_init(&sync->mutex, NULL);
+    wl_list_init(&sync->held);
+    wl_list_init(&sync->returned);
+    wl_list_init(&sync->waiting);
+
+    sync->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (sync->event_fd >= 0) {
+        sync->event_source = wl_event_loop_add_fd(loop, sync->event_fd, WL_EVENT_READABLE,
+                                                  handle_returned, sync);
+    }
+    if (!sync->event_source) {
+        wlr_log(WLR_ERROR, "Failed to set up the buffer release queue");
+        if (sync->event_fd >= 0) close(sync->event_fd);
+        pthread_mutex_destroy(&sync->mutex);
+        free(sync);
+        return NULL;
+    }
+    return sync;
+}
+
+void buffer_sync_destroy(struct buffer_sync* sync) {
+    if (!sync) return;
+
+    wl_event_source_remove(sync->event_source);
+    close(sync->event_fd);
+
+    pthread_mutex_lock(&sync->mutex);
+    sync->destroyed = true;
+
+    struct comp_buffer_lock* lock;
+    struct comp_buffer_lock* tmp;
+    wl_list_for_each_safe(lock, tmp, &sync->returned, link) {
+        lock_finish(lock);
+    }
+    wl_list_for_each_safe(lock, tmp, &sync->waiting, link) {
+        lock_finish(lock);
+    }
+    /* Still with the scene graph - it frees them when it hands them back */
+    wl_list_for_each(lock, &sync->held, link) {
+        if (lock->buffer) {
+            wlr_buffer_unlock(lock->buffer);
+            lock->buffer = NULL;
+        }
+    }
+    sync_unref_locked(sync);
+}
+
+struct comp_buffer_lock* buffer_sync_lock(struct buffer_sync* sync, struct wlr_buffer* buffer) {
+    if (!sync || !buffer) return NULL;
+
+    struct comp_buffer_lock* lock = calloc(1, sizeof(*lock));
+    if (!lock) return NULL;
+
+    lock->sync = sync;
+    lock->buffer = wlr_buffer_lock(buffer);
+    lock->fence = -1;
+
+    pthread_mutex_lock(&sync->mutex);
+    sync->refs++;
+    wl_list_insert(&sync->held, &lock->link);
+    pthread_mutex_unlock(&sync->mutex);
+    return lock;
+}
+
+void buffer_sync_unlock(struct comp_buffer_lock* lock, int release_fence) {
+    if (!lock) {
+        if (release_fence >= 0) close(release_fence);
+        return;
+    }
+
+    struct buffer_sync* sync = lock->sync;
+    pthread_mutex_lock(&sync->mutex);
+
+    if (sync->destroyed) {
+        /* The buffer was unlocked when the server went away */
+        if (release_fence >= 0) close(release_fence);
+        wl_list_remove(&lock->link);
+        free(lock);
+        sync_unref_locked(sync);
+        return;
+    }
+
+    lock->fence = release_fence;
+    wl_list_remove(&lock->link);
+    wl_list_insert(sync->returned.prev, &lock->link);
+    pthread_mutex_unlock(&sync->mutex);
+
+    uint64_t one = 1;
+    if (write(sync->event_fd, &one, sizeof(one)) < 0) {
+        /* Counter saturated - the loop is already due to run */
+    }
+}
+
+int buffer_sync_export_acquire(struct wlr_surface* surface) {
+    if (!surface || !surface->buffer) return -1;
+
+    /* Explicit sync: the commit's acquire point, materialized by now
+     * because wlroots holds back the commit until it is */
+    struct wlr_linux_drm_syncobj_surface_v1_state* state =
+        wlr_linux_drm_syncobj_v1_get_surface_state(surface);
+    if (state && state->acquire_timeline) {
+        int fd = wlr_drm_syncobj_timeline_export_sync_file(state->acquire_timeline,
+                                                           state->acquire_point);
+        if (fd < 0) {
+            wlr_log(WLR_ERROR, "Failed to export the acquire point as sync_file");
+        }
+        return fd;
+    }
+
+    return buffer_sync_export_implicit(&surface->buffer->base);
+}
+
+int buffer_sync_export_implicit(struct wlr_buffer* buffer) {
+    /* The fences the kernel tracks for writes to the buffer */
+    struct wlr_dmabuf_attributes attribs;
+    if (!buffer || !wlr_buffer_get_dmabuf(buffer, &attribs)) return -1;
+
+    struct dma_buf_export_sync_file request = {
+        .flags = DMA_BUF_SYNC_READ,
+        .fd = -1,
+    };
+    if (ioctl(attribs.fd[0], DMA_BUF_IOCTL_EXPORT_SYNC_FILE, &request) != 0) {
+        /* Kernel before 6.0 - the importer falls back to implicit sync */
+        return -1;
+    }
+    return request.fd;
+}
@@ -0,0 +1,140 @@
+/*
+ * client_socket.c - Listening Wayland socket without a display
+ *
+ * SPDX-License-Identifier: MIT
+ * Copyright (c) 2024
+ */
+#define _GNU_SOURCE
+
+#include "client_socket.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <wlr/util/log.h>
+
+/* Same range wl_display_add_socket_auto() tries */
+#define CLIENT_SOCKET_MAX_DISPLAYNO 32
+
+struct client_socket {
+    int fd;
+    int lock_fd;
+    char name[16];
+    struct sockaddr_un addr;
+    char lock_path[sizeof(((struct sockaddr_un*)0)->sun_path) + 8];
+};
+
+/* Take name if nobody holds its lock; a socket left behind is stale */
+static bool socket_lock(struct client_socket* sock, const char* dir, const char* name) {
+    int len = snprintf(sock->addr.sun_path, sizeof(sock->addr.sun_path), "%s/%s", dir, name);
+    if (len < 0 || (size_t)len >= sizeof(sock->addr.sun_path)) {
+        wlr_log(WLR_ERROR, "Socket path %s/%s is too long", dir, name);
+        return false;
+    }
+    snprintf(sock->lock_path, sizeof(sock->lock_path), "%s.lock", sock->addr.sun_path);
+
+    sock->lock_fd = open(sock->lock_path, O_CREAT | O_CLOEXEC | O_RDWR,
+                         S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    if (sock->lock_fd < 0) {
+        return false;
+    }
+    if (flock(sock->lock_fd, LOCK_EX | LOCK_NB) < 0) {
+        close(sock->lock_fd);
+        sock->lock_fd = -1;
+        return false;
+    }
+
+    struct stat st;
+    if (lstat(sock->addr.sun_path, &st) == 0 && (st.st_mode & (S_IWUSR | S_IWGRP))) {
+        unlink(sock->addr.sun_path);
+    }
+    snprintf(sock->name, sizeof(sock->name), "%s", name);
+    return true;
+}
+
+static void socket_unlock(struct client_socket* sock) {
+    if (sock->lock_fd < 0) return;
+
+    unlink(sock->lock_path);
+    close(sock->lock_fd);
+    sock->lock_fd = -1;
+}
+
+struct client_socket* client_socket_create(void) {
+    const char* dir = getenv("XDG_RUNTIME_DIR");
+    if (!dir || dir[0] != '/') {
+        wlr_log(WLR_ERROR, "XDG_RUNTIME_DIR is not set, cannot create a socket");
+        return NULL;
+    }
+
+    struct client_socket* sock = calloc(1, sizeof(*sock));
+    if (!sock) return NULL;
+    sock->fd = -1;
+    sock->lock_fd = -1;
+    sock->addr.sun_family = AF_UNIX;
+
+    for (int displayno = 0; displayno <= CLIENT_SOCKET_MAX_DISPLAYNO; displayno++) {
+        char name[16];
+        snprintf(name, sizeof(name), "wayland-%d", displayno);
+        if (!socket_lock(sock, dir, name)) continue;
+
+        sock->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+        if (sock->fd >= 0 &&
+            bind(sock->fd, (struct sockaddr*)&sock->addr, sizeof(sock->addr)) == 0 &&
+            listen(sock->fd, 128) == 0) {
+            wlr_log(WLR_DEBUG, "Listening on %s", sock->name);
+            return sock;
+        }
+
+        wlr_log(WLR_ERROR, "Failed to listen on %s: %s", sock->addr.sun_path, strerror(errno));
+        if (sock->fd >= 0) {
+            close(sock->fd);
+            sock->fd = -1;
+        }
+        socket_unlock(sock);
+        break;
+    }
+
+    free(sock);
+    return NULL;
+}
+
+void client_socket_destroy(struct client_socket* sock) {
+    if (!sock) return;
+
+    close(sock->fd);
+    unlink(sock->addr.sun_path);
+    socket_unlock(sock);
+    free(sock);
+}
+
+const char* client_socket_get_name(struct client_socket* sock) {
+    return sock ? sock->name : NULL;
+}
+
+int client_socket_get_fd(struct client_socket* sock) {
+    return sock ? sock->fd : -1;
+}
+
+int client_socket_accept(struct client_socket* sock) {
+    if (!sock) return -1;
+
+    int fd;
+    do {
+        fd = accept4(sock->fd, NULL, NULL, SOCK_CLOEXEC);
+    } while (fd < 0 && errno == EINTR);
+
+    if (fd < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+        wlr_log(WLR_ERROR, "Failed to accept a client on %s: %s", sock->name, strerror(errno));
+    }
+    return fd;
+}
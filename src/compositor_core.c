@@ -16,13 +16,24 @@
 #include "xdg_shell_handler.h"
 #include "seat_handler.h"
 #include "output_handler.h"
+#include "pixel_convert.h"
+#include "frame_trace.h"
+#include "gpu_probe.h"
+#include "buffer_sync.h"
+#include "dmabuf_feedback.h"
+#include "view_scene.h"
+#include "view_stream.h"
+#include "screen_capture.h"
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <assert.h>
 #include <time.h>
+#include <errno.h>
+#include <poll.h>
 
 #include <wayland-server-core.h>
 #include <wlr/backend.h>
@@ -36,11 +47,16 @@
 #include <wlr/types/wlr_scene.h>
 #include <wlr/types/wlr_xdg_shell.h>
 #include <wlr/types/wlr_buffer.h>
+#include <wlr/types/wlr_presentation_time.h>
+#include <wlr/types/wlr_linux_drm_syncobj_v1.h>
 #include <wlr/interfaces/wlr_buffer.h>
 #include <wlr/util/log.h>
 #include <drm_fourcc.h>
 #include <pixman.h>
 
+/* Dispatch rounds per comp_server_dispatch_events before yielding */
+#define COMP_DISPATCH_MAX_ROUNDS 16
+
 /* Server structure - internal */
 struct comp_server {
     /* Wayland core */
@@ -64,6 +80,17 @@ struct comp_server {
     struct wlr_compositor* compositor;
     struct wlr_subcompositor* subcompositor;
     struct wlr_data_device_manager* data_device_manager;
+    struct wlr_presentation* presentation;
+    struct wlr_linux_drm_syncobj_manager_v1* syncobj_manager;
+    
+    /* Client buffers on loan to Qt */
+    struct buffer_sync* buffer_sync;
+    
+    /* linux-dmabuf-v1, NULL for software rendering */
+    struct dmabuf_feedback* dmabuf_feedback;
+    
+    /* Screencopy and image capture for external tools */
+    struct screen_capture* capture;
     
     /* Subsystems */
     struct comp_xdg_shell xdg_shell;
@@ -80,11 +107,21 @@ struct comp_server {
     void* view_callback_data;
     comp_commit_callback_t commit_callback;
     void* commit_callback_data;
+    comp_view_commit_callback_t view_commit_callback;
+    void* view_commit_callback_data;
+    comp_cursor_callback_t cursor_callback;
+    void* cursor_callback_data;
     
     /* State */
     bool running;
     bool backend_started;
     bool use_hardware_rendering;
+    bool external_frame_clock;  /* Frame callbacks paced by the embedder */
+    bool per_view_outputs;      /* One headless output per view */
+    
+    /* First configure of new views, see comp_server_set_initial_view_size */
+    uint32_t initial_width, initial_height;
+    float initial_scale;
 };
 
 /* Create server instance */
@@ -98,6 +135,9 @@ struct comp_server* comp_server_create(void) {
     }
     
     wl_list_init(&server->views);
+    server->initial_width = 640;
+    server->initial_height = 480;
+    server->initial_scale = 1.0f;
     
     /* Create wayland display */
     server->display = wl_display_create();
@@ -115,19 +155,29 @@ struct comp_server* comp_server_create(void) {
 
 /* Initialize backend with specified renderer type */
 bool comp_server_init_backend_with_renderer(struct comp_server* server, bool use_hardware) {
+    return comp_server_init_backend_with_type(server,
+        use_hardware ? COMP_RENDERER_GLES2 : COMP_RENDERER_PIXMAN);
+}
+
+/* Initialize backend with a specific renderer */
+bool comp_server_init_backend_with_type(struct comp_server* server, enum comp_renderer renderer) {
     if (!server) return false;
     
-    server->use_hardware_rendering = use_hardware;
+    /* Phase timings for the startup log */
+    uint64_t start_ns = frame_trace_now_ns();
     
     /* Determine backend type */
-    render_backend_type_t type = use_hardware ? 
-        RENDER_BACKEND_HARDWARE : RENDER_BACKEND_SOFTWARE;
+    render_backend_type_t type = RENDER_BACKEND_SOFTWARE;
+    if (renderer == COMP_RENDERER_VULKAN) {
+        type = RENDER_BACKEND_VULKAN;
+    } else if (renderer == COMP_RENDERER_GLES2) {
+        type = RENDER_BACKEND_HARDWARE;
+    }
     
     /* Check if hardware is actually available */
-    if (use_hardware && !render_backend_hardware_available()) {
+    if (type != RENDER_BACKEND_SOFTWARE && !render_backend_hardware_available()) {
         wlr_log(WLR_INFO, "Hardware rendering requested but not available, using software");
         type = RENDER_BACKEND_SOFTWARE;
-        server->use_hardware_rendering = false;
     }
     
     /* Create render backend */
@@ -137,6 +187,8 @@ bool comp_server_init_backend_with_renderer(struct comp_server* server, bool use
         return false;
     }
     
+    uint64_t backend_ns = frame_trace_now_ns();
+    
     /* Initialize renderer */
     if (!render_backend_init_renderer(server->render_backend, server->display)) {
         wlr_log(WLR_ERROR, "Failed to init renderer");
@@ -149,6 +201,9 @@ bool comp_server_init_backend_with_renderer(struct comp_server* server, bool use
     server->backend = render_backend_get_wlr_backend(server->render_backend);
     server->renderer = render_backend_get_renderer(server->render_backend);
     server->allocator = render_backend_get_allocator(server->render_backend);
+    /* The render backend may have fallen back from what was asked for */
+    server->use_hardware_rendering = server->render_backend->type != RENDER_BACKEND_SOFTWARE;
+    uint64_t renderer_ns = frame_trace_now_ns();
     
     /* Create scene graph */
     server->scene = wlr_scene_create();
@@ -179,12 +234,39 @@ bool comp_server_init_backend_with_renderer(struct comp_server* server, bool use
         return false;
     }
     
+    /* Fences and locks for DMA-BUFs handed to Qt */
+    server->buffer_sync = buffer_sync_create(server->event_loop);
+    
+    /* Client DMA-BUFs, preferring formats the embedder imports directly */
+    server->dmabuf_feedback = dmabuf_feedback_create(server->display, server->renderer);
+    
+    /* Explicit sync for clients - needs timeline support in the renderer.
+     * The headless backend never scans out, so its own support is moot. */
+    int drm_fd = wlr_renderer_get_drm_fd(server->renderer);
+    if (drm_fd >= 0 && server->renderer->features.timeline) {
+        server->syncobj_manager = wlr_linux_drm_syncobj_manager_v1_create(server->display, 1,
+                                                                          drm_fd);
+    }
+    if (server->use_hardware_rendering && !server->syncobj_manager) {
+        wlr_log(WLR_INFO, "No linux-drm-syncobj-v1, clients use implicit sync");
+    }
+    
     /* Create subcompositor */
     server->subcompositor = wlr_subcompositor_create(server->display);
     
     /* Create data device manager */
     server->data_device_manager = wlr_data_device_manager_create(server->display);
     
+    /* Presentation feedback - sent when Qt actually shows the content */
+    server->presentation = wlr_presentation_create(server->display, server->backend, 2);
+    if (!server->presentation) {
+        wlr_log(WLR_ERROR, "Failed to create presentation-time");
+    }
+    
+    /* Recorders, VNC bridges, screenshot tools */
+    server->capture = screen_capture_create(server->display, server->renderer,
+                                            server->allocator, server->output_manager.layout);
+    
     /* Initialize XDG shell - CRITICAL for app windows */
     if (!comp_xdg_shell_init(&server->xdg_shell, server)) {
         wlr_log(WLR_ERROR, "Failed to init XDG shell");
@@ -197,8 +279,12 @@ bool comp_server_init_backend_with_renderer(struct comp_server* server, bool use
         return false;
     }
     
-    wlr_log(WLR_INFO, "Backend initialized: %s", 
-            server->use_hardware_rendering ? "Hardware (GLES2)" : "Software (Pixman)");
+    uint64_t end_ns = frame_trace_now_ns();
+    wlr_log(WLR_INFO, "Backend initialized: %s (backend %.1f ms, renderer %.1f ms, "
+            "protocols %.1f ms)",
+            render_backend_type_name(server->render_backend->type),
+            (backend_ns - start_ns) / 1e6, (renderer_ns - backend_ns) / 1e6,
+            (end_ns - renderer_ns) / 1e6);
     return true;
 }
 
@@ -211,16 +297,27 @@ bool comp_server_init_backend(struct comp_server* server) {
     return comp_server_init_backend_with_renderer(server, use_hardware);
 }
 
-/* Start server */
-bool comp_server_start(struct comp_server* server) {
-    if (!server || !server->backend) return false;
+/* Add the listening socket */
+bool comp_server_add_socket(struct comp_server* server) {
+    if (!server) return false;
+    if (server->socket) return true;
     
-    /* Add socket */
     server->socket = wl_display_add_socket_auto(server->display);
     if (!server->socket) {
         wlr_log(WLR_ERROR, "Failed to create socket");
         return false;
     }
+    return true;
+}
+
+/* Start server */
+bool comp_server_start(struct comp_server* server) {
+    if (!server || !server->backend) return false;
+    
+    /* Add socket, unless comp_server_add_socket() already did */
+    if (!comp_server_add_socket(server)) {
+        return false;
+    }
     
     /* Start backend */
     if (!wlr_backend_start(server->backend)) {
@@ -228,11 +325,14 @@ bool comp_server_start(struct comp_server* server) {
         return false;
     }
     
-    /* Create headless output (virtual display) */
-    struct wlr_output* output = wlr_headless_add_output(server->backend, 1280, 720);
-    if (!output) {
-        wlr_log(WLR_ERROR, "Failed to create headless output");
-        return false;
+    /* Create headless output (virtual display) - per-view outputs are
+     * added as views appear instead */
+    if (!server->per_view_outputs) {
+        struct wlr_output* output = wlr_headless_add_output(server->backend, 1280, 720);
+        if (!output) {
+            wlr_log(WLR_ERROR, "Failed to create headless output");
+            return false;
+        }
     }
     
     /* Setup virtual keyboard AFTER backend started */
@@ -244,7 +344,8 @@ bool comp_server_start(struct comp_server* server) {
     server->backend_started = true;
     server->running = true;
     
-    wlr_log(WLR_INFO, "Server started on %s with headless output", server->socket);
+    wlr_log(WLR_INFO, "Server started on %s with %s", server->socket,
+            server->per_view_outputs ? "per-view outputs" : "headless output");
     return true;
 }
 
@@ -254,6 +355,17 @@ void comp_server_destroy(struct comp_server* server) {
     
     wlr_log(WLR_INFO, "Destroying server");
     
+    /* Give back buffers Qt still holds while their clients exist */
+    buffer_sync_destroy(server->buffer_sync);
+    server->buffer_sync = NULL;
+    
+    dmabuf_feedback_destroy(server->dmabuf_feedback);
+    server->dmabuf_feedback = NULL;
+    
+    /* Views still unmapping below find it gone */
+    screen_capture_destroy(server->capture);
+    server->capture = NULL;
+    
     /* Cleanup subsystems */
     comp_seat_finish(&server->seat);
     comp_xdg_shell_finish(&server->xdg_shell);
@@ -280,32 +392,78 @@ bool comp_server_hardware_available(void) {
     return render_backend_hardware_available();
 }
 
+/* Pick the render node */
+void comp_server_set_render_node(const char* node) {
+    gpu_probe_set_preferred(node);
+}
+
+/* Render node hardware rendering would use */
+const struct gpu_node* comp_server_probe_gpu(void) {
+    return gpu_probe_selected();
+}
+
+/* Render node in use */
+const struct gpu_node* comp_server_get_gpu(struct comp_server* server) {
+    return server ? render_backend_get_gpu(server->render_backend) : NULL;
+}
+
 /* Check if currently using hardware rendering */
 bool comp_server_is_hardware_rendering(struct comp_server* server) {
     return server ? server->use_hardware_rendering : false;
 }
 
+/* Get the renderer in use */
+enum comp_renderer comp_server_get_renderer_type(struct comp_server* server) {
+    if (!server || !server->render_backend) return COMP_RENDERER_PIXMAN;
+    switch (server->render_backend->type) {
+        case RENDER_BACKEND_VULKAN:
+            return COMP_RENDERER_VULKAN;
+        case RENDER_BACKEND_HARDWARE:
+            return COMP_RENDERER_GLES2;
+        default:
+            return COMP_RENDERER_PIXMAN;
+    }
+}
+
 /* Get socket name */
 const char* comp_server_get_socket(struct comp_server* server) {
     return server ? server->socket : NULL;
 }
 
+/* Serve a connected socket as a client */
+bool comp_server_add_client(struct comp_server* server, int fd) {
+    if (!server || !server->display || fd < 0) return false;
+    
+    if (!wl_client_create(server->display, fd)) {
+        wlr_log(WLR_ERROR, "Failed to create client for fd %d", fd);
+        close(fd);
+        return false;
+    }
+    return true;
+}
+
 /* Get event fd for polling */
 int comp_server_get_event_fd(struct comp_server* server) {
     if (!server || !server->event_loop) return -1;
     return wl_event_loop_get_fd(server->event_loop);
 }
 
-/* Dispatch pending events */
+/* Dispatch until nothing is pending, within reason - a client flooding
+ * us must not keep the embedder's loop from running */
 void comp_server_dispatch_events(struct comp_server* server) {
     if (!server || !server->event_loop) return;
-    wl_event_loop_dispatch(server->event_loop, 0);
-    wl_display_flush_clients(server->display);
+    
+    struct pollfd pfd = { .fd = wl_event_loop_get_fd(server->event_loop), .events = POLLIN };
+    for (int i = 0; i < COMP_DISPATCH_MAX_ROUNDS; i++) {
+        wl_event_loop_dispatch(server->event_loop, 0);
+        if (poll(&pfd, 1, 0) <= 0) break;
+    }
 }
 
-/* Flush clients */
+/* Flush clients - idle work (configures, ...) first, it queues events too */
 void comp_server_flush_clients(struct comp_server* server) {
     if (!server || !server->display) return;
+    wl_event_loop_dispatch_idle(server->event_loop);
     wl_display_flush_clients(server->display);
 }
 
@@ -336,14 +494,30 @@ void comp_server_set_commit_callback(struct comp_server* server,
     server->commit_callback_data = user_data;
 }
 
-/* Notify frame commit - triggers Qt update */
-void comp_server_notify_frame_commit(struct comp_server* server) {
+/* Set view commit callback */
+void comp_server_set_view_commit_callback(struct comp_server* server,
+                                           comp_view_commit_callback_t callback,
+                                           void* user_data) {
     if (!server) return;
-    
-    /* Render and send frame_done to clients */
-    struct comp_output* output = comp_output_manager_get_primary(&server->output_manager);
-    if (output) {
-        comp_output_render_frame(output);
+    server->view_commit_callback = callback;
+    server->view_commit_callback_data = user_data;
+}
+
+/* Set cursor callback */
+void comp_server_set_cursor_callback(struct comp_server* server,
+                                     comp_cursor_callback_t callback,
+                                     void* user_data) {
+    if (!server) return;
+    server->cursor_callback = callback;
+    server->cursor_callback_data = user_data;
+}
+
+static void notify_frame_commit(struct comp_server* server, struct comp_output* output) {
+    /* Compose if anyone looks and send frame_done with the output's next
+     * frame - unless the embedder paces frame callbacks to its own
+     * presentation */
+    if (output && !server->external_frame_clock) {
+        comp_output_schedule_frame(output);
     }
     
     /* Notify Qt */
@@ -352,6 +526,120 @@ void comp_server_notify_frame_commit(struct comp_server* server) {
     }
 }
 
+/* Notify frame commit - triggers Qt update */
+void comp_server_notify_frame_commit(struct comp_server* server) {
+    if (!server) return;
+    notify_frame_commit(server, comp_output_manager_get_primary(&server->output_manager));
+}
+
+/* A view committed - with per-view outputs only its own output redraws */
+void comp_server_notify_view_frame_commit(struct comp_server* server, struct comp_view* view) {
+    if (!server || !view) return;
+    notify_frame_commit(server, view->output ? view->output :
+                        comp_output_manager_get_primary(&server->output_manager));
+}
+
+/* Choose per-view outputs - only before start */
+void comp_server_set_per_view_outputs(struct comp_server* server, bool enabled) {
+    if (!server) return;
+    if (server->backend_started) {
+        wlr_log(WLR_ERROR, "Per-view outputs must be chosen before start");
+        return;
+    }
+    server->per_view_outputs = enabled;
+}
+
+/* Size of the first configure - the item a new view will most likely land in */
+void comp_server_set_initial_view_size(struct comp_server* server, uint32_t width,
+                                       uint32_t height, float scale) {
+    if (!server || width == 0 || height == 0) return;
+    server->initial_width = width;
+    server->initial_height = height;
+    server->initial_scale = scale > 0.0f ? scale : 1.0f;
+}
+
+void comp_server_get_initial_view_size(struct comp_server* server, uint32_t* width,
+                                       uint32_t* height, float* scale) {
+    *width = server ? server->initial_width : 640;
+    *height = server ? server->initial_height : 480;
+    *scale = server ? server->initial_scale : 1.0f;
+}
+
+bool comp_server_has_per_view_outputs(struct comp_server* server) {
+    return server && server->per_view_outputs;
+}
+
+/* Let the embedder drive frame callbacks */
+void comp_server_set_external_frame_clock(struct comp_server* server, bool enabled) {
+    if (!server) return;
+    server->external_frame_clock = enabled;
+}
+
+bool comp_server_has_external_frame_clock(struct comp_server* server) {
+    return server && server->external_frame_clock;
+}
+
+static void timespec_from_ns(struct timespec* ts, uint64_t time_ns) {
+    ts->tv_sec = (time_t)(time_ns / 1000000000ull);
+    ts->tv_nsec = (long)(time_ns % 1000000000ull);
+}
+
+static void send_frame_done_iterator(struct wlr_surface* surface, int sx, int sy, void* data) {
+    (void)sx;
+    (void)sy;
+    wlr_surface_send_frame_done(surface, data);
+}
+
+/* Send wl_surface.frame done to the view and its subsurfaces/popups */
+void comp_view_send_frame_done(struct comp_view* view, uint64_t time_ns) {
+    if (!view || !view->mapped || !view->xdg_toplevel) return;
+    
+    struct timespec when;
+    timespec_from_ns(&when, time_ns);
+    wlr_xdg_surface_for_each_surface(view->xdg_toplevel->base, send_frame_done_iterator, &when);
+    
+    /* The cursor over the view is drawn along with it */
+    struct comp_seat* seat = &view->server->seat;
+    if (seat->cursor_view == view && seat->cursor_surface) {
+        wlr_surface_send_frame_done(seat->cursor_surface, &when);
+    }
+}
+
+static void send_presented_iterator(struct wlr_surface* surface, int sx, int sy, void* data) {
+    (void)sx;
+    (void)sy;
+    struct wlr_presentation_event* event = data;
+    
+    struct wlr_presentation_feedback* feedback = wlr_presentation_surface_sampled(surface);
+    if (!feedback) return;
+    
+    if (event->output) {
+        wlr_presentation_feedback_send_presented(feedback, event);
+    }
+    /* Without an output the feedback is discarded */
+    wlr_presentation_feedback_destroy(feedback);
+}
+
+/* Send wp_presentation feedback for the view's current content */
+void comp_view_send_presented(struct comp_view* view, uint64_t time_ns,
+                              uint32_t refresh_ns, uint64_t seq) {
+    if (!view || !view->mapped || !view->xdg_toplevel || !view->server) return;
+    if (!view->server->presentation) return;
+    
+    struct comp_output* output = view->output ? view->output :
+        comp_output_manager_get_primary(&view->server->output_manager);
+    
+    struct wlr_presentation_event event = {
+        .output = output ? output->wlr_output : NULL,
+        .tv_sec = time_ns / 1000000000ull,
+        .tv_nsec = (uint32_t)(time_ns % 1000000000ull),
+        .refresh = refresh_ns,
+        .seq = seq,
+        .flags = 0,
+    };
+    wlr_xdg_surface_for_each_surface(view->xdg_toplevel->base, send_presented_iterator, &event);
+}
+
 /* Get output */
 struct comp_output* comp_server_get_output(struct comp_server* server) {
     if (!server) return NULL;
@@ -401,13 +689,19 @@ void comp_view_set_size(struct comp_view* view, uint32_t width, uint32_t height)
     wlr_xdg_toplevel_set_size(view->xdg_toplevel, width, height);
 }
 
-/* Request view to resize - sends configure event */
+/* Request view to resize - merged into the next configure */
 void comp_view_request_size(struct comp_view* view, uint32_t width, uint32_t height) {
-    if (!view || !view->xdg_toplevel) return;
-    wlr_xdg_toplevel_set_size(view->xdg_toplevel, width, height);
-    wlr_xdg_toplevel_set_fullscreen(view->xdg_toplevel, true);
-    /* Schedule configure to be sent */
-    wlr_xdg_surface_schedule_configure(view->xdg_toplevel->base);
+    if (!view || !view->xdg_toplevel || width == 0 || height == 0) return;
+    view->requested_width = width;
+    view->requested_height = height;
+    comp_view_flush_configure(view);
+}
+
+/* Size the view's own output to the item showing it */
+bool comp_view_set_output_size(struct comp_view* view, uint32_t width, uint32_t height,
+                               float scale) {
+    if (!view || !view->output) return false;
+    return comp_output_set_size(view->output, width, height, scale);
 }
 
 /* Close view */
@@ -416,11 +710,65 @@ void comp_view_close(struct comp_view* view) {
     wlr_xdg_toplevel_send_close(view->xdg_toplevel);
 }
 
+/* Mark the view suspended (xdg_toplevel v6) while nothing shows it */
+void comp_view_set_suspended(struct comp_view* view, bool suspended) {
+    if (!view || !view->xdg_toplevel || view->suspended == suspended) return;
+    
+    view->suspended = suspended;
+    if (wl_resource_get_version(view->xdg_toplevel->resource) >=
+        XDG_TOPLEVEL_STATE_SUSPENDED_SINCE_VERSION) {
+        wlr_xdg_toplevel_set_suspended(view->xdg_toplevel, suspended);
+    }
+}
+
+bool comp_view_is_suspended(struct comp_view* view) {
+    return view && view->suspended;
+}
+
+/* Send the view feedback for how it is shown */
+void comp_server_update_view_feedback(struct comp_server* server, struct comp_view* view) {
+    if (!server || !server->dmabuf_feedback || !view->xdg_toplevel) return;
+    dmabuf_feedback_update_surface(server->dmabuf_feedback, view->xdg_toplevel->base->surface,
+                                   view->scanout_hint);
+}
+
+void comp_view_set_scanout_hint(struct comp_view* view, bool scanout) {
+    if (!view || view->scanout_hint == scanout) return;
+    
+    view->scanout_hint = scanout;
+    comp_server_update_view_feedback(view->server, view);
+}
+
+/* New import formats - every view gets feedback built from them */
+void comp_server_set_import_formats(struct comp_server* server,
+                                    const struct comp_dmabuf_format* formats, int n_formats) {
+    if (!server || !server->dmabuf_feedback) return;
+    
+    dmabuf_feedback_set_import_formats(server->dmabuf_feedback, formats, n_formats);
+    
+    struct comp_view* view;
+    wl_list_for_each(view, &server->views, link) {
+        comp_server_update_view_feedback(server, view);
+    }
+}
+
 /* Check if mapped */
 bool comp_view_is_mapped(struct comp_view* view) {
     return view && view->mapped;
 }
 
+bool comp_server_has_view(struct comp_server* server, struct comp_view* view) {
+    if (!server || !view) return false;
+    
+    struct comp_view* it;
+    wl_list_for_each(it, &server->views, link) {
+        if (it == view) {
+            return it->mapped;
+        }
+    }
+    return false;
+}
+
 /* Input forwarding - keyboard */
 void comp_server_send_key(struct comp_server* server, uint32_t key, bool pressed) {
     if (!server) return;
@@ -433,6 +781,16 @@ void comp_server_send_modifiers(struct comp_server* server, uint32_t depressed,
     comp_seat_send_modifiers(&server->seat, depressed, latched, locked, group);
 }
 
+void comp_server_clear_focus(struct comp_server* server, bool pointer) {
+    if (!server) return;
+    if (!pointer) {
+        comp_seat_focus_view(&server->seat, NULL);
+    } else if (server->seat.seat) {
+        /* Sends its own pointer frame */
+        wlr_seat_pointer_notify_clear_focus(server->seat.seat);
+    }
+}
+
 /* Input forwarding - pointer */
 void comp_server_send_pointer_motion(struct comp_server* server, double x, double y) {
     if (!server) return;
@@ -444,9 +802,42 @@ void comp_server_send_pointer_button(struct comp_server* server, uint32_t button
     comp_seat_send_pointer_button(&server->seat, button, pressed);
 }
 
-void comp_server_send_pointer_axis(struct comp_server* server, bool horizontal, double value) {
+void comp_server_send_pointer_axis(struct comp_server* server, bool horizontal, double value,
+                                   int32_t value120, bool continuous, bool inverted) {
+    if (!server) return;
+    comp_seat_send_pointer_axis(&server->seat, horizontal, value, value120, continuous, inverted);
+}
+
+void comp_server_send_pointer_frame(struct comp_server* server) {
     if (!server) return;
-    comp_seat_send_pointer_axis(&server->seat, horizontal, value);
+    comp_seat_send_pointer_frame(&server->seat);
+}
+
+/* What shows the view - its composed scene if it has one, else the
+ * toplevel's committed buffer */
+static struct wlr_buffer* view_get_buffer(struct comp_view* view) {
+    if (view->scene) {
+        return view_scene_get_buffer(view->scene);
+    }
+    struct wlr_surface* surface = view->xdg_toplevel->base->surface;
+    return surface && surface->buffer ? &surface->buffer->base : NULL;
+}
+
+void comp_view_send_pointer_motion(struct comp_view* view, double x, double y) {
+    if (!view || !view->server) return;
+    
+    if (view->mapped && view->xdg_toplevel) {
+        /* Frame pixels to surface coordinates - they differ once the client
+         * uses a buffer scale or a viewport, or the view is composed at the
+         * output scale */
+        struct wlr_surface_state* current = &view->xdg_toplevel->base->surface->current;
+        struct wlr_buffer* frame = view_get_buffer(view);
+        if (frame && frame->width > 0 && frame->height > 0) {
+            x = x * current->width / frame->width;
+            y = y * current->height / frame->height;
+        }
+    }
+    comp_seat_send_view_pointer_motion(&view->server->seat, view, x, y);
 }
 
 /* Get view surface dimensions */
@@ -474,19 +865,11 @@ bool comp_view_render_to_buffer(struct comp_view* view, void* buffer,
         return false;
     }
     
-    struct wlr_surface* surface = view->xdg_toplevel->base->surface;
-    if (!surface) {
-        return false;
-    }
-    
-    /* Get the committed buffer from the surface */
-    struct wlr_client_buffer* client_buffer = surface->buffer;
-    if (!client_buffer) {
+    struct wlr_buffer* wlr_buf = view_get_buffer(view);
+    if (!wlr_buf) {
         return false;
     }
     
-    struct wlr_buffer* wlr_buf = &client_buffer->base;
-    
     /* Try to get data pointer via begin_data_ptr_access */
     void* data;
     uint32_t format;
@@ -500,28 +883,186 @@ bool comp_view_render_to_buffer(struct comp_view* view, void* buffer,
     uint32_t src_width = wlr_buf->width;
     uint32_t src_height = wlr_buf->height;
     
-    /* Copy pixels - handle size differences */
+    /* Convert pixels - handle size differences */
     uint32_t copy_width = (src_width < buf_width) ? src_width : buf_width;
     uint32_t copy_height = (src_height < buf_height) ? src_height : buf_height;
     
-    uint8_t* dst = (uint8_t*)buffer;
-    uint8_t* src = (uint8_t*)data;
+    bool ok = pixel_convert(buffer, stride, data, buf_stride, format, copy_width, copy_height);
+    
+    wlr_buffer_end_data_ptr_access(wlr_buf);
+    
+    return ok;
+}
+
+/* Acquire the view's latest frame - the client's shm buffer itself, or a
+ * copy in its staging ring */
+bool comp_view_acquire_frame(struct comp_view* view, struct comp_frame* frame) {
+    if (!view || !view->mapped || !view->xdg_toplevel || !frame) {
+        return false;
+    }
     
-    for (uint32_t y = 0; y < copy_height; y++) {
-        memcpy(dst + y * stride, src + y * buf_stride, copy_width * 4);
+    struct wlr_buffer* buffer = view_get_buffer(view);
+    if (!buffer) {
+        return false;
     }
     
-    wlr_buffer_end_data_ptr_access(wlr_buf);
+    uint64_t start = frame_trace_enabled() ? frame_trace_now_ns() : 0;
     
+    /* Shown small - filter it down, the ring keeps the full-size copy */
+    uint32_t factor = 1;
+    if (view->thumbnail_width > 0 && view->thumbnail_height > 0) {
+        uint32_t fx = (uint32_t)buffer->width / view->thumbnail_width;
+        uint32_t fy = (uint32_t)buffer->height / view->thumbnail_height;
+        factor = fx < fy ? fx : fy;
+        if (factor > PIXEL_DOWNSCALE_MAX) factor = PIXEL_DOWNSCALE_MAX;
+    }
+    if (factor > 1) {
+        if (!view_frames_acquire_scaled(&view->frames, buffer, factor, frame)) {
+            return false;
+        }
+        if (view->frames.last_copy_bytes) {
+            frame_trace_mark(view, FRAME_TRACE_CAPTURE, start, view->frames.last_copy_bytes);
+        }
+        return true;
+    }
+    
+    /* The wl_shm buffer behind the surface while the client has not got it
+     * back yet - no copy, and it goes back right after the upload */
+    struct wlr_surface* surface = view->xdg_toplevel->base->surface;
+    struct wlr_buffer* source = view->scene ? NULL : surface->buffer->source;
+    if (source && view_frames_acquire_direct(&view->frames, source,
+                                             view->server->buffer_sync, frame)) {
+        if (frame->n_damage) {
+            frame_trace_mark(view, FRAME_TRACE_CAPTURE, start, 0);
+        }
+        return true;
+    }
+    
+    if (!view_frames_acquire(&view->frames, buffer, frame)) {
+        return false;
+    }
+    if (view->frames.last_copy_bytes) {
+        frame_trace_mark(view, FRAME_TRACE_CAPTURE, start, view->frames.last_copy_bytes);
+    }
     return true;
 }
 
+void comp_view_set_thumbnail_size(struct comp_view* view, uint32_t width, uint32_t height) {
+    if (!view) return;
+    view->thumbnail_width = width;
+    view->thumbnail_height = height;
+}
+
+void comp_view_trim_frames(struct comp_view* view) {
+    if (!view) return;
+    view_frames_trim(&view->frames);
+}
+
+/* Export the view's current buffer as DMA-BUF */
+bool comp_view_export_dmabuf(struct comp_view* view, struct comp_dmabuf* dmabuf) {
+    if (!view || !view->mapped || !view->xdg_toplevel || !dmabuf) {
+        return false;
+    }
+    
+    struct wlr_buffer* buffer = view_get_buffer(view);
+    if (!buffer) {
+        return false;
+    }
+    
+    /* Only GPU clients (linux-dmabuf) have a DMA-BUF behind their buffer -
+     * and a composed view if the renderer is a GPU one */
+    struct wlr_dmabuf_attributes attribs;
+    if (!wlr_buffer_get_dmabuf(buffer, &attribs)) {
+        return false;
+    }
+    
+    if (attribs.n_planes <= 0 || attribs.n_planes > COMP_DMABUF_MAX_PLANES) {
+        return false;
+    }
+    
+    memset(dmabuf, 0, sizeof(*dmabuf));
+    for (int i = 0; i < COMP_DMABUF_MAX_PLANES; i++) {
+        dmabuf->fd[i] = -1;
+    }
+    dmabuf->acquire_fence = -1;
+    
+    dmabuf->width = (uint32_t)attribs.width;
+    dmabuf->height = (uint32_t)attribs.height;
+    dmabuf->format = attribs.format;
+    dmabuf->modifier = attribs.modifier;
+    dmabuf->n_planes = attribs.n_planes;
+    
+    /* Duplicate the fds so the consumer owns them independently of the
+     * client buffer, which may be released on the next commit */
+    for (int i = 0; i < attribs.n_planes; i++) {
+        dmabuf->fd[i] = fcntl(attribs.fd[i], F_DUPFD_CLOEXEC, 0);
+        if (dmabuf->fd[i] < 0) {
+            wlr_log(WLR_ERROR, "Failed to dup DMA-BUF plane %d", i);
+            comp_dmabuf_close(dmabuf);
+            return false;
+        }
+        dmabuf->offset[i] = attribs.offset[i];
+        dmabuf->stride[i] = attribs.stride[i];
+    }
+    
+    /* Ready-to-read fence, and keep the client off the buffer until the
+     * importer says it is done with it */
+    dmabuf->acquire_fence = view->scene ? buffer_sync_export_implicit(buffer) :
+        buffer_sync_export_acquire(view->xdg_toplevel->base->surface);
+    dmabuf->lock = buffer_sync_lock(view->server->buffer_sync, buffer);
+    
+    return true;
+}
+
+/* Close exported DMA-BUF fds */
+void comp_dmabuf_close(struct comp_dmabuf* dmabuf) {
+    if (!dmabuf) return;
+    
+    /* The fence is only set on structs that were exported */
+    if (dmabuf->n_planes > 0 && dmabuf->acquire_fence >= 0) {
+        close(dmabuf->acquire_fence);
+    }
+    dmabuf->acquire_fence = -1;
+    for (int i = 0; i < dmabuf->n_planes && i < COMP_DMABUF_MAX_PLANES; i++) {
+        if (dmabuf->fd[i] >= 0) {
+            close(dmabuf->fd[i]);
+        }
+        dmabuf->fd[i] = -1;
+    }
+    dmabuf->n_planes = 0;
+    
+    /* Never handed to an importer that kept it - nothing to wait for */
+    buffer_sync_unlock(dmabuf->lock, -1);
+    dmabuf->lock = NULL;
+}
+
+/* Give a buffer back to its client */
+void comp_buffer_unlock(struct comp_buffer_lock* lock, int release_fence) {
+    buffer_sync_unlock(lock, release_fence);
+}
+
+/* Wait for a sync_file on the CPU */
+bool comp_fence_wait(int fence, int timeout_ms) {
+    if (fence < 0) return true;
+    struct pollfd pfd = { .fd = fence, .events = POLLIN };
+    int ret;
+    do {
+        ret = poll(&pfd, 1, timeout_ms);
+    } while (ret < 0 && errno == EINTR);
+    return ret > 0;
+}
+
+/* Check for explicit sync */
+bool comp_server_has_explicit_sync(struct comp_server* server) {
+    return server && server->syncobj_manager;
+}
+
 /* Trigger frame render and notify clients - call regularly from Qt timer */
 void comp_server_render_and_notify(struct comp_server* server) {
     if (!server) return;
     
-    struct comp_output* output = comp_output_manager_get_primary(&server->output_manager);
-    if (output) {
+    struct comp_output* output;
+    wl_list_for_each(output, &server->output_manager.outputs, link) {
         comp_output_render_frame(output);
     }
 }
@@ -538,10 +1079,7 @@ bool comp_server_render_frame(struct comp_server* server, void* buffer,
         return false;
     }
     
-    /* First, render the scene and send frame done to clients */
-    comp_output_render_frame(output);
-    
-    /* Build scene output state */
+    /* Compose once - the commit below clears the damage it covered */
     struct wlr_scene_output_state_options options = {0};
     struct wlr_output_state state;
     wlr_output_state_init(&state);
@@ -574,17 +1112,20 @@ bool comp_server_render_frame(struct comp_server* server, void* buffer,
     uint32_t copy_width = (src_width < width) ? src_width : width;
     uint32_t copy_height = (src_height < height) ? src_height : height;
     
-    uint8_t* dst = (uint8_t*)buffer;
-    uint8_t* src_ptr = (uint8_t*)data;
-    
-    for (uint32_t y = 0; y < copy_height; y++) {
-        memcpy(dst + y * stride, src_ptr + y * buf_stride, copy_width * 4);
-    }
+    bool ok = pixel_convert(buffer, stride, data, buf_stride, format, copy_width, copy_height);
     
     wlr_buffer_end_data_ptr_access(wlr_buf);
+    if (!wlr_output_commit_state(output->wlr_output, &state)) {
+        wlr_log(WLR_ERROR, "Failed to commit the composed output");
+    }
     wlr_output_state_finish(&state);
     
-    return true;
+    /* Clients render their next frame */
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    wlr_scene_output_send_frame_done(output->scene_output, &now);
+    
+    return ok;
 }
 
 /* --- Internal accessors used by other C modules --- */
@@ -609,18 +1150,210 @@ struct comp_seat* comp_server_get_seat(struct comp_server* server) {
     return server ? &server->seat : NULL;
 }
 
+struct buffer_pool* comp_server_get_buffer_pool(struct comp_server* server) {
+    return server ? render_backend_get_buffer_pool(server->render_backend) : NULL;
+}
+
+struct comp_output_manager* comp_server_get_output_manager(struct comp_server* server) {
+    return server ? &server->output_manager : NULL;
+}
+
 struct wl_list* comp_server_get_views(struct comp_server* server) {
     return server ? &server->views : NULL;
 }
 
 void comp_server_notify_view_added(struct comp_server* server, struct comp_view* view) {
-    if (server && server->view_callback) {
+    if (!server) return;
+    screen_capture_add_view(server->capture, view);
+    if (server->view_callback) {
         server->view_callback(server->view_callback_data, view, true);
     }
 }
 
 void comp_server_notify_view_removed(struct comp_server* server, struct comp_view* view) {
-    if (server && server->view_callback) {
+    if (!server) return;
+    screen_capture_remove_view(server->capture, view);
+    if (server->view_callback) {
         server->view_callback(server->view_callback_data, view, false);
     }
 }
+
+/* Title or app id changed */
+void comp_server_notify_view_title(struct comp_server* server, struct comp_view* view) {
+    if (!server || !view->mapped) return;
+    screen_capture_update_view(server->capture, view);
+}
+
+/* The wl_shm buffer behind a cursor surface - the committed one is only
+ * held during its commit, the client's wl_buffer lives on after */
+static struct wlr_buffer* cursor_get_buffer(struct wlr_surface* surface) {
+    if (surface->current.buffer) {
+        return surface->current.buffer;
+    }
+    return surface->buffer ? surface->buffer->source : NULL;
+}
+
+/* The cursor over view was set, redrawn or hidden, or went away - see
+ * comp_seat.cursor_client */
+void comp_server_notify_cursor(struct comp_server* server, struct comp_view* view) {
+    if (!server || !view || !server->cursor_callback) return;
+    
+    struct comp_seat* seat = &server->seat;
+    if (!seat->cursor_client || !view->mapped || !view->xdg_toplevel) {
+        server->cursor_callback(server->cursor_callback_data, view, NULL);
+        return;
+    }
+    
+    struct comp_cursor cursor = {0};
+    struct wlr_surface* surface = seat->cursor_surface;
+    struct wlr_buffer* buffer = surface ? cursor_get_buffer(surface) : NULL;
+    if (!buffer || surface->current.width <= 0 || surface->current.height <= 0) {
+        /* Hidden, or a surface without content yet */
+        server->cursor_callback(server->cursor_callback_data, view, &cursor);
+        return;
+    }
+    
+    /* Surface coordinates to frame pixels, as in comp_view_send_pointer_motion */
+    double sx = 1.0, sy = 1.0;
+    struct wlr_surface_state* current = &view->xdg_toplevel->base->surface->current;
+    struct wlr_buffer* frame = view_get_buffer(view);
+    if (frame && current->width > 0 && current->height > 0) {
+        sx = (double)frame->width / current->width;
+        sy = (double)frame->height / current->height;
+    }
+    
+    void* data;
+    uint32_t format;
+    size_t stride;
+    if (!wlr_buffer_begin_data_ptr_access(buffer, WLR_BUFFER_DATA_PTR_ACCESS_READ,
+                                          &data, &format, &stride)) {
+        /* A GPU buffer - leave the cursor to the embedder */
+        wlr_log(WLR_DEBUG, "Cursor buffer is not CPU-readable");
+        server->cursor_callback(server->cursor_callback_data, view, NULL);
+        return;
+    }
+    
+    /* Cursors are small - a copy per image change */
+    cursor.width = (uint32_t)buffer->width;
+    cursor.height = (uint32_t)buffer->height;
+    cursor.stride = cursor.width * 4;
+    void* pixels = malloc((size_t)cursor.stride * cursor.height);
+    bool ok = pixels && pixel_convert(pixels, cursor.stride, data, stride, format,
+                                      cursor.width, cursor.height);
+    wlr_buffer_end_data_ptr_access(buffer);
+    
+    if (!ok) {
+        free(pixels);
+        server->cursor_callback(server->cursor_callback_data, view, NULL);
+        return;
+    }
+    
+    cursor.pixels = pixels;
+    cursor.hotspot_x = seat->cursor_hotspot_x * sx;
+    cursor.hotspot_y = seat->cursor_hotspot_y * sy;
+    cursor.frame_width = surface->current.width * sx;
+    cursor.frame_height = surface->current.height * sy;
+    server->cursor_callback(server->cursor_callback_data, view, &cursor);
+    free(pixels);
+}
+
+/* Hand the view's current buffer to its stream, all of it for NULL damage */
+static void view_stream_push(struct comp_view* view, const struct comp_rect* damage, int n_damage) {
+    struct comp_dmabuf dmabuf;
+    if (!comp_view_export_dmabuf(view, &dmabuf)) {
+        return;
+    }
+    
+    struct comp_rect full = { 0, 0, (int32_t)dmabuf.width, (int32_t)dmabuf.height };
+    if (!damage) {
+        damage = &full;
+        n_damage = 1;
+    }
+    
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    view_stream_submit(view->stream, &dmabuf, damage, n_damage,
+                       (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec);
+    comp_dmabuf_close(&dmabuf);
+}
+
+/* Start or stop streaming a view */
+bool comp_view_set_stream(struct comp_view* view, const struct view_stream_config* config,
+                          const struct view_stream_sink* sink) {
+    if (!view) {
+        if (sink && sink->destroy) sink->destroy(sink->data);
+        return false;
+    }
+    
+    view_stream_destroy(view->stream);
+    view->stream = NULL;
+    if (!config) {
+        if (sink && sink->destroy) sink->destroy(sink->data);
+        return true;
+    }
+    
+    struct view_stream_config stream_config = *config;
+    const struct gpu_node* gpu = comp_server_get_gpu(view->server);
+    if (!stream_config.render_node && gpu) {
+        stream_config.render_node = gpu->path;
+    }
+    
+    view->stream = view_stream_create(&stream_config, sink);
+    if (!view->stream) {
+        return false;
+    }
+    
+    /* Start from the whole current frame, later frames bring their damage */
+    view_stream_push(view, NULL, 0);
+    return true;
+}
+
+/* Report new pixels of a view - damage in frame pixels */
+void comp_server_notify_view_damage(struct comp_server* server, struct comp_view* view,
+                                    pixman_region32_t* damage) {
+    if (!server || !view || !damage) {
+        return;
+    }
+    if (!server->view_commit_callback && !view->stream) {
+        return;
+    }
+    
+    int n_boxes = 0;
+    const pixman_box32_t* boxes = pixman_region32_rectangles(damage, &n_boxes);
+    if (n_boxes <= 0) {
+        /* No new pixels - nothing for Qt to re-upload */
+        return;
+    }
+    
+    struct comp_rect rects[COMP_MAX_DAMAGE_RECTS];
+    int n_rects = 0;
+    
+    if (n_boxes > COMP_MAX_DAMAGE_RECTS) {
+        const pixman_box32_t* ext = pixman_region32_extents(damage);
+        rects[0] = (struct comp_rect){ ext->x1, ext->y1, ext->x2 - ext->x1, ext->y2 - ext->y1 };
+        n_rects = 1;
+    } else {
+        for (int i = 0; i < n_boxes; i++) {
+            rects[n_rects++] = (struct comp_rect){
+                boxes[i].x1, boxes[i].y1,
+                boxes[i].x2 - boxes[i].x1, boxes[i].y2 - boxes[i].y1 };
+        }
+    }
+    
+    if (view->stream) {
+        view_stream_push(view, rects, n_rects);
+    }
+    if (server->view_commit_callback) {
+        server->view_commit_callback(server->view_commit_callback_data, view, rects, n_rects);
+    }
+}
+
+/* Report a view commit with the buffer damage of that commit */
+void comp_server_notify_view_commit(struct comp_server* server, struct comp_view* view) {
+    if (!server || !view || !view->xdg_toplevel) return;
+    
+    struct wlr_surface* surface = view->xdg_toplevel->base->surface;
+    if (!surface) return;
+    
+    comp_server_notify_view_damage(server, view, &surface->buffer_damage);
+}
@@ -0,0 +1,479 @@
+/*
+ * compositor_thread.cpp - Threaded compositor event loop
+ *
+ * SPDX-License-Identifier: MIT
+ * Copyright (c) 2024
+ */
+#include "compositor_thread.h"
+#include "compositor_wrapper.h"
+
+#include <QTimer>
+#include <QDebug>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+CompositorThread::CompositorThread(struct comp_server* server, CompositorWrapper* wrapper)
+    : m_server(server)
+    , m_wrapper(wrapper)
+{
+    setObjectName(QStringLiteral("compositor"));
+
+    m_wakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (m_wakeFd < 0) {
+        qWarning() << "CompositorThread: eventfd failed:" << strerror(errno);
+    }
+
+    /* All core callbacks now fire on the compositor thread */
+    comp_server_set_frame_callback(m_server, nullptr, nullptr);
+    comp_server_set_commit_callback(m_server, &CompositorThread::commitCallback, this);
+    comp_server_set_view_callback(m_server, &CompositorThread::viewCallback, this);
+    comp_server_set_view_commit_callback(m_server, &CompositorThread::viewCommitCallback, this);
+    comp_server_set_cursor_callback(m_server, &CompositorThread::cursorCallback, this);
+}
+
+CompositorThread::~CompositorThread() {
+    stop();
+
+    /* Frames the GUI never picked up */
+    CompositorFrame frame;
+    while (m_frames.pop(frame)) {
+        releaseFrame(frame);
+    }
+
+    /* Requests that never ran may still own a client fd */
+    CompositorCommand cmd;
+    while (m_commands.pop(cmd)) {
+        discardCommand(cmd);
+    }
+    for (const CompositorCommand& pending : m_overflow) {
+        discardCommand(pending);
+    }
+    m_overflow.clear();
+
+    if (m_wakeFd >= 0) {
+        close(m_wakeFd);
+        m_wakeFd = -1;
+    }
+}
+
+void CompositorThread::stop() {
+    if (!isRunning()) return;
+
+    m_quit.store(true, std::memory_order_release);
+    wake();
+    wait();
+
+    comp_server_set_commit_callback(m_server, nullptr, nullptr);
+    comp_server_set_view_callback(m_server, nullptr, nullptr);
+    comp_server_set_view_commit_callback(m_server, nullptr, nullptr);
+    comp_server_set_cursor_callback(m_server, nullptr, nullptr);
+}
+
+void CompositorThread::wake() {
+    if (m_wakeFd < 0) return;
+
+    uint64_t one = 1;
+    ssize_t ret = write(m_wakeFd, &one, sizeof(one));
+    (void)ret;  /* EAGAIN means a wakeup is already pending */
+}
+
+void CompositorThread::post(const CompositorCommand& command) {
+    flushOverflow();
+
+    /* Keep ordering and never drop input - a lost release is a stuck key */
+    if (!m_overflow.empty() || !m_commands.push(command)) {
+        m_overflow.push_back(command);
+        scheduleOverflowRetry();
+    }
+
+    wake();
+}
+
+void CompositorThread::scheduleOverflowRetry() {
+    if (m_overflowRetryScheduled) return;
+
+    m_overflowRetryScheduled = true;
+    QTimer::singleShot(1, this, [this]() {
+        m_overflowRetryScheduled = false;
+        flushOverflow();
+        if (!m_overflow.empty()) {
+            scheduleOverflowRetry();
+        }
+        wake();
+    });
+}
+
+void CompositorThread::flushOverflow() {
+    while (!m_overflow.empty() && m_commands.push(m_overflow.front())) {
+        m_overflow.pop_front();
+    }
+}
+
+void CompositorThread::setImportFormats(const QList<struct comp_dmabuf_format>& formats) {
+    {
+        QMutexLocker lock(&m_importMutex);
+        m_importFormats = formats;
+    }
+
+    CompositorCommand cmd = {};
+    cmd.type = CompositorCommand::ImportFormats;
+    post(cmd);
+}
+
+void CompositorThread::setViewStream(struct comp_view* view, int viewId,
+                                     const struct view_stream_config* config,
+                                     const QByteArray& url) {
+    PendingStream pending;
+    pending.start = config != nullptr;
+    if (config) {
+        pending.config = *config;
+    }
+    pending.url = url;
+
+    {
+        /* Supersedes one the compositor did not get to yet */
+        QMutexLocker lock(&m_streamMutex);
+        m_pendingStreams.insert(viewId, pending);
+    }
+
+    CompositorCommand cmd = {};
+    cmd.type = CompositorCommand::SetStream;
+    cmd.view = view;
+    cmd.viewId = viewId;
+    post(cmd);
+}
+
+bool CompositorThread::takeFrame(CompositorFrame& frame) {
+    return m_frames.pop(frame);
+}
+
+void CompositorThread::clearFrameWake() {
+    m_frameWakePending.store(false, std::memory_order_release);
+}
+
+void CompositorThread::discardCommand(const CompositorCommand& command) {
+    if (command.type == CompositorCommand::AddClient) {
+        close(int(command.args[0]));
+    }
+}
+
+void CompositorThread::releaseFrame(CompositorFrame& frame) {
+    if (frame.isDmabuf) {
+        comp_dmabuf_close(&frame.dmabuf);
+    } else {
+        comp_frame_release(frame.frame.handle);
+    }
+}
+
+void CompositorThread::run() {
+    struct pollfd fds[2];
+    fds[0].fd = comp_server_get_event_fd(m_server);
+    fds[0].events = POLLIN;
+    fds[1].fd = m_wakeFd;
+    fds[1].events = POLLIN;
+
+    qDebug() << "Compositor thread running";
+
+    while (!m_quit.load(std::memory_order_acquire)) {
+        processCommands();
+
+        /* Protocol requests (and our callbacks) until none are pending */
+        comp_server_dispatch_events(m_server);
+
+        /* One write per client for everything this round produced -
+         * input, configures, frame events */
+        comp_server_flush_clients(m_server);
+
+        /* Nothing to do until a client or the GUI has something */
+        fds[0].revents = 0;
+        fds[1].revents = 0;
+        int ret = poll(fds, m_wakeFd >= 0 ? 2 : 1, -1);
+        if (ret < 0 && errno != EINTR) {
+            qWarning() << "CompositorThread: poll failed:" << strerror(errno);
+            break;
+        }
+
+        if (m_wakeFd >= 0 && (fds[1].revents & POLLIN)) {
+            uint64_t count;
+            ssize_t n = read(m_wakeFd, &count, sizeof(count));
+            (void)n;
+        }
+    }
+
+    qDebug() << "Compositor thread stopped";
+}
+
+void CompositorThread::processCommands() {
+    CompositorCommand cmd;
+
+    while (m_commands.pop(cmd)) {
+        switch (cmd.type) {
+        case CompositorCommand::Key:
+            comp_server_send_key(m_server, cmd.args[0], cmd.args[1] != 0);
+            break;
+        case CompositorCommand::Modifiers:
+            comp_server_send_modifiers(m_server, cmd.args[0], cmd.args[1],
+                                       cmd.args[2], cmd.args[3]);
+            break;
+        case CompositorCommand::PointerMotion:
+            /* With a view the position is in its frame's pixels */
+            if (!cmd.view) {
+                comp_server_send_pointer_motion(m_server, cmd.x, cmd.y);
+            } else if (hasView(cmd)) {
+                comp_view_send_pointer_motion(cmd.view, cmd.x, cmd.y);
+            }
+            break;
+        case CompositorCommand::PointerButton:
+            comp_server_send_pointer_button(m_server, cmd.args[0], cmd.args[1] != 0);
+            break;
+        case CompositorCommand::PointerAxis:
+            comp_server_send_pointer_axis(m_server, cmd.args[0] != 0, cmd.x,
+                                          (int32_t)cmd.args[1], cmd.args[2] != 0,
+                                          cmd.args[3] != 0);
+            break;
+        case CompositorCommand::PointerFrame:
+            comp_server_send_pointer_frame(m_server);
+            break;
+        case CompositorCommand::FocusView:
+            if (hasView(cmd)) {
+                comp_view_focus(cmd.view);
+            }
+            break;
+        case CompositorCommand::ClearFocus:
+            comp_server_clear_focus(m_server, cmd.args[0] != 0);
+            break;
+        case CompositorCommand::CloseView:
+            if (hasView(cmd)) {
+                comp_view_close(cmd.view);
+            }
+            break;
+        case CompositorCommand::ResizeView:
+            if (hasView(cmd)) {
+                /* Output in pixels - no-op without per-view outputs */
+                comp_view_set_output_size(cmd.view, (uint32_t)qRound(cmd.args[0] * cmd.x),
+                                          (uint32_t)qRound(cmd.args[1] * cmd.x), (float)cmd.x);
+                comp_view_request_size(cmd.view, cmd.args[0], cmd.args[1]);
+            }
+            break;
+        case CompositorCommand::InitialViewSize:
+            comp_server_set_initial_view_size(m_server, cmd.args[0], cmd.args[1], (float)cmd.x);
+            break;
+        case CompositorCommand::FrameConsumed:
+            /* A view that went away took its in-flight state along */
+            if (hasView(cmd)) {
+                m_inFlight.remove(cmd.view);
+                if (m_dirty.contains(cmd.view)) {
+                    queueFrame(cmd.view);
+                }
+            }
+            break;
+        case CompositorCommand::FrameDone:
+            if (hasView(cmd)) {
+                if (cmd.args[0]) {
+                    comp_view_send_presented(cmd.view, cmd.time, cmd.args[1], cmd.args[2]);
+                }
+                comp_view_send_frame_done(cmd.view, cmd.time);
+            }
+            break;
+        case CompositorCommand::SetSuspended:
+            if (hasView(cmd)) {
+                comp_view_set_suspended(cmd.view, cmd.args[0] != 0);
+            }
+            break;
+        case CompositorCommand::SetScanoutHint:
+            if (hasView(cmd)) {
+                comp_view_set_scanout_hint(cmd.view, cmd.args[0] != 0);
+            }
+            break;
+        case CompositorCommand::SetThumbnailSize:
+            if (hasView(cmd)) {
+                comp_view_set_thumbnail_size(cmd.view, cmd.args[0], cmd.args[1]);
+                /* The frame at the new size shouldn't wait for a commit */
+                if (!m_trimmed.contains(cmd.view)) {
+                    queueFrame(cmd.view);
+                }
+            }
+            break;
+        case CompositorCommand::TrimFrames:
+            if (hasView(cmd)) {
+                /* Commits keep the ring empty until the GUI asks again */
+                m_trimmed.insert(cmd.view);
+                m_dirty.remove(cmd.view);
+                comp_view_trim_frames(cmd.view);
+            }
+            break;
+        case CompositorCommand::RequestFrame:
+            if (hasView(cmd)) {
+                m_trimmed.remove(cmd.view);
+                queueFrame(cmd.view);
+            }
+            break;
+        case CompositorCommand::AddClient:
+            /* Closes the fd itself on failure */
+            comp_server_add_client(m_server, int(cmd.args[0]));
+            break;
+        case CompositorCommand::ImportFormats: {
+            QMutexLocker lock(&m_importMutex);
+            comp_server_set_import_formats(m_server, m_importFormats.constData(),
+                                           int(m_importFormats.size()));
+            break;
+        }
+        case CompositorCommand::SetStream: {
+            PendingStream pending;
+            {
+                QMutexLocker lock(&m_streamMutex);
+                auto it = m_pendingStreams.find(cmd.viewId);
+                if (it == m_pendingStreams.end()) break;    /* Taken by an earlier command */
+                pending = *it;
+                m_pendingStreams.erase(it);
+            }
+            if (hasView(cmd)) {
+                startStream(cmd.view, pending);
+            }
+            break;
+        }
+        }
+    }
+}
+
+void CompositorThread::queueFrame(struct comp_view* view) {
+    if (m_inFlight.contains(view)) {
+        m_dirty.insert(view);
+        return;
+    }
+
+    CompositorFrame frame;
+    memset(&frame, 0, sizeof(frame));
+    frame.view = view;
+    frame.viewId = m_viewIds.value(view);
+
+    if (comp_server_is_hardware_rendering(m_server) &&
+        comp_view_export_dmabuf(view, &frame.dmabuf)) {
+        frame.isDmabuf = true;
+    } else if (!comp_view_acquire_frame(view, &frame.frame)) {
+        /* All slots still held by the GUI - retried once one is consumed */
+        m_dirty.insert(view);
+        return;
+    } else if (frame.frame.n_damage == 0) {
+        comp_frame_release(frame.frame.handle);
+        m_dirty.remove(view);
+        return;
+    }
+
+    if (!m_frames.push(frame)) {
+        releaseFrame(frame);
+        m_dirty.insert(view);
+        return;
+    }
+
+    m_inFlight.insert(view);
+    m_dirty.remove(view);
+    requestDrain();
+}
+
+void CompositorThread::requestDrain() {
+    /* One queued drain per batch of frames and commits */
+    if (!m_frameWakePending.exchange(true, std::memory_order_acq_rel)) {
+        QMetaObject::invokeMethod(this, [this]() {
+            m_wrapper->drainFrames(this);
+        }, Qt::QueuedConnection);
+    }
+}
+
+void CompositorThread::startStream(struct comp_view* view, const PendingStream& pending) {
+    if (!pending.start) {
+        comp_view_set_stream(view, nullptr, nullptr);
+        return;
+    }
+
+    /* Opening the sink may touch the network - not on the GUI thread */
+    struct view_stream_sink sink;
+    if (view_stream_sink_open(&sink, pending.url.constData()) &&
+        comp_view_set_stream(view, &pending.config, &sink)) {
+        return;
+    }
+
+    int id = m_viewIds.value(view, 0);
+    QMetaObject::invokeMethod(this, [this, view, id]() {
+        m_wrapper->threadStreamFailed(view, id);
+    }, Qt::QueuedConnection);
+}
+
+void CompositorThread::publishViewInfo(struct comp_view* view, bool added) {
+    const char* rawTitle = comp_view_get_title(view);
+    QString title = rawTitle ? QString::fromUtf8(rawTitle) : QString("(untitled)");
+
+    int32_t x, y;
+    uint32_t w, h;
+    comp_view_get_geometry(view, &x, &y, &w, &h);
+    QRect geometry(x, y, w, h);
+
+    auto it = m_info.find(view);
+    if (!added && it != m_info.end() && it->title == title && it->geometry == geometry) {
+        return;
+    }
+    m_info.insert(view, ViewInfo{ title, geometry });
+
+    /* Context object is this: calls still queued after stop() are dropped */
+    int id = m_viewIds.value(view);
+    QMetaObject::invokeMethod(this, [this, view, id, title, geometry, added]() {
+        if (added) {
+            m_wrapper->threadViewAdded(this, view, id, title, geometry);
+        } else {
+            m_wrapper->threadViewInfo(view, id, title, geometry);
+        }
+    }, Qt::QueuedConnection);
+}
+
+void CompositorThread::viewCallback(void* userData, struct comp_view* view, bool added) {
+    auto* self = static_cast<CompositorThread*>(userData);
+
+    if (added) {
+        self->m_viewIds.insert(view, self->m_wrapper->allocateViewId());
+        self->publishViewInfo(view, true);
+        return;
+    }
+
+    self->m_inFlight.remove(view);
+    self->m_dirty.remove(view);
+    self->m_trimmed.remove(view);
+    self->m_info.remove(view);
+    int id = self->m_viewIds.take(view);
+    QMetaObject::invokeMethod(self, [self, view, id]() {
+        self->m_wrapper->threadViewRemoved(view, id);
+    }, Qt::QueuedConnection);
+}
+
+void CompositorThread::commitCallback(void* userData) {
+    /* Any commit needs a presented frame for its frame callback */
+    static_cast<CompositorThread*>(userData)->requestDrain();
+}
+
+void CompositorThread::viewCommitCallback(void* userData, struct comp_view* view,
+                                          const struct comp_rect* damage, int nDamage) {
+    Q_UNUSED(damage);
+    Q_UNUSED(nDamage);
+
+    /* The frame carries the damage accumulated since the last one */
+    auto* self = static_cast<CompositorThread*>(userData);
+    self->publishViewInfo(view, false);
+    if (!self->m_trimmed.contains(view)) {
+        self->queueFrame(view);
+    }
+}
+
+void CompositorThread::cursorCallback(void* userData, struct comp_view* view,
+                                      const struct comp_cursor* cursor) {
+    auto* self = static_cast<CompositorThread*>(userData);
+
+    /* A small image, and only when the cursor changes - copied along */
+    ViewCursor copy = CompositorWrapper::cursorFromCore(cursor);
+    int id = self->m_viewIds.value(view);
+    QMetaObject::invokeMethod(self, [self, view, id, copy]() {
+        self->m_wrapper->threadViewCursor(view, id, copy);
+    }, Qt::QueuedConnection);
+}
@@ -6,16 +6,68 @@
  */
 #include "compositor_wrapper.h"
 #include "compositor_core.h"
+#include "compositor_thread.h"
+#include "frame_scheduler.h"
+#include "texture_budget.h"
+#include "client_socket.h"
+#include "frame_trace.h"
+#include "gpu_probe.h"
+#include "view_stream.h"
 
+#include <QAbstractEventDispatcher>
 #include <QDebug>
+#include <QElapsedTimer>
+#include <QThread>
 #include <QRect>
 
+#include <utility>
+
+/* Read-only wrapper around a frame's memory - a staging slot or, for a
+ * direct frame, the client's buffer. The frame is released when the last
+ * QImage sharing it goes away (possibly on the render thread). */
+static QImage frameImage(const struct comp_frame& frame) {
+    return QImage(static_cast<const uchar*>(frame.data),
+                  static_cast<int>(frame.width), static_cast<int>(frame.height),
+                  static_cast<qsizetype>(frame.stride),
+                  QImage::Format_ARGB32_Premultiplied,
+                  [](void* handle) { comp_frame_release(handle); }, frame.handle);
+}
+
 CompositorWrapper::CompositorWrapper(QObject* parent)
     : QObject(parent)
+    , m_scheduler(new FrameScheduler(this))
+    , m_textureBudget(new TextureBudget(this))
+    , m_model(new ViewModel(this))
 {
+    /* Every commit asks the presenting windows for a frame */
+    connect(this, &CompositorWrapper::frameReady,
+            m_scheduler, &FrameScheduler::scheduleFrame);
+    
+    m_statsTimer = new QTimer(this);
+    m_statsTimer->setInterval(500);
+    connect(m_statsTimer, &QTimer::timeout, this, &CompositorWrapper::onStatsTimer);
+    if (frame_trace_enabled()) {
+        m_statsTimer->start();
+    }
+    
+    /* Fallback for coalesced motion while no Qt frame is drawn */
+    m_pointerTimer = new QTimer(this);
+    m_pointerTimer->setSingleShot(true);
+    m_pointerTimer->setTimerType(Qt::PreciseTimer);
+    m_pointerTimer->setInterval(16);
+    connect(m_pointerTimer, &QTimer::timeout, this, &CompositorWrapper::flushPointerMotion);
 }
 
 CompositorWrapper::~CompositorWrapper() {
+    /* Abandon an unfinished initializeAsync() */
+    if (m_initThread) {
+        m_initThread->wait();
+        delete m_initThread;
+        m_initThread = nullptr;
+        for (struct comp_server* server : std::exchange(m_initServers, {})) {
+            comp_server_destroy(server);
+        }
+    }
     stop();
 }
 
@@ -24,39 +76,231 @@ bool CompositorWrapper::hardwareAvailable() {
 }
 
 bool CompositorWrapper::initialize(bool useHardware) {
+    if (m_server || m_initThread) return false;
+    
     qDebug() << "Initializing compositor...";
     qDebug() << "Hardware acceleration:" << (useHardware ? "requested" : "not requested");
     qDebug() << "Hardware available:" << hardwareAvailable();
     
-    /* Create server */
-    m_server = comp_server_create();
-    if (!m_server) {
-        emit error("Failed to create compositor server");
-        return false;
+    QElapsedTimer timer;
+    timer.start();
+    m_initServers = createServers(m_shardCount, useHardware, m_vulkan, &m_initError);
+    m_initMs = timer.elapsed();
+    return finishInitialize();
+}
+
+void CompositorWrapper::initializeAsync(bool useHardware) {
+    if (m_server || m_initThread) return;
+    
+    qDebug() << "Initializing compositor on a worker thread...";
+    qDebug() << "Hardware acceleration:" << (useHardware ? "requested" : "not requested");
+    
+    /* Only m_init* is touched by the worker, and read once it finished */
+    bool vulkan = m_vulkan;
+    int count = m_shardCount;
+    m_initThread = QThread::create([this, count, useHardware, vulkan]() {
+        QElapsedTimer timer;
+        timer.start();
+        m_initServers = createServers(count, useHardware, vulkan, &m_initError);
+        m_initMs = timer.elapsed();
+    });
+    m_initThread->setObjectName("compositor-init");
+    connect(m_initThread, &QThread::finished, this, [this]() {
+        m_initThread->wait();
+        delete m_initThread;
+        m_initThread = nullptr;
+        emit initialized(finishInitialize());
+    });
+    m_initThread->start();
+}
+
+QList<struct comp_server*> CompositorWrapper::createServers(int count, bool useHardware,
+                                                           bool vulkan, QString* errorMessage) {
+    QList<struct comp_server*> servers;
+    for (int i = 0; i < count; i++) {
+        QString message;
+        struct comp_server* server = createServer(useHardware, vulkan, &message);
+        if (!server) {
+            if (i == 0) {
+                *errorMessage = message;
+            } else {
+                qWarning() << "Running" << i << "of" << count << "shards:" << message;
+            }
+            break;
+        }
+        servers.append(server);
+    }
+    return servers;
+}
+
+struct comp_server* CompositorWrapper::createServer(bool useHardware, bool vulkan,
+                                                    QString* errorMessage) {
+    struct comp_server* server = comp_server_create();
+    if (!server) {
+        *errorMessage = "Failed to create compositor server";
+        return nullptr;
+    }
+    
+    /* Listen before the slow part - clients connecting now are accepted
+     * once the event loop runs after start() */
+    if (comp_server_add_socket(server)) {
+        qInfo() << "Listening on" << comp_server_get_socket(server);
     }
     
     /* Initialize backend with renderer choice */
-    if (!comp_server_init_backend_with_renderer(m_server, useHardware)) {
-        emit error("Failed to initialize backend");
-        comp_server_destroy(m_server);
-        m_server = nullptr;
+    enum comp_renderer renderer = !useHardware ? COMP_RENDERER_PIXMAN :
+                                  vulkan ? COMP_RENDERER_VULKAN : COMP_RENDERER_GLES2;
+    if (!comp_server_init_backend_with_type(server, renderer)) {
+        *errorMessage = "Failed to initialize backend";
+        comp_server_destroy(server);
+        return nullptr;
+    }
+    return server;
+}
+
+void CompositorWrapper::configureServer(struct comp_server* server) {
+    /* Frame callbacks follow Qt presentation, see FrameScheduler */
+    comp_server_set_external_frame_clock(server, true);
+    comp_server_set_per_view_outputs(server, m_perViewOutputs);
+    if (!m_initialViewSize.isEmpty()) {
+        comp_server_set_initial_view_size(server, (uint32_t)m_initialViewSize.width(),
+                                          (uint32_t)m_initialViewSize.height(),
+                                          (float)m_initialViewScale);
+    }
+    if (!m_importFormats.isEmpty()) {
+        comp_server_set_import_formats(server, m_importFormats.constData(),
+                                       int(m_importFormats.size()));
+    }
+}
+
+bool CompositorWrapper::finishInitialize() {
+    QList<struct comp_server*> servers = std::exchange(m_initServers, {});
+    if (servers.isEmpty()) {
+        emit error(m_initError);
         return false;
     }
     
-    /* Set callbacks */
+    m_server = servers.first();
+    for (struct comp_server* server : servers) {
+        Shard shard;
+        shard.server = server;
+        m_shards.append(shard);
+        configureServer(server);
+    }
+    
+    /* Single-threaded mode runs the first shard only - the others exist
+     * with threads, which take over their callbacks */
     comp_server_set_frame_callback(m_server, &CompositorWrapper::frameCallback, this);
     comp_server_set_view_callback(m_server, &CompositorWrapper::viewCallback, this);
     comp_server_set_commit_callback(m_server, &CompositorWrapper::commitCallback, this);
+    comp_server_set_view_commit_callback(m_server, &CompositorWrapper::viewCommitCallback, this);
+    comp_server_set_cursor_callback(m_server, &CompositorWrapper::cursorCallback, this);
+    
+    /* Known before start() - the sockets are already listening and the
+     * balancer's backlog holds clients until then */
+    if (m_shards.size() > 1 && m_shardPolicy == ShardByLoad) {
+        m_balancer = client_socket_create();
+        if (!m_balancer) {
+            qWarning() << "No socket for load-balanced shards, clients have to pick one";
+        }
+    }
+    const char* socket = m_balancer ? client_socket_get_name(m_balancer) :
+                                      comp_server_get_socket(m_server);
+    if (socket) {
+        m_socketName = QString::fromUtf8(socket);
+        emit socketNameChanged();
+    }
     
     qDebug() << "Compositor initialized with" 
-             << (isHardwareRendering() ? "hardware" : "software") << "rendering";
+             << (isVulkanRendering() ? "Vulkan" :
+                 isHardwareRendering() ? "hardware" : "software") << "rendering in"
+             << m_initMs << "ms";
+    if (m_shards.size() > 1) {
+        qDebug() << "Sharded over" << m_shards.size() << "servers:" << shardSockets();
+    }
+    emit hardwareRenderingChanged();
     return true;
 }
 
+bool CompositorWrapper::isInitialized() const {
+    return m_server != nullptr;
+}
+
+qint64 CompositorWrapper::initializeTime() const {
+    return m_initMs;
+}
+
 bool CompositorWrapper::isHardwareRendering() const {
     return m_server ? comp_server_is_hardware_rendering(m_server) : false;
 }
 
+bool CompositorWrapper::isVulkanRendering() const {
+    return m_server && comp_server_get_renderer_type(m_server) == COMP_RENDERER_VULKAN;
+}
+
+void CompositorWrapper::setVulkan(bool enabled) {
+    if (m_server || m_initThread) {
+        qWarning() << "The Vulkan renderer must be chosen before initialize()";
+        return;
+    }
+    m_vulkan = enabled;
+}
+
+void CompositorWrapper::setThreaded(bool threaded) {
+    if (m_running) {
+        qWarning() << "Threaded mode must be chosen before start()";
+        return;
+    }
+    if (m_threaded != threaded) {
+        m_threaded = threaded;
+        emit threadedChanged();
+    }
+}
+
+bool CompositorWrapper::isThreaded() const {
+    return m_threaded;
+}
+
+void CompositorWrapper::setPerViewOutputs(bool enabled) {
+    if (m_server) {
+        qWarning() << "Per-view outputs must be chosen before initialize()";
+        return;
+    }
+    if (m_perViewOutputs != enabled) {
+        m_perViewOutputs = enabled;
+        emit perViewOutputsChanged();
+    }
+}
+
+bool CompositorWrapper::perViewOutputs() const {
+    return m_perViewOutputs;
+}
+
+void CompositorWrapper::setShards(int count, ShardPolicy policy) {
+    if (m_server || m_initThread) {
+        qWarning() << "Shards must be set up before initialize()";
+        return;
+    }
+    m_shardCount = qMax(1, count);
+    m_shardPolicy = policy;
+    if (m_shardCount > 1) {
+        setThreaded(true);
+    }
+}
+
+int CompositorWrapper::shardCount() const {
+    return m_shards.isEmpty() ? m_shardCount : int(m_shards.size());
+}
+
+QStringList CompositorWrapper::shardSockets() const {
+    QStringList sockets;
+    for (const Shard& shard : m_shards) {
+        const char* socket = comp_server_get_socket(shard.server);
+        sockets.append(socket ? QString::fromUtf8(socket) : QString());
+    }
+    return sockets;
+}
+
 bool CompositorWrapper::start() {
     if (!m_server) {
         emit error("Server not initialized");
@@ -69,13 +313,57 @@ bool CompositorWrapper::start() {
         emit error("Failed to start compositor");
         return false;
     }
+    for (int i = m_shards.size() - 1; i > 0; i--) {
+        if (!comp_server_start(m_shards[i].server)) {
+            qWarning() << "Failed to start shard" << i << "- its clients go elsewhere";
+            comp_server_destroy(m_shards[i].server);
+            m_shards.removeAt(i);
+        }
+    }
     
-    m_socketName = QString::fromUtf8(comp_server_get_socket(m_server));
-    emit socketNameChanged();
+    /* Normally known since initialize(), unless the early socket failed */
+    QString socketName = m_balancer ? m_socketName :
+                         QString::fromUtf8(comp_server_get_socket(m_server));
+    if (socketName != m_socketName) {
+        m_socketName = socketName;
+        emit socketNameChanged();
+    }
     
     qDebug() << "Compositor started on socket:" << m_socketName;
     
-    /* Setup Qt event integration */
+    if (m_shards.size() > 1 && !m_threaded) {
+        qWarning() << "Shards need threaded mode, enabling it";
+        setThreaded(true);
+    }
+    
+    if (m_threaded) {
+        /* From here on only the compositor threads touch the servers */
+        for (int i = 0; i < m_shards.size(); i++) {
+            Shard& shard = m_shards[i];
+            shard.thread = new CompositorThread(shard.server, this);
+            if (m_shards.size() > 1) {
+                shard.thread->setObjectName(QString("compositor-%1").arg(i));
+            }
+            shard.thread->start();
+        }
+        m_thread = m_shards.first().thread;
+        m_keyboardThread = m_thread;
+        m_pointerThread = m_thread;
+        
+        if (m_balancer) {
+            m_balancerNotifier = new QSocketNotifier(client_socket_get_fd(m_balancer),
+                                                     QSocketNotifier::Read, this);
+            connect(m_balancerNotifier, &QSocketNotifier::activated,
+                    this, &CompositorWrapper::onClientConnected);
+        }
+        
+        m_running = true;
+        emit runningChanged();
+        return true;
+    }
+    
+    /* Setup Qt event integration - the loop fd covers client requests and
+     * the loop's timers, so an idle compositor never wakes Qt up */
     int fd = comp_server_get_event_fd(m_server);
     if (fd >= 0) {
         m_notifier = new QSocketNotifier(fd, QSocketNotifier::Read, this);
@@ -84,10 +372,11 @@ bool CompositorWrapper::start() {
         m_notifier->setEnabled(true);
     }
     
-    /* Frame timer - just for event dispatching, not rendering */
-    m_frameTimer = new QTimer(this);
-    connect(m_frameTimer, &QTimer::timeout, this, &CompositorWrapper::onFrameTimer);
-    m_frameTimer->start(100);  /* 10Hz - just keep events flowing */
+    /* Whatever this iteration queued for clients - replies, input,
+     * frame events - goes out in one write per client */
+    m_aboutToBlock = connect(QAbstractEventDispatcher::instance(thread()),
+                             &QAbstractEventDispatcher::aboutToBlock,
+                             this, &CompositorWrapper::onAboutToBlock);
     
     m_running = true;
     emit runningChanged();
@@ -101,12 +390,37 @@ void CompositorWrapper::stop() {
     qDebug() << "Stopping compositor...";
     
     m_running = false;
+    m_pointerTimer->stop();
+    m_motionView = nullptr;
     
-    if (m_frameTimer) {
-        m_frameTimer->stop();
-        delete m_frameTimer;
-        m_frameTimer = nullptr;
+    if (m_balancerNotifier) {
+        delete m_balancerNotifier;
+        m_balancerNotifier = nullptr;
+    }
+    if (m_balancer) {
+        client_socket_destroy(m_balancer);
+        m_balancer = nullptr;
+    }
+    
+    for (Shard& shard : m_shards) {
+        if (!shard.thread) continue;
+        shard.thread->stop();
+        /* Releases unconsumed frames and drops calls still queued from the thread */
+        delete shard.thread;
+        shard.thread = nullptr;
+    }
+    m_thread = nullptr;
+    m_keyboardThread = nullptr;
+    m_pointerThread = nullptr;
+    for (ViewState& state : m_viewState) {
+        if (state.dmabuf) {
+            comp_dmabuf_close(state.dmabuf);
+            delete state.dmabuf;
+        }
     }
+    m_viewState.clear();  /* Releases the staging slots */
+    
+    disconnect(m_aboutToBlock);
     
     if (m_notifier) {
         m_notifier->setEnabled(false);
@@ -114,12 +428,17 @@ void CompositorWrapper::stop() {
         m_notifier = nullptr;
     }
     
-    if (m_server) {
-        comp_server_destroy(m_server);
-        m_server = nullptr;
+    for (const Shard& shard : m_shards) {
+        comp_server_destroy(shard.server);
     }
+    m_shards.clear();
+    m_server = nullptr;
     
+    m_model->beginResetViews();
     m_views.clear();
+    m_viewIds.clear();
+    m_viewsById.clear();
+    m_model->endResetViews();
     emit runningChanged();
     emit viewsChanged();
 }
@@ -137,15 +456,27 @@ int CompositorWrapper::viewCount() const {
 }
 
 QString CompositorWrapper::viewTitle(int index) const {
-    if (index < 0 || index >= m_views.size()) return QString();
+    return viewTitle(viewHandle(index));
+}
+
+QString CompositorWrapper::viewTitle(struct comp_view* view) const {
+    if (!view || !m_viewIds.contains(view)) return QString();
     
-    const char* title = comp_view_get_title(m_views[index]);
+    if (m_thread) {
+        return m_viewState.value(view).title;
+    }
+    
+    const char* title = comp_view_get_title(view);
     return title ? QString::fromUtf8(title) : QString("(untitled)");
 }
 
 QRect CompositorWrapper::viewGeometry(int index) const {
     if (index < 0 || index >= m_views.size()) return QRect();
     
+    if (m_thread) {
+        return m_viewState.value(m_views[index]).geometry;
+    }
+    
     int32_t x, y;
     uint32_t w, h;
     comp_view_get_geometry(m_views[index], &x, &y, &w, &h);
@@ -153,97 +484,706 @@ QRect CompositorWrapper::viewGeometry(int index) const {
 }
 
 void CompositorWrapper::focusView(int index) {
-    if (index < 0 || index >= m_views.size()) return;
-    comp_view_focus(m_views[index]);
+    focusView(viewHandle(index));
+}
+
+void CompositorWrapper::focusView(struct comp_view* view) {
+    if (!view || !m_viewIds.contains(view)) return;
+    if (m_thread) {
+        setInputThread(viewThread(view), false);
+        CompositorCommand cmd = {};
+        cmd.type = CompositorCommand::FocusView;
+        cmd.view = view;
+        cmd.viewId = m_viewIds.value(view);
+        viewThread(view)->post(cmd);
+        return;
+    }
+    comp_view_focus(view);
 }
 
 void CompositorWrapper::closeView(int index) {
     if (index < 0 || index >= m_views.size()) return;
+    if (m_thread) {
+        CompositorCommand cmd = {};
+        cmd.type = CompositorCommand::CloseView;
+        cmd.view = m_views[index];
+        cmd.viewId = m_viewIds.value(cmd.view);
+        viewThread(cmd.view)->post(cmd);
+        return;
+    }
     comp_view_close(m_views[index]);
 }
 
-void CompositorWrapper::resizeView(int index, int width, int height) {
-    if (index < 0 || index >= m_views.size()) return;
+void CompositorWrapper::resizeView(int index, int width, int height, qreal scale) {
+    resizeView(viewHandle(index), width, height, scale);
+}
+
+void CompositorWrapper::resizeView(struct comp_view* view, int width, int height, qreal scale) {
+    if (!view || !m_viewIds.contains(view)) return;
     if (width <= 0 || height <= 0) return;
-    comp_view_request_size(m_views[index], (uint32_t)width, (uint32_t)height);
+    if (scale <= 0.0) scale = 1.0;
+    if (m_thread) {
+        CompositorCommand cmd = {};
+        cmd.type = CompositorCommand::ResizeView;
+        cmd.view = view;
+        cmd.viewId = m_viewIds.value(view);
+        cmd.args[0] = (uint32_t)width;
+        cmd.args[1] = (uint32_t)height;
+        cmd.x = scale;
+        viewThread(view)->post(cmd);
+        return;
+    }
+    
+    /* Output in pixels, so the client's logical size matches the item.
+     * No-op without per-view outputs. */
+    comp_view_set_output_size(view, (uint32_t)qRound(width * scale),
+                              (uint32_t)qRound(height * scale), (float)scale);
+    comp_view_request_size(view, (uint32_t)width, (uint32_t)height);
 }
 
-QImage CompositorWrapper::getViewFrame(int index) {
-    if (index < 0 || index >= m_views.size()) return QImage();
+void CompositorWrapper::setInitialViewSize(int width, int height, qreal scale) {
+    if (width <= 0 || height <= 0) return;
+    if (scale <= 0.0) scale = 1.0;
+    if (m_initialViewSize == QSize(width, height) && m_initialViewScale == scale) return;
+    
+    /* Kept for initialize() if the server does not exist yet */
+    m_initialViewSize = QSize(width, height);
+    m_initialViewScale = scale;
+    if (m_thread) {
+        CompositorCommand cmd = {};
+        cmd.type = CompositorCommand::InitialViewSize;
+        cmd.args[0] = (uint32_t)width;
+        cmd.args[1] = (uint32_t)height;
+        cmd.x = scale;
+        postToShards(cmd);
+    } else if (m_server) {
+        comp_server_set_initial_view_size(m_server, (uint32_t)width, (uint32_t)height,
+                                          (float)scale);
+    }
+}
+
+QImage CompositorWrapper::acquireViewFrame(int index, QRegion* damage) {
+    return acquireViewFrame(viewHandle(index), damage);
+}
+
+QImage CompositorWrapper::acquireViewFrame(struct comp_view* view, QRegion* damage,
+                                           int* downscale) {
+    if (damage) *damage = QRegion();
+    if (downscale) *downscale = 1;
+    if (!view || !m_viewIds.contains(view)) return QImage();
+    
+    if (m_thread) {
+        requestTrimmedFrame(view);
+        
+        /* Latest frame delivered by the compositor thread */
+        auto it = m_viewState.find(view);
+        if (it == m_viewState.end() || it->frame.isNull()) return QImage();
+        if (damage) *damage = it->damage;
+        if (downscale) *downscale = it->downscale;
+        it->damage = QRegion();
+        if (it->directFrame) {
+            /* Only the upload may pin the client's buffer */
+            it->directFrame = false;
+            return std::exchange(it->frame, QImage());
+        }
+        return it->frame;
+    }
     
-    struct comp_view* view = m_views[index];
-    if (!comp_view_is_mapped(view)) return QImage();
+    struct comp_frame frame;
+    if (!comp_view_acquire_frame(view, &frame)) return QImage();
     
-    uint32_t width, height;
-    comp_view_get_surface_size(view, &width, &height);
+    if (downscale) *downscale = int(frame.downscale);
+    if (damage) {
+        for (int i = 0; i < frame.n_damage; i++) {
+            *damage += QRect(frame.damage[i].x, frame.damage[i].y,
+                             frame.damage[i].width, frame.damage[i].height);
+        }
+    }
     
-    if (width == 0 || height == 0) {
-        /* Try geometry instead */
-        int32_t x, y;
-        comp_view_get_geometry(view, &x, &y, &width, &height);
+    return frameImage(frame);
+}
+
+struct comp_view* CompositorWrapper::viewHandle(int index) const {
+    if (index < 0 || index >= m_views.size()) return nullptr;
+    return m_views[index];
+}
+
+int CompositorWrapper::viewId(int index) const {
+    return m_viewIds.value(viewHandle(index), 0);
+}
+
+struct comp_view* CompositorWrapper::viewById(int id) const {
+    return m_viewsById.value(id, nullptr);
+}
+
+int CompositorWrapper::viewIndexOf(struct comp_view* view) const {
+    return view ? m_views.indexOf(view) : -1;
+}
+
+ViewModel* CompositorWrapper::viewModel() const {
+    return m_model;
+}
+
+FrameScheduler* CompositorWrapper::frameScheduler() const {
+    return m_scheduler;
+}
+
+TextureBudget* CompositorWrapper::textureBudget() const {
+    return m_textureBudget;
+}
+
+void CompositorWrapper::completeFrame(const QList<struct comp_view*>& views,
+                                      const QSet<struct comp_view*>& presented, quint64 timeNs,
+                                      quint32 refreshNs, quint64 seq) {
+    if (!m_running) return;
+    
+    /* Clients draw the frame after this one with the latest pointer position */
+    sendPendingMotion(true);
+    
+    for (struct comp_view* view : views) {
+        if (!m_viewIds.contains(view)) continue;
+        
+        bool shown = presented.contains(view);
+        if (m_thread) {
+            CompositorCommand cmd = {};
+            cmd.type = CompositorCommand::FrameDone;
+            cmd.view = view;
+            cmd.viewId = m_viewIds.value(view);
+            cmd.args[0] = shown;
+            cmd.args[1] = refreshNs;
+            cmd.args[2] = (quint32)seq;
+            cmd.time = timeNs;
+            viewThread(view)->post(cmd);
+            continue;
+        }
+        if (shown) {
+            comp_view_send_presented(view, timeNs, refreshNs, seq);
+        }
+        comp_view_send_frame_done(view, timeNs);
+    }
+}
+
+void CompositorWrapper::setViewVisible(int index, bool visible) {
+    setViewVisible(viewHandle(index), visible);
+}
+
+void CompositorWrapper::setViewVisible(struct comp_view* view, bool visible) {
+    if (!view || !m_viewIds.contains(view)) return;
+    
+    /* Only the first host showing it and the last one hiding it count */
+    bool wasVisible = m_scheduler->isViewVisible(view);
+    m_scheduler->setViewVisible(view, visible);
+    if (m_scheduler->isViewVisible(view) == wasVisible) return;
+    
+    if (m_thread) {
+        CompositorCommand cmd = {};
+        cmd.type = CompositorCommand::SetSuspended;
+        cmd.view = view;
+        cmd.viewId = m_viewIds.value(view);
+        cmd.args[0] = !visible;
+        viewThread(view)->post(cmd);
+    } else {
+        comp_view_set_suspended(view, !visible);
+    }
+}
+
+void CompositorWrapper::setViewScanoutHint(struct comp_view* view, bool scanout) {
+    if (!view || !m_viewIds.contains(view)) return;
+    
+    if (m_thread) {
+        CompositorCommand cmd = {};
+        cmd.type = CompositorCommand::SetScanoutHint;
+        cmd.view = view;
+        cmd.viewId = m_viewIds.value(view);
+        cmd.args[0] = scanout;
+        viewThread(view)->post(cmd);
+    } else {
+        comp_view_set_scanout_hint(view, scanout);
+    }
+}
+
+void CompositorWrapper::trimViewFrames(struct comp_view* view) {
+    if (!view || !m_viewIds.contains(view)) return;
+    
+    if (m_thread) {
+        auto it = m_viewState.find(view);
+        if (it == m_viewState.end() || it->trimmed) return;
+        
+        /* Our references pin a slot and the client's buffer */
+        it->frame = QImage();
+        it->directFrame = false;
+        it->damage = QRegion();
+        if (it->dmabuf) {
+            comp_dmabuf_close(it->dmabuf);
+            delete it->dmabuf;
+            it->dmabuf = nullptr;
+        }
+        it->trimmed = true;
+        
+        CompositorCommand cmd = {};
+        cmd.type = CompositorCommand::TrimFrames;
+        cmd.view = view;
+        cmd.viewId = m_viewIds.value(view);
+        viewThread(view)->post(cmd);
+    } else {
+        comp_view_trim_frames(view);
+    }
+}
+
+void CompositorWrapper::setViewThumbnailSize(struct comp_view* view, const QSize& size) {
+    if (!view || !m_viewIds.contains(view)) return;
+    
+    uint32_t width = size.isEmpty() ? 0 : uint32_t(size.width());
+    uint32_t height = size.isEmpty() ? 0 : uint32_t(size.height());
+    if (m_thread) {
+        CompositorCommand cmd = {};
+        cmd.type = CompositorCommand::SetThumbnailSize;
+        cmd.view = view;
+        cmd.viewId = m_viewIds.value(view);
+        cmd.args[0] = width;
+        cmd.args[1] = height;
+        viewThread(view)->post(cmd);
+    } else {
+        comp_view_set_thumbnail_size(view, width, height);
+    }
+}
+
+void CompositorWrapper::requestTrimmedFrame(struct comp_view* view) {
+    auto it = m_viewState.find(view);
+    if (it == m_viewState.end() || !it->trimmed) return;
+    
+    /* Arrives like a commit, with full damage */
+    it->trimmed = false;
+    CompositorCommand cmd = {};
+    cmd.type = CompositorCommand::RequestFrame;
+    cmd.view = view;
+    cmd.viewId = m_viewIds.value(view);
+    viewThread(view)->post(cmd);
+}
+
+CompositorThread* CompositorWrapper::viewThread(struct comp_view* view) const {
+    auto it = m_viewState.constFind(view);
+    return it != m_viewState.cend() && it->thread ? it->thread : m_thread;
+}
+
+void CompositorWrapper::postToShards(const CompositorCommand& command) {
+    for (const Shard& shard : m_shards) {
+        shard.thread->post(command);
+    }
+}
+
+void CompositorWrapper::setInputThread(CompositorThread* thread, bool pointer) {
+    CompositorThread*& current = pointer ? m_pointerThread : m_keyboardThread;
+    if (current == thread) return;
+    
+    /* Each shard has its own seat - only one of them may show focus */
+    CompositorCommand clear = {};
+    clear.type = CompositorCommand::ClearFocus;
+    clear.args[0] = pointer;
+    current->post(clear);
+    current = thread;
+    
+    /* Keys held down carry over, so shortcuts still work after the switch */
+    if (!pointer) {
+        CompositorCommand cmd = {};
+        cmd.type = CompositorCommand::Modifiers;
+        for (int i = 0; i < 4; i++) {
+            cmd.args[i] = m_modifiers[i];
+        }
+        thread->post(cmd);
+    }
+}
+
+void CompositorWrapper::setImportFormats(const QList<struct comp_dmabuf_format>& formats) {
+    /* Kept for initialize() if the server does not exist yet */
+    m_importFormats = formats;
+    if (m_thread) {
+        for (const Shard& shard : m_shards) {
+            shard.thread->setImportFormats(formats);
+        }
+    } else if (m_server) {
+        comp_server_set_import_formats(m_server, formats.constData(), int(formats.size()));
+    }
+}
+
+int CompositorWrapper::hiddenFrameRate() const {
+    return m_scheduler->hiddenFrameRate();
+}
+
+void CompositorWrapper::setHiddenFrameRate(int hz) {
+    if (m_scheduler->hiddenFrameRate() == hz) return;
+    
+    m_scheduler->setHiddenFrameRate(hz);
+    emit hiddenFrameRateChanged();
+}
+
+int CompositorWrapper::textureMemoryLimit() const {
+    return int(m_textureBudget->limit() >> 20);
+}
+
+void CompositorWrapper::setTextureMemoryLimit(int mib) {
+    mib = qMax(0, mib);
+    if (textureMemoryLimit() == mib) return;
+    
+    m_textureBudget->setLimit(qint64(mib) << 20);
+    emit textureMemoryLimitChanged();
+}
+
+bool CompositorWrapper::getViewDmabuf(int index, struct comp_dmabuf* dmabuf) {
+    return getViewDmabuf(viewHandle(index), dmabuf);
+}
+
+bool CompositorWrapper::streamView(int index, const QString& url, const QString& codec,
+                                   int bitrateKbps) {
+    struct comp_view* view = viewHandle(index);
+    if (!view) return false;
+    
+    struct view_stream_config config = {};
+    if (codec.compare(QLatin1String("hevc"), Qt::CaseInsensitive) == 0 ||
+        codec.compare(QLatin1String("h265"), Qt::CaseInsensitive) == 0) {
+        config.codec = VIEW_STREAM_HEVC;
+    } else if (codec.compare(QLatin1String("h264"), Qt::CaseInsensitive) == 0) {
+        config.codec = VIEW_STREAM_H264;
+    } else {
+        qWarning() << "CompositorWrapper: unknown stream codec" << codec;
+        return false;
+    }
+    config.bitrate_kbps = quint32(qMax(0, bitrateKbps));
+    
+    if (m_thread) {
+        /* Started asynchronously, see streamFailed */
+        viewThread(view)->setViewStream(view, m_viewIds.value(view), &config, url.toUtf8());
+        return true;
     }
     
-    if (width == 0 || height == 0) return QImage();
+    struct view_stream_sink sink;
+    if (!view_stream_sink_open(&sink, url.toUtf8().constData()) ||
+        !comp_view_set_stream(view, &config, &sink)) {
+        emit streamFailed(index);
+        return false;
+    }
+    return true;
+}
+
+void CompositorWrapper::stopViewStream(int index) {
+    struct comp_view* view = viewHandle(index);
+    if (!view) return;
     
-    /* Create buffer for rendering */
-    QImage frame(width, height, QImage::Format_ARGB32);
-    frame.fill(Qt::transparent);
+    if (m_thread) {
+        viewThread(view)->setViewStream(view, m_viewIds.value(view), nullptr, {});
+        return;
+    }
+    comp_view_set_stream(view, nullptr, nullptr);
+}
+
+bool CompositorWrapper::getViewDmabuf(struct comp_view* view, struct comp_dmabuf* dmabuf) {
+    if (!view || !m_viewIds.contains(view) || !dmabuf) return false;
+    if (!isHardwareRendering()) return false;
     
-    /* Try to render view to buffer */
-    if (comp_view_render_to_buffer(view, frame.bits(), width, height, frame.bytesPerLine())) {
-        return frame;
+    if (m_thread) {
+        requestTrimmedFrame(view);
+        
+        /* Hand over the latest hardware frame, fds included */
+        auto it = m_viewState.find(view);
+        if (it == m_viewState.end() || !it->dmabuf) return false;
+        *dmabuf = *it->dmabuf;
+        delete it->dmabuf;
+        it->dmabuf = nullptr;
+        return true;
     }
     
-    /* Fallback: Return empty frame with correct size - client might not have rendered yet */
-    frame.fill(QColor(30, 30, 30));
-    return frame;
+    return comp_view_export_dmabuf(view, dmabuf);
+}
+
+bool CompositorWrapper::isTracing() const {
+    return frame_trace_enabled();
+}
+
+void CompositorWrapper::setTracing(bool enabled) {
+    if (frame_trace_enabled() == enabled) return;
+    
+    frame_trace_set_enabled(enabled);
+    if (enabled) {
+        m_statsTimer->start();
+    } else {
+        m_statsTimer->stop();
+    }
+    emit tracingChanged();
+}
+
+double CompositorWrapper::frameLatencyP50() const {
+    return m_latencyP50;
+}
+
+double CompositorWrapper::frameLatencyP99() const {
+    return m_latencyP99;
+}
+
+double CompositorWrapper::frameRate() const {
+    return m_frameRate;
+}
+
+qint64 CompositorWrapper::droppedFrames() const {
+    return m_droppedFrames;
+}
+
+qint64 CompositorWrapper::bytesCopied() const {
+    return m_bytesCopied;
+}
+
+QVariantMap CompositorWrapper::viewFrameStats(int index) const {
+    QVariantMap map;
+    struct frame_trace_stats stats;
+    if (!viewHandle(index) || !frame_trace_get_stats(viewHandle(index), &stats)) {
+        return map;
+    }
+    
+    map.insert("latencyP50", stats.latency_p50_ns / 1e6);
+    map.insert("latencyP99", stats.latency_p99_ns / 1e6);
+    map.insert("frameRate", stats.fps);
+    map.insert("frames", qint64(stats.frames));
+    map.insert("droppedFrames", qint64(stats.dropped));
+    map.insert("bytesCopied", qint64(stats.bytes_copied));
+    return map;
+}
+
+void CompositorWrapper::setRenderNode(const QString& node) {
+    comp_server_set_render_node(node.isEmpty() ? nullptr : node.toLocal8Bit().constData());
+}
+
+QVariantMap CompositorWrapper::gpuInfo() const {
+    QVariantMap map;
+    const struct gpu_node* gpu = m_server ? comp_server_get_gpu(m_server) : comp_server_probe_gpu();
+    if (!gpu) return map;
+    
+    QVariantList formats;
+    for (uint32_t i = 0; i < gpu->n_formats; i++) {
+        const struct gpu_format& f = gpu->formats[i];
+        QVariantList modifiers;
+        for (uint32_t j = 0; j < f.n_modifiers; j++) {
+            /* Strings - JS numbers cannot hold 64-bit modifiers */
+            modifiers.append(QString("0x%1").arg(f.modifiers[j], 16, 16, QChar('0')));
+        }
+        char fourcc[5] = {
+            char(f.format & 0xff), char((f.format >> 8) & 0xff),
+            char((f.format >> 16) & 0xff), char((f.format >> 24) & 0xff), 0
+        };
+        QVariantMap format;
+        format.insert("fourcc", QString::fromLatin1(fourcc));
+        format.insert("format", f.format);
+        format.insert("modifiers", modifiers);
+        formats.append(format);
+    }
+    
+    map.insert("renderNode", QString::fromUtf8(gpu->path));
+    map.insert("driver", QString::fromUtf8(gpu->driver));
+    map.insert("vendorId", gpu->vendor_id);
+    map.insert("deviceId", gpu->device_id);
+    map.insert("bootVga", gpu->boot_vga);
+    map.insert("inUse", m_server != nullptr);
+    map.insert("formats", formats);
+    return map;
+}
+
+bool CompositorWrapper::writeFrameTrace(const QString& path) {
+    if (!frame_trace_write_json(path.toLocal8Bit().constData())) {
+        emit error(QString("Failed to write frame trace to %1").arg(path));
+        return false;
+    }
+    return true;
 }
 
 void CompositorWrapper::sendKey(quint32 key, bool pressed) {
-    if (m_server) {
+    if (m_thread) {
+        CompositorCommand cmd = {};
+        cmd.type = CompositorCommand::Key;
+        cmd.args[0] = key;
+        cmd.args[1] = pressed;
+        m_keyboardThread->post(cmd);
+    } else if (m_server) {
         comp_server_send_key(m_server, key, pressed);
     }
 }
 
 void CompositorWrapper::sendModifiers(quint32 depressed, quint32 latched,
                                        quint32 locked, quint32 group) {
-    if (m_server) {
+    m_modifiers[0] = depressed;
+    m_modifiers[1] = latched;
+    m_modifiers[2] = locked;
+    m_modifiers[3] = group;
+    if (m_thread) {
+        CompositorCommand cmd = {};
+        cmd.type = CompositorCommand::Modifiers;
+        cmd.args[0] = depressed;
+        cmd.args[1] = latched;
+        cmd.args[2] = locked;
+        cmd.args[3] = group;
+        m_keyboardThread->post(cmd);
+    } else if (m_server) {
         comp_server_send_modifiers(m_server, depressed, latched, locked, group);
     }
 }
 
 void CompositorWrapper::sendPointerMotion(double x, double y) {
-    if (m_server) {
+    sendPendingMotion(false);
+    if (m_thread) {
+        CompositorCommand cmd = {};
+        cmd.type = CompositorCommand::PointerMotion;
+        cmd.x = x;
+        cmd.y = y;
+        m_pointerThread->post(cmd);
+    } else if (m_server) {
         comp_server_send_pointer_motion(m_server, x, y);
     }
+    sendPointerFrame();
+}
+
+void CompositorWrapper::sendViewPointerMotion(int index, double x, double y, bool coalesce) {
+    sendViewPointerMotion(viewHandle(index), x, y, coalesce);
+}
+
+void CompositorWrapper::sendViewPointerMotion(struct comp_view* view, double x, double y,
+                                              bool coalesce) {
+    if (!view || !m_viewIds.contains(view)) return;
+    
+    /* Motion over another view is a separate event */
+    if (m_motionView && m_motionView != view) {
+        sendPendingMotion(true);
+    }
+    m_motionView = view;
+    m_motionPos = QPointF(x, y);
+    
+    if (!coalesce) {
+        sendPendingMotion(true);
+    } else if (!m_pointerTimer->isActive()) {
+        m_pointerTimer->start();
+    }
+}
+
+void CompositorWrapper::sendPendingMotion(bool endFrame) {
+    m_pointerTimer->stop();
+    struct comp_view* view = m_motionView;
+    m_motionView = nullptr;
+    if (!view || !m_viewIds.contains(view)) return;
+    
+    if (m_thread) {
+        /* Buttons and scrolling follow to the shard the pointer is over */
+        setInputThread(viewThread(view), true);
+        CompositorCommand cmd = {};
+        cmd.type = CompositorCommand::PointerMotion;
+        cmd.view = view;
+        cmd.viewId = m_viewIds.value(view);
+        cmd.x = m_motionPos.x();
+        cmd.y = m_motionPos.y();
+        viewThread(view)->post(cmd);
+    } else if (m_server) {
+        comp_view_send_pointer_motion(view, m_motionPos.x(), m_motionPos.y());
+    }
+    
+    if (endFrame) {
+        sendPointerFrame();
+    }
+}
+
+void CompositorWrapper::flushPointerMotion() {
+    sendPendingMotion(true);
+}
+
+void CompositorWrapper::sendPointerFrame() {
+    if (m_thread) {
+        CompositorCommand cmd = {};
+        cmd.type = CompositorCommand::PointerFrame;
+        m_pointerThread->post(cmd);
+    } else if (m_server) {
+        comp_server_send_pointer_frame(m_server);
+    }
 }
 
 void CompositorWrapper::sendPointerButton(quint32 button, bool pressed) {
-    if (m_server) {
+    /* The press lands where the pointer is now, in the same event group */
+    sendPendingMotion(false);
+    if (m_thread) {
+        CompositorCommand cmd = {};
+        cmd.type = CompositorCommand::PointerButton;
+        cmd.args[0] = button;
+        cmd.args[1] = pressed;
+        m_pointerThread->post(cmd);
+    } else if (m_server) {
         comp_server_send_pointer_button(m_server, button, pressed);
     }
+    sendPointerFrame();
 }
 
-void CompositorWrapper::sendPointerAxis(bool horizontal, double value) {
-    if (m_server) {
-        comp_server_send_pointer_axis(m_server, horizontal, value);
+void CompositorWrapper::sendPointerAxis(bool horizontal, double value, int value120,
+                                        bool continuous, bool inverted) {
+    sendPendingMotion(false);
+    if (m_thread) {
+        CompositorCommand cmd = {};
+        cmd.type = CompositorCommand::PointerAxis;
+        cmd.args[0] = horizontal;
+        cmd.args[1] = (quint32)value120;
+        cmd.args[2] = continuous;
+        cmd.args[3] = inverted;
+        cmd.x = value;
+        m_pointerThread->post(cmd);
+    } else if (m_server) {
+        comp_server_send_pointer_axis(m_server, horizontal, value, value120, continuous, inverted);
     }
+    sendPointerFrame();
 }
 
 void CompositorWrapper::onWaylandEvents() {
-    if (m_server) {
+    if (m_server && !m_thread) {
         comp_server_dispatch_events(m_server);
     }
 }
 
-void CompositorWrapper::onFrameTimer() {
-    if (m_server) {
-        /* Just dispatch events - rendering is triggered by client commits */
-        comp_server_dispatch_events(m_server);
+void CompositorWrapper::onAboutToBlock() {
+    if (m_server && !m_thread) {
         comp_server_flush_clients(m_server);
     }
 }
 
+void CompositorWrapper::onClientConnected() {
+    /* Fewest views first, then fewest connections handed out, so a burst
+     * of clients that have not mapped yet is still spread evenly */
+    QHash<CompositorThread*, int> views;
+    for (const ViewState& state : m_viewState) {
+        views[state.thread]++;
+    }
+    
+    int fd;
+    while ((fd = client_socket_accept(m_balancer)) >= 0) {
+        Shard* target = nullptr;
+        for (Shard& shard : m_shards) {
+            if (!target || views.value(shard.thread) < views.value(target->thread) ||
+                (views.value(shard.thread) == views.value(target->thread) &&
+                 shard.clients < target->clients)) {
+                target = &shard;
+            }
+        }
+        target->clients++;
+        
+        CompositorCommand cmd = {};
+        cmd.type = CompositorCommand::AddClient;
+        cmd.args[0] = quint32(fd);
+        target->thread->post(cmd);
+    }
+}
+
+void CompositorWrapper::onStatsTimer() {
+    struct frame_trace_stats stats;
+    frame_trace_get_stats(nullptr, &stats);
+    
+    m_latencyP50 = stats.latency_p50_ns / 1e6;
+    m_latencyP99 = stats.latency_p99_ns / 1e6;
+    m_frameRate = stats.fps;
+    m_droppedFrames = qint64(stats.dropped);
+    m_bytesCopied = qint64(stats.bytes_copied);
+    emit frameStatsChanged();
+    m_model->frameRatesChanged();
+}
+
 void CompositorWrapper::frameCallback(void* userData, uint32_t width, 
                                        uint32_t height, void* buffer) {
     Q_UNUSED(width);
@@ -258,21 +1198,15 @@ void CompositorWrapper::viewCallback(void* userData, struct comp_view* view, boo
     auto* self = static_cast<CompositorWrapper*>(userData);
     
     if (added) {
-        if (!self->m_views.contains(view)) {
-            int index = self->m_views.size();
-            self->m_views.append(view);
-            emit self->viewsChanged();
-            emit self->viewAdded(index);
-            qDebug() << "View added, count:" << self->m_views.size();
-        }
+        const char* title = comp_view_get_title(view);
+        int32_t x, y;
+        uint32_t w, h;
+        comp_view_get_geometry(view, &x, &y, &w, &h);
+        self->addView(view, self->allocateViewId(),
+                      title ? QString::fromUtf8(title) : QString("(untitled)"), QRect(x, y, w, h));
     } else {
-        int index = self->m_views.indexOf(view);
-        if (index >= 0) {
-            self->m_views.removeAt(index);
-            emit self->viewsChanged();
-            emit self->viewRemoved(index);
-            qDebug() << "View removed, count:" << self->m_views.size();
-        }
+        self->m_viewState.remove(view);
+        self->removeView(view);
     }
 }
 
@@ -281,3 +1215,233 @@ void CompositorWrapper::commitCallback(void* userData) {
     /* Client committed new content - trigger Qt redraw */
     emit self->frameReady();
 }
+
+void CompositorWrapper::viewCommitCallback(void* userData, struct comp_view* view,
+                                           const struct comp_rect* damage, int nDamage) {
+    auto* self = static_cast<CompositorWrapper*>(userData);
+    
+    int index = self->m_views.indexOf(view);
+    if (index < 0) return;
+    
+    /* Titles and sizes change with commits - only the row is refreshed */
+    const char* title = comp_view_get_title(view);
+    int32_t x, y;
+    uint32_t w, h;
+    comp_view_get_geometry(view, &x, &y, &w, &h);
+    self->updateViewInfo(view, title ? QString::fromUtf8(title) : QString("(untitled)"),
+                         QRect(x, y, w, h));
+    
+    QRegion region;
+    for (int i = 0; i < nDamage; i++) {
+        region += QRect(damage[i].x, damage[i].y, damage[i].width, damage[i].height);
+    }
+    
+    /* Only the EmbeddedView showing this view refreshes */
+    emit self->viewCommitted(index, region);
+}
+
+void CompositorWrapper::cursorCallback(void* userData, struct comp_view* view,
+                                       const struct comp_cursor* cursor) {
+    auto* self = static_cast<CompositorWrapper*>(userData);
+    self->updateViewCursor(view, cursorFromCore(cursor));
+}
+
+ViewCursor CompositorWrapper::cursorFromCore(const struct comp_cursor* cursor) {
+    ViewCursor result;
+    if (!cursor) return result;
+    
+    result.set = true;
+    if (cursor->pixels) {
+        result.image = QImage(static_cast<const uchar*>(cursor->pixels), int(cursor->width),
+                              int(cursor->height), int(cursor->stride),
+                              QImage::Format_ARGB32_Premultiplied).copy();
+        result.hotspot = QPointF(cursor->hotspot_x, cursor->hotspot_y);
+        result.size = QSizeF(cursor->frame_width, cursor->frame_height);
+    }
+    return result;
+}
+
+int CompositorWrapper::allocateViewId() {
+    return m_nextViewId.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool CompositorWrapper::isCurrentView(struct comp_view* view, int id) const {
+    return id > 0 && m_viewsById.value(id, nullptr) == view;
+}
+
+void CompositorWrapper::threadViewAdded(CompositorThread* thread, struct comp_view* view, int id,
+                                        const QString& title, const QRect& geometry) {
+    auto known = m_viewIds.constFind(view);
+    if (known != m_viewIds.cend()) {
+        if (*known == id) return;
+        /* Memory of a view that went away, whose removal is still on its
+         * way - from another shard's thread */
+        threadViewRemoved(view, *known);
+    }
+    
+    m_viewState[view].thread = thread;
+    addView(view, id, title, geometry);
+    
+    /* The shard focused the view as it mapped, like a single server does */
+    setInputThread(thread, false);
+}
+
+void CompositorWrapper::threadViewRemoved(struct comp_view* view, int id) {
+    if (!isCurrentView(view, id)) return;
+    
+    auto it = m_viewState.find(view);
+    if (it != m_viewState.end()) {
+        if (it->dmabuf) {
+            comp_dmabuf_close(it->dmabuf);
+            delete it->dmabuf;
+        }
+        m_viewState.erase(it);
+    }
+    
+    removeView(view);
+}
+
+void CompositorWrapper::threadViewInfo(struct comp_view* view, int id, const QString& title,
+                                       const QRect& geometry) {
+    if (!isCurrentView(view, id)) return;
+    updateViewInfo(view, title, geometry);
+}
+
+void CompositorWrapper::threadViewCursor(struct comp_view* view, int id,
+                                         const ViewCursor& cursor) {
+    if (!isCurrentView(view, id)) return;
+    updateViewCursor(view, cursor);
+}
+
+void CompositorWrapper::threadStreamFailed(struct comp_view* view, int id) {
+    if (!isCurrentView(view, id)) return;
+    emit streamFailed(m_views.indexOf(view));
+}
+
+void CompositorWrapper::addView(struct comp_view* view, int id, const QString& title,
+                                const QRect& geometry) {
+    if (m_viewIds.contains(view)) return;
+    
+    ViewState& state = m_viewState[view];
+    state.title = title;
+    state.geometry = geometry;
+    
+    int index = m_views.size();
+    m_model->beginInsertView(index);
+    m_views.append(view);
+    m_viewIds.insert(view, id);
+    m_viewsById.insert(id, view);
+    m_model->endInsertView();
+    
+    emit viewsChanged();
+    emit viewAdded(index);
+    qDebug() << "View" << id << "added, count:" << m_views.size();
+}
+
+void CompositorWrapper::removeView(struct comp_view* view) {
+    int index = m_views.indexOf(view);
+    if (index < 0) return;
+    
+    if (m_motionView == view) {
+        m_motionView = nullptr;
+    }
+    
+    int id = m_viewIds.value(view);
+    m_model->beginRemoveView(index);
+    m_views.removeAt(index);
+    m_viewIds.remove(view);
+    m_viewsById.remove(id);
+    m_model->endRemoveView();
+    
+    emit viewsChanged();
+    emit viewRemoved(index);
+    qDebug() << "View" << id << "removed, count:" << m_views.size();
+}
+
+void CompositorWrapper::updateViewInfo(struct comp_view* view, const QString& title,
+                                       const QRect& geometry) {
+    auto it = m_viewState.find(view);
+    if (it == m_viewState.end()) return;
+    
+    QList<int> roles;
+    if (it->title != title) {
+        it->title = title;
+        roles << ViewModel::TitleRole << Qt::DisplayRole;
+    }
+    if (it->geometry != geometry) {
+        it->geometry = geometry;
+        roles << ViewModel::GeometryRole;
+    }
+    if (!roles.isEmpty()) {
+        m_model->viewChanged(m_views.indexOf(view), roles);
+    }
+}
+
+void CompositorWrapper::updateViewCursor(struct comp_view* view, const ViewCursor& cursor) {
+    auto it = m_viewState.find(view);
+    if (it == m_viewState.end()) return;
+    
+    it->cursor = cursor;
+    emit viewCursorChanged(m_views.indexOf(view));
+}
+
+ViewCursor CompositorWrapper::viewCursor(struct comp_view* view) const {
+    auto it = m_viewState.constFind(view);
+    return it != m_viewState.cend() ? it->cursor : ViewCursor();
+}
+
+void CompositorWrapper::drainFrames(CompositorThread* thread) {
+    if (!m_thread) return;
+    
+    /* Clear first - a frame pushed while we drain queues another drain */
+    thread->clearFrameWake();
+    
+    CompositorFrame frame;
+    while (thread->takeFrame(frame)) {
+        /* Lets the compositor thread produce this view's next frame */
+        CompositorCommand done = {};
+        done.type = CompositorCommand::FrameConsumed;
+        done.view = frame.view;
+        done.viewId = frame.viewId;
+        thread->post(done);
+        
+        int index = m_views.indexOf(frame.view);
+        auto it = m_viewState.find(frame.view);
+        /* Frames queued before a trim are not kept either */
+        if (!isCurrentView(frame.view, frame.viewId) || it == m_viewState.end() || it->trimmed) {
+            if (frame.isDmabuf) {
+                comp_dmabuf_close(&frame.dmabuf);
+            } else {
+                comp_frame_release(frame.frame.handle);
+            }
+            continue;
+        }
+        
+        QRegion region;
+        if (frame.isDmabuf) {
+            if (it->dmabuf) {
+                comp_dmabuf_close(it->dmabuf);
+            } else {
+                it->dmabuf = new comp_dmabuf;
+            }
+            *it->dmabuf = frame.dmabuf;
+            region = QRect(0, 0, frame.dmabuf.width, frame.dmabuf.height);
+        } else {
+            const struct comp_frame& f = frame.frame;
+            for (int i = 0; i < f.n_damage; i++) {
+                region += QRect(f.damage[i].x, f.damage[i].y,
+                                f.damage[i].width, f.damage[i].height);
+            }
+            /* Replacing the previous frame releases its slot */
+            it->frame = frameImage(f);
+            it->directFrame = f.direct;
+            it->downscale = int(f.downscale);
+            it->damage += region;
+        }
+        
+        emit viewCommitted(index, region);
+    }
+    
+    /* Also invoked for commits without new frames - they still need a frame */
+    emit frameReady();
+}
@@ -0,0 +1,183 @@
+/*
+ * dmabuf_feedback.c - linux-dmabuf-v1 feedback steered towards Qt's importer
+ *
+ * SPDX-License-Identifier: MIT
+ * Copyright (c) 2024
+ */
+#include "dmabuf_feedback.h"
+#include "compositor_core.h"
+
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include <drm_fourcc.h>
+#include <wlr/render/drm_format_set.h>
+#include <wlr/render/wlr_renderer.h>
+#include <wlr/types/wlr_buffer.h>
+#include <wlr/types/wlr_linux_dmabuf_v1.h>
+#include <wlr/util/log.h>
+
+/* zwp_linux_dmabuf_feedback_v1.tranche_flags - only the client side of
+ * the protocol is generated here */
+#define TRANCHE_FLAGS_SCANOUT 1
+
+struct dmabuf_feedback {
+    struct wlr_linux_dmabuf_v1* linux_dmabuf;
+    const struct wlr_drm_format_set* texture_formats;   /* What wlroots imports */
+    dev_t main_device;
+    struct wlr_drm_format_set direct;   /* What Qt samples, of texture_formats */
+};
+
+/* No alpha channel - nothing to blend, fine for a primary plane */
+static bool format_is_opaque(uint32_t format) {
+    switch (format) {
+    case DRM_FORMAT_XRGB8888:
+    case DRM_FORMAT_XBGR8888:
+    case DRM_FORMAT_RGBX8888:
+    case DRM_FORMAT_BGRX8888:
+    case DRM_FORMAT_XRGB2101010:
+    case DRM_FORMAT_XBGR2101010:
+    case DRM_FORMAT_XRGB16161616F:
+    case DRM_FORMAT_XBGR16161616F:
+    case DRM_FORMAT_RGB565:
+    case DRM_FORMAT_NV12:
+    case DRM_FORMAT_P010:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* Copy the pairs of src that are (or, with exclude, are not) in filter */
+static void add_formats(struct wlr_drm_format_set* dst, const struct wlr_drm_format_set* src,
+                        const struct wlr_drm_format_set* filter, bool exclude, bool opaque_only) {
+    for (size_t i = 0; i < src->len; i++) {
+        const struct wlr_drm_format* fmt = &src->formats[i];
+        if (opaque_only && !format_is_opaque(fmt->format)) continue;
+        for (size_t j = 0; j < fmt->len; j++) {
+            if (filter && wlr_drm_format_set_has(filter, fmt->format, fmt->modifiers[j]) == exclude) {
+                continue;
+            }
+            wlr_drm_format_set_add(dst, fmt->format, fmt->modifiers[j]);
+        }
+    }
+}
+
+static bool add_tranche(struct wlr_linux_dmabuf_feedback_v1* out, dev_t device, uint32_t flags,
+                        const struct wlr_drm_format_set* src,
+                        const struct wlr_drm_format_set* filter, bool exclude, bool opaque_only) {
+    struct wlr_drm_format_set formats = {0};
+    add_formats(&formats, src, filter, exclude, opaque_only);
+    if (formats.len == 0) {
+        wlr_drm_format_set_finish(&formats);
+        return true;
+    }
+
+    struct wlr_linux_dmabuf_feedback_v1_tranche* tranche =
+        wlr_linux_dmabuf_feedback_add_tranche(out);
+    if (!tranche) {
+        wlr_drm_format_set_finish(&formats);
+        return false;
+    }
+    tranche->target_device = device;
+    tranche->flags = flags;
+    tranche->formats = formats;
+    return true;
+}
+
+/* Tranches in order of preference: scanout, direct, everything else */
+static bool build_feedback(struct dmabuf_feedback* feedback, bool scanout,
+                           struct wlr_linux_dmabuf_feedback_v1* out) {
+    out->main_device = feedback->main_device;
+    wl_array_init(&out->tranches);
+
+    const struct wlr_drm_format_set* direct = &feedback->direct;
+    bool ok = true;
+    if (direct->len > 0) {
+        if (scanout) {
+            ok = ok && add_tranche(out, feedback->main_device, TRANCHE_FLAGS_SCANOUT,
+                                   direct, NULL, false, true);
+        }
+        ok = ok && add_tranche(out, feedback->main_device, 0, direct, NULL, false, false);
+    }
+    ok = ok && add_tranche(out, feedback->main_device, 0, feedback->texture_formats,
+                           direct->len > 0 ? direct : NULL, true, false);
+    if (!ok) {
+        wlr_linux_dmabuf_feedback_v1_finish(out);
+    }
+    return ok;
+}
+
+struct dmabuf_feedback* dmabuf_feedback_create(struct wl_display* display,
+                                               struct wlr_renderer* renderer) {
+    const struct wlr_drm_format_set* texture_formats =
+        wlr_renderer_get_texture_formats(renderer, WLR_BUFFER_CAP_DMABUF);
+    int drm_fd = wlr_renderer_get_drm_fd(renderer);
+    if (!texture_formats || drm_fd < 0) return NULL;
+
+    struct stat st;
+    if (fstat(drm_fd, &st) != 0) {
+        wlr_log_errno(WLR_ERROR, "Failed to stat the renderer's DRM node");
+        return NULL;
+    }
+
+    struct dmabuf_feedback* feedback = calloc(1, sizeof(*feedback));
+    if (!feedback) return NULL;
+    feedback->texture_formats = texture_formats;
+    feedback->main_device = st.st_rdev;
+
+    /* Default feedback and import checks as wlr_renderer_init_wl_display()
+     * sets them up - until the embedder reports its formats */
+    feedback->linux_dmabuf = wlr_linux_dmabuf_v1_create_with_renderer(display, 5, renderer);
+    if (!feedback->linux_dmabuf) {
+        wlr_log(WLR_ERROR, "Failed to create linux-dmabuf-v1");
+        free(feedback);
+        return NULL;
+    }
+    return feedback;
+}
+
+void dmabuf_feedback_destroy(struct dmabuf_feedback* feedback) {
+    if (!feedback) return;
+
+    /* linux_dmabuf goes with the display */
+    wlr_drm_format_set_finish(&feedback->direct);
+    free(feedback);
+}
+
+void dmabuf_feedback_set_import_formats(struct dmabuf_feedback* feedback,
+                                        const struct comp_dmabuf_format* formats, int n_formats) {
+    if (!feedback) return;
+
+    struct wlr_drm_format_set import = {0};
+    for (int i = 0; i < n_formats; i++) {
+        wlr_drm_format_set_add(&import, formats[i].format, formats[i].modifier);
+    }
+
+    /* Only what the clients' buffers can actually arrive in */
+    wlr_drm_format_set_finish(&feedback->direct);
+    add_formats(&feedback->direct, feedback->texture_formats, &import, false, false);
+    wlr_drm_format_set_finish(&import);
+
+    size_t n_direct = 0;
+    for (size_t i = 0; i < feedback->direct.len; i++) {
+        n_direct += feedback->direct.formats[i].len;
+    }
+    wlr_log(WLR_INFO, "DMA-BUF feedback: %zu of %d format/modifier pairs imported directly",
+            n_direct, n_formats);
+}
+
+void dmabuf_feedback_update_surface(struct dmabuf_feedback* feedback,
+                                    struct wlr_surface* surface, bool scanout) {
+    if (!feedback || !surface) return;
+
+    struct wlr_linux_dmabuf_feedback_v1 out;
+    if (!build_feedback(feedback, scanout, &out)) {
+        wlr_log(WLR_ERROR, "Failed to build DMA-BUF feedback");
+        return;
+    }
+    if (!wlr_linux_dmabuf_v1_set_surface_feedback(feedback->linux_dmabuf, surface, &out)) {
+        wlr_log(WLR_ERROR, "Failed to set DMA-BUF feedback for surface");
+    }
+    wlr_linux_dmabuf_feedback_v1_finish(&out);
+}
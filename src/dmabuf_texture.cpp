@@ -0,0 +1,356 @@
+/*
+ * dmabuf_texture.cpp - EGLImage based DMA-BUF import for the scene graph
+ *
+ * SPDX-License-Identifier: MIT
+ * Copyright (c) 2024
+ */
+#include "dmabuf_texture.h"
+#include "compositor_core.h"
+
+#include <QOpenGLContext>
+#include <QOpenGLFunctions>
+#include <QSGRendererInterface>
+#include <QtQuick/qsgtexture_platform.h>
+#include <QDebug>
+
+/* Keep eglplatform.h from dragging in Xlib (clashes with Qt macros) */
+#define EGL_NO_X11
+#define MESA_EGL_NO_X11_HEADERS
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include <drm_fourcc.h>
+#include <cstring>
+#include <unistd.h>
+
+/* From GL_OES_EGL_image - declared here to avoid mixing GL/GLES headers */
+typedef void (*GLEGLImageTargetTexture2DOESProc)(GLenum target, void* image);
+
+namespace {
+
+struct EglProcs {
+    PFNEGLCREATEIMAGEKHRPROC createImage = nullptr;
+    PFNEGLDESTROYIMAGEKHRPROC destroyImage = nullptr;
+    GLEGLImageTargetTexture2DOESProc imageTargetTexture = nullptr;
+    PFNEGLCREATESYNCKHRPROC createSync = nullptr;
+    PFNEGLDESTROYSYNCKHRPROC destroySync = nullptr;
+    PFNEGLWAITSYNCKHRPROC waitSync = nullptr;
+    PFNEGLDUPNATIVEFENCEFDANDROIDPROC dupNativeFenceFd = nullptr;
+    PFNEGLQUERYDMABUFFORMATSEXTPROC queryFormats = nullptr;
+    PFNEGLQUERYDMABUFMODIFIERSEXTPROC queryModifiers = nullptr;
+    bool hasModifiers = false;
+    bool hasFences = false;     /* sync_file in and out of GL */
+    bool resolved = false;
+    bool ok = false;
+};
+
+/* Resolve extension entry points once per process (render thread) */
+const EglProcs& eglProcs() {
+    static EglProcs procs;
+    if (procs.resolved) {
+        return procs;
+    }
+    procs.resolved = true;
+
+    EGLDisplay display = eglGetCurrentDisplay();
+    if (display == EGL_NO_DISPLAY) {
+        qWarning() << "DMA-BUF import: no current EGL display";
+        return procs;
+    }
+
+    const char* exts = eglQueryString(display, EGL_EXTENSIONS);
+    if (!exts || !strstr(exts, "EGL_EXT_image_dma_buf_import")) {
+        qWarning() << "DMA-BUF import: EGL_EXT_image_dma_buf_import not supported";
+        return procs;
+    }
+    procs.hasModifiers = strstr(exts, "EGL_EXT_image_dma_buf_import_modifiers") != nullptr;
+    if (procs.hasModifiers) {
+        procs.queryFormats = reinterpret_cast<PFNEGLQUERYDMABUFFORMATSEXTPROC>(
+            eglGetProcAddress("eglQueryDmaBufFormatsEXT"));
+        procs.queryModifiers = reinterpret_cast<PFNEGLQUERYDMABUFMODIFIERSEXTPROC>(
+            eglGetProcAddress("eglQueryDmaBufModifiersEXT"));
+    }
+
+    procs.createImage = reinterpret_cast<PFNEGLCREATEIMAGEKHRPROC>(
+        eglGetProcAddress("eglCreateImageKHR"));
+    procs.destroyImage = reinterpret_cast<PFNEGLDESTROYIMAGEKHRPROC>(
+        eglGetProcAddress("eglDestroyImageKHR"));
+    procs.imageTargetTexture = reinterpret_cast<GLEGLImageTargetTexture2DOESProc>(
+        eglGetProcAddress("glEGLImageTargetTexture2DOES"));
+
+    procs.ok = procs.createImage && procs.destroyImage && procs.imageTargetTexture;
+    if (!procs.ok) {
+        qWarning() << "DMA-BUF import: missing EGLImage entry points";
+    }
+
+    if (strstr(exts, "EGL_ANDROID_native_fence_sync") && strstr(exts, "EGL_KHR_wait_sync")) {
+        procs.createSync = reinterpret_cast<PFNEGLCREATESYNCKHRPROC>(
+            eglGetProcAddress("eglCreateSyncKHR"));
+        procs.destroySync = reinterpret_cast<PFNEGLDESTROYSYNCKHRPROC>(
+            eglGetProcAddress("eglDestroySyncKHR"));
+        procs.waitSync = reinterpret_cast<PFNEGLWAITSYNCKHRPROC>(
+            eglGetProcAddress("eglWaitSyncKHR"));
+        procs.dupNativeFenceFd = reinterpret_cast<PFNEGLDUPNATIVEFENCEFDANDROIDPROC>(
+            eglGetProcAddress("eglDupNativeFenceFDANDROID"));
+        procs.hasFences = procs.createSync && procs.destroySync && procs.waitSync &&
+                          procs.dupNativeFenceFd;
+    }
+    if (!procs.hasFences) {
+        qWarning() << "DMA-BUF import: no native fence sync, waiting on the CPU";
+    }
+    return procs;
+}
+
+/* Make GL wait for an acquire fence on the GPU. Takes the fd. */
+void waitAcquire(EGLDisplay display, int fd) {
+    if (fd < 0) return;
+
+    const EglProcs& procs = eglProcs();
+    if (procs.hasFences) {
+        const EGLint attribs[] = { EGL_SYNC_NATIVE_FENCE_FD_ANDROID, fd, EGL_NONE };
+        EGLSyncKHR sync = procs.createSync(display, EGL_SYNC_NATIVE_FENCE_ANDROID, attribs);
+        if (sync != EGL_NO_SYNC_KHR) {
+            /* EGL owns the fd now */
+            procs.waitSync(display, sync, 0);
+            procs.destroySync(display, sync);
+            return;
+        }
+    }
+    comp_fence_wait(fd, -1);
+    close(fd);
+}
+
+/* Fence that signals once GL is done with everything submitted so far,
+ * -1 if the work is already finished */
+int createReleaseFence(EGLDisplay display, QOpenGLFunctions* gl) {
+    const EglProcs& procs = eglProcs();
+    if (procs.hasFences) {
+        EGLSyncKHR sync = procs.createSync(display, EGL_SYNC_NATIVE_FENCE_ANDROID, nullptr);
+        if (sync != EGL_NO_SYNC_KHR) {
+            /* The fd only exists once the fence is flushed */
+            gl->glFlush();
+            int fd = procs.dupNativeFenceFd(display, sync);
+            procs.destroySync(display, sync);
+            if (fd != EGL_NO_NATIVE_FENCE_FD_ANDROID) return fd;
+        }
+    }
+    /* Without native fences the only way to be sure */
+    gl->glFinish();
+    return -1;
+}
+
+} // namespace
+
+DmabufTexture::DmabufTexture() = default;
+
+DmabufTexture::~DmabufTexture() {
+    delete m_texture;
+    m_texture = nullptr;
+
+    releaseImage();
+
+    QOpenGLContext* ctx = QOpenGLContext::currentContext();
+    if (m_lock) {
+        EGLDisplay display = eglGetCurrentDisplay();
+        comp_buffer_unlock(m_lock, ctx && display != EGL_NO_DISPLAY ?
+                                   createReleaseFence(display, ctx->functions()) : -1);
+        m_lock = nullptr;
+    }
+    if (m_textureId && ctx) {
+        GLuint id = m_textureId;
+        ctx->functions()->glDeleteTextures(1, &id);
+    }
+    m_textureId = 0;
+}
+
+QList<comp_dmabuf_format> DmabufTexture::importFormats(QQuickWindow* window) {
+    QList<comp_dmabuf_format> formats;
+    if (!isSupported(window)) return formats;
+
+    const EglProcs& procs = eglProcs();
+    EGLDisplay display = eglGetCurrentDisplay();
+    if (!procs.ok || !procs.queryFormats || !procs.queryModifiers || display == EGL_NO_DISPLAY) {
+        return formats;
+    }
+
+    EGLint n = 0;
+    if (!procs.queryFormats(display, 0, nullptr, &n) || n <= 0) return formats;
+    QList<EGLint> fourccs(n);
+    procs.queryFormats(display, n, fourccs.data(), &n);
+
+    for (EGLint i = 0; i < n; i++) {
+        /* Implicit modifiers go through EGL_EXT_image_dma_buf_import */
+        formats.append({ uint32_t(fourccs[i]), DRM_FORMAT_MOD_INVALID });
+
+        EGLint m = 0;
+        if (!procs.queryModifiers(display, fourccs[i], 0, nullptr, nullptr, &m) || m <= 0) {
+            continue;
+        }
+        QList<EGLuint64KHR> modifiers(m);
+        QList<EGLBoolean> externalOnly(m);
+        procs.queryModifiers(display, fourccs[i], m, modifiers.data(), externalOnly.data(), &m);
+        for (EGLint j = 0; j < m; j++) {
+            /* External-only would need GL_TEXTURE_EXTERNAL_OES, which the
+             * scene graph's shaders do not sample */
+            if (externalOnly[j]) continue;
+            formats.append({ uint32_t(fourccs[i]), uint64_t(modifiers[j]) });
+        }
+    }
+    return formats;
+}
+
+bool DmabufTexture::formatHasAlpha(uint32_t format) {
+    switch (format) {
+    case DRM_FORMAT_ARGB8888:
+    case DRM_FORMAT_ABGR8888:
+    case DRM_FORMAT_RGBA8888:
+    case DRM_FORMAT_BGRA8888:
+    case DRM_FORMAT_ARGB2101010:
+    case DRM_FORMAT_ABGR2101010:
+    case DRM_FORMAT_ABGR16161616F:
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool DmabufTexture::isSupported(QQuickWindow* window) {
+    if (!window || !window->rendererInterface()) return false;
+    return window->rendererInterface()->graphicsApi() == QSGRendererInterface::OpenGL;
+}
+
+void DmabufTexture::releaseImage() {
+    if (m_image && m_display) {
+        const EglProcs& procs = eglProcs();
+        if (procs.ok) {
+            procs.destroyImage(static_cast<EGLDisplay>(m_display),
+                               static_cast<EGLImageKHR>(m_image));
+        }
+    }
+    m_image = nullptr;
+}
+
+bool DmabufTexture::import(struct comp_dmabuf* dmabuf, QQuickWindow* window) {
+    if (!dmabuf) return false;
+
+    QOpenGLContext* ctx = QOpenGLContext::currentContext();
+    const EglProcs& procs = eglProcs();
+    if (!ctx || !procs.ok || !isSupported(window) || dmabuf->n_planes <= 0) {
+        comp_dmabuf_close(dmabuf);
+        return false;
+    }
+
+    EGLDisplay display = eglGetCurrentDisplay();
+
+    /* Both stay with us past comp_dmabuf_close() */
+    int acquireFence = dmabuf->acquire_fence;
+    dmabuf->acquire_fence = -1;
+    struct comp_buffer_lock* lock = dmabuf->lock;
+    dmabuf->lock = nullptr;
+
+    static const EGLint planeFd[] = {
+        EGL_DMA_BUF_PLANE0_FD_EXT, EGL_DMA_BUF_PLANE1_FD_EXT,
+        EGL_DMA_BUF_PLANE2_FD_EXT, EGL_DMA_BUF_PLANE3_FD_EXT };
+    static const EGLint planeOffset[] = {
+        EGL_DMA_BUF_PLANE0_OFFSET_EXT, EGL_DMA_BUF_PLANE1_OFFSET_EXT,
+        EGL_DMA_BUF_PLANE2_OFFSET_EXT, EGL_DMA_BUF_PLANE3_OFFSET_EXT };
+    static const EGLint planePitch[] = {
+        EGL_DMA_BUF_PLANE0_PITCH_EXT, EGL_DMA_BUF_PLANE1_PITCH_EXT,
+        EGL_DMA_BUF_PLANE2_PITCH_EXT, EGL_DMA_BUF_PLANE3_PITCH_EXT };
+    static const EGLint planeModLo[] = {
+        EGL_DMA_BUF_PLANE0_MODIFIER_LO_EXT, EGL_DMA_BUF_PLANE1_MODIFIER_LO_EXT,
+        EGL_DMA_BUF_PLANE2_MODIFIER_LO_EXT, EGL_DMA_BUF_PLANE3_MODIFIER_LO_EXT };
+    static const EGLint planeModHi[] = {
+        EGL_DMA_BUF_PLANE0_MODIFIER_HI_EXT, EGL_DMA_BUF_PLANE1_MODIFIER_HI_EXT,
+        EGL_DMA_BUF_PLANE2_MODIFIER_HI_EXT, EGL_DMA_BUF_PLANE3_MODIFIER_HI_EXT };
+
+    /* 6 header values + 10 per plane + terminator */
+    EGLint attribs[6 + 10 * COMP_DMABUF_MAX_PLANES + 1];
+    int n = 0;
+    attribs[n++] = EGL_WIDTH;
+    attribs[n++] = static_cast<EGLint>(dmabuf->width);
+    attribs[n++] = EGL_HEIGHT;
+    attribs[n++] = static_cast<EGLint>(dmabuf->height);
+    attribs[n++] = EGL_LINUX_DRM_FOURCC_EXT;
+    attribs[n++] = static_cast<EGLint>(dmabuf->format);
+
+    bool useModifier = procs.hasModifiers && dmabuf->modifier != DRM_FORMAT_MOD_INVALID;
+    for (int i = 0; i < dmabuf->n_planes && i < COMP_DMABUF_MAX_PLANES; i++) {
+        attribs[n++] = planeFd[i];
+        attribs[n++] = dmabuf->fd[i];
+        attribs[n++] = planeOffset[i];
+        attribs[n++] = static_cast<EGLint>(dmabuf->offset[i]);
+        attribs[n++] = planePitch[i];
+        attribs[n++] = static_cast<EGLint>(dmabuf->stride[i]);
+        if (useModifier) {
+            attribs[n++] = planeModLo[i];
+            attribs[n++] = static_cast<EGLint>(dmabuf->modifier & 0xFFFFFFFF);
+            attribs[n++] = planeModHi[i];
+            attribs[n++] = static_cast<EGLint>(dmabuf->modifier >> 32);
+        }
+    }
+    attribs[n++] = EGL_NONE;
+
+    EGLImageKHR image = procs.createImage(display, EGL_NO_CONTEXT,
+                                          EGL_LINUX_DMA_BUF_EXT, nullptr, attribs);
+
+    /* EGL holds its own reference to the buffer - our fds are done */
+    comp_dmabuf_close(dmabuf);
+
+    if (image == EGL_NO_IMAGE_KHR) {
+        qWarning() << "DMA-BUF import: eglCreateImageKHR failed, error"
+                   << Qt::hex << eglGetError();
+        if (acquireFence >= 0) close(acquireFence);
+        comp_buffer_unlock(lock, -1);
+        return false;
+    }
+
+    QOpenGLFunctions* gl = ctx->functions();
+
+    /* Sampling waits for the client's rendering, on the GPU */
+    waitAcquire(display, acquireFence);
+
+    /* The client gets the previous buffer back once the frames that
+     * sampled it are done */
+    if (m_lock) {
+        comp_buffer_unlock(m_lock, createReleaseFence(display, gl));
+    }
+    m_lock = lock;
+    if (!m_textureId) {
+        GLuint id = 0;
+        gl->glGenTextures(1, &id);
+        m_textureId = id;
+        gl->glBindTexture(GL_TEXTURE_2D, id);
+        gl->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        gl->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        gl->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        gl->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    } else {
+        gl->glBindTexture(GL_TEXTURE_2D, m_textureId);
+    }
+
+    /* Re-point the same GL texture at the new image - no pixel copy */
+    procs.imageTargetTexture(GL_TEXTURE_2D, image);
+    gl->glBindTexture(GL_TEXTURE_2D, 0);
+
+    releaseImage();
+    m_display = display;
+    m_image = image;
+
+    /* The QSGTexture wrapper only needs replacing when its size/alpha changes */
+    QSize size(static_cast<int>(dmabuf->width), static_cast<int>(dmabuf->height));
+    bool hasAlpha = formatHasAlpha(dmabuf->format);
+    if (!m_texture || size != m_size || hasAlpha != m_hasAlpha) {
+        delete m_texture;
+        QQuickWindow::CreateTextureOptions options;
+        if (hasAlpha) {
+            options |= QQuickWindow::TextureHasAlphaChannel;
+        }
+        m_texture = QNativeInterface::QSGOpenGLTexture::fromNative(
+            m_textureId, window, size, options);
+        m_size = size;
+        m_hasAlpha = hasAlpha;
+    }
+
+    return m_texture != nullptr;
+}
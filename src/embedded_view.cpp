@@ -3,19 +3,93 @@
  */
 #include "embedded_view.h"
 #include "compositor_wrapper.h"
+#include "view_model.h"
+#include "dmabuf_texture.h"
+#include "vulkan_texture.h"
+#include "view_texture.h"
+#include "view_passthrough.h"
+#include "frame_scheduler.h"
+#include "texture_budget.h"
+#include "frame_trace.h"
 
 #include <QSGSimpleTextureNode>
+#include <QSGRectangleNode>
+#include <QSGTransformNode>
+#include <QMatrix4x4>
+#include <QCursor>
+#include <QPixmap>
 #include <QQuickWindow>
 #include <QKeyEvent>
 #include <QMouseEvent>
 #include <QWheelEvent>
 #include <QHoverEvent>
 #include <QDebug>
+#include <QtMath>
 
 #include <linux/input-event-codes.h>
 
+#include <memory>
+
 CompositorWrapper* EmbeddedView::s_compositor = nullptr;
 
+namespace {
+
+/* Share of the window a fully opaque view has to cover to be offered
+ * scanout formats */
+constexpr qreal kScanoutCoverage = 0.5;
+
+/* Scene graph node for a view: a texture child once there is a frame, a
+ * solid fill before, and the client's cursor over either. Owns its
+ * textures so that GL resources are released on the render thread
+ * together with the node. */
+class ViewNode : public QSGNode {
+public:
+    QSGTexture* texture() const { return content ? content->texture() : nullptr; }
+    
+    /* Show texture instead of the fill */
+    void setTexture(QSGTexture* texture) {
+        if (!content) {
+            delete fill;
+            fill = nullptr;
+            content = new QSGSimpleTextureNode();
+            content->setOwnsTexture(false);
+            prependChildNode(content);
+        }
+        if (content->texture() != texture) {
+            content->setTexture(texture);
+        }
+    }
+    
+    DmabufTexture dmabuf;                       /* Hardware (zero-copy) path, GL */
+    VulkanTexture vulkan;                       /* Same for a Vulkan scene graph */
+    std::unique_ptr<ViewTexture> viewTexture;   /* CPU path, kept across frames */
+    QSGSimpleTextureNode* content = nullptr;    /* Child showing the frame */
+    QSGRectangleNode* fill = nullptr;           /* Child until there is one */
+    /* Client cursor, last child - the transform follows the pointer, the
+     * texture node under it is offset by the hotspot and owns its texture */
+    QSGTransformNode* cursorTransform = nullptr;
+    QSGSimpleTextureNode* cursor = nullptr;
+};
+
+/* Whether item, or anything under it, draws into rect (scene coordinates) */
+bool drawsOver(const QQuickItem* item, const QRectF& rect) {
+    if (!item->isVisible() || item->opacity() <= 0.0) return false;
+    
+    QRectF bounds = item->mapRectToScene(item->boundingRect());
+    if (item->flags().testFlag(QQuickItem::ItemHasContents) && bounds.intersects(rect)) {
+        return true;
+    }
+    if (item->clip() && !bounds.intersects(rect)) return false;
+    
+    const QList<QQuickItem*> children = item->childItems();
+    for (const QQuickItem* child : children) {
+        if (drawsOver(child, rect)) return true;
+    }
+    return false;
+}
+
+} // namespace
+
 EmbeddedView::EmbeddedView(QQuickItem* parent)
     : QQuickItem(parent)
 {
@@ -27,18 +101,55 @@ EmbeddedView::EmbeddedView(QQuickItem* parent)
     
     /* Connect to compositor if available */
     if (s_compositor) {
-        connect(s_compositor, &CompositorWrapper::viewsChanged,
-                this, &EmbeddedView::onViewsChanged);
-        connect(s_compositor, &CompositorWrapper::frameReady,
-                this, &EmbeddedView::updateFrame, Qt::QueuedConnection);
+        /* Row changes only rebind if they move our view - no full rescan */
+        ViewModel* model = s_compositor->viewModel();
+        connect(model, &QAbstractItemModel::rowsInserted, this, &EmbeddedView::onViewsChanged);
+        connect(model, &QAbstractItemModel::rowsRemoved, this, &EmbeddedView::onViewsChanged);
+        connect(model, &QAbstractItemModel::modelReset, this, &EmbeddedView::onViewsChanged);
+        connect(model, &QAbstractItemModel::dataChanged, this, &EmbeddedView::onViewDataChanged);
+        connect(s_compositor, &CompositorWrapper::viewCommitted,
+                this, &EmbeddedView::onViewCommitted);
+        connect(s_compositor, &CompositorWrapper::viewCursorChanged,
+                this, &EmbeddedView::onViewCursorChanged);
+        
+        /* Client frame callbacks are paced by the window we end up in */
+        connect(this, &QQuickItem::windowChanged, this, [](QQuickWindow* window) {
+            if (window && s_compositor) {
+                s_compositor->frameScheduler()->addWindow(window);
+            }
+        });
     }
     
-    /* Resize view when item size changes */
+    /* Hidden views get suspended and throttled */
+    connect(this, &QQuickItem::visibleChanged, this, &EmbeddedView::updateEffectiveVisibility);
+    connect(this, &QQuickItem::opacityChanged, this, &EmbeddedView::updateEffectiveVisibility);
+    connect(this, &QQuickItem::windowChanged, this, &EmbeddedView::trackWindow);
+    
+    m_fetchTimer.setSingleShot(true);
+    connect(&m_fetchTimer, &QTimer::timeout, this, &EmbeddedView::updateFrame);
+    
+    /* Resize view when item size changes - once per frame, see updatePolish */
     connect(this, &QQuickItem::widthChanged, this, &EmbeddedView::onSizeChanged);
     connect(this, &QQuickItem::heightChanged, this, &EmbeddedView::onSizeChanged);
 }
 
 EmbeddedView::~EmbeddedView() {
+    /* Nobody shows the view any more */
+    if (s_compositor && m_passthrough) {
+        s_compositor->frameScheduler()->setViewPassthrough(m_view, false);
+    }
+    if (s_compositor && m_reportedView && m_reportedVisible) {
+        s_compositor->setViewVisible(m_reportedView, false);
+    }
+    if (s_compositor && m_reportedView && m_thumbnailSize.isValid()) {
+        s_compositor->setViewThumbnailSize(m_reportedView, QSize());
+    }
+    if (s_compositor) {
+        s_compositor->textureBudget()->remove(this);
+    }
+    
+    QMutexLocker lock(&m_bufferMutex);
+    comp_dmabuf_close(&m_pendingDmabuf);
 }
 
 void EmbeddedView::setCompositor(CompositorWrapper* compositor) {
@@ -53,127 +164,740 @@ void EmbeddedView::setViewIndex(int index) {
     }
 }
 
+void EmbeddedView::setViewId(int id) {
+    if (m_viewId != id) {
+        m_viewId = id;
+        emit viewIdChanged();
+        updateViewState();
+    }
+}
+
 void EmbeddedView::updateViewState() {
-    if (!s_compositor) {
-        if (m_hasView) {
-            m_hasView = false;
-            emit hasViewChanged();
-        }
-        return;
+    struct comp_view* view = nullptr;
+    if (s_compositor) {
+        /* By id the item follows one view, by index whatever is at the row */
+        view = m_viewId > 0 ? s_compositor->viewById(m_viewId)
+                            : s_compositor->viewHandle(m_viewIndex);
     }
+    if (view == m_view) return;
     
-    bool hasView = m_viewIndex >= 0 && m_viewIndex < s_compositor->viewCount();
+    /* The previous view is not shown here any more */
+    setPassthrough(false);
+    if (m_reportedView && m_reportedVisible) {
+        s_compositor->setViewVisible(m_reportedView, false);
+    }
+    if (m_reportedView && m_scanoutHint) {
+        s_compositor->setViewScanoutHint(m_reportedView, false);
+    }
+    if (m_reportedView && m_thumbnailSize.isValid()) {
+        s_compositor->setViewThumbnailSize(m_reportedView, QSize());
+    }
+    m_reportedVisible = false;
+    m_scanoutHint = false;
+    m_thumbnailSize = QSize();
+    m_reportedView = nullptr;
     
+    {
+        QMutexLocker lock(&m_bufferMutex);
+        comp_dmabuf_close(&m_pendingDmabuf);
+        m_hasPendingDmabuf = false;
+        m_frameBuffer = QImage();
+        m_frameDamage = QRegion();
+        m_needsUpdate = false;
+        m_view = view;
+    }
+    m_fullDamage = true;
+    m_evicted = false;
+    m_passthroughFailed = false;
+    m_frameIsDmabuf = false;
+    
+    bool hasView = view != nullptr;
     if (hasView != m_hasView) {
         m_hasView = hasView;
         emit hasViewChanged();
-        
-        /* When view is assigned, resize it to our size */
-        if (m_hasView) {
-            int w = static_cast<int>(width());
-            int h = static_cast<int>(height());
-            if (w > 0 && h > 0) {
-                s_compositor->resizeView(m_viewIndex, w, h);
-            }
+    }
+    
+    /* Resize the view to our size */
+    polish();
+    
+    if (m_view) {
+        /* Show the current content without waiting for a commit */
+        scheduleFrameFetch();
+    }
+    
+    updateTitle();
+    updateCursor();
+    updateEffectiveVisibility();
+    update();
+}
+
+void EmbeddedView::updateTitle() {
+    QString title = m_view ? s_compositor->viewTitle(m_view) : QString();
+    if (title != m_title) {
+        m_title = title;
+        emit titleChanged();
+    }
+}
+
+void EmbeddedView::updateCursor() {
+    ViewCursor cursor = m_view ? s_compositor->viewCursor(m_view) : ViewCursor();
+    
+    {
+        QMutexLocker lock(&m_bufferMutex);
+        m_cursorImage = cursor.image;
+        m_cursorHotspot = cursor.hotspot;
+        m_cursorSize = cursor.size;
+        m_cursorChanged = true;
+    }
+    
+    /* The client draws its own - hide ours over the item meanwhile.
+     * Passed through, nothing of Qt's shows over the view: the window's
+     * cursor becomes the client's instead. */
+    m_clientCursor = cursor.set;
+    if (m_clientCursor && m_passthrough && !cursor.image.isNull() && !cursor.size.isEmpty()) {
+        /* Frame pixels are device pixels while passed through */
+        qreal dpr = pixelRatio();
+        QPixmap pixmap = QPixmap::fromImage(cursor.image);
+        pixmap.setDevicePixelRatio(cursor.image.width() * dpr / cursor.size.width());
+        setCursor(QCursor(pixmap, qRound(cursor.hotspot.x() / dpr),
+                          qRound(cursor.hotspot.y() / dpr)));
+    } else if (m_clientCursor) {
+        setCursor(Qt::BlankCursor);
+    } else {
+        unsetCursor();
+    }
+    update();
+}
+
+void EmbeddedView::trackWindow(QQuickWindow* window) {
+    /* The subsurface hangs off the old window */
+    if (m_passthrough) {
+        setPassthrough(false);
+        scheduleFrameFetch();
+    }
+    
+    if (m_trackedWindow) {
+        disconnect(m_trackedWindow, nullptr, this, nullptr);
+    }
+    m_trackedWindow = window;
+    
+    if (window) {
+        /* Scrolling, parent opacity or clipping changes don't notify us -
+         * re-check once per animated frame (a cheap parent walk) */
+        connect(window, &QQuickWindow::afterAnimating,
+                this, &EmbeddedView::updateEffectiveVisibility);
+        connect(window, &QWindow::visibilityChanged,
+                this, &EmbeddedView::updateEffectiveVisibility);
+        /* A new screen may mean a new scale for the view's output */
+        connect(window, &QWindow::screenChanged, this, &EmbeddedView::onSizeChanged);
+    }
+    updateEffectiveVisibility();
+    onSizeChanged();
+}
+
+bool EmbeddedView::computeEffectiveVisibility(bool* largeAndOpaque) const {
+    *largeAndOpaque = false;
+    QQuickWindow* win = window();
+    if (!isVisible() || !win || !win->isVisible() || !win->isExposed() ||
+        win->visibility() == QWindow::Minimized) {
+        return false;
+    }
+    
+    /* Effective opacity along the parent chain */
+    qreal opacity = 1.0;
+    for (const QQuickItem* item = this; item; item = item->parentItem()) {
+        opacity *= item->opacity();
+        if (opacity <= 0.0) return false;
+    }
+    
+    /* Scrolled out of a clipping parent (Flickable, ListView) or the window */
+    QRectF rect = mapRectToScene(boundingRect());
+    rect &= QRectF(0, 0, win->width(), win->height());
+    for (const QQuickItem* item = parentItem(); item && !rect.isEmpty(); item = item->parentItem()) {
+        if (item->clip()) {
+            rect &= item->mapRectToScene(item->boundingRect());
         }
     }
     
-    if (m_hasView) {
-        QString newTitle = s_compositor->viewTitle(m_viewIndex);
-        if (newTitle != m_title) {
-            m_title = newTitle;
-            emit titleChanged();
+    /* Drawn without blending over a good part of the window */
+    *largeAndOpaque = opacity >= 1.0 &&
+                      rect.width() * rect.height() >= kScanoutCoverage * win->width() * win->height();
+    return !rect.isEmpty();
+}
+
+void EmbeddedView::updateEffectiveVisibility() {
+    bool largeAndOpaque;
+    bool visible = computeEffectiveVisibility(&largeAndOpaque);
+    if (visible != m_effectivelyVisible) {
+        m_effectivelyVisible = visible;
+        /* Shown until now, or from now on */
+        if (s_compositor) {
+            s_compositor->textureBudget()->touch(this);
+        }
+        emit effectivelyVisibleChanged();
+    }
+    
+    if (!s_compositor || !m_hasView) return;
+    
+    if (visible && m_evicted) {
+        /* Back from eviction - the whole frame is needed again */
+        m_evicted = false;
+        m_fullDamage = true;
+        scheduleFrameFetch();
+    }
+    
+    /* Changes only - the wrapper counts the hosts showing a view */
+    m_reportedView = m_view;
+    if (visible != m_reportedVisible) {
+        m_reportedVisible = visible;
+        s_compositor->setViewVisible(m_view, visible);
+    }
+    
+    /* Buffer formats follow, see dmabuf_feedback.h */
+    bool scanout = visible && largeAndOpaque;
+    if (scanout != m_scanoutHint) {
+        m_scanoutHint = scanout;
+        s_compositor->setViewScanoutHint(m_view, scanout);
+    }
+    
+    updatePassthrough();
+}
+
+bool EmbeddedView::passthroughEligible() const {
+    if (!m_allowPassthrough || !m_view || m_thumbnail || m_passthroughFailed ||
+        !m_scanoutHint || !m_frameIsDmabuf || !dmabufPathEnabled()) {
+        return false;
+    }
+    
+    QQuickWindow* win = window();
+    if (m_passthrough ? !m_passthrough->isValid() : !ViewPassthrough::isSupported(win)) {
+        return false;
+    }
+    
+    /* One buffer pixel per device pixel - the parent need not scale */
+    qreal dpr = pixelRatio();
+    if (qAbs(m_frameSize.width() - width() * dpr) > 1.0 ||
+        qAbs(m_frameSize.height() - height() * dpr) > 1.0) {
+        return false;
+    }
+    
+    /* Untransformed, on whole window coordinates */
+    QRectF rect = mapRectToScene(boundingRect());
+    if (rect.topLeft() != mapToScene(QPointF(0, 0)) || QRectF(passthroughRect()) != rect) {
+        return false;
+    }
+    
+    /* Not cut by the window or a clipping parent */
+    if (!QRectF(0, 0, win->width(), win->height()).contains(rect)) return false;
+    for (const QQuickItem* item = parentItem(); item; item = item->parentItem()) {
+        if (item->clip() && !item->mapRectToScene(item->boundingRect()).contains(rect)) {
+            return false;
         }
+    }
+    
+    return !isOverlapped();
+}
+
+/* Anything painted after us that draws over the item - our children,
+ * then the later siblings of us and of each parent, in stacking order */
+bool EmbeddedView::isOverlapped() const {
+    QRectF rect = mapRectToScene(boundingRect());
+    
+    const QList<QQuickItem*> children = childItems();
+    for (const QQuickItem* child : children) {
+        if (drawsOver(child, rect)) return true;
+    }
+    
+    for (const QQuickItem* item = this; item->parentItem(); item = item->parentItem()) {
+        const QList<QQuickItem*> siblings = item->parentItem()->childItems();
+        int index = siblings.indexOf(const_cast<QQuickItem*>(item));
+        for (int i = 0; i < siblings.size(); i++) {
+            const QQuickItem* sibling = siblings.at(i);
+            bool above = sibling->z() > item->z() || (sibling->z() == item->z() && i > index);
+            if (sibling != item && above && drawsOver(sibling, rect)) return true;
+        }
+    }
+    return false;
+}
+
+QRect EmbeddedView::passthroughRect() const {
+    return mapRectToScene(boundingRect()).toRect();
+}
+
+void EmbeddedView::updatePassthrough() {
+    bool eligible = passthroughEligible();
+    if (eligible == isPassthroughActive()) {
+        /* Cheap when nothing moved */
+        if (m_passthrough) {
+            m_passthrough->setGeometry(passthroughRect());
+        }
+        return;
+    }
+    
+    setPassthrough(eligible);
+    if (m_passthrough) {
+        /* The next frame goes to the parent */
+        scheduleFrameFetch();
+    } else if (!eligible) {
+        /* Back in the scene graph - show the current frame with the next
+         * Qt frame, the subsurface stays until then */
+        updateFrame();
+    }
+}
+
+void EmbeddedView::setPassthrough(bool active) {
+    if (active == isPassthroughActive()) return;
+    FrameScheduler* scheduler = s_compositor->frameScheduler();
+    
+    if (active) {
+        m_passthrough = new ViewPassthrough(window(), this);
+        if (!m_passthrough->isValid()) {
+            delete m_passthrough;
+            m_passthrough = nullptr;
+            m_passthroughFailed = true;
+            return;
+        }
+        connect(m_passthrough, &ViewPassthrough::presented,
+                this, &EmbeddedView::onPassthroughPresented);
+        connect(m_passthrough, &ViewPassthrough::failed,
+                this, &EmbeddedView::onPassthroughFailed);
+        m_passthrough->setGeometry(passthroughRect());
+        scheduler->setViewPassthrough(m_view, true);
         
-        /* Focus this view in the compositor */
-        s_compositor->focusView(m_viewIndex);
+        /* Nothing more to import - Qt keeps its frame until the
+         * parent's is on screen, see onPassthroughPresented */
+        QMutexLocker lock(&m_bufferMutex);
+        comp_dmabuf_close(&m_pendingDmabuf);
+        m_hasPendingDmabuf = false;
+    } else {
+        scheduler->setViewPassthrough(m_view, false);
+        disconnect(m_passthrough, nullptr, this, nullptr);
+        
+        /* Shown until the window has the view in its own content again */
+        QQuickWindow* win = m_passthrough->window();
+        if (win && win == window() && m_passthroughShown) {
+            connect(win, &QQuickWindow::frameSwapped,
+                    m_passthrough, &QObject::deleteLater, Qt::QueuedConnection);
+        } else {
+            m_passthrough->deleteLater();
+        }
+        m_passthrough = nullptr;
+        
+        QMutexLocker lock(&m_bufferMutex);
+        m_passthroughShown = false;
+        m_fullDamage = true;
     }
     
-    update();
+    updateCursor();
+    emit passthroughActiveChanged();
+}
+
+void EmbeddedView::onPassthroughPresented() {
+    if (!m_passthroughShown) {
+        /* The parent shows the view - Qt's textures (and the client
+         * buffers they hold) can go */
+        QMutexLocker lock(&m_bufferMutex);
+        m_passthroughShown = true;
+        m_dropTextures = true;
+        m_frameBuffer = QImage();
+        m_frameDamage = QRegion();
+        m_needsUpdate = false;
+        update();
+    }
+    s_compositor->frameScheduler()->passthroughPresented(m_view);
+}
+
+void EmbeddedView::onPassthroughFailed() {
+    /* Not again for this view */
+    m_passthroughFailed = true;
+    setPassthrough(false);
+    updateFrame();
+}
+
+void EmbeddedView::setAllowPassthrough(bool allow) {
+    if (m_allowPassthrough == allow) return;
+    
+    m_allowPassthrough = allow;
+    emit allowPassthroughChanged();
+    if (s_compositor && m_hasView) {
+        updatePassthrough();
+    }
 }
 
 void EmbeddedView::onViewsChanged() {
     updateViewState();
+    
+    /* Another row is next to fill - maybe ours */
+    if (!m_view) {
+        polish();
+    }
+}
+
+void EmbeddedView::onViewDataChanged(const QModelIndex& topLeft, const QModelIndex& bottomRight,
+                                     const QList<int>& roles) {
+    if (!m_view) return;
+    if (!roles.isEmpty() && !roles.contains(ViewModel::TitleRole)) return;
+    
+    int row = s_compositor->viewIndexOf(m_view);
+    if (row >= topLeft.row() && row <= bottomRight.row()) {
+        updateTitle();
+    }
+}
+
+void EmbeddedView::onViewCommitted(int index, const QRegion& damage) {
+    if (!m_view || s_compositor->viewHandle(index) != m_view) return;
+    
+    /* The staging ring accumulates damage per acquire, so coalesced
+     * commits are covered by the damage returned with the frame */
+    Q_UNUSED(damage);
+    scheduleFrameFetch();
+}
+
+void EmbeddedView::onViewCursorChanged(int index) {
+    if (!m_view || s_compositor->viewHandle(index) != m_view) return;
+    updateCursor();
+}
+
+void EmbeddedView::scheduleFrameFetch() {
+    /* Coalesce bursts of commits into a single fetch */
+    if (m_frameFetchScheduled) return;
+    m_frameFetchScheduled = true;
+    QMetaObject::invokeMethod(this, &EmbeddedView::updateFrame, Qt::QueuedConnection);
 }
 
 void EmbeddedView::onSizeChanged() {
-    if (!m_hasView || !s_compositor) return;
+    /* A resize animation changes width and height every tick - polish
+     * runs once before the next frame with the final size */
+    polish();
+}
+
+void EmbeddedView::updatePolish() {
+    if (!s_compositor) return;
     
     int w = static_cast<int>(width());
     int h = static_cast<int>(height());
+    if (w <= 0 || h <= 0) return;
     
-    if (w > 0 && h > 0) {
-        s_compositor->resizeView(m_viewIndex, w, h);
+    if (m_thumbnail) {
+        /* Tiles show the view at its own size */
+        updateThumbnailSize();
+    } else if (m_view) {
+        s_compositor->resizeView(m_view, w, h, pixelRatio());
+    } else if (m_viewId <= 0 && m_viewIndex == s_compositor->viewCount()) {
+        /* The next view to map lands here - configure it at our size */
+        s_compositor->setInitialViewSize(w, h, pixelRatio());
     }
 }
 
-void EmbeddedView::updateFrame() {
-    if (!m_hasView || !s_compositor) return;
+void EmbeddedView::updateThumbnailSize() {
+    if (!m_view) return;
     
-    /* Request buffer from compositor for this view */
-    QImage frame = s_compositor->getViewFrame(m_viewIndex);
-    if (!frame.isNull() && frame.width() > 0 && frame.height() > 0) {
-        QMutexLocker lock(&m_bufferMutex);
-        
-        /* Log size changes */
-        if (m_frameBuffer.isNull() || 
-            m_frameBuffer.width() != frame.width() || 
-            m_frameBuffer.height() != frame.height()) {
-            qDebug() << "View" << m_viewIndex << "frame size:" 
-                     << frame.width() << "x" << frame.height()
-                     << "item size:" << width() << "x" << height();
+    QSize size;
+    if (m_thumbnail) {
+        size = QSize(qCeil(width() * pixelRatio()), qCeil(height() * pixelRatio()));
+    }
+    if (size == m_thumbnailSize) return;
+    
+    m_reportedView = m_view;
+    m_thumbnailSize = size;
+    s_compositor->setViewThumbnailSize(m_view, size);
+    
+    /* Frames change size - don't wait for a commit */
+    m_fullDamage = true;
+    scheduleFrameFetch();
+}
+
+void EmbeddedView::setThumbnail(bool thumbnail) {
+    if (m_thumbnail == thumbnail) return;
+    
+    m_thumbnail = thumbnail;
+    emit thumbnailChanged();
+    
+    if (!thumbnail) {
+        /* Back to full frames at the item's size */
+        m_fetchTimer.stop();
+        if (s_compositor) {
+            updateThumbnailSize();
         }
-        
-        m_frameBuffer = frame.copy();  /* Deep copy */
-        m_needsUpdate = true;
-        update();
     }
+    polish();
+    update();
 }
 
-QSGNode* EmbeddedView::updatePaintNode(QSGNode* oldNode, UpdatePaintNodeData*) {
-    QSGSimpleTextureNode* node = static_cast<QSGSimpleTextureNode*>(oldNode);
+void EmbeddedView::setThumbnailRate(int hz) {
+    hz = qMax(0, hz);
+    if (m_thumbnailRate == hz) return;
     
-    if (!node) {
-        node = new QSGSimpleTextureNode();
-        node->setOwnsTexture(true);
+    m_thumbnailRate = hz;
+    emit thumbnailRateChanged();
+}
+
+qreal EmbeddedView::pixelRatio() const {
+    return window() ? window()->effectiveDevicePixelRatio() : 1.0;
+}
+
+bool EmbeddedView::dmabufPathEnabled() const {
+    if (m_dmabufFailed || !s_compositor || !s_compositor->isHardwareRendering()) {
+        return false;
     }
+    return DmabufTexture::isSupported(window()) || VulkanTexture::isSupported(window());
+}
+
+void EmbeddedView::evictFrame() {
+    if (m_effectivelyVisible) return;
     
-    QMutexLocker lock(&m_bufferMutex);
+    {
+        QMutexLocker lock(&m_bufferMutex);
+        comp_dmabuf_close(&m_pendingDmabuf);
+        m_hasPendingDmabuf = false;
+        m_frameBuffer = QImage();
+        m_frameDamage = QRegion();
+        m_needsUpdate = false;
+        m_dropTextures = true;
+    }
+    m_fullDamage = true;
     
-    if (!m_frameBuffer.isNull() && window()) {
-        QSGTexture* texture = window()->createTextureFromImage(m_frameBuffer);
-        if (texture) {
-            node->setTexture(texture);
-            
-            /* Calculate rect that maintains aspect ratio */
-            qreal imgW = m_frameBuffer.width();
-            qreal imgH = m_frameBuffer.height();
-            qreal itemW = width();
-            qreal itemH = height();
-            
-            qreal scale = qMin(itemW / imgW, itemH / imgH);
-            qreal scaledW = imgW * scale;
-            qreal scaledH = imgH * scale;
+    if (m_view) {
+        m_evicted = true;
+        s_compositor->trimViewFrames(m_view);
+    }
+    update();
+}
+
+void EmbeddedView::updateFrame() {
+    m_frameFetchScheduled = false;
+    if (!m_hasView || !s_compositor || m_evicted) return;
+    
+    /* Tiles are refreshed at thumbnailRate - later commits are picked up
+     * by the held back fetch */
+    if (m_thumbnail && m_thumbnailRate > 0 && m_lastFetch.isValid()) {
+        qint64 wait = 1000 / m_thumbnailRate - m_lastFetch.elapsed();
+        if (wait > 0) {
+            if (!m_fetchTimer.isActive()) {
+                m_fetchTimer.start(int(wait));
+            }
+            return;
+        }
+    }
+    m_lastFetch.start();
+    
+    struct comp_view* view = m_view;
+    uint64_t start = frame_trace_enabled() ? frame_trace_now_ns() : 0;
+    
+    /* Hardware path: pass the client's DMA-BUF straight to the render thread */
+    if (dmabufPathEnabled()) {
+        struct comp_dmabuf dmabuf;
+        if (s_compositor->getViewDmabuf(m_view, &dmabuf)) {
+            m_frameIsDmabuf = true;
+            m_frameSize = QSize(int(dmabuf.width), int(dmabuf.height));
+            m_frameDownscale = 1;
             
-            /* Center the image */
-            qreal x = (itemW - scaledW) / 2.0;
-            qreal y = (itemH - scaledH) / 2.0;
+            /* Straight to the parent compositor while it can show it */
+            bool passthrough = passthroughEligible();
+            if (passthrough != isPassthroughActive()) {
+                setPassthrough(passthrough);
+            }
+            m_fullDamage = false;
+            if (m_passthrough) {
+                m_passthrough->present(&dmabuf);
+                frame_trace_mark(view, FRAME_TRACE_FETCH, start, 0);
+                return;
+            }
             
-            node->setRect(QRectF(x, y, scaledW, scaledH));
-            node->markDirty(QSGNode::DirtyMaterial);
+            QMutexLocker lock(&m_bufferMutex);
+            /* Drop a buffer the render thread never got to */
+            comp_dmabuf_close(&m_pendingDmabuf);
+            m_pendingDmabuf = dmabuf;
+            m_hasPendingDmabuf = true;
+            frame_trace_mark(view, FRAME_TRACE_FETCH, start, 0);
+            update();
+            return;
         }
+        /* wl_shm client - fall through to the CPU copy */
+    }
+    
+    /* Only DMA-BUFs can be passed through */
+    m_frameIsDmabuf = false;
+    setPassthrough(false);
+    
+    /* Borrow the view's staging buffer - no allocation, no deep copy */
+    QRegion damage;
+    int downscale = 1;
+    QImage frame = s_compositor->acquireViewFrame(m_view, &damage, &downscale);
+    if (frame.isNull()) {
+        /* Not CPU-readable yet, or every slot still in flight - the ring
+         * keeps the damage and the next commit fetches again */
+        return;
+    }
+    
+    if (!m_fullDamage && damage.isEmpty()) {
+        /* Same frame as last time */
+        return;
+    }
+    
+    QMutexLocker lock(&m_bufferMutex);
+    
+    /* Log size changes */
+    if (m_frameSize != frame.size()) {
+        qDebug() << "View" << m_title << "frame size:" 
+                 << frame.width() << "x" << frame.height()
+                 << "item size:" << width() << "x" << height();
+        m_frameSize = frame.size();
+    }
+    m_frameDownscale = downscale;
+    
+    /* Replacing an unconsumed frame releases its slot */
+    m_frameBuffer = frame;
+    if (m_fullDamage) {
+        m_frameDamage = QRegion(frame.rect());
     } else {
-        /* No frame - show placeholder */
-        QImage placeholder(qMax(1, (int)width()), qMax(1, (int)height()), QImage::Format_ARGB32);
-        placeholder.fill(m_hasView ? QColor(40, 40, 40) : QColor(60, 60, 60));
-        
-        if (window()) {
-            QSGTexture* texture = window()->createTextureFromImage(placeholder);
-            if (texture) {
-                node->setTexture(texture);
-                node->setRect(boundingRect());
+        m_frameDamage += damage;
+    }
+    m_fullDamage = false;
+    m_needsUpdate = true;
+    frame_trace_mark(view, FRAME_TRACE_FETCH, start, 0);
+    update();
+}
+
+QSGNode* EmbeddedView::updatePaintNode(QSGNode* oldNode, UpdatePaintNodeData*) {
+    ViewNode* node = static_cast<ViewNode*>(oldNode);
+    
+    QMutexLocker lock(&m_bufferMutex);
+    
+    /* Evicted - the textures (and client buffers) go with the node */
+    if (m_dropTextures) {
+        m_dropTextures = false;
+        delete node;
+        node = nullptr;
+        m_cursorChanged = true;
+    }
+    
+    if (!node) {
+        node = new ViewNode();
+    }
+    
+    if (!window()) {
+        return node;
+    }
+    
+    /* Passed through - the parent compositor shows the view */
+    if (m_passthroughShown) {
+        s_compositor->textureBudget()->report(this, 0);
+        return node;
+    }
+    
+    /* Hardware path: import the DMA-BUF, no CPU access to the pixels */
+    if (m_hasPendingDmabuf) {
+        m_hasPendingDmabuf = false;
+        uint64_t start = frame_trace_enabled() ? frame_trace_now_ns() : 0;
+        bool vulkan = VulkanTexture::isSupported(window());
+        bool imported = vulkan ? node->vulkan.import(&m_pendingDmabuf, window())
+                               : node->dmabuf.import(&m_pendingDmabuf, window());
+        if (imported) {
+            frame_trace_mark(m_view, FRAME_TRACE_UPLOAD, start, 0);
+            node->setTexture(vulkan ? node->vulkan.texture() : node->dmabuf.texture());
+            s_compositor->frameScheduler()->markPresented(m_view);
+        } else {
+            qWarning() << "View" << m_title << "DMA-BUF import failed, using CPU copies";
+            m_dmabufFailed = true;
+        }
+    }
+    
+    /* CPU path: upload only the damaged part into the persistent texture */
+    if (m_needsUpdate && !m_frameBuffer.isNull()) {
+        m_needsUpdate = false;
+        if (!node->viewTexture) {
+            node->viewTexture = std::make_unique<ViewTexture>();
+        }
+        /* Coming back from the DMA-BUF path the texture content is stale */
+        QRegion damage = m_frameDamage;
+        if (node->texture() != node->viewTexture.get()) {
+            damage = QRegion(m_frameBuffer.rect());
+        }
+        node->viewTexture->setImage(m_frameBuffer, damage);
+        if (frame_trace_enabled()) {
+            uint64_t bytes = 0;
+            for (const QRect& rect : damage & m_frameBuffer.rect()) {
+                bytes += uint64_t(rect.width()) * rect.height() * 4;
             }
+            frame_trace_mark(m_view, FRAME_TRACE_UPLOAD, 0, bytes);
+        }
+        m_frameDamage = QRegion();
+        /* The texture holds the slot until uploaded - don't pin it here */
+        m_frameBuffer = QImage();
+        s_compositor->frameScheduler()->markPresented(m_view);
+        node->setTexture(node->viewTexture.get());
+    }
+    
+    qint64 bytes = 0;
+    if (node->viewTexture) {
+        /* Uploaded texture, plus the staging buffer behind it if it is shown */
+        QSize size = node->viewTexture->textureSize();
+        bytes = qint64(size.width()) * size.height() * 4;
+        if (node->texture() == node->viewTexture.get()) {
+            bytes *= 2;
+        }
+    }
+    if (s_compositor) {
+        s_compositor->textureBudget()->report(this, bytes);
+    }
+    
+    if (node->content) {
+        /* Calculate rect that maintains aspect ratio */
+        QSize textureSize = node->texture()->textureSize();
+        qreal imgW = textureSize.width();
+        qreal imgH = textureSize.height();
+        qreal itemW = width();
+        qreal itemH = height();
+        
+        qreal scale = qMin(itemW / imgW, itemH / imgH);
+        qreal scaledW = imgW * scale;
+        qreal scaledH = imgH * scale;
+        
+        /* Center the image */
+        qreal x = (itemW - scaledW) / 2.0;
+        qreal y = (itemH - scaledH) / 2.0;
+        
+        node->content->setRect(QRectF(x, y, scaledW, scaledH));
+        /* Tiles are sampled below their size even when downscaled */
+        node->content->setFiltering(m_thumbnail ? QSGTexture::Linear : QSGTexture::Nearest);
+        node->content->markDirty(QSGNode::DirtyMaterial);
+    } else {
+        /* No frame - a solid fill, no texture */
+        if (!node->fill) {
+            node->fill = window()->createRectangleNode();
+            node->prependChildNode(node->fill);
         }
+        node->fill->setRect(boundingRect());
+        node->fill->setColor(m_hasView ? QColor(40, 40, 40) : QColor(60, 60, 60));
+    }
+    
+    /* Client cursor: a new texture only when the image changes */
+    if (m_cursorChanged) {
+        m_cursorChanged = false;
+        delete node->cursorTransform;   /* And the texture node under it */
+        node->cursorTransform = nullptr;
+        node->cursor = nullptr;
+        if (!m_cursorImage.isNull()) {
+            node->cursor = new QSGSimpleTextureNode();
+            node->cursor->setOwnsTexture(true);
+            node->cursor->setTexture(window()->createTextureFromImage(m_cursorImage));
+            node->cursor->setFiltering(QSGTexture::Linear);
+            node->cursorTransform = new QSGTransformNode();
+            node->cursorTransform->appendChildNode(node->cursor);
+            node->appendChildNode(node->cursorTransform);
+        }
+    }
+    
+    /* Pointer motion only moves it */
+    if (node->cursorTransform) {
+        bool shown = m_clientCursor && m_pointerInside && node->content;
+        qreal scale = frameScale();
+        node->cursor->setRect(shown ? QRectF(-m_cursorHotspot * scale, m_cursorSize * scale)
+                                    : QRectF());
+        QMatrix4x4 matrix;
+        matrix.translate(float(m_pointerPos.x()), float(m_pointerPos.y()));
+        node->cursorTransform->setMatrix(matrix);
     }
     
     return node;
@@ -190,7 +914,7 @@ void EmbeddedView::keyPressEvent(QKeyEvent* event) {
     }
     
     /* Focus this view before sending input */
-    s_compositor->focusView(m_viewIndex);
+    s_compositor->focusView(m_view);
     
     quint32 linuxKey = qtKeyToLinux(event->key());
     if (linuxKey != 0) {
@@ -226,11 +950,11 @@ void EmbeddedView::mousePressEvent(QMouseEvent* event) {
     }
     
     /* Focus this view */
-    s_compositor->focusView(m_viewIndex);
+    s_compositor->focusView(m_view);
     forceActiveFocus();
     
-    /* Send coordinates relative to this item */
-    s_compositor->sendPointerMotion(event->position().x(), event->position().y());
+    /* The button follows the motion within the same pointer frame */
+    sendPointerMotion(event->position());
     
     quint32 button = qtButtonToLinux(event->button());
     if (button != 0) {
@@ -260,7 +984,7 @@ void EmbeddedView::mouseMoveEvent(QMouseEvent* event) {
         return;
     }
     
-    s_compositor->sendPointerMotion(event->position().x(), event->position().y());
+    sendPointerMotion(event->position());
     event->accept();
 }
 
@@ -270,38 +994,102 @@ void EmbeddedView::hoverMoveEvent(QHoverEvent* event) {
         return;
     }
     
-    s_compositor->sendPointerMotion(event->position().x(), event->position().y());
+    sendPointerMotion(event->position());
     event->accept();
 }
 
+void EmbeddedView::hoverLeaveEvent(QHoverEvent* event) {
+    m_pointerInside = false;
+    if (!m_cursorImage.isNull() && !m_passthrough) {
+        update();
+    }
+    QQuickItem::hoverLeaveEvent(event);
+}
+
 void EmbeddedView::wheelEvent(QWheelEvent* event) {
     if (!s_compositor || !m_hasView) {
         QQuickItem::wheelEvent(event);
         return;
     }
     
-    QPoint delta = event->angleDelta();
+    /* Touchpads report pixels and an end phase; wheels report 1/120ths of
+     * a notch, 15 scroll units each like libinput. Qt deltas are positive
+     * towards the top and left, Wayland's towards the bottom and right. */
+    bool inverted = event->inverted();
+    QPoint pixels = event->pixelDelta();
+    if (!pixels.isNull() || event->phase() == Qt::ScrollEnd) {
+        if (pixels.y() != 0 || event->phase() == Qt::ScrollEnd) {
+            s_compositor->sendPointerAxis(false, -pixels.y(), 0, true, inverted);
+        }
+        if (pixels.x() != 0 || event->phase() == Qt::ScrollEnd) {
+            s_compositor->sendPointerAxis(true, -pixels.x(), 0, true, inverted);
+        }
+    } else {
+        QPoint delta = event->angleDelta();
+        if (delta.y() != 0) {
+            s_compositor->sendPointerAxis(false, -delta.y() * 15.0 / 120.0, -delta.y(),
+                                          false, inverted);
+        }
+        if (delta.x() != 0) {
+            s_compositor->sendPointerAxis(true, -delta.x() * 15.0 / 120.0, -delta.x(),
+                                          false, inverted);
+        }
+    }
+    
+    event->accept();
+}
+
+/* Item coordinates to pixels of the frame, which is drawn aspect-fit */
+QPointF EmbeddedView::mapToFrame(const QPointF& pos) const {
+    if (m_frameSize.isEmpty() || width() <= 0 || height() <= 0) {
+        return pos;
+    }
     
-    if (delta.y() != 0) {
-        s_compositor->sendPointerAxis(false, -delta.y() / 120.0 * 15.0);
+    qreal scale = qMin(width() / m_frameSize.width(), height() / m_frameSize.height());
+    qreal x = (width() - m_frameSize.width() * scale) / 2.0;
+    qreal y = (height() - m_frameSize.height() * scale) / 2.0;
+    return QPointF((pos.x() - x) / scale, (pos.y() - y) / scale);
+}
+
+qreal EmbeddedView::frameScale() const {
+    if (m_frameSize.isEmpty() || width() <= 0 || height() <= 0) {
+        return 1.0;
     }
-    if (delta.x() != 0) {
-        s_compositor->sendPointerAxis(true, delta.x() / 120.0 * 15.0);
+    
+    qreal scale = qMin(width() / m_frameSize.width(), height() / m_frameSize.height());
+    return scale / m_frameDownscale;
+}
+
+void EmbeddedView::sendPointerMotion(const QPointF& pos) {
+    /* The client's cursor follows here at once, no round trip */
+    m_pointerPos = pos;
+    m_pointerInside = true;
+    if (!m_cursorImage.isNull() && !m_passthrough) {
+        update();
     }
     
-    event->accept();
+    /* Scaled back to the view's buffer for tiles */
+    QPointF framePos = mapToFrame(pos) * m_frameDownscale;
+    s_compositor->sendViewPointerMotion(m_view, framePos.x(), framePos.y(),
+                                        m_coalescePointer);
+}
+
+void EmbeddedView::setCoalescePointer(bool coalesce) {
+    if (m_coalescePointer == coalesce) return;
+    m_coalescePointer = coalesce;
+    emit coalescePointerChanged();
 }
 
 void EmbeddedView::focusInEvent(QFocusEvent* event) {
-    qDebug() << "EmbeddedView" << m_viewIndex << "got focus";
+    qDebug() << "EmbeddedView" << m_title << "got focus";
     if (s_compositor && m_hasView) {
-        s_compositor->focusView(m_viewIndex);
+        s_compositor->focusView(m_view);
     }
     QQuickItem::focusInEvent(event);
 }
 
 void EmbeddedView::focusOutEvent(QFocusEvent* event) {
-    qDebug() << "EmbeddedView" << m_viewIndex << "lost focus";
+    qDebug() << "EmbeddedView" << m_title << "lost focus";
     QQuickItem::focusOutEvent(event);
 }
 
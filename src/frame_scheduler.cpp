@@ -0,0 +1,209 @@
+/*
+ * frame_scheduler.cpp - Presentation-driven frame callbacks
+ *
+ * SPDX-License-Identifier: MIT
+ * Copyright (c) 2024
+ */
+#include "frame_scheduler.h"
+#include "compositor_wrapper.h"
+#include "frame_trace.h"
+
+#include <QScreen>
+#include <QMutexLocker>
+
+#include <time.h>
+
+FrameScheduler::FrameScheduler(CompositorWrapper* compositor)
+    : QObject(compositor)
+    , m_compositor(compositor)
+{
+    m_fallback.setSingleShot(true);
+    m_fallback.setInterval(kFallbackIntervalMs);
+    connect(&m_fallback, &QTimer::timeout, this, &FrameScheduler::onFallback);
+    
+    connect(&m_hiddenTimer, &QTimer::timeout, this, &FrameScheduler::onHiddenTimer);
+    connect(compositor, &CompositorWrapper::viewsChanged, this, &FrameScheduler::pruneViews);
+}
+
+quint64 FrameScheduler::monotonicNs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return quint64(now.tv_sec) * 1000000000ull + quint64(now.tv_nsec);
+}
+
+void FrameScheduler::addWindow(QQuickWindow* window) {
+    if (!window) return;
+
+    for (const QPointer<QQuickWindow>& known : m_windows) {
+        if (known == window) return;
+    }
+    m_windows.append(window);
+
+    /* Emitted on the render thread - queue to our (GUI) thread */
+    connect(window, &QQuickWindow::frameSwapped,
+            this, &FrameScheduler::onFrameSwapped, Qt::QueuedConnection);
+}
+
+void FrameScheduler::markPresented(struct comp_view* view) {
+    if (!view) return;
+
+    QMutexLocker lock(&m_mutex);
+    m_rendered.insert(view);
+}
+
+void FrameScheduler::scheduleFrame() {
+    /* Every view on screen is passed through - nothing for Qt to draw */
+    if (!m_passthrough.isEmpty() && visibleViews().isEmpty()) return;
+    
+    bool exposed = false;
+    for (const QPointer<QQuickWindow>& window : m_windows) {
+        if (window && window->isExposed()) {
+            window->update();
+            exposed = true;
+        }
+    }
+
+    /* Nothing will swap - release the clients at a low rate instead */
+    if (!exposed && !m_fallback.isActive()) {
+        m_fallback.start();
+    }
+}
+
+quint32 FrameScheduler::refreshNs() const {
+    for (const QPointer<QQuickWindow>& window : m_windows) {
+        if (window && window->screen() && window->screen()->refreshRate() > 0) {
+            return quint32(1000000000.0 / window->screen()->refreshRate());
+        }
+    }
+    return 0;
+}
+
+void FrameScheduler::onFrameSwapped() {
+    m_fallback.stop();
+
+    QSet<struct comp_view*> presented;
+    {
+        QMutexLocker lock(&m_mutex);
+        presented.swap(m_rendered);
+    }
+    
+    for (struct comp_view* view : presented) {
+        frame_trace_mark(view, FRAME_TRACE_PRESENT, 0, 0);
+    }
+
+    m_compositor->completeFrame(visibleViews(), presented, monotonicNs(), refreshNs(), ++m_seq);
+}
+
+void FrameScheduler::onFallback() {
+    /* Not presented - frame done only, feedback waits for a real swap */
+    m_compositor->completeFrame(visibleViews(), QSet<struct comp_view*>(),
+                                monotonicNs(), refreshNs(), m_seq);
+}
+
+QList<struct comp_view*> FrameScheduler::visibleViews() const {
+    QList<struct comp_view*> views;
+    for (int i = 0; i < m_compositor->viewCount(); i++) {
+        struct comp_view* view = m_compositor->viewHandle(i);
+        if (m_hosts.value(view) > 0 && !m_passthrough.contains(view)) {
+            views.append(view);
+        }
+    }
+    return views;
+}
+
+QList<struct comp_view*> FrameScheduler::hiddenViews() const {
+    QList<struct comp_view*> views;
+    for (int i = 0; i < m_compositor->viewCount(); i++) {
+        struct comp_view* view = m_compositor->viewHandle(i);
+        if (m_hosts.value(view) == 0) {
+            views.append(view);
+        }
+    }
+    return views;
+}
+
+void FrameScheduler::setViewVisible(struct comp_view* view, bool visible) {
+    if (!view) return;
+    
+    int& hosts = m_hosts[view];
+    if (visible) {
+        if (hosts++ > 0) return;
+        /* Release it with the next presented frame */
+        scheduleFrame();
+    } else {
+        /* Unpaired hides are ignored */
+        if (hosts == 0 || --hosts > 0) return;
+    }
+    updateHiddenTimer();
+}
+
+bool FrameScheduler::isViewVisible(struct comp_view* view) const {
+    return m_hosts.value(view) > 0;
+}
+
+void FrameScheduler::setViewPassthrough(struct comp_view* view, bool passthrough) {
+    if (!view) return;
+    
+    if (passthrough) {
+        m_passthrough.insert(view);
+    } else if (m_passthrough.remove(view)) {
+        /* Back in Qt's frames */
+        scheduleFrame();
+    }
+}
+
+void FrameScheduler::passthroughPresented(struct comp_view* view) {
+    if (!m_passthrough.contains(view)) return;
+    
+    /* Shown by the parent at about this time - its own presentation
+     * feedback doesn't reach us */
+    frame_trace_mark(view, FRAME_TRACE_PRESENT, 0, 0);
+    QSet<struct comp_view*> presented = { view };
+    m_compositor->completeFrame({ view }, presented, monotonicNs(), refreshNs(), ++m_seq);
+}
+
+void FrameScheduler::setHiddenFrameRate(int hz) {
+    hz = qMax(0, hz);
+    if (m_hiddenFrameRate == hz) return;
+    
+    m_hiddenFrameRate = hz;
+    updateHiddenTimer();
+}
+
+void FrameScheduler::updateHiddenTimer() {
+    if (m_hiddenFrameRate <= 0 || hiddenViews().isEmpty()) {
+        m_hiddenTimer.stop();
+        return;
+    }
+    
+    int interval = qMax(1, 1000 / m_hiddenFrameRate);
+    if (!m_hiddenTimer.isActive() || m_hiddenTimer.interval() != interval) {
+        m_hiddenTimer.start(interval);
+    }
+}
+
+void FrameScheduler::onHiddenTimer() {
+    m_compositor->completeFrame(hiddenViews(), QSet<struct comp_view*>(), monotonicNs(),
+                                refreshNs(), m_seq);
+}
+
+void FrameScheduler::pruneViews() {
+    QSet<struct comp_view*> current;
+    for (int i = 0; i < m_compositor->viewCount(); i++) {
+        current.insert(m_compositor->viewHandle(i));
+    }
+    for (auto it = m_hosts.begin(); it != m_hosts.end();) {
+        if (current.contains(it.key())) {
+            ++it;
+        } else {
+            it = m_hosts.erase(it);
+        }
+    }
+    m_passthrough.intersect(current);
+    
+    QMutexLocker lock(&m_mutex);
+    m_rendered.intersect(current);
+    lock.unlock();
+    
+    updateHiddenTimer();
+}
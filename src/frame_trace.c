@@ -0,0 +1,316 @@
+/*
+ * frame_trace.c - Frame latency tracing and per-view counters
+ *
+ * One mutex guards everything. Call sites are a handful per frame, so
+ * contention is not a concern; while tracing is off they return before
+ * taking it.
+ *
+ * SPDX-License-Identifier: MIT
+ * Copyright (c) 2024
+ */
+#define _GNU_SOURCE
+
+#include "frame_trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/syscall.h>
+
+#include <wlr/util/log.h>
+
+/* Views tracked at once - more are folded into the totals only */
+#define TRACE_MAX_VIEWS 64
+
+/* Latency samples per histogram */
+#define TRACE_LATENCY_SAMPLES 512
+
+/* Present timestamps kept for the frame rate - bounds it to this many fps */
+#define TRACE_PRESENT_HISTORY 256
+
+/* Raw events kept for the trace file */
+#define TRACE_MAX_EVENTS 16384
+
+struct trace_event {
+    uint64_t ts_ns;
+    uint64_t dur_ns;
+    uint64_t bytes;
+    uint64_t latency_ns;    /* Present only */
+    const void* view;
+    uint32_t tid;
+    uint8_t stage;
+};
+
+struct view_trace {
+    const void* view;
+    bool used;
+    uint64_t pending_commit_ns; /* Latest commit not yet presented, 0 if none */
+
+    uint64_t latency[TRACE_LATENCY_SAMPLES];
+    uint32_t n_latency;
+    uint32_t latency_pos;
+
+    uint64_t presents[TRACE_PRESENT_HISTORY];
+    uint32_t n_presents;
+    uint32_t present_pos;
+
+    uint64_t frames;
+    uint64_t dropped;
+    uint64_t bytes;
+};
+
+static const char* const stage_names[FRAME_TRACE_STAGE_COUNT] = {
+    "commit", "render", "capture", "fetch", "upload", "present",
+};
+
+/* -1 until WLROOTS_QT_TRACE was read */
+static atomic_int trace_state = -1;
+
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct view_trace views[TRACE_MAX_VIEWS];
+static struct view_trace total;  /* dropped only holds forgotten views' */
+static struct trace_event* events;
+static uint32_t n_events;
+static uint32_t event_pos;
+
+static _Thread_local uint32_t thread_id;
+
+static uint32_t current_tid(void) {
+    if (!thread_id) {
+        thread_id = (uint32_t)syscall(SYS_gettid);
+    }
+    return thread_id;
+}
+
+void frame_trace_set_enabled(bool enabled) {
+    atomic_store(&trace_state, enabled ? 1 : 0);
+}
+
+bool frame_trace_enabled(void) {
+    int state = atomic_load_explicit(&trace_state, memory_order_relaxed);
+    if (state < 0) {
+        const char* env = getenv("WLROOTS_QT_TRACE");
+        state = env && (strcmp(env, "1") == 0 || strcmp(env, "true") == 0);
+        atomic_store(&trace_state, state);
+    }
+    return state > 0;
+}
+
+uint64_t frame_trace_now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+/* Find or claim the slot of view - under trace_lock */
+static struct view_trace* view_lookup(const void* view, bool create) {
+    struct view_trace* free_slot = NULL;
+    for (int i = 0; i < TRACE_MAX_VIEWS; i++) {
+        if (views[i].used && views[i].view == view) {
+            return &views[i];
+        }
+        if (!views[i].used && !free_slot) {
+            free_slot = &views[i];
+        }
+    }
+    if (!create || !free_slot) return NULL;
+
+    memset(free_slot, 0, sizeof(*free_slot));
+    free_slot->view = view;
+    free_slot->used = true;
+    return free_slot;
+}
+
+static void record_commit(struct view_trace* vt, uint64_t now) {
+    /* The previous commit is replaced before anyone saw it */
+    if (vt->pending_commit_ns) {
+        vt->dropped++;
+    }
+    vt->pending_commit_ns = now;
+}
+
+static uint64_t record_present(struct view_trace* vt, uint64_t now) {
+    vt->frames++;
+    vt->presents[vt->present_pos] = now;
+    vt->present_pos = (vt->present_pos + 1) % TRACE_PRESENT_HISTORY;
+    if (vt->n_presents < TRACE_PRESENT_HISTORY) vt->n_presents++;
+
+    if (!vt->pending_commit_ns) return 0;
+
+    uint64_t latency = now - vt->pending_commit_ns;
+    vt->pending_commit_ns = 0;
+    vt->latency[vt->latency_pos] = latency;
+    vt->latency_pos = (vt->latency_pos + 1) % TRACE_LATENCY_SAMPLES;
+    if (vt->n_latency < TRACE_LATENCY_SAMPLES) vt->n_latency++;
+    return latency;
+}
+
+void frame_trace_mark(const void* view, enum frame_trace_stage stage, uint64_t start_ns,
+                      uint64_t bytes) {
+    if (!frame_trace_enabled() || stage >= FRAME_TRACE_STAGE_COUNT) return;
+
+    uint64_t now = frame_trace_now_ns();
+    uint64_t latency = 0;
+
+    pthread_mutex_lock(&trace_lock);
+
+    struct view_trace* vt = view ? view_lookup(view, true) : NULL;
+    if (stage == FRAME_TRACE_COMMIT) {
+        if (vt) record_commit(vt, now);
+    } else if (stage == FRAME_TRACE_PRESENT) {
+        if (vt) latency = record_present(vt, now);
+        /* Totals get the same sample so percentiles cover every view */
+        total.frames++;
+        total.presents[total.present_pos] = now;
+        total.present_pos = (total.present_pos + 1) % TRACE_PRESENT_HISTORY;
+        if (total.n_presents < TRACE_PRESENT_HISTORY) total.n_presents++;
+        if (latency) {
+            total.latency[total.latency_pos] = latency;
+            total.latency_pos = (total.latency_pos + 1) % TRACE_LATENCY_SAMPLES;
+            if (total.n_latency < TRACE_LATENCY_SAMPLES) total.n_latency++;
+        }
+    }
+    if (bytes) {
+        if (vt) vt->bytes += bytes;
+        total.bytes += bytes;
+    }
+
+    if (!events) {
+        events = calloc(TRACE_MAX_EVENTS, sizeof(*events));
+    }
+    if (events) {
+        struct trace_event* ev = &events[event_pos];
+        ev->ts_ns = start_ns ? start_ns : now;
+        ev->dur_ns = start_ns && now > start_ns ? now - start_ns : 0;
+        ev->bytes = bytes;
+        ev->latency_ns = latency;
+        ev->view = view;
+        ev->tid = current_tid();
+        ev->stage = (uint8_t)stage;
+        event_pos = (event_pos + 1) % TRACE_MAX_EVENTS;
+        if (n_events < TRACE_MAX_EVENTS) n_events++;
+    }
+
+    pthread_mutex_unlock(&trace_lock);
+}
+
+static int compare_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+static void fill_stats(const struct view_trace* vt, uint64_t dropped,
+                       struct frame_trace_stats* stats) {
+    memset(stats, 0, sizeof(*stats));
+    stats->frames = vt->frames;
+    stats->dropped = dropped;
+    stats->bytes_copied = vt->bytes;
+
+    if (vt->n_latency > 0) {
+        uint64_t sorted[TRACE_LATENCY_SAMPLES];
+        memcpy(sorted, vt->latency, vt->n_latency * sizeof(uint64_t));
+        qsort(sorted, vt->n_latency, sizeof(uint64_t), compare_u64);
+        stats->latency_p50_ns = sorted[(vt->n_latency - 1) * 50 / 100];
+        stats->latency_p99_ns = sorted[(vt->n_latency - 1) * 99 / 100];
+    }
+
+    /* Presents within the last second */
+    uint64_t now = frame_trace_now_ns();
+    uint32_t recent = 0;
+    for (uint32_t i = 0; i < vt->n_presents; i++) {
+        if (now - vt->presents[i] <= 1000000000ull) recent++;
+    }
+    stats->fps = recent;
+}
+
+bool frame_trace_get_stats(const void* view, struct frame_trace_stats* stats) {
+    if (!stats) return false;
+
+    pthread_mutex_lock(&trace_lock);
+
+    bool found = true;
+    if (view) {
+        struct view_trace* vt = view_lookup(view, false);
+        if (vt) {
+            fill_stats(vt, vt->dropped, stats);
+        } else {
+            found = false;
+        }
+    } else {
+        uint64_t dropped = total.dropped;
+        for (int i = 0; i < TRACE_MAX_VIEWS; i++) {
+            if (views[i].used) dropped += views[i].dropped;
+        }
+        fill_stats(&total, dropped, stats);
+    }
+
+    pthread_mutex_unlock(&trace_lock);
+
+    if (!found) {
+        memset(stats, 0, sizeof(*stats));
+    }
+    return found;
+}
+
+void frame_trace_forget_view(const void* view) {
+    if (!view) return;
+
+    pthread_mutex_lock(&trace_lock);
+    struct view_trace* vt = view_lookup(view, false);
+    if (vt) {
+        /* Its drops stay in the totals */
+        total.dropped += vt->dropped;
+        vt->used = false;
+    }
+    pthread_mutex_unlock(&trace_lock);
+}
+
+bool frame_trace_write_json(const char* path) {
+    if (!path) return false;
+
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        wlr_log(WLR_ERROR, "Failed to open trace file %s", path);
+        return false;
+    }
+
+    int pid = (int)getpid();
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+    pthread_mutex_lock(&trace_lock);
+
+    uint32_t first = (event_pos + TRACE_MAX_EVENTS - n_events) % TRACE_MAX_EVENTS;
+    for (uint32_t i = 0; i < n_events; i++) {
+        const struct trace_event* ev = &events[(first + i) % TRACE_MAX_EVENTS];
+
+        fprintf(file, "%s{\"name\":\"%s\",\"cat\":\"frame\",\"pid\":%d,\"tid\":%u,\"ts\":%.3f,",
+                i ? ",\n" : "", stage_names[ev->stage], pid, ev->tid, ev->ts_ns / 1000.0);
+        if (ev->dur_ns) {
+            fprintf(file, "\"ph\":\"X\",\"dur\":%.3f,", ev->dur_ns / 1000.0);
+        } else {
+            fprintf(file, "\"ph\":\"i\",\"s\":\"t\",");
+        }
+        fprintf(file, "\"args\":{\"view\":\"%p\",\"bytes\":%llu",
+                ev->view, (unsigned long long)ev->bytes);
+        if (ev->latency_ns) {
+            fprintf(file, ",\"latency_ms\":%.3f", ev->latency_ns / 1000000.0);
+        }
+        fprintf(file, "}}");
+    }
+
+    pthread_mutex_unlock(&trace_lock);
+
+    fprintf(file, "\n]}\n");
+    bool ok = ferror(file) == 0;
+    if (fclose(file) != 0) ok = false;
+
+    if (!ok) {
+        wlr_log(WLR_ERROR, "Failed to write trace file %s", path);
+    }
+    return ok;
+}
@@ -0,0 +1,385 @@
+/*
+ * gpu_probe.c - Render node discovery and capability probing
+ *
+ * Cache file ($XDG_RUNTIME_DIR/wlroots-qt-gpu-probe), one record per line:
+ *
+ *   wlroots-qt-gpu-probe 1
+ *   boot <boot_id>
+ *   node <path> <usable>
+ *   format <fourcc> <modifier>...      (hex, belongs to the node above)
+ *
+ * It is only used when the boot id matches and it lists exactly the
+ * render nodes present now. Sysfs facts (driver, ids, boot_vga) are cheap
+ * and always read fresh.
+ *
+ * SPDX-License-Identifier: MIT
+ * Copyright (c) 2024
+ */
+#define _GNU_SOURCE
+
+#include "gpu_probe.h"
+#include "frame_trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <wlr/config.h>
+#include <wlr/render/drm_format_set.h>
+#include <wlr/render/wlr_renderer.h>
+#include <wlr/types/wlr_buffer.h>
+#include <wlr/util/log.h>
+
+#ifdef WLR_HAS_GLES2_RENDERER
+#include <wlr/render/gles2.h>
+#endif
+
+#define CACHE_NAME "wlroots-qt-gpu-probe"
+#define CACHE_MAGIC "wlroots-qt-gpu-probe 1"
+
+static pthread_once_t probe_once = PTHREAD_ONCE_INIT;
+static struct gpu_probe probe;
+
+static pthread_mutex_t preferred_lock = PTHREAD_MUTEX_INITIALIZER;
+static char preferred[64];
+
+/* First line of a sysfs attribute of the node's device, "" if missing */
+static void read_device_attr(const char* name, const char* attr, char* buf, size_t size) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "/sys/class/drm/%s/device/%s", name, attr);
+
+    buf[0] = '\0';
+    FILE* file = fopen(path, "r");
+    if (!file) return;
+    if (fgets(buf, (int)size, file)) {
+        buf[strcspn(buf, "\n")] = '\0';
+    }
+    fclose(file);
+}
+
+/* Name of the kernel driver bound to the node's device */
+static void read_driver(const char* name, char* buf, size_t size) {
+    char path[PATH_MAX];
+    char target[PATH_MAX];
+    snprintf(path, sizeof(path), "/sys/class/drm/%s/device/driver", name);
+
+    buf[0] = '\0';
+    ssize_t len = readlink(path, target, sizeof(target) - 1);
+    if (len <= 0) return;
+    target[len] = '\0';
+
+    const char* base = strrchr(target, '/');
+    snprintf(buf, size, "%s", base ? base + 1 : target);
+}
+
+static int node_number(const struct gpu_node* node) {
+    const char* name = strrchr(node->path, '/');
+    return name ? atoi(name + 1 + strlen("renderD")) : 0;
+}
+
+static int compare_nodes(const void* a, const void* b) {
+    return node_number(a) - node_number(b);
+}
+
+/* Fill in every render node with what sysfs knows about it */
+static void enumerate_nodes(struct gpu_probe* p) {
+    DIR* dir = opendir("/dev/dri");
+    if (!dir) return;
+
+    struct dirent* entry;
+    while ((entry = readdir(dir)) && p->n_nodes < GPU_PROBE_MAX_NODES) {
+        if (strncmp(entry->d_name, "renderD", strlen("renderD")) != 0) continue;
+
+        struct gpu_node* node = &p->nodes[p->n_nodes++];
+        memset(node, 0, sizeof(*node));
+        snprintf(node->path, sizeof(node->path), "/dev/dri/%s", entry->d_name);
+
+        char value[32];
+        read_device_attr(entry->d_name, "vendor", value, sizeof(value));
+        node->vendor_id = (uint16_t)strtoul(value, NULL, 16);
+        read_device_attr(entry->d_name, "device", value, sizeof(value));
+        node->device_id = (uint16_t)strtoul(value, NULL, 16);
+        read_device_attr(entry->d_name, "boot_vga", value, sizeof(value));
+        node->boot_vga = value[0] == '1';
+        read_driver(entry->d_name, node->driver, sizeof(node->driver));
+    }
+    closedir(dir);
+
+    qsort(p->nodes, p->n_nodes, sizeof(struct gpu_node), compare_nodes);
+}
+
+#ifdef WLR_HAS_GLES2_RENDERER
+static void free_formats(struct gpu_node* node) {
+    for (uint32_t i = 0; i < node->n_formats; i++) {
+        free(node->formats[i].modifiers);
+    }
+    free(node->formats);
+    node->formats = NULL;
+    node->n_formats = 0;
+}
+
+/* Append a format to node, returns NULL when out of memory */
+static struct gpu_format* add_format(struct gpu_node* node, uint32_t format) {
+    struct gpu_format* formats = realloc(node->formats,
+                                         (node->n_formats + 1) * sizeof(struct gpu_format));
+    if (!formats) return NULL;
+    node->formats = formats;
+
+    struct gpu_format* f = &formats[node->n_formats++];
+    f->format = format;
+    f->n_modifiers = 0;
+    f->modifiers = NULL;
+    return f;
+}
+
+static bool add_modifier(struct gpu_format* f, uint64_t modifier) {
+    uint64_t* modifiers = realloc(f->modifiers, (f->n_modifiers + 1) * sizeof(uint64_t));
+    if (!modifiers) return false;
+    f->modifiers = modifiers;
+    f->modifiers[f->n_modifiers++] = modifier;
+    return true;
+}
+
+/* Bring up a GLES2 renderer on the node and keep its DMA-BUF formats */
+static void probe_node(struct gpu_node* node) {
+    int fd = open(node->path, O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        wlr_log(WLR_INFO, "GPU probe: cannot open %s: %s", node->path, strerror(errno));
+        return;
+    }
+
+    /* Creates a GBM device and an EGL display on the node */
+    struct wlr_renderer* renderer = wlr_gles2_renderer_create_with_drm_fd(fd);
+    close(fd);
+    if (!renderer) {
+        wlr_log(WLR_INFO, "GPU probe: no GLES2 renderer on %s", node->path);
+        return;
+    }
+
+    const struct wlr_drm_format_set* set =
+        wlr_renderer_get_texture_formats(renderer, WLR_BUFFER_CAP_DMABUF);
+    bool ok = set && set->len > 0;
+    for (size_t i = 0; ok && i < set->len; i++) {
+        struct gpu_format* f = add_format(node, set->formats[i].format);
+        ok = f != NULL;
+        for (size_t j = 0; ok && j < set->formats[i].len; j++) {
+            ok = add_modifier(f, set->formats[i].modifiers[j]);
+        }
+    }
+    wlr_renderer_destroy(renderer);
+
+    if (!ok) {
+        free_formats(node);
+        return;
+    }
+    node->usable = true;
+}
+
+static bool read_boot_id(char* buf, size_t size) {
+    buf[0] = '\0';
+    FILE* file = fopen("/proc/sys/kernel/random/boot_id", "r");
+    if (!file) return false;
+    if (fgets(buf, (int)size, file)) {
+        buf[strcspn(buf, "\n")] = '\0';
+    }
+    fclose(file);
+    return buf[0] != '\0';
+}
+
+static bool cache_path(char* buf, size_t size) {
+    const char* dir = getenv("XDG_RUNTIME_DIR");
+    if (!dir || !dir[0]) return false;
+    return snprintf(buf, size, "%s/" CACHE_NAME, dir) < (int)size;
+}
+
+/* Take usable/formats from the cache if it is for this boot and nodes */
+static bool load_cache(struct gpu_probe* p, const char* path, const char* boot_id) {
+    FILE* file = fopen(path, "r");
+    if (!file) return false;
+
+    char* line = NULL;
+    size_t capacity = 0;
+    int current = -1;
+    bool header = false;
+    bool boot = false;
+    bool ok = true;
+
+    while (ok && getline(&line, &capacity, file) > 0) {
+        line[strcspn(line, "\n")] = '\0';
+        char* save = NULL;
+        char* key = strtok_r(line, " ", &save);
+        if (!key) continue;
+
+        if (!header) {
+            char* version = strtok_r(NULL, " ", &save);
+            header = true;
+            ok = strcmp(key, CACHE_NAME) == 0 && version && strcmp(version, "1") == 0;
+        } else if (strcmp(key, "boot") == 0) {
+            char* id = strtok_r(NULL, " ", &save);
+            boot = id && strcmp(id, boot_id) == 0;
+            ok = boot;
+        } else if (strcmp(key, "node") == 0) {
+            char* node_path = strtok_r(NULL, " ", &save);
+            char* usable = strtok_r(NULL, " ", &save);
+            current++;
+            ok = boot && node_path && usable && current < (int)p->n_nodes &&
+                 strcmp(node_path, p->nodes[current].path) == 0;
+            if (ok) p->nodes[current].usable = strcmp(usable, "1") == 0;
+        } else if (strcmp(key, "format") == 0) {
+            char* token = strtok_r(NULL, " ", &save);
+            ok = current >= 0 && token;
+            struct gpu_format* f = ok ?
+                add_format(&p->nodes[current], (uint32_t)strtoul(token, NULL, 16)) : NULL;
+            ok = f != NULL;
+            while (ok && (token = strtok_r(NULL, " ", &save))) {
+                ok = add_modifier(f, strtoull(token, NULL, 16));
+            }
+        }
+    }
+    free(line);
+    fclose(file);
+
+    ok = ok && boot && current + 1 == (int)p->n_nodes;
+    if (!ok) {
+        for (uint32_t i = 0; i < p->n_nodes; i++) {
+            free_formats(&p->nodes[i]);
+            p->nodes[i].usable = false;
+        }
+    }
+    return ok;
+}
+
+/* Write the cache next to its final name and move it into place */
+static void save_cache(const struct gpu_probe* p, const char* path, const char* boot_id) {
+    char tmp[PATH_MAX];
+    if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) >= (int)sizeof(tmp)) return;
+
+    int fd = mkstemp(tmp);
+    if (fd < 0) return;
+    FILE* file = fdopen(fd, "w");
+    if (!file) {
+        close(fd);
+        unlink(tmp);
+        return;
+    }
+
+    fprintf(file, CACHE_MAGIC "\nboot %s\n", boot_id);
+    for (uint32_t i = 0; i < p->n_nodes; i++) {
+        const struct gpu_node* node = &p->nodes[i];
+        fprintf(file, "node %s %d\n", node->path, node->usable ? 1 : 0);
+        for (uint32_t j = 0; j < node->n_formats; j++) {
+            const struct gpu_format* f = &node->formats[j];
+            fprintf(file, "format %x", f->format);
+            for (uint32_t k = 0; k < f->n_modifiers; k++) {
+                fprintf(file, " %llx", (unsigned long long)f->modifiers[k]);
+            }
+            fprintf(file, "\n");
+        }
+    }
+
+    bool ok = ferror(file) == 0;
+    if (fclose(file) != 0) ok = false;
+    if (!ok || rename(tmp, path) != 0) {
+        wlr_log(WLR_INFO, "GPU probe: could not write cache %s", path);
+        unlink(tmp);
+    }
+}
+#endif
+
+static void probe_run(void) {
+    uint64_t start_ns = frame_trace_now_ns();
+
+    enumerate_nodes(&probe);
+
+#ifdef WLR_HAS_GLES2_RENDERER
+    char boot_id[64];
+    char path[PATH_MAX];
+    bool cacheable = read_boot_id(boot_id, sizeof(boot_id)) && cache_path(path, sizeof(path));
+
+    if (cacheable && load_cache(&probe, path, boot_id)) {
+        probe.from_cache = true;
+    } else {
+        for (uint32_t i = 0; i < probe.n_nodes; i++) {
+            probe_node(&probe.nodes[i]);
+        }
+        if (cacheable) {
+            save_cache(&probe, path, boot_id);
+        }
+    }
+#endif
+
+    for (uint32_t i = 0; i < probe.n_nodes; i++) {
+        const struct gpu_node* node = &probe.nodes[i];
+        wlr_log(WLR_INFO, "GPU %s: %s %04x:%04x%s, %s, %u DMA-BUF formats", node->path,
+                node->driver[0] ? node->driver : "unknown", node->vendor_id, node->device_id,
+                node->boot_vga ? " (boot VGA)" : "", node->usable ? "usable" : "not usable",
+                node->n_formats);
+    }
+    wlr_log(WLR_INFO, "GPU probe: %u render nodes in %.1f ms%s", probe.n_nodes,
+            (frame_trace_now_ns() - start_ns) / 1e6, probe.from_cache ? " (cached)" : "");
+}
+
+const struct gpu_probe* gpu_probe_get(void) {
+    pthread_once(&probe_once, probe_run);
+    return &probe;
+}
+
+void gpu_probe_set_preferred(const char* node) {
+    pthread_mutex_lock(&preferred_lock);
+    snprintf(preferred, sizeof(preferred), "%s", node ? node : "");
+    pthread_mutex_unlock(&preferred_lock);
+}
+
+/* Whether want names node, by path or by node name */
+static bool node_matches(const struct gpu_node* node, const char* want) {
+    if (strcmp(node->path, want) == 0) return true;
+    const char* name = strrchr(node->path, '/');
+    return name && strcmp(name + 1, want) == 0;
+}
+
+const struct gpu_node* gpu_probe_selected(void) {
+    const struct gpu_probe* p = gpu_probe_get();
+
+    char want[64];
+    pthread_mutex_lock(&preferred_lock);
+    snprintf(want, sizeof(want), "%s", preferred);
+    pthread_mutex_unlock(&preferred_lock);
+    if (!want[0]) {
+        const char* env = getenv("WLROOTS_QT_RENDER_NODE");
+        snprintf(want, sizeof(want), "%s", env ? env : "");
+    }
+
+    if (want[0]) {
+        bool found = false;
+        for (uint32_t i = 0; i < p->n_nodes && !found; i++) {
+            if (!node_matches(&p->nodes[i], want)) continue;
+            if (p->nodes[i].usable) return &p->nodes[i];
+            found = true;
+        }
+        wlr_log(WLR_ERROR, "Render node %s is %s, choosing another", want,
+                found ? "not usable" : "missing");
+    }
+
+    /* With several GPUs the one not driving the firmware console is
+     * usually the discrete one */
+    const struct gpu_node* first = NULL;
+    uint32_t n_usable = 0;
+    for (uint32_t i = 0; i < p->n_nodes; i++) {
+        if (!p->nodes[i].usable) continue;
+        if (!first) first = &p->nodes[i];
+        n_usable++;
+    }
+    if (n_usable > 1) {
+        for (uint32_t i = 0; i < p->n_nodes; i++) {
+            const struct gpu_node* node = &p->nodes[i];
+            if (node->usable && node->vendor_id && !node->boot_vga) return node;
+        }
+    }
+    return first;
+}
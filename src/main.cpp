@@ -8,13 +8,19 @@
 #include <QQmlApplicationEngine>
 #include <QQmlContext>
 #include <QQuickWindow>
-#include <QTimer>
+#include <QQuickGraphicsConfiguration>
+#include <QElapsedTimer>
 #include <QDebug>
 #include <QCommandLineParser>
 
 #include "compositor_wrapper.h"
 #include "embedded_view.h"
+#include "view_model.h"
+#include "dmabuf_texture.h"
+#include "vulkan_texture.h"
+#include "compositor_core.h"
 
+#include <algorithm>
 #include <cstdlib>
 #include <iostream>
 
@@ -24,10 +30,25 @@ void printUsage() {
     std::cout << "Options:\n";
     std::cout << "  --hardware, -hw    Use hardware-accelerated rendering (GLES2)\n";
     std::cout << "  --software, -sw    Use software rendering (Pixman) [default]\n";
+    std::cout << "  --vulkan, -vk      Use hardware rendering with Vulkan, in wlroots and Qt\n";
+    std::cout << "  --render-node <n>  GPU for hardware rendering, e.g. renderD129\n";
+    std::cout << "  --threaded         Run the Wayland event loop on its own thread\n";
+    std::cout << "  --shards <n>       Spread clients over n servers, each on its own thread\n";
+    std::cout << "  --shard-policy <p> load: one socket, least busy shard [default]\n";
+    std::cout << "                     socket: clients pick a shard by its socket\n";
+    std::cout << "  --per-view-outputs Give every view its own output sized to its item\n";
+    std::cout << "  --trace <file>     Trace frame latencies and write them to file on exit\n";
+    std::cout << "  --texture-limit <MiB> Evict hidden views' frames above this much memory\n";
     std::cout << "  --help, -h         Show this help\n";
     std::cout << "\n";
     std::cout << "Environment:\n";
     std::cout << "  WLROOTS_QT_HARDWARE=1   Enable hardware rendering\n";
+    std::cout << "  WLROOTS_QT_VULKAN=1     Enable hardware rendering with Vulkan\n";
+    std::cout << "  WLROOTS_QT_RENDER_NODE=/dev/dri/renderD129   GPU for hardware rendering\n";
+    std::cout << "  WLROOTS_QT_THREADED=1   Enable the compositor thread\n";
+    std::cout << "  WLROOTS_QT_PER_VIEW_OUTPUTS=1   Enable per-view outputs\n";
+    std::cout << "  WLROOTS_QT_BUFFER_POOL=memfd,hugepages   Frame buffer backing\n";
+    std::cout << "  WLROOTS_QT_TRACE=1      Count frame latencies (shown in the header)\n";
 }
 
 int main(int argc, char* argv[]) {
@@ -43,12 +64,38 @@ int main(int argc, char* argv[]) {
     
     /* Parse command line arguments manually before QApplication */
     bool useHardware = false;
+    bool vulkan = false;
+    bool threaded = false;
+    bool perViewOutputs = false;
+    int shards = 1;
+    auto shardPolicy = CompositorWrapper::ShardByLoad;
+    QString traceFile;
+    int textureLimit = 0;
     for (int i = 1; i < argc; i++) {
         std::string arg = argv[i];
         if (arg == "--hardware" || arg == "-hw") {
             useHardware = true;
         } else if (arg == "--software" || arg == "-sw") {
             useHardware = false;
+            vulkan = false;
+        } else if (arg == "--vulkan" || arg == "-vk") {
+            useHardware = true;
+            vulkan = true;
+        } else if (arg == "--render-node" && i + 1 < argc) {
+            CompositorWrapper::setRenderNode(QString::fromLocal8Bit(argv[++i]));
+        } else if (arg == "--threaded") {
+            threaded = true;
+        } else if (arg == "--shards" && i + 1 < argc) {
+            shards = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--shard-policy" && i + 1 < argc) {
+            shardPolicy = std::string(argv[++i]) == "socket" ? CompositorWrapper::ShardBySocket
+                                                             : CompositorWrapper::ShardByLoad;
+        } else if (arg == "--per-view-outputs") {
+            perViewOutputs = true;
+        } else if (arg == "--trace" && i + 1 < argc) {
+            traceFile = QString::fromLocal8Bit(argv[++i]);
+        } else if (arg == "--texture-limit" && i + 1 < argc) {
+            textureLimit = std::atoi(argv[++i]);
         } else if (arg == "--help" || arg == "-h") {
             printUsage();
             return 0;
@@ -61,46 +108,79 @@ int main(int argc, char* argv[]) {
         useHardware = true;
     }
     
+    const char* vulkanEnv = std::getenv("WLROOTS_QT_VULKAN");
+    if (vulkanEnv && (std::string(vulkanEnv) == "1" || std::string(vulkanEnv) == "true")) {
+        useHardware = true;
+        vulkan = true;
+    }
+    
+    const char* threadEnv = std::getenv("WLROOTS_QT_THREADED");
+    if (threadEnv && (std::string(threadEnv) == "1" || std::string(threadEnv) == "true")) {
+        threaded = true;
+    }
+    
+    const char* outputsEnv = std::getenv("WLROOTS_QT_PER_VIEW_OUTPUTS");
+    if (outputsEnv && (std::string(outputsEnv) == "1" || std::string(outputsEnv) == "true")) {
+        perViewOutputs = true;
+    }
+    
     std::cout << "Starting wlroots-qt-compositor in nested mode\n";
     if (waylandDisplay) {
         std::cout << "  Parent compositor: Wayland (" << waylandDisplay << ")\n";
     } else {
         std::cout << "  Parent compositor: X11 (" << x11Display << ")\n";
     }
-    std::cout << "  Rendering: " << (useHardware ? "Hardware (GLES2)" : "Software (Pixman)") << "\n";
-    std::cout << "  Hardware available: " << (CompositorWrapper::hardwareAvailable() ? "Yes" : "No") << "\n";
+    std::cout << "  Rendering: " << (vulkan ? "Hardware (Vulkan)" :
+                                     useHardware ? "Hardware (GLES2)" : "Software (Pixman)") << "\n";
+    if (shards > 1) {
+        std::cout << "  Event loop: " << shards << " compositor threads, clients by "
+                  << (shardPolicy == CompositorWrapper::ShardBySocket ? "socket" : "load") << "\n";
+    } else {
+        std::cout << "  Event loop: " << (threaded ? "Compositor thread" : "GUI thread") << "\n";
+    }
+    std::cout << "  Outputs: " << (perViewOutputs ? "One per view" : "Shared 1280x720") << "\n";
     
     /* Create Qt application */
     QGuiApplication app(argc, argv);
     app.setApplicationName("wlroots-qt-compositor");
     app.setApplicationVersion("1.0");
     
+    /* Hardware mode imports client DMA-BUFs as EGLImages, which needs the
+     * scene graph on OpenGL rather than whatever RHI backend Qt picks.
+     * Vulkan mode imports them as VkImages instead. */
+    if (vulkan) {
+        QQuickWindow::setGraphicsApi(QSGRendererInterface::Vulkan);
+    } else if (useHardware) {
+        QQuickWindow::setGraphicsApi(QSGRendererInterface::OpenGL);
+    }
+    
     /* Register QML types */
     qmlRegisterType<EmbeddedView>("WaylandCompositor", 1, 0, "EmbeddedView");
+    qmlRegisterUncreatableType<ViewModel>("WaylandCompositor", 1, 0, "ViewModel",
+                                          "ViewModel is provided by compositor.views");
     
     /* Create compositor */
     CompositorWrapper compositor;
+    compositor.setThreaded(threaded);
+    compositor.setShards(shards, shardPolicy);
+    compositor.setPerViewOutputs(perViewOutputs);
+    compositor.setVulkan(vulkan);
+    compositor.setTextureMemoryLimit(textureLimit);
+    if (!traceFile.isEmpty()) {
+        compositor.setTracing(true);
+    }
     
     /* Set compositor for EmbeddedView items */
     EmbeddedView::setCompositor(&compositor);
     
-    /* Create QML engine */
-    QQmlApplicationEngine engine;
-    
-    /* Expose compositor to QML */
-    engine.rootContext()->setContextProperty("compositor", &compositor);
-    
-    /* Load QML */
-    engine.load(QUrl("qrc:/qml/main.qml"));
-    
-    if (engine.rootObjects().isEmpty()) {
-        std::cerr << "Failed to load QML\n";
-        return 1;
-    }
+    /* Bring the compositor up on a worker thread while QML compiles -
+     * start() runs as soon as both are done */
+    QElapsedTimer startup;
+    startup.start();
+    qint64 qmlMs = 0;
     
-    /* Initialize and start compositor after event loop begins */
-    QTimer::singleShot(100, [&, useHardware]() {
-        if (!compositor.initialize(useHardware)) {
+    QObject::connect(&compositor, &CompositorWrapper::initialized, &app, [&](bool ok) {
+        if (!ok) {
             std::cerr << "Failed to initialize compositor\n";
             QGuiApplication::quit();
             return;
@@ -112,11 +192,26 @@ int main(int argc, char* argv[]) {
             return;
         }
         
+        qInfo().nospace() << "Startup: QML " << qmlMs << " ms, compositor "
+                          << compositor.initializeTime() << " ms (in parallel), running after "
+                          << startup.elapsed() << " ms";
+        
         std::cout << "\n";
         std::cout << "===========================================\n";
         std::cout << "  Compositor is running!\n";
         std::cout << "  Socket: " << compositor.socketName().toStdString() << "\n";
-        std::cout << "  Renderer: " << (compositor.isHardwareRendering() ? "Hardware" : "Software") << "\n";
+        if (compositor.shardCount() > 1) {
+            std::cout << "  Shard sockets: "
+                      << compositor.shardSockets().join(", ").toStdString() << "\n";
+        }
+        std::cout << "  Renderer: " << (compositor.isVulkanRendering() ? "Vulkan" :
+                                        compositor.isHardwareRendering() ? "Hardware" : "Software") << "\n";
+        QVariantMap gpu = compositor.gpuInfo();
+        if (!gpu.isEmpty()) {
+            std::cout << "  GPU: " << gpu["renderNode"].toString().toStdString() << " ("
+                      << gpu["driver"].toString().toStdString() << ", "
+                      << gpu["formats"].toList().size() << " DMA-BUF formats)\n";
+        }
         std::cout << "===========================================\n";
         std::cout << "\n";
         std::cout << "To test, open a new terminal and run:\n";
@@ -126,6 +221,44 @@ int main(int argc, char* argv[]) {
         std::cout << "Click a view to focus it, then type!\n";
         std::cout << "\n";
     });
+    compositor.initializeAsync(useHardware);
+    
+    /* Create QML engine */
+    QQmlApplicationEngine engine;
+    
+    /* Expose compositor to QML */
+    engine.rootContext()->setContextProperty("compositor", &compositor);
+    
+    /* Load QML */
+    engine.load(QUrl("qrc:/qml/main.qml"));
+    qmlMs = startup.elapsed();
+    
+    if (engine.rootObjects().isEmpty()) {
+        std::cerr << "Failed to load QML\n";
+        return 1;
+    }
+    
+    auto* window = qobject_cast<QQuickWindow*>(engine.rootObjects().first());
+    
+    /* The Vulkan device is created when the window is first exposed, after
+     * this - it needs the DMA-BUF import extensions */
+    if (vulkan && window) {
+        QQuickGraphicsConfiguration config = window->graphicsConfiguration();
+        config.setDeviceExtensions(VulkanTexture::requiredDeviceExtensions());
+        window->setGraphicsConfiguration(config);
+    }
+    
+    /* Steer clients towards buffers the scene graph samples as they are.
+     * Queried on the render thread, whose graphics context it needs. */
+    if (useHardware && window) {
+        QObject::connect(window, &QQuickWindow::sceneGraphInitialized, window, [window, &compositor]() {
+            QList<comp_dmabuf_format> formats = VulkanTexture::isSupported(window)
+                ? VulkanTexture::importFormats(window) : DmabufTexture::importFormats(window);
+            QMetaObject::invokeMethod(&compositor, [&compositor, formats]() {
+                compositor.setImportFormats(formats);
+            });
+        }, Qt::DirectConnection);
+    }
     
     /* Run event loop */
     int result = app.exec();
@@ -133,5 +266,9 @@ int main(int argc, char* argv[]) {
     /* Cleanup */
     compositor.stop();
     
+    if (!traceFile.isEmpty() && compositor.writeFrameTrace(traceFile)) {
+        std::cout << "Frame trace written to " << traceFile.toStdString() << "\n";
+    }
+    
     return result;
 }
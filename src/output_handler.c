@@ -10,16 +10,20 @@
 
 #include "output_handler.h"
 #include "compositor_core.h"
+#include "xdg_shell_handler.h"
+#include "frame_trace.h"
 
 #include <stdlib.h>
 #include <string.h>
 
 #include <wlr/backend.h>
+#include <wlr/backend/headless.h>
 #include <wlr/types/wlr_output.h>
 #include <wlr/types/wlr_output_layout.h>
 #include <wlr/types/wlr_scene.h>
 #include <wlr/render/wlr_renderer.h>
 #include <wlr/render/allocator.h>
+#include <wlr/util/box.h>
 #include <wlr/util/log.h>
 
 /* External accessors - MUST be declared before use */
@@ -27,6 +31,7 @@ extern struct wlr_scene* comp_server_get_scene(struct comp_server* server);
 extern struct wlr_renderer* comp_server_get_renderer(struct comp_server* server);
 extern struct wlr_allocator* comp_server_get_allocator(struct comp_server* server);
 extern struct wl_display* comp_server_get_display(struct comp_server* server);
+extern bool comp_server_has_external_frame_clock(struct comp_server* server);
 
 /* Remove output listeners safely */
 static void output_remove_listeners(struct comp_output* output) {
@@ -39,6 +44,25 @@ static void output_remove_listeners(struct comp_output* output) {
     output->listeners_active = false;
 }
 
+/* Compose the scene if anyone reads the output - a screen capture client
+ * waiting for this frame, which wlroots flags with needs_frame. Views are
+ * shown from their own buffers, so otherwise nobody would see it. Returns
+ * true if it composed. */
+static bool output_compose(struct comp_output* output) {
+    return output->wlr_output->needs_frame &&
+           wlr_scene_output_commit(output->scene_output, NULL);
+}
+
+/* Compose if needed, then let clients draw their next frame */
+static bool output_present(struct comp_output* output) {
+    bool composed = output_compose(output);
+    
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    wlr_scene_output_send_frame_done(output->scene_output, &now);
+    return composed;
+}
+
 /* Handle frame event - render and present */
 static void handle_output_frame(struct wl_listener* listener, void* data) {
     struct comp_output* output = wl_container_of(listener, output, frame);
@@ -47,13 +71,15 @@ static void handle_output_frame(struct wl_listener* listener, void* data) {
     struct wlr_scene* scene = comp_server_get_scene(output->server);
     if (!scene || !output->scene_output) return;
     
-    /* Render scene to output */
-    wlr_scene_output_commit(output->scene_output, NULL);
+    uint64_t start = frame_trace_enabled() ? frame_trace_now_ns() : 0;
     
-    /* Get current time for frame callbacks */
-    struct timespec now;
-    clock_gettime(CLOCK_MONOTONIC, &now);
-    wlr_scene_output_send_frame_done(output->scene_output, &now);
+    /* Qt presents the views and paces their frame callbacks itself - the
+     * output is only composed for whoever reads it */
+    bool composed = comp_server_has_external_frame_clock(output->server) ?
+                    output_compose(output) : output_present(output);
+    if (composed) {
+        frame_trace_mark(output->view, FRAME_TRACE_RENDER, start, 0);
+    }
 }
 
 /* Handle output state request (mode change, etc) */
@@ -71,6 +97,10 @@ static void handle_output_destroy(struct wl_listener* listener, void* data) {
     
     wlr_log(WLR_INFO, "Output destroyed: %s", output->wlr_output->name);
     
+    if (output->view) {
+        output->view->output = NULL;
+    }
+    
     wl_list_remove(&output->link);
     output_remove_listeners(output);
     
@@ -103,6 +133,7 @@ static void handle_new_output(struct wl_listener* listener, void* data) {
     
     output->server = mgr->server;
     output->wlr_output = wlr_output;
+    output->scale = 1.0f;
     wlr_output->data = output;
     
     /* Configure output - prefer first available mode */
@@ -118,17 +149,20 @@ static void handle_new_output(struct wl_listener* listener, void* data) {
         wlr_log(WLR_INFO, "Output mode: %dx%d@%dmHz", 
                 mode->width, mode->height, mode->refresh);
     } else {
-        /* Fallback for headless/nested backends without modes */
-        output->width = 1280;
-        output->height = 720;
-        wlr_output_state_set_custom_mode(&state, 1280, 720, 0);
-        wlr_log(WLR_INFO, "Output using custom mode: 1280x720");
+        /* Fallback for headless/nested backends without modes - keep the
+         * size the output was created with */
+        output->width = wlr_output->width > 0 ? (uint32_t)wlr_output->width : 1280;
+        output->height = wlr_output->height > 0 ? (uint32_t)wlr_output->height : 720;
+        wlr_output_state_set_custom_mode(&state, (int32_t)output->width,
+                                         (int32_t)output->height, 0);
+        wlr_log(WLR_INFO, "Output using custom mode: %ux%u", output->width, output->height);
     }
     
     /* Commit output state */
     if (!wlr_output_commit_state(wlr_output, &state)) {
         wlr_log(WLR_ERROR, "Failed to commit output state");
         wlr_output_state_finish(&state);
+        wlr_output->data = NULL;
         free(output);
         return;
     }
@@ -146,6 +180,14 @@ static void handle_new_output(struct wl_listener* listener, void* data) {
     
     output->listeners_active = true;
     
+    /* Offscreen outputs stop here - no wl_output global, no server scene */
+    if (mgr->adding_offscreen) {
+        output->offscreen = true;
+        wl_list_init(&output->link);
+        wlr_log(WLR_DEBUG, "Offscreen output configured: %ux%u", output->width, output->height);
+        return;
+    }
+    
     /* Add to output layout */
     struct wlr_output_layout_output* l_output = 
         wlr_output_layout_add_auto(mgr->layout, wlr_output);
@@ -167,6 +209,23 @@ static void handle_new_output(struct wl_listener* listener, void* data) {
             output->width, output->height);
 }
 
+/* Keep every per-view output's view at the output's layout origin */
+static void handle_layout_change(struct wl_listener* listener, void* data) {
+    struct comp_output_manager* mgr = wl_container_of(listener, mgr, layout_change);
+    (void)data;
+    
+    struct comp_output* output;
+    wl_list_for_each(output, &mgr->outputs, link) {
+        if (!output->view) continue;
+        
+        struct wlr_box box;
+        wlr_output_layout_get_box(mgr->layout, output->wlr_output, &box);
+        if (!wlr_box_empty(&box)) {
+            comp_view_set_position(output->view, box.x, box.y);
+        }
+    }
+}
+
 /* Initialize output manager */
 bool comp_output_manager_init(struct comp_output_manager* mgr, struct comp_server* server) {
     memset(mgr, 0, sizeof(*mgr));
@@ -181,6 +240,9 @@ bool comp_output_manager_init(struct comp_output_manager* mgr, struct comp_serve
         return false;
     }
     
+    mgr->layout_change.notify = handle_layout_change;
+    wl_signal_add(&mgr->layout->events.change, &mgr->layout_change);
+    
     /* Listen for new outputs - backend must be created first */
     /* Note: This listener is connected to backend in comp_server_init_backend */
     
@@ -191,6 +253,7 @@ bool comp_output_manager_init(struct comp_output_manager* mgr, struct comp_serve
 /* Connect to backend for output events */
 void comp_output_manager_connect_backend(struct comp_output_manager* mgr, 
                                           struct wlr_backend* backend) {
+    mgr->backend = backend;
     mgr->new_output.notify = handle_new_output;
     wl_signal_add(&backend->events.new_output, &mgr->new_output);
 }
@@ -204,6 +267,7 @@ void comp_output_manager_finish(struct comp_output_manager* mgr) {
     /* Outputs will be cleaned up by wlr_output destruction */
     
     if (mgr->layout) {
+        wl_list_remove(&mgr->layout_change.link);
         wlr_output_layout_destroy(mgr->layout);
         mgr->layout = NULL;
     }
@@ -230,6 +294,93 @@ void comp_output_get_size(struct comp_output* output, uint32_t* width, uint32_t*
     if (height) *height = output->height;
 }
 
+/* Create a headless output for a single view */
+struct comp_output* comp_output_manager_add_view_output(struct comp_output_manager* mgr,
+                                                        struct comp_view* view,
+                                                        uint32_t width, uint32_t height) {
+    if (!mgr || !mgr->backend || !view || width == 0 || height == 0) return NULL;
+    
+    /* new_output fires synchronously and sets up the comp_output */
+    struct wlr_output* wlr_output = wlr_headless_add_output(mgr->backend, width, height);
+    if (!wlr_output) {
+        wlr_log(WLR_ERROR, "Failed to create per-view output");
+        return NULL;
+    }
+    
+    struct comp_output* output = wlr_output->data;
+    if (!output) {
+        wlr_output_destroy(wlr_output);
+        return NULL;
+    }
+    
+    output->view = view;
+    
+    /* Place the view before the first layout change */
+    struct wlr_box box;
+    wlr_output_layout_get_box(mgr->layout, wlr_output, &box);
+    comp_view_set_position(view, box.x, box.y);
+    
+    return output;
+}
+
+/* Create an offscreen output */
+struct comp_output* comp_output_manager_add_offscreen_output(struct comp_output_manager* mgr,
+                                                             uint32_t width, uint32_t height) {
+    if (!mgr || !mgr->backend || width == 0 || height == 0) return NULL;
+    
+    /* new_output fires synchronously and sees the flag */
+    mgr->adding_offscreen = true;
+    struct wlr_output* wlr_output = wlr_headless_add_output(mgr->backend, width, height);
+    mgr->adding_offscreen = false;
+    if (!wlr_output) {
+        wlr_log(WLR_ERROR, "Failed to create offscreen output");
+        return NULL;
+    }
+    
+    struct comp_output* output = wlr_output->data;
+    if (!output) {
+        wlr_output_destroy(wlr_output);
+        return NULL;
+    }
+    return output;
+}
+
+/* Resize a per-view output */
+bool comp_output_set_size(struct comp_output* output, uint32_t width, uint32_t height,
+                          float scale) {
+    if (!output || !output->wlr_output || width == 0 || height == 0) return false;
+    if (scale <= 0.0f) scale = 1.0f;
+    
+    if (output->width == width && output->height == height && output->scale == scale) {
+        return true;
+    }
+    
+    struct wlr_output_state state;
+    wlr_output_state_init(&state);
+    wlr_output_state_set_custom_mode(&state, (int32_t)width, (int32_t)height, 0);
+    wlr_output_state_set_scale(&state, scale);
+    
+    /* The layout re-arranges itself and handle_layout_change follows */
+    bool ok = wlr_output_commit_state(output->wlr_output, &state);
+    wlr_output_state_finish(&state);
+    if (!ok) {
+        wlr_log(WLR_ERROR, "Failed to resize output %s to %ux%u@%.2f",
+                output->wlr_output->name, width, height, scale);
+        return false;
+    }
+    
+    output->width = width;
+    output->height = height;
+    output->scale = scale;
+    return true;
+}
+
+/* Destroy a per-view output - handle_output_destroy frees it */
+void comp_output_destroy(struct comp_output* output) {
+    if (!output || !output->wlr_output) return;
+    wlr_output_destroy(output->wlr_output);
+}
+
 /* Manually trigger frame rendering - needed for headless backend */
 void comp_output_render_frame(struct comp_output* output) {
     if (!output || !output->scene_output || !output->wlr_output) return;
@@ -237,11 +388,14 @@ void comp_output_render_frame(struct comp_output* output) {
     struct wlr_scene* scene = comp_server_get_scene(output->server);
     if (!scene) return;
     
-    /* Commit the scene to output */
-    if (wlr_scene_output_commit(output->scene_output, NULL)) {
-        /* Send frame done to all surfaces so clients render next frame */
-        struct timespec now;
-        clock_gettime(CLOCK_MONOTONIC, &now);
-        wlr_scene_output_send_frame_done(output->scene_output, &now);
+    uint64_t start = frame_trace_enabled() ? frame_trace_now_ns() : 0;
+    if (output_present(output)) {
+        frame_trace_mark(output->view, FRAME_TRACE_RENDER, start, 0);
     }
 }
+
+/* Render on the next frame event */
+void comp_output_schedule_frame(struct comp_output* output) {
+    if (!output || !output->wlr_output) return;
+    wlr_output_schedule_frame(output->wlr_output);
+}
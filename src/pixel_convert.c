@@ -0,0 +1,600 @@
+/*
+ * pixel_convert.c - Client buffer to Qt pixel conversion kernels
+ *
+ * Every kernel converts one row; the SIMD versions handle full vectors
+ * and leave the tail to the scalar version. Pixels are read with
+ * unaligned loads, client buffers make no alignment promises.
+ *
+ * SPDX-License-Identifier: MIT
+ * Copyright (c) 2024
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include "pixel_convert.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <drm_fourcc.h>
+#include <wlr/util/log.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PIXEL_CONVERT_X86 1
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#define PIXEL_CONVERT_NEON 1
+#include <arm_neon.h>
+#endif
+
+typedef void (*row_fn)(uint32_t* dst, const void* src, uint32_t width);
+/* Add a row of ARGB8888 to 16-bit sums, one per channel */
+typedef void (*accumulate_fn)(uint16_t* acc, const void* src, uint32_t width);
+
+struct pixel_kernels {
+    const char* name;
+    row_fn force_alpha;         /* XRGB8888 */
+    row_fn swap_rb;             /* ABGR8888 */
+    row_fn swap_rb_force_alpha; /* XBGR8888 */
+    row_fn rgb565;              /* RGB565 */
+    row_fn premultiply;         /* Straight ARGB8888, in place */
+    accumulate_fn accumulate;   /* Box filter rows */
+};
+
+/* --- Scalar --- */
+
+static inline uint32_t swap_rb(uint32_t p) {
+    return (p & 0xff00ff00u) | ((p >> 16) & 0xffu) | ((p & 0xffu) << 16);
+}
+
+static void force_alpha_scalar(uint32_t* dst, const void* src, uint32_t width) {
+    const uint8_t* s = src;
+    for (uint32_t i = 0; i < width; i++) {
+        uint32_t p;
+        memcpy(&p, s + (size_t)i * 4, 4);
+        dst[i] = p | 0xff000000u;
+    }
+}
+
+static void swap_rb_scalar(uint32_t* dst, const void* src, uint32_t width) {
+    const uint8_t* s = src;
+    for (uint32_t i = 0; i < width; i++) {
+        uint32_t p;
+        memcpy(&p, s + (size_t)i * 4, 4);
+        dst[i] = swap_rb(p);
+    }
+}
+
+static void swap_rb_force_alpha_scalar(uint32_t* dst, const void* src, uint32_t width) {
+    const uint8_t* s = src;
+    for (uint32_t i = 0; i < width; i++) {
+        uint32_t p;
+        memcpy(&p, s + (size_t)i * 4, 4);
+        dst[i] = swap_rb(p) | 0xff000000u;
+    }
+}
+
+static void rgb565_scalar(uint32_t* dst, const void* src, uint32_t width) {
+    const uint8_t* s = src;
+    for (uint32_t i = 0; i < width; i++) {
+        uint16_t p;
+        memcpy(&p, s + (size_t)i * 2, 2);
+        uint32_t r = (p >> 11) & 0x1f;
+        uint32_t g = (p >> 5) & 0x3f;
+        uint32_t b = p & 0x1f;
+        r = (r << 3) | (r >> 2);
+        g = (g << 2) | (g >> 4);
+        b = (b << 3) | (b >> 2);
+        dst[i] = 0xff000000u | (r << 16) | (g << 8) | b;
+    }
+}
+
+/* c * a / 255, rounded */
+static inline uint32_t mul_div255(uint32_t c, uint32_t a) {
+    uint32_t t = c * a + 128;
+    return (t + (t >> 8)) >> 8;
+}
+
+static void premultiply_scalar(uint32_t* dst, const void* src, uint32_t width) {
+    const uint8_t* s = src;
+    for (uint32_t i = 0; i < width; i++) {
+        uint32_t p;
+        memcpy(&p, s + (size_t)i * 4, 4);
+        uint32_t a = p >> 24;
+        dst[i] = (a << 24) | (mul_div255((p >> 16) & 0xff, a) << 16) |
+                 (mul_div255((p >> 8) & 0xff, a) << 8) | mul_div255(p & 0xff, a);
+    }
+}
+
+static void accumulate_scalar(uint16_t* acc, const void* src, uint32_t width) {
+    const uint8_t* s = src;
+    for (size_t i = 0; i < (size_t)width * 4; i++) {
+        acc[i] = (uint16_t)(acc[i] + s[i]);
+    }
+}
+
+static const struct pixel_kernels scalar_kernels = {
+    "scalar",
+    force_alpha_scalar,
+    swap_rb_scalar,
+    swap_rb_force_alpha_scalar,
+    rgb565_scalar,
+    premultiply_scalar,
+    accumulate_scalar,
+};
+
+#ifdef PIXEL_CONVERT_X86
+
+/* --- SSE4.1 --- */
+
+__attribute__((target("sse4.1")))
+static void force_alpha_sse41(uint32_t* dst, const void* src, uint32_t width) {
+    const uint8_t* s = src;
+    const __m128i alpha = _mm_set1_epi32((int)0xff000000u);
+    uint32_t i = 0;
+    for (; i + 4 <= width; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(s + (size_t)i * 4));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_or_si128(v, alpha));
+    }
+    force_alpha_scalar(dst + i, s + (size_t)i * 4, width - i);
+}
+
+__attribute__((target("sse4.1")))
+static void swap_rb_sse41(uint32_t* dst, const void* src, uint32_t width) {
+    const uint8_t* s = src;
+    const __m128i mask = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+    uint32_t i = 0;
+    for (; i + 4 <= width; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(s + (size_t)i * 4));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_shuffle_epi8(v, mask));
+    }
+    swap_rb_scalar(dst + i, s + (size_t)i * 4, width - i);
+}
+
+__attribute__((target("sse4.1")))
+static void swap_rb_force_alpha_sse41(uint32_t* dst, const void* src, uint32_t width) {
+    const uint8_t* s = src;
+    const __m128i mask = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+    const __m128i alpha = _mm_set1_epi32((int)0xff000000u);
+    uint32_t i = 0;
+    for (; i + 4 <= width; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(s + (size_t)i * 4));
+        v = _mm_or_si128(_mm_shuffle_epi8(v, mask), alpha);
+        _mm_storeu_si128((__m128i*)(dst + i), v);
+    }
+    swap_rb_force_alpha_scalar(dst + i, s + (size_t)i * 4, width - i);
+}
+
+/* 8 RGB565 pixels in 16-bit lanes to blue|green and red|alpha halves */
+__attribute__((target("sse4.1")))
+static inline void rgb565_expand_sse41(__m128i p, __m128i* bg, __m128i* ra) {
+    __m128i r = _mm_srli_epi16(p, 11);
+    __m128i g = _mm_and_si128(_mm_srli_epi16(p, 5), _mm_set1_epi16(0x3f));
+    __m128i b = _mm_and_si128(p, _mm_set1_epi16(0x1f));
+    r = _mm_or_si128(_mm_slli_epi16(r, 3), _mm_srli_epi16(r, 2));
+    g = _mm_or_si128(_mm_slli_epi16(g, 2), _mm_srli_epi16(g, 4));
+    b = _mm_or_si128(_mm_slli_epi16(b, 3), _mm_srli_epi16(b, 2));
+    *bg = _mm_or_si128(b, _mm_slli_epi16(g, 8));
+    *ra = _mm_or_si128(r, _mm_set1_epi16((short)0xff00));
+}
+
+__attribute__((target("sse4.1")))
+static void rgb565_sse41(uint32_t* dst, const void* src, uint32_t width) {
+    const uint8_t* s = src;
+    uint32_t i = 0;
+    for (; i + 8 <= width; i += 8) {
+        __m128i bg, ra;
+        rgb565_expand_sse41(_mm_loadu_si128((const __m128i*)(s + (size_t)i * 2)), &bg, &ra);
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_unpacklo_epi16(bg, ra));
+        _mm_storeu_si128((__m128i*)(dst + i + 4), _mm_unpackhi_epi16(bg, ra));
+    }
+    rgb565_scalar(dst + i, s + (size_t)i * 2, width - i);
+}
+
+/* Two pixels in 16-bit lanes: c * a / 255 with alpha left alone */
+__attribute__((target("sse4.1")))
+static inline __m128i premultiply2_sse41(__m128i px) {
+    __m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(px, 0xff), 0xff);
+    a = _mm_blend_epi16(a, _mm_set1_epi16(255), 0x88);
+    __m128i t = _mm_add_epi16(_mm_mullo_epi16(px, a), _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+__attribute__((target("sse4.1")))
+static void premultiply_sse41(uint32_t* dst, const void* src, uint32_t width) {
+    const uint8_t* s = src;
+    const __m128i zero = _mm_setzero_si128();
+    uint32_t i = 0;
+    for (; i + 4 <= width; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(s + (size_t)i * 4));
+        __m128i lo = premultiply2_sse41(_mm_unpacklo_epi8(v, zero));
+        __m128i hi = premultiply2_sse41(_mm_unpackhi_epi8(v, zero));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(lo, hi));
+    }
+    premultiply_scalar(dst + i, s + (size_t)i * 4, width - i);
+}
+
+__attribute__((target("sse4.1")))
+static void accumulate_sse41(uint16_t* acc, const void* src, uint32_t width) {
+    const uint8_t* s = src;
+    const __m128i zero = _mm_setzero_si128();
+    uint32_t i = 0;
+    for (; i + 4 <= width; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(s + (size_t)i * 4));
+        __m128i* a = (__m128i*)(acc + (size_t)i * 4);
+        _mm_storeu_si128(a, _mm_add_epi16(_mm_loadu_si128(a), _mm_unpacklo_epi8(v, zero)));
+        _mm_storeu_si128(a + 1, _mm_add_epi16(_mm_loadu_si128(a + 1), _mm_unpackhi_epi8(v, zero)));
+    }
+    accumulate_scalar(acc + (size_t)i * 4, s + (size_t)i * 4, width - i);
+}
+
+static const struct pixel_kernels sse41_kernels = {
+    "sse4.1",
+    force_alpha_sse41,
+    swap_rb_sse41,
+    swap_rb_force_alpha_sse41,
+    rgb565_sse41,
+    premultiply_sse41,
+    accumulate_sse41,
+};
+
+/* --- AVX2 --- */
+
+__attribute__((target("avx2")))
+static void force_alpha_avx2(uint32_t* dst, const void* src, uint32_t width) {
+    const uint8_t* s = src;
+    const __m256i alpha = _mm256_set1_epi32((int)0xff000000u);
+    uint32_t i = 0;
+    for (; i + 8 <= width; i += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(s + (size_t)i * 4));
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_or_si256(v, alpha));
+    }
+    force_alpha_sse41(dst + i, s + (size_t)i * 4, width - i);
+}
+
+__attribute__((target("avx2")))
+static void swap_rb_avx2(uint32_t* dst, const void* src, uint32_t width) {
+    const uint8_t* s = src;
+    const __m256i mask = _mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+                                          2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+    uint32_t i = 0;
+    for (; i + 8 <= width; i += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(s + (size_t)i * 4));
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_shuffle_epi8(v, mask));
+    }
+    swap_rb_sse41(dst + i, s + (size_t)i * 4, width - i);
+}
+
+__attribute__((target("avx2")))
+static void swap_rb_force_alpha_avx2(uint32_t* dst, const void* src, uint32_t width) {
+    const uint8_t* s = src;
+    const __m256i mask = _mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+                                          2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+    const __m256i alpha = _mm256_set1_epi32((int)0xff000000u);
+    uint32_t i = 0;
+    for (; i + 8 <= width; i += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(s + (size_t)i * 4));
+        v = _mm256_or_si256(_mm256_shuffle_epi8(v, mask), alpha);
+        _mm256_storeu_si256((__m256i*)(dst + i), v);
+    }
+    swap_rb_force_alpha_sse41(dst + i, s + (size_t)i * 4, width - i);
+}
+
+__attribute__((target("avx2")))
+static void rgb565_avx2(uint32_t* dst, const void* src, uint32_t width) {
+    const uint8_t* s = src;
+    uint32_t i = 0;
+    for (; i + 16 <= width; i += 16) {
+        __m256i p = _mm256_loadu_si256((const __m256i*)(s + (size_t)i * 2));
+        __m256i r = _mm256_srli_epi16(p, 11);
+        __m256i g = _mm256_and_si256(_mm256_srli_epi16(p, 5), _mm256_set1_epi16(0x3f));
+        __m256i b = _mm256_and_si256(p, _mm256_set1_epi16(0x1f));
+        r = _mm256_or_si256(_mm256_slli_epi16(r, 3), _mm256_srli_epi16(r, 2));
+        g = _mm256_or_si256(_mm256_slli_epi16(g, 2), _mm256_srli_epi16(g, 4));
+        b = _mm256_or_si256(_mm256_slli_epi16(b, 3), _mm256_srli_epi16(b, 2));
+        __m256i bg = _mm256_or_si256(b, _mm256_slli_epi16(g, 8));
+        __m256i ra = _mm256_or_si256(r, _mm256_set1_epi16((short)0xff00));
+
+        /* Unpacking is per 128-bit lane: lo = pixels 0-3 and 8-11,
+         * hi = 4-7 and 12-15 */
+        __m256i lo = _mm256_unpacklo_epi16(bg, ra);
+        __m256i hi = _mm256_unpackhi_epi16(bg, ra);
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_storeu_si256((__m256i*)(dst + i + 8), _mm256_permute2x128_si256(lo, hi, 0x31));
+    }
+    rgb565_sse41(dst + i, s + (size_t)i * 2, width - i);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i premultiply4_avx2(__m256i px) {
+    __m256i a = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(px, 0xff), 0xff);
+    a = _mm256_blend_epi16(a, _mm256_set1_epi16(255), 0x88);
+    __m256i t = _mm256_add_epi16(_mm256_mullo_epi16(px, a), _mm256_set1_epi16(128));
+    return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+}
+
+__attribute__((target("avx2")))
+static void premultiply_avx2(uint32_t* dst, const void* src, uint32_t width) {
+    const uint8_t* s = src;
+    const __m256i zero = _mm256_setzero_si256();
+    uint32_t i = 0;
+    for (; i + 8 <= width; i += 8) {
+        /* Unpack and pack are both per lane, so pixel order is kept */
+        __m256i v = _mm256_loadu_si256((const __m256i*)(s + (size_t)i * 4));
+        __m256i lo = premultiply4_avx2(_mm256_unpacklo_epi8(v, zero));
+        __m256i hi = premultiply4_avx2(_mm256_unpackhi_epi8(v, zero));
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_packus_epi16(lo, hi));
+    }
+    premultiply_sse41(dst + i, s + (size_t)i * 4, width - i);
+}
+
+__attribute__((target("avx2")))
+static void accumulate_avx2(uint16_t* acc, const void* src, uint32_t width) {
+    const uint8_t* s = src;
+    uint32_t i = 0;
+    for (; i + 8 <= width; i += 8) {
+        __m128i lo = _mm_loadu_si128((const __m128i*)(s + (size_t)i * 4));
+        __m128i hi = _mm_loadu_si128((const __m128i*)(s + (size_t)i * 4 + 16));
+        __m256i* a = (__m256i*)(acc + (size_t)i * 4);
+        _mm256_storeu_si256(a, _mm256_add_epi16(_mm256_loadu_si256(a), _mm256_cvtepu8_epi16(lo)));
+        _mm256_storeu_si256(a + 1, _mm256_add_epi16(_mm256_loadu_si256(a + 1),
+                                                    _mm256_cvtepu8_epi16(hi)));
+    }
+    accumulate_sse41(acc + (size_t)i * 4, s + (size_t)i * 4, width - i);
+}
+
+static const struct pixel_kernels avx2_kernels = {
+    "avx2",
+    force_alpha_avx2,
+    swap_rb_avx2,
+    swap_rb_force_alpha_avx2,
+    rgb565_avx2,
+    premultiply_avx2,
+    accumulate_avx2,
+};
+
+#endif /* PIXEL_CONVERT_X86 */
+
+#ifdef PIXEL_CONVERT_NEON
+
+/* --- NEON --- */
+
+static void force_alpha_neon(uint32_t* dst, const void* src, uint32_t width) {
+    const uint8_t* s = src;
+    const uint32x4_t alpha = vdupq_n_u32(0xff000000u);
+    uint32_t i = 0;
+    for (; i + 4 <= width; i += 4) {
+        uint32x4_t v = vreinterpretq_u32_u8(vld1q_u8(s + (size_t)i * 4));
+        vst1q_u32(dst + i, vorrq_u32(v, alpha));
+    }
+    force_alpha_scalar(dst + i, s + (size_t)i * 4, width - i);
+}
+
+static void swap_rb_neon(uint32_t* dst, const void* src, uint32_t width) {
+    const uint8_t* s = src;
+    uint32_t i = 0;
+    for (; i + 16 <= width; i += 16) {
+        uint8x16x4_t v = vld4q_u8(s + (size_t)i * 4);
+        uint8x16_t t = v.val[0];
+        v.val[0] = v.val[2];
+        v.val[2] = t;
+        vst4q_u8((uint8_t*)(dst + i), v);
+    }
+    swap_rb_scalar(dst + i, s + (size_t)i * 4, width - i);
+}
+
+static void swap_rb_force_alpha_neon(uint32_t* dst, const void* src, uint32_t width) {
+    const uint8_t* s = src;
+    uint32_t i = 0;
+    for (; i + 16 <= width; i += 16) {
+        uint8x16x4_t v = vld4q_u8(s + (size_t)i * 4);
+        uint8x16_t t = v.val[0];
+        v.val[0] = v.val[2];
+        v.val[2] = t;
+        v.val[3] = vdupq_n_u8(0xff);
+        vst4q_u8((uint8_t*)(dst + i), v);
+    }
+    swap_rb_force_alpha_scalar(dst + i, s + (size_t)i * 4, width - i);
+}
+
+static void rgb565_neon(uint32_t* dst, const void* src, uint32_t width) {
+    const uint8_t* s = src;
+    uint32_t i = 0;
+    for (; i + 8 <= width; i += 8) {
+        uint16x8_t p = vreinterpretq_u16_u8(vld1q_u8(s + (size_t)i * 2));
+        uint16x8_t r = vshrq_n_u16(p, 11);
+        uint16x8_t g = vandq_u16(vshrq_n_u16(p, 5), vdupq_n_u16(0x3f));
+        uint16x8_t b = vandq_u16(p, vdupq_n_u16(0x1f));
+        uint8x8x4_t out;
+        out.val[0] = vmovn_u16(vorrq_u16(vshlq_n_u16(b, 3), vshrq_n_u16(b, 2)));
+        out.val[1] = vmovn_u16(vorrq_u16(vshlq_n_u16(g, 2), vshrq_n_u16(g, 4)));
+        out.val[2] = vmovn_u16(vorrq_u16(vshlq_n_u16(r, 3), vshrq_n_u16(r, 2)));
+        out.val[3] = vdup_n_u8(0xff);
+        vst4_u8((uint8_t*)(dst + i), out);
+    }
+    rgb565_scalar(dst + i, s + (size_t)i * 2, width - i);
+}
+
+/* c * a / 255, rounded */
+static inline uint8x8_t mul_div255_neon(uint8x8_t c, uint8x8_t a) {
+    uint16x8_t t = vmull_u8(c, a);
+    return vrshrn_n_u16(vrsraq_n_u16(t, t, 8), 8);
+}
+
+static void premultiply_neon(uint32_t* dst, const void* src, uint32_t width) {
+    const uint8_t* s = src;
+    uint32_t i = 0;
+    for (; i + 8 <= width; i += 8) {
+        uint8x8x4_t v = vld4_u8(s + (size_t)i * 4);
+        v.val[0] = mul_div255_neon(v.val[0], v.val[3]);
+        v.val[1] = mul_div255_neon(v.val[1], v.val[3]);
+        v.val[2] = mul_div255_neon(v.val[2], v.val[3]);
+        vst4_u8((uint8_t*)(dst + i), v);
+    }
+    premultiply_scalar(dst + i, s + (size_t)i * 4, width - i);
+}
+
+static void accumulate_neon(uint16_t* acc, const void* src, uint32_t width) {
+    const uint8_t* s = src;
+    uint32_t i = 0;
+    for (; i + 4 <= width; i += 4) {
+        uint8x16_t v = vld1q_u8(s + (size_t)i * 4);
+        uint16_t* a = acc + (size_t)i * 4;
+        vst1q_u16(a, vaddw_u8(vld1q_u16(a), vget_low_u8(v)));
+        vst1q_u16(a + 8, vaddw_u8(vld1q_u16(a + 8), vget_high_u8(v)));
+    }
+    accumulate_scalar(acc + (size_t)i * 4, s + (size_t)i * 4, width - i);
+}
+
+static const struct pixel_kernels neon_kernels = {
+    "neon",
+    force_alpha_neon,
+    swap_rb_neon,
+    swap_rb_force_alpha_neon,
+    rgb565_neon,
+    premultiply_neon,
+    accumulate_neon,
+};
+
+#endif /* PIXEL_CONVERT_NEON */
+
+/* --- Dispatch --- */
+
+static const struct pixel_kernels* kernels = &scalar_kernels;
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+static void kernels_init(void) {
+#ifdef PIXEL_CONVERT_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        kernels = &avx2_kernels;
+    } else if (__builtin_cpu_supports("sse4.1")) {
+        kernels = &sse41_kernels;
+    }
+#elif defined(PIXEL_CONVERT_NEON)
+    kernels = &neon_kernels;
+#endif
+    wlr_log(WLR_INFO, "Pixel conversion kernels: %s", kernels->name);
+}
+
+static const struct pixel_kernels* get_kernels(void) {
+    pthread_once(&kernels_once, kernels_init);
+    return kernels;
+}
+
+uint32_t pixel_convert_bpp(uint32_t format) {
+    switch (format) {
+        case DRM_FORMAT_ARGB8888:
+        case DRM_FORMAT_XRGB8888:
+        case DRM_FORMAT_ABGR8888:
+        case DRM_FORMAT_XBGR8888:
+            return 4;
+        case DRM_FORMAT_RGB565:
+            return 2;
+        default:
+            return 0;
+    }
+}
+
+bool pixel_convert_supported(uint32_t format) {
+    return pixel_convert_bpp(format) != 0;
+}
+
+bool pixel_convert(void* dst, size_t dst_stride, const void* src, size_t src_stride,
+                   uint32_t format, uint32_t width, uint32_t height) {
+    if (!dst || !src || width == 0 || height == 0) return width == 0 || height == 0;
+
+    uint8_t* d = dst;
+    const uint8_t* s = src;
+
+    if (format == DRM_FORMAT_ARGB8888) {
+        size_t row_bytes = (size_t)width * 4;
+        if (dst_stride == src_stride && row_bytes == src_stride) {
+            /* Contiguous in both - one copy for the whole block */
+            memcpy(d, s, row_bytes * height);
+            return true;
+        }
+        for (uint32_t y = 0; y < height; y++) {
+            memcpy(d + (size_t)y * dst_stride, s + (size_t)y * src_stride, row_bytes);
+        }
+        return true;
+    }
+
+    const struct pixel_kernels* k = get_kernels();
+    row_fn row;
+    switch (format) {
+        case DRM_FORMAT_XRGB8888: row = k->force_alpha; break;
+        case DRM_FORMAT_ABGR8888: row = k->swap_rb; break;
+        case DRM_FORMAT_XBGR8888: row = k->swap_rb_force_alpha; break;
+        case DRM_FORMAT_RGB565:   row = k->rgb565; break;
+        default:
+            return false;
+    }
+
+    for (uint32_t y = 0; y < height; y++) {
+        row((uint32_t*)(d + (size_t)y * dst_stride), s + (size_t)y * src_stride, width);
+    }
+    return true;
+}
+
+void pixel_premultiply(void* data, size_t stride, uint32_t width, uint32_t height) {
+    if (!data) return;
+
+    const struct pixel_kernels* k = get_kernels();
+    uint8_t* d = data;
+    for (uint32_t y = 0; y < height; y++) {
+        uint32_t* row = (uint32_t*)(d + (size_t)y * stride);
+        k->premultiply(row, row, width);
+    }
+}
+
+bool pixel_downscale(void* dst, size_t dst_stride, const void* src, size_t src_stride,
+                     uint32_t width, uint32_t height, uint32_t factor) {
+    if (!dst || !src || factor == 0 || factor > PIXEL_DOWNSCALE_MAX) return false;
+    if (width == 0 || height == 0) return true;
+    if (factor == 1) {
+        return pixel_convert(dst, dst_stride, src, src_stride, DRM_FORMAT_ARGB8888,
+                             width, height);
+    }
+
+    /* Channel sums of a row of blocks - factor^2 * 255 fits 16 bits */
+    size_t n_sums = (size_t)width * 4;
+    uint16_t* acc = malloc(n_sums * sizeof(*acc));
+    if (!acc) return false;
+
+    const struct pixel_kernels* k = get_kernels();
+    const uint8_t* s = src;
+    uint8_t* d = dst;
+    uint32_t out_width = (width + factor - 1) / factor;
+
+    for (uint32_t y = 0; y < height; y += factor) {
+        uint32_t rows = height - y < factor ? height - y : factor;
+        memset(acc, 0, n_sums * sizeof(*acc));
+        for (uint32_t r = 0; r < rows; r++) {
+            k->accumulate(acc, s + (size_t)(y + r) * src_stride, width);
+        }
+
+        /* Edge blocks average the pixels they have */
+        uint8_t* out = d + (size_t)(y / factor) * dst_stride;
+        for (uint32_t x = 0; x < out_width; x++) {
+            uint32_t x0 = x * factor;
+            uint32_t cols = width - x0 < factor ? width - x0 : factor;
+            uint32_t count = rows * cols;
+            const uint16_t* a = acc + (size_t)x0 * 4;
+            for (uint32_t c = 0; c < 4; c++) {
+                uint32_t sum = 0;
+                for (uint32_t i = 0; i < cols; i++) {
+                    sum += a[i * 4 + c];
+                }
+                out[(size_t)x * 4 + c] = (uint8_t)((sum + count / 2) / count);
+            }
+        }
+    }
+
+    free(acc);
+    return true;
+}
+
+const char* pixel_convert_impl_name(void) {
+    return get_kernels()->name;
+}
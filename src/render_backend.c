@@ -7,11 +7,15 @@
 #define _POSIX_C_SOURCE 200809L
 
 #include "render_backend.h"
+#include "buffer_pool.h"
+#include "gpu_probe.h"
 
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
 #include <unistd.h>
 
+#include <wlr/config.h>
 #include <wlr/backend.h>
 #include <wlr/backend/headless.h>
 #include <wlr/render/allocator.h>
@@ -28,20 +32,15 @@
 #include <wlr/render/egl.h>
 #include <wlr/render/gles2.h>
 #endif
+#ifdef WLR_HAS_VULKAN_RENDERER
+#include <wlr/render/vulkan.h>
+#endif
 
-/* Check if hardware acceleration is available at runtime */
+/* Check if hardware acceleration is available at runtime - a render
+ * node passed the probe */
 bool render_backend_hardware_available(void) {
 #ifdef WLR_HAS_GLES2_RENDERER
-    /* Check for EGL/DRM availability */
-    /* This is a simplified check - real implementation would probe GPU */
-    const char* session_type = getenv("XDG_SESSION_TYPE");
-    if (session_type && strcmp(session_type, "wayland") == 0) {
-        return true;
-    }
-    if (getenv("DISPLAY") != NULL) {
-        return true;  /* X11 with EGL might work */
-    }
-    return false;
+    return gpu_probe_selected() != NULL;
 #else
     return false;
 #endif
@@ -53,6 +52,8 @@ const char* render_backend_type_name(render_backend_type_t type) {
             return "Software (Pixman)";
         case RENDER_BACKEND_HARDWARE:
             return "Hardware (GLES2)";
+        case RENDER_BACKEND_VULKAN:
+            return "Hardware (Vulkan)";
         default:
             return "Unknown";
     }
@@ -69,10 +70,17 @@ struct render_backend* render_backend_create(render_backend_type_t type,
     backend->type = type;
     backend->dmabuf_fd = -1;
     
+    backend->pool = buffer_pool_create(buffer_pool_flags_from_env());
+    if (!backend->pool) {
+        free(backend);
+        return NULL;
+    }
+    
     /* Create wlr_backend - always headless for embedding */
     backend->wlr_backend = wlr_headless_backend_create(event_loop);
     if (!backend->wlr_backend) {
         wlr_log(WLR_ERROR, "Failed to create headless backend");
+        buffer_pool_destroy(backend->pool);
         free(backend);
         return NULL;
     }
@@ -96,10 +104,45 @@ bool render_backend_init_renderer(struct render_backend* backend,
             wlr_log(WLR_INFO, "Using Pixman software renderer");
             break;
             
+        case RENDER_BACKEND_VULKAN:
+#ifdef WLR_HAS_VULKAN_RENDERER
+            /* Vulkan on the probed node, its buffers are DMA-BUFs too */
+            backend->gpu = gpu_probe_selected();
+            if (backend->gpu) {
+                int fd = open(backend->gpu->path, O_RDWR | O_CLOEXEC);
+                if (fd >= 0) {
+                    backend->renderer = wlr_vk_renderer_create_with_drm_fd(fd);
+                    close(fd);
+                }
+            }
+            if (backend->renderer) {
+                wlr_log(WLR_INFO, "Using Vulkan renderer on %s (%s)",
+                        backend->gpu->path, backend->gpu->driver);
+                break;
+            }
+            backend->gpu = NULL;
+            wlr_log(WLR_ERROR, "Failed to create Vulkan renderer, trying GLES2");
+#else
+            wlr_log(WLR_INFO, "wlroots built without Vulkan, trying GLES2");
+#endif
+            backend->type = RENDER_BACKEND_HARDWARE;
+            /* fall through */
+            
         case RENDER_BACKEND_HARDWARE:
 #ifdef WLR_HAS_GLES2_RENDERER
-            /* Try GLES2 renderer with EGL */
-            backend->renderer = wlr_renderer_autocreate(backend->wlr_backend);
+            /* GLES2 on the probed node, the headless backend has none */
+            backend->gpu = gpu_probe_selected();
+            if (backend->gpu) {
+                int fd = open(backend->gpu->path, O_RDWR | O_CLOEXEC);
+                if (fd >= 0) {
+                    /* The renderer keeps its own reference to the node */
+                    backend->renderer = wlr_gles2_renderer_create_with_drm_fd(fd);
+                    close(fd);
+                }
+                if (!backend->renderer) {
+                    backend->gpu = NULL;
+                }
+            }
             if (!backend->renderer) {
                 wlr_log(WLR_ERROR, "Failed to create hardware renderer, falling back to software");
                 backend->type = RENDER_BACKEND_SOFTWARE;
@@ -109,7 +152,8 @@ bool render_backend_init_renderer(struct render_backend* backend,
                     return false;
                 }
             } else {
-                wlr_log(WLR_INFO, "Using hardware-accelerated renderer");
+                wlr_log(WLR_INFO, "Using hardware-accelerated renderer on %s (%s)",
+                        backend->gpu->path, backend->gpu->driver);
             }
 #else
             wlr_log(WLR_INFO, "Hardware rendering not available, using software");
@@ -126,8 +170,12 @@ bool render_backend_init_renderer(struct render_backend* backend,
             return false;
     }
     
-    /* Initialize renderer with display */
-    wlr_renderer_init_wl_display(backend->renderer, display);
+    /* wl_shm only - linux-dmabuf-v1 comes with our own feedback, see
+     * dmabuf_feedback.h */
+    if (!wlr_renderer_init_wl_shm(backend->renderer, display)) {
+        wlr_log(WLR_ERROR, "Failed to create wl_shm");
+        return false;
+    }
     
     /* Create allocator */
     backend->allocator = wlr_allocator_autocreate(backend->wlr_backend, 
@@ -145,9 +193,9 @@ bool render_backend_init_renderer(struct render_backend* backend,
 void render_backend_destroy(struct render_backend* backend) {
     if (!backend) return;
     
-    if (backend->pixel_buffer) {
-        free(backend->pixel_buffer);
-    }
+    /* Buffers still held elsewhere keep the pool alive until released */
+    pool_buffer_unref(backend->capture);
+    buffer_pool_destroy(backend->pool);
     
     if (backend->dmabuf_fd >= 0) {
         close(backend->dmabuf_fd);
@@ -174,6 +222,38 @@ struct wlr_allocator* render_backend_get_allocator(struct render_backend* backen
     return backend ? backend->allocator : NULL;
 }
 
+struct buffer_pool* render_backend_get_buffer_pool(struct render_backend* backend) {
+    return backend ? backend->pool : NULL;
+}
+
+const struct gpu_node* render_backend_get_gpu(struct render_backend* backend) {
+    return backend ? backend->gpu : NULL;
+}
+
+/* Copy a CPU frame into a pooled buffer nobody else is reading. The
+ * previous capture is reused unless a consumer still holds it. */
+static bool capture_copy(struct render_backend* backend, const void* data, size_t size,
+                         struct pool_buffer** frame_out) {
+    if (!backend->capture || !pool_buffer_is_exclusive(backend->capture) ||
+        backend->capture->size < size) {
+        struct pool_buffer* buffer = buffer_pool_acquire(backend->pool, size);
+        if (!buffer) {
+            wlr_log(WLR_ERROR, "Failed to get a %zu byte capture buffer", size);
+            return false;
+        }
+        pool_buffer_unref(backend->capture);
+        backend->capture = buffer;
+    }
+    
+    memcpy(backend->capture->data, data, size);
+    
+    if (frame_out) {
+        pool_buffer_ref(backend->capture);
+        *frame_out = backend->capture;
+    }
+    return true;
+}
+
 bool render_backend_capture_frame(struct render_backend* backend,
                                    void* scene_output_ptr,
                                    void** buffer_out,
@@ -181,7 +261,9 @@ bool render_backend_capture_frame(struct render_backend* backend,
                                    uint32_t* width_out,
                                    uint32_t* height_out,
                                    uint32_t* stride_out,
-                                   uint32_t* format_out) {
+                                   uint32_t* format_out,
+                                   struct pool_buffer** frame_out) {
+    if (frame_out) *frame_out = NULL;
     if (!backend || !scene_output_ptr) return false;
     
     struct wlr_scene_output* scene_output = scene_output_ptr;
@@ -222,30 +304,21 @@ bool render_backend_capture_frame(struct render_backend* backend,
                 return false;
             }
             
-            /* Allocate/reallocate pixel buffer if needed */
-            uint32_t needed_size = buf_stride * height;
-            if (backend->buffer_size < needed_size) {
-                free(backend->pixel_buffer);
-                backend->pixel_buffer = malloc(needed_size);
-                backend->buffer_size = needed_size;
-            }
-            
-            if (backend->pixel_buffer) {
-                memcpy(backend->pixel_buffer, data, needed_size);
-            }
+            bool ok = capture_copy(backend, data, buf_stride * height, frame_out);
             
             wlr_buffer_end_data_ptr_access(buffer);
             wlr_output_state_finish(&state);
             
-            if (buffer_out) *buffer_out = backend->pixel_buffer;
+            if (buffer_out) *buffer_out = ok ? backend->capture->data : NULL;
             if (fd_out) *fd_out = -1;
             if (stride_out) *stride_out = (uint32_t)buf_stride;
             if (format_out) *format_out = format;
             
-            return backend->pixel_buffer != NULL;
+            return ok;
         }
         
-        case RENDER_BACKEND_HARDWARE: {
+        case RENDER_BACKEND_HARDWARE:
+        case RENDER_BACKEND_VULKAN: {
             /* Hardware path: try to get DMA-BUF fd */
             struct wlr_dmabuf_attributes dmabuf;
             
@@ -284,26 +357,17 @@ bool render_backend_capture_frame(struct render_backend* backend,
                 return false;
             }
             
-            uint32_t needed_size = buf_stride * height;
-            if (backend->buffer_size < needed_size) {
-                free(backend->pixel_buffer);
-                backend->pixel_buffer = malloc(needed_size);
-                backend->buffer_size = needed_size;
-            }
-            
-            if (backend->pixel_buffer) {
-                memcpy(backend->pixel_buffer, data, needed_size);
-            }
+            bool ok = capture_copy(backend, data, buf_stride * height, frame_out);
             
             wlr_buffer_end_data_ptr_access(buffer);
             wlr_output_state_finish(&state);
             
-            if (buffer_out) *buffer_out = backend->pixel_buffer;
+            if (buffer_out) *buffer_out = ok ? backend->capture->data : NULL;
             if (fd_out) *fd_out = -1;
             if (stride_out) *stride_out = (uint32_t)buf_stride;
             if (format_out) *format_out = format;
             
-            return backend->pixel_buffer != NULL;
+            return ok;
         }
         
         default:
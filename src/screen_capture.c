@@ -0,0 +1,187 @@
+/*
+ * screen_capture.c - Screen capture protocols for recorders and VNC bridges
+ *
+ * SPDX-License-Identifier: MIT
+ * Copyright (c) 2024
+ */
+/* Generated here - wlroots' capture header includes it */
+#include "ext-image-copy-capture-v1-protocol.h"
+
+#include "screen_capture.h"
+#include "xdg_shell_handler.h"
+
+#include <stdlib.h>
+
+#include <wlr/types/wlr_ext_foreign_toplevel_list_v1.h>
+#include <wlr/types/wlr_ext_image_capture_source_v1.h>
+#include <wlr/types/wlr_ext_image_copy_capture_v1.h>
+#include <wlr/types/wlr_scene.h>
+#include <wlr/types/wlr_screencopy_v1.h>
+#include <wlr/types/wlr_xdg_output_v1.h>
+#include <wlr/types/wlr_xdg_shell.h>
+#include <wlr/util/log.h>
+
+/* A mapped view in ext-foreign-toplevel-list */
+struct capture_toplevel {
+    struct screen_capture* capture;
+    struct comp_view* view;
+    struct wlr_ext_foreign_toplevel_handle_v1* handle;
+    /* Shared by every client capturing the view, NULL until one does */
+    struct wlr_ext_image_capture_source_v1* source;
+    struct wl_listener source_destroy;
+    struct wl_list link;                /* screen_capture.toplevels */
+};
+
+struct screen_capture {
+    struct wl_event_loop* loop;
+    struct wlr_renderer* renderer;
+    struct wlr_allocator* allocator;
+
+    struct wlr_ext_foreign_toplevel_list_v1* toplevel_list;
+    struct wlr_ext_foreign_toplevel_image_capture_source_manager_v1* toplevel_sources;
+    struct wl_listener toplevel_request;
+    struct wl_list toplevels;           /* capture_toplevel.link */
+};
+
+static void toplevel_state(struct comp_view* view,
+                           struct wlr_ext_foreign_toplevel_handle_v1_state* state) {
+    state->title = view->xdg_toplevel->title;
+    state->app_id = view->xdg_toplevel->app_id;
+}
+
+static void toplevel_forget_source(struct capture_toplevel* toplevel) {
+    if (!toplevel->source) return;
+
+    wl_list_remove(&toplevel->source_destroy.link);
+    toplevel->source = NULL;
+}
+
+static void handle_source_destroy(struct wl_listener* listener, void* data) {
+    struct capture_toplevel* toplevel = wl_container_of(listener, toplevel, source_destroy);
+    (void)data;
+    toplevel_forget_source(toplevel);
+}
+
+static void toplevel_destroy(struct capture_toplevel* toplevel) {
+    toplevel_forget_source(toplevel);
+    wlr_ext_foreign_toplevel_handle_v1_destroy(toplevel->handle);
+    wl_list_remove(&toplevel->link);
+    free(toplevel);
+}
+
+static struct capture_toplevel* find_toplevel(struct screen_capture* capture,
+                                              struct comp_view* view) {
+    struct capture_toplevel* toplevel;
+    wl_list_for_each(toplevel, &capture->toplevels, link) {
+        if (toplevel->view == view) return toplevel;
+    }
+    return NULL;
+}
+
+/* A client wants to capture a listed view */
+static void handle_toplevel_request(struct wl_listener* listener, void* data) {
+    struct screen_capture* capture = wl_container_of(listener, capture, toplevel_request);
+    struct wlr_ext_foreign_toplevel_image_capture_source_manager_v1_request* request = data;
+
+    /* Handles of unmapped views are inert, their sources stay so too */
+    struct capture_toplevel* toplevel = request->toplevel_handle->data;
+    if (!toplevel || !toplevel->view->scene_tree) return;
+
+    if (!toplevel->source) {
+        toplevel->source = wlr_ext_image_capture_source_v1_create_with_scene_node(
+            &toplevel->view->scene_tree->node, capture->loop, capture->allocator,
+            capture->renderer);
+        if (!toplevel->source) {
+            wlr_log(WLR_ERROR, "Failed to create a capture source for a view");
+            return;
+        }
+        toplevel->source_destroy.notify = handle_source_destroy;
+        wl_signal_add(&toplevel->source->events.destroy, &toplevel->source_destroy);
+    }
+
+    wlr_ext_foreign_toplevel_image_capture_source_manager_v1_request_accept(request,
+                                                                           toplevel->source);
+}
+
+struct screen_capture* screen_capture_create(struct wl_display* display,
+                                             struct wlr_renderer* renderer,
+                                             struct wlr_allocator* allocator,
+                                             struct wlr_output_layout* layout) {
+    struct screen_capture* capture = calloc(1, sizeof(*capture));
+    if (!capture) return NULL;
+    capture->loop = wl_display_get_event_loop(display);
+    capture->renderer = renderer;
+    capture->allocator = allocator;
+    wl_list_init(&capture->toplevels);
+
+    /* Globals go away with the display */
+    bool ok = wlr_screencopy_manager_v1_create(display) != NULL;
+    ok = wlr_ext_image_copy_capture_manager_v1_create(display, 1) != NULL && ok;
+    ok = wlr_ext_output_image_capture_source_manager_v1_create(display, 1) != NULL && ok;
+    ok = wlr_xdg_output_manager_v1_create(display, layout) != NULL && ok;
+    capture->toplevel_list = wlr_ext_foreign_toplevel_list_v1_create(display, 1);
+    capture->toplevel_sources =
+        wlr_ext_foreign_toplevel_image_capture_source_manager_v1_create(display, 1);
+    if (!ok || !capture->toplevel_list || !capture->toplevel_sources) {
+        wlr_log(WLR_ERROR, "Failed to create the screen capture globals");
+        free(capture);
+        return NULL;
+    }
+
+    capture->toplevel_request.notify = handle_toplevel_request;
+    wl_signal_add(&capture->toplevel_sources->events.new_request, &capture->toplevel_request);
+
+    wlr_log(WLR_INFO, "Screen capture: ext-image-copy-capture-v1, wlr-screencopy-unstable-v1");
+    return capture;
+}
+
+void screen_capture_destroy(struct screen_capture* capture) {
+    if (!capture) return;
+
+    struct capture_toplevel* toplevel;
+    struct capture_toplevel* tmp;
+    wl_list_for_each_safe(toplevel, tmp, &capture->toplevels, link) {
+        toplevel_destroy(toplevel);
+    }
+    wl_list_remove(&capture->toplevel_request.link);
+    free(capture);
+}
+
+void screen_capture_add_view(struct screen_capture* capture, struct comp_view* view) {
+    if (!capture || !view || find_toplevel(capture, view)) return;
+
+    struct capture_toplevel* toplevel = calloc(1, sizeof(*toplevel));
+    if (!toplevel) return;
+
+    struct wlr_ext_foreign_toplevel_handle_v1_state state;
+    toplevel_state(view, &state);
+    toplevel->handle = wlr_ext_foreign_toplevel_handle_v1_create(capture->toplevel_list, &state);
+    if (!toplevel->handle) {
+        free(toplevel);
+        return;
+    }
+    toplevel->capture = capture;
+    toplevel->view = view;
+    toplevel->handle->data = toplevel;
+    wl_list_insert(&capture->toplevels, &toplevel->link);
+}
+
+void screen_capture_remove_view(struct screen_capture* capture, struct comp_view* view) {
+    if (!capture) return;
+
+    struct capture_toplevel* toplevel = find_toplevel(capture, view);
+    if (toplevel) {
+        toplevel_destroy(toplevel);
+    }
+}
+
+void screen_capture_update_view(struct screen_capture* capture, struct comp_view* view) {
+    if (!capture) return;
+
+    struct capture_toplevel* toplevel = find_toplevel(capture, view);
+    if (!toplevel) return;
+
+    struct wlr_ext_foreign_toplevel_handle_v1_state state;
+    toplevel_state(view, &state);
+    wlr_ext_foreign_toplevel_handle_v1_update_state(toplevel->handle, &state);
+}
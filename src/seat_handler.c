@@ -20,6 +20,7 @@
 #include <unistd.h>
 
 #include <wlr/types/wlr_seat.h>
+#include <wlr/types/wlr_compositor.h>
 #include <wlr/types/wlr_keyboard.h>
 #include <wlr/types/wlr_keyboard_group.h>
 #include <wlr/types/wlr_input_device.h>
@@ -33,6 +34,7 @@
 extern struct wl_display* comp_server_get_display(struct comp_server* server);
 extern struct wlr_scene* comp_server_get_scene(struct comp_server* server);
 extern struct wl_list* comp_server_get_views(struct comp_server* server);
+extern void comp_server_notify_cursor(struct comp_server* server, struct comp_view* view);
 
 /* Get current timestamp in milliseconds */
 static uint32_t get_time_msec(void) {
@@ -41,16 +43,99 @@ static uint32_t get_time_msec(void) {
     return (uint32_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
 }
 
-/* Handle cursor image request */
+/* Stop following the cursor surface */
+static void cursor_forget_surface(struct comp_seat* seat) {
+    if (!seat->cursor_surface) return;
+    
+    wl_list_remove(&seat->cursor_commit.link);
+    wl_list_remove(&seat->cursor_destroy.link);
+    seat->cursor_surface = NULL;
+}
+
+/* The cursor no longer applies - the embedder's shows again */
+static void cursor_clear(struct comp_seat* seat, bool notify) {
+    if (!seat->cursor_client) return;
+    
+    struct comp_view* view = seat->cursor_view;
+    cursor_forget_surface(seat);
+    seat->cursor_client = NULL;
+    seat->cursor_view = NULL;
+    if (notify) {
+        comp_server_notify_cursor(seat->server, view);
+    }
+}
+
+static void handle_cursor_commit(struct wl_listener* listener, void* data) {
+    struct comp_seat* seat = wl_container_of(listener, seat, cursor_commit);
+    struct wlr_surface* surface = data;
+    
+    /* wl_surface.offset moves the hotspot */
+    seat->cursor_hotspot_x -= surface->current.dx;
+    seat->cursor_hotspot_y -= surface->current.dy;
+    
+    if ((surface->current.committed & WLR_SURFACE_STATE_BUFFER) ||
+        surface->current.dx || surface->current.dy) {
+        comp_server_notify_cursor(seat->server, seat->cursor_view);
+    }
+}
+
+static void handle_cursor_destroy(struct wl_listener* listener, void* data) {
+    struct comp_seat* seat = wl_container_of(listener, seat, cursor_destroy);
+    (void)data;
+    
+    /* Nothing left to show - hidden until the client sets another */
+    cursor_forget_surface(seat);
+    comp_server_notify_cursor(seat->server, seat->cursor_view);
+}
+
+/* Handle cursor image request - the embedder draws the image, see
+ * comp_server_set_cursor_callback */
 static void handle_request_cursor(struct wl_listener* listener, void* data) {
     struct comp_seat* seat = wl_container_of(listener, seat, request_cursor);
     struct wlr_seat_pointer_request_set_cursor_event* event = data;
     
-    /* In nested mode, we don't need to handle cursor images ourselves -
-     * the parent compositor does it. This is just for acknowledgment. */
-    (void)seat;
-    (void)event;
-    wlr_log(WLR_DEBUG, "Cursor request received");
+    /* Only the client with the pointer sets it */
+    if (event->seat_client != seat->seat->pointer_state.focused_client ||
+        !seat->pointer_view) {
+        return;
+    }
+    
+    /* Same client, another of its views */
+    if (seat->cursor_view != seat->pointer_view) {
+        cursor_clear(seat, true);
+    }
+    
+    cursor_forget_surface(seat);
+    seat->cursor_client = event->seat_client;
+    seat->cursor_view = seat->pointer_view;
+    seat->cursor_hotspot_x = event->hotspot_x;
+    seat->cursor_hotspot_y = event->hotspot_y;
+    
+    if (event->surface) {
+        seat->cursor_surface = event->surface;
+        seat->cursor_commit.notify = handle_cursor_commit;
+        wl_signal_add(&event->surface->events.commit, &seat->cursor_commit);
+        seat->cursor_destroy.notify = handle_cursor_destroy;
+        wl_signal_add(&event->surface->events.destroy, &seat->cursor_destroy);
+    }
+    
+    comp_server_notify_cursor(seat->server, seat->cursor_view);
+}
+
+/* Pointer moved on - a cursor only lasts while its client has the
+ * pointer. Within one client it stays until the client sets the next,
+ * as clients do on every enter. */
+static void handle_pointer_focus_change(struct wl_listener* listener, void* data) {
+    struct comp_seat* seat = wl_container_of(listener, seat, pointer_focus_change);
+    struct wlr_seat_pointer_focus_change_event* event = data;
+    
+    if (!seat->cursor_client) return;
+    
+    struct wl_client* client = event->new_surface ?
+        wl_resource_get_client(event->new_surface->resource) : NULL;
+    if (client != seat->cursor_client->client) {
+        cursor_clear(seat, true);
+    }
 }
 
 /* Handle selection request */
@@ -155,6 +240,9 @@ bool comp_seat_init(struct comp_seat* seat, struct comp_server* server) {
     seat->request_set_selection.notify = handle_request_set_selection;
     wl_signal_add(&seat->seat->events.request_set_selection, &seat->request_set_selection);
     
+    seat->pointer_focus_change.notify = handle_pointer_focus_change;
+    wl_signal_add(&seat->seat->pointer_state.events.focus_change, &seat->pointer_focus_change);
+    
     seat->new_input.notify = handle_new_input;
     /* Note: new_input comes from backend, which we'll connect later */
     
@@ -195,8 +283,10 @@ bool comp_seat_setup_keyboard(struct comp_seat* seat, struct wlr_backend* backen
 void comp_seat_finish(struct comp_seat* seat) {
     if (!seat || !seat->initialized) return;
     
+    cursor_clear(seat, false);
     wl_list_remove(&seat->request_cursor.link);
     wl_list_remove(&seat->request_set_selection.link);
+    wl_list_remove(&seat->pointer_focus_change.link);
     
     if (seat->xkb_state) xkb_state_unref(seat->xkb_state);
     if (seat->xkb_keymap) xkb_keymap_unref(seat->xkb_keymap);
@@ -327,10 +417,65 @@ void comp_seat_send_pointer_motion(struct comp_seat* seat, double x, double y) {
         
         /* Send motion */
         wlr_seat_pointer_notify_motion(seat->seat, get_time_msec(), sx, sy);
+        seat->pointer_frame_pending = true;
     } else {
         /* Clear focus */
         wlr_seat_pointer_notify_clear_focus(seat->seat);
     }
+    
+    /* Scene coordinates bypass the per-view cache */
+    seat->pointer_view = view;
+    seat->pointer_surface = NULL;
+}
+
+/* Surface of view at (sx, sy) in its root surface coordinates */
+static struct wlr_surface* view_surface_at(struct comp_seat* seat, struct comp_view* view,
+                                           double sx, double sy,
+                                           double* surface_x, double* surface_y) {
+    struct wlr_xdg_surface* xdg = view->xdg_toplevel->base;
+    struct wlr_surface* root = xdg->surface;
+    
+    /* Nothing can be stacked over the root surface - skip the tree walk */
+    bool single = wl_list_empty(&xdg->popups) &&
+        wl_list_empty(&root->current.subsurfaces_above) &&
+        wl_list_empty(&root->current.subsurfaces_below);
+    if (single && seat->pointer_view == view && seat->pointer_surface == root) {
+        *surface_x = sx;
+        *surface_y = sy;
+        return wlr_surface_point_accepts_input(root, sx, sy) ? root : NULL;
+    }
+    
+    struct wlr_surface* surface = wlr_xdg_surface_surface_at(xdg, sx, sy, surface_x, surface_y);
+    seat->pointer_view = view;
+    seat->pointer_surface = surface ? surface : root;
+    return surface;
+}
+
+/* Send pointer motion over a known view */
+void comp_seat_send_view_pointer_motion(struct comp_seat* seat, struct comp_view* view,
+                                        double sx, double sy) {
+    if (!seat || !seat->seat) return;
+    
+    if (!view || !view->mapped || !view->xdg_toplevel) {
+        wlr_seat_pointer_notify_clear_focus(seat->seat);
+        seat->pointer_view = NULL;
+        seat->pointer_surface = NULL;
+        return;
+    }
+    
+    double surface_x, surface_y;
+    struct wlr_surface* surface = view_surface_at(seat, view, sx, sy, &surface_x, &surface_y);
+    if (!surface) {
+        /* Outside the input region - leave, but keep the view for focus on click */
+        wlr_seat_pointer_notify_clear_focus(seat->seat);
+        return;
+    }
+    
+    if (surface != seat->seat->pointer_state.focused_surface) {
+        wlr_seat_pointer_notify_enter(seat->seat, surface, surface_x, surface_y);
+    }
+    wlr_seat_pointer_notify_motion(seat->seat, get_time_msec(), surface_x, surface_y);
+    seat->pointer_frame_pending = true;
 }
 
 /* Send pointer button */
@@ -339,25 +484,55 @@ void comp_seat_send_pointer_button(struct comp_seat* seat, uint32_t button, bool
     
     wlr_seat_pointer_notify_button(seat->seat, get_time_msec(), button,
         pressed ? WL_POINTER_BUTTON_STATE_PRESSED : WL_POINTER_BUTTON_STATE_RELEASED);
+    seat->pointer_frame_pending = true;
     
     /* Focus on click */
     if (pressed) {
-        double sx, sy;
-        struct comp_view* view = comp_seat_view_at(seat, seat->cursor_x, seat->cursor_y, &sx, &sy);
+        struct comp_view* view = seat->pointer_view;
+        if (!view) {
+            double sx, sy;
+            view = comp_seat_view_at(seat, seat->cursor_x, seat->cursor_y, &sx, &sy);
+        }
         if (view) {
             comp_view_focus(view);
         }
     }
 }
 
-/* Send pointer axis (scroll) */
-void comp_seat_send_pointer_axis(struct comp_seat* seat, bool horizontal, double value) {
+/* Send pointer axis (scroll). value120 is the wheel delta in 1/120ths of
+ * a notch, 0 for continuous sources, whose value 0 ends the scroll. */
+void comp_seat_send_pointer_axis(struct comp_seat* seat, bool horizontal, double value,
+                                 int32_t value120, bool continuous, bool inverted) {
     if (!seat || !seat->seat) return;
     
     wlr_seat_pointer_notify_axis(seat->seat, get_time_msec(),
         horizontal ? WL_POINTER_AXIS_HORIZONTAL_SCROLL : WL_POINTER_AXIS_VERTICAL_SCROLL,
-        value, (int32_t)value, WL_POINTER_AXIS_SOURCE_WHEEL,
-        WL_POINTER_AXIS_RELATIVE_DIRECTION_IDENTICAL);
+        value, continuous ? 0 : value120,
+        continuous ? WL_POINTER_AXIS_SOURCE_FINGER : WL_POINTER_AXIS_SOURCE_WHEEL,
+        inverted ? WL_POINTER_AXIS_RELATIVE_DIRECTION_INVERTED
+                 : WL_POINTER_AXIS_RELATIVE_DIRECTION_IDENTICAL);
+    seat->pointer_frame_pending = true;
+}
+
+/* End the current group of pointer events */
+void comp_seat_send_pointer_frame(struct comp_seat* seat) {
+    if (!seat || !seat->seat || !seat->pointer_frame_pending) return;
+    
+    wlr_seat_pointer_notify_frame(seat->seat);
+    seat->pointer_frame_pending = false;
+}
+
+/* Forget a view going away */
+void comp_seat_forget_view(struct comp_seat* seat, struct comp_view* view) {
+    if (!seat) return;
+    
+    if (seat->cursor_view == view) {
+        cursor_clear(seat, false);
+    }
+    if (seat->pointer_view != view) return;
+    
+    seat->pointer_view = NULL;
+    seat->pointer_surface = NULL;
 }
 
 /* Find view at coordinates */
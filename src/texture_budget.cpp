@@ -0,0 +1,110 @@
+/*
+ * texture_budget.cpp - LRU eviction of hidden views' frames
+ *
+ * SPDX-License-Identifier: MIT
+ * Copyright (c) 2024
+ */
+#include "texture_budget.h"
+#include "embedded_view.h"
+
+#include <QMutexLocker>
+#include <QDebug>
+
+#include <algorithm>
+
+TextureBudget::TextureBudget(QObject* parent)
+    : QObject(parent)
+{
+}
+
+void TextureBudget::setLimit(qint64 bytes) {
+    bytes = qMax<qint64>(0, bytes);
+    if (m_limit == bytes) return;
+
+    {
+        QMutexLocker lock(&m_mutex);
+        m_limit = bytes;
+    }
+    m_warned = false;
+    enforce();
+}
+
+qint64 TextureBudget::usage() const {
+    QMutexLocker lock(&m_mutex);
+    return m_usage;
+}
+
+void TextureBudget::report(EmbeddedView* view, qint64 bytes) {
+    QMutexLocker lock(&m_mutex);
+    Entry& entry = m_entries[view];
+    if (entry.lastDisplayed == 0) {
+        entry.lastDisplayed = ++m_clock;
+    }
+    m_usage += bytes - entry.bytes;
+    entry.bytes = bytes;
+
+    /* Items are only touched on the GUI thread */
+    if (m_limit > 0 && m_usage > m_limit && !m_enforceScheduled) {
+        m_enforceScheduled = true;
+        QMetaObject::invokeMethod(this, &TextureBudget::enforce, Qt::QueuedConnection);
+    }
+}
+
+void TextureBudget::touch(EmbeddedView* view) {
+    QMutexLocker lock(&m_mutex);
+    m_entries[view].lastDisplayed = ++m_clock;
+}
+
+void TextureBudget::remove(EmbeddedView* view) {
+    QMutexLocker lock(&m_mutex);
+    auto it = m_entries.find(view);
+    if (it == m_entries.end()) return;
+
+    m_usage -= it->bytes;
+    m_entries.erase(it);
+}
+
+void TextureBudget::enforce() {
+    QList<EmbeddedView*> evict;
+    qint64 usage;
+    {
+        QMutexLocker lock(&m_mutex);
+        m_enforceScheduled = false;
+        if (m_limit <= 0 || m_usage <= m_limit) {
+            m_warned = false;
+            return;
+        }
+
+        QList<EmbeddedView*> hidden;
+        for (auto it = m_entries.cbegin(); it != m_entries.cend(); ++it) {
+            if (it->bytes > 0 && !it.key()->isEffectivelyVisible()) {
+                hidden.append(it.key());
+            }
+        }
+        std::sort(hidden.begin(), hidden.end(), [this](EmbeddedView* a, EmbeddedView* b) {
+            return m_entries.value(a).lastDisplayed < m_entries.value(b).lastDisplayed;
+        });
+
+        /* Counted as freed right away - the textures go with the next sync */
+        for (EmbeddedView* view : hidden) {
+            if (m_usage <= m_limit) break;
+            Entry& entry = m_entries[view];
+            m_usage -= entry.bytes;
+            entry.bytes = 0;
+            evict.append(view);
+        }
+        usage = m_usage;
+    }
+
+    /* Outside the lock - the views take their buffer mutex, which the
+     * render thread holds while it reports */
+    for (EmbeddedView* view : evict) {
+        view->evictFrame();
+    }
+
+    if (usage > m_limit && !m_warned) {
+        m_warned = true;
+        qWarning() << "Visible views need" << (usage >> 20) << "MiB of frames, over the"
+                   << (m_limit >> 20) << "MiB texture limit";
+    }
+}
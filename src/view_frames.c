@@ -0,0 +1,520 @@
+/*
+ * view_frames.c - Per-view CPU staging buffers
+ *
+ * A slot is shared between the ring (one reference) and any consumer
+ * holding a frame from it (one reference each). The compositor only
+ * writes into a slot while the ring holds the sole reference, so
+ * consumers can read their frame without locking. References are
+ * atomic because consumers release from the Qt render thread.
+ *
+ * Slot memory comes from the server's buffer pool, so a resize trades
+ * the old buffer for a pooled one of the new size class instead of
+ * going through the allocator.
+ *
+ * Direct frames get a slot of their own outside the ring that points into
+ * the client's shm mapping and holds a lock on its buffer instead.
+ *
+ * Downscaled frames have a second ring of small slots, filtered from the
+ * latest full-size slot. Their staleness is kept in their own pixels.
+ *
+ * SPDX-License-Identifier: MIT
+ * Copyright (c) 2024
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include "view_frames.h"
+#include "buffer_pool.h"
+#include "buffer_sync.h"
+#include "pixel_convert.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#include <drm_fourcc.h>
+#include <wlr/types/wlr_buffer.h>
+#include <wlr/util/log.h>
+
+/* Row alignment of staging buffers - keeps rows cache-line aligned */
+#define SLOT_STRIDE_ALIGN 64
+
+struct comp_frame_slot {
+    atomic_int refs;            /* 1 for the ring + 1 per consumer */
+    struct pool_buffer* buffer;
+    void* data;
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;
+    uint64_t seq;
+    uint32_t format;            /* Client format last converted from */
+    pixman_region32_t stale;    /* Where data differs from the client buffer */
+    struct comp_buffer_lock* lock;  /* Direct: data is the client's */
+    uint32_t factor;            /* Buffer pixels per side of one of ours */
+    uint32_t src_width;         /* Downscaled: size of the frame filtered */
+    uint32_t src_height;
+};
+
+static struct comp_frame_slot* slot_create(void) {
+    struct comp_frame_slot* slot = calloc(1, sizeof(*slot));
+    if (!slot) return NULL;
+
+    atomic_init(&slot->refs, 1);
+    pixman_region32_init(&slot->stale);
+    slot->factor = 1;
+    return slot;
+}
+
+static void slot_unref(struct comp_frame_slot* slot) {
+    if (!slot) return;
+
+    if (atomic_fetch_sub_explicit(&slot->refs, 1, memory_order_acq_rel) == 1) {
+        buffer_sync_unlock(slot->lock, -1);
+        pixman_region32_fini(&slot->stale);
+        pool_buffer_unref(slot->buffer);
+        free(slot);
+    }
+}
+
+static bool slot_is_free(struct comp_frame_slot* slot) {
+    return atomic_load_explicit(&slot->refs, memory_order_acquire) == 1;
+}
+
+/* (Re)allocate for a new buffer size - everything becomes stale */
+static bool slot_ensure_size(struct comp_view_frames* frames, struct comp_frame_slot* slot,
+                             uint32_t width, uint32_t height) {
+    if (slot->data && slot->width == width && slot->height == height) {
+        return true;
+    }
+
+    /* Pool memory is page aligned, so rows stay aligned too */
+    uint32_t stride = (width * 4 + SLOT_STRIDE_ALIGN - 1) & ~(uint32_t)(SLOT_STRIDE_ALIGN - 1);
+    size_t size = (size_t)stride * height;
+
+    /* Still big enough (and not oversized) - keep the memory, only the
+     * layout changes */
+    if (!slot->buffer || slot->buffer->size < size || size < slot->buffer->size / 2) {
+        struct pool_buffer* buffer = buffer_pool_acquire(frames->pool, size);
+        if (!buffer) {
+            wlr_log(WLR_ERROR, "Failed to allocate %ux%u staging buffer", width, height);
+            return false;
+        }
+        pool_buffer_unref(slot->buffer);
+        slot->buffer = buffer;
+    }
+
+    slot->data = slot->buffer->data;
+    slot->width = width;
+    slot->height = height;
+    slot->stride = stride;
+    pixman_region32_fini(&slot->stale);
+    pixman_region32_init_rect(&slot->stale, 0, 0, width, height);
+    return true;
+}
+
+/* Convert the stale part of the client buffer into the slot.
+ * Returns the number of bytes written. */
+static uint64_t slot_update(struct comp_frame_slot* slot, const uint8_t* src, size_t src_stride,
+                        uint32_t format) {
+    pixman_region32_intersect_rect(&slot->stale, &slot->stale, 0, 0,
+                                   slot->width, slot->height);
+
+    int n_boxes = 0;
+    const pixman_box32_t* boxes = pixman_region32_rectangles(&slot->stale, &n_boxes);
+    uint8_t* dst = slot->data;
+    uint32_t bpp = pixel_convert_bpp(format);
+    uint64_t bytes = 0;
+
+    for (int i = 0; i < n_boxes; i++) {
+        pixel_convert(dst + (size_t)boxes[i].y1 * slot->stride + (size_t)boxes[i].x1 * 4,
+                      slot->stride,
+                      src + (size_t)boxes[i].y1 * src_stride + (size_t)boxes[i].x1 * bpp,
+                      src_stride, format,
+                      (uint32_t)(boxes[i].x2 - boxes[i].x1),
+                      (uint32_t)(boxes[i].y2 - boxes[i].y1));
+        bytes += (uint64_t)(boxes[i].x2 - boxes[i].x1) * (boxes[i].y2 - boxes[i].y1) * 4;
+    }
+
+    pixman_region32_clear(&slot->stale);
+    return bytes;
+}
+
+/* Whether the consumer's copy has another size or scale than the next
+ * frame, so damage means nothing to it */
+static bool frames_out_changed(struct comp_view_frames* frames, uint32_t width,
+                               uint32_t height, uint32_t downscale) {
+    return frames->out_width != width || frames->out_height != height ||
+           frames->out_downscale != downscale;
+}
+
+/* Pick a slot of a ring to write: the latest one if free (least stale),
+ * else any free one */
+static struct comp_frame_slot* frames_pick_slot(struct comp_frame_slot** slots,
+                                                struct comp_frame_slot* latest) {
+    if (latest && slot_is_free(latest)) {
+        return latest;
+    }
+
+    for (int i = 0; i < COMP_FRAME_SLOTS; i++) {
+        if (!slots[i]) {
+            slots[i] = slot_create();
+            return slots[i];
+        }
+        if (slot_is_free(slots[i])) {
+            return slots[i];
+        }
+    }
+
+    return NULL;
+}
+
+/* Pixels of a downscaled frame that cover a rectangle of the buffer */
+static struct comp_rect rect_scale_down(struct comp_rect rect, uint32_t factor) {
+    int32_t f = (int32_t)factor;
+    int32_t x1 = rect.x / f;
+    int32_t y1 = rect.y / f;
+    int32_t x2 = (rect.x + rect.width + f - 1) / f;
+    int32_t y2 = (rect.y + rect.height + f - 1) / f;
+    return (struct comp_rect){ x1, y1, x2 - x1, y2 - y1 };
+}
+
+static void frames_fill(struct comp_view_frames* frames, struct comp_frame_slot* slot,
+                        struct comp_frame* frame, bool with_damage) {
+    atomic_fetch_add_explicit(&slot->refs, 1, memory_order_relaxed);
+
+    frame->data = slot->data;
+    frame->direct = slot->lock != NULL;
+    frame->downscale = slot->factor;
+    frame->width = slot->width;
+    frame->height = slot->height;
+    frame->stride = slot->stride;
+    frame->seq = slot->seq;
+    frame->handle = slot;
+    frame->n_damage = 0;
+
+    frames->out_width = frame->width;
+    frames->out_height = frame->height;
+    frames->out_downscale = frame->downscale;
+
+    if (!with_damage) return;
+
+    int n_boxes = 0;
+    const pixman_box32_t* boxes = pixman_region32_rectangles(&frames->damage, &n_boxes);
+    if (n_boxes > COMP_MAX_DAMAGE_RECTS) {
+        const pixman_box32_t* ext = pixman_region32_extents(&frames->damage);
+        frame->damage[0] = (struct comp_rect){ ext->x1, ext->y1,
+                                               ext->x2 - ext->x1, ext->y2 - ext->y1 };
+        frame->n_damage = 1;
+        return;
+    }
+    for (int i = 0; i < n_boxes; i++) {
+        frame->damage[frame->n_damage++] = (struct comp_rect){
+            boxes[i].x1, boxes[i].y1, boxes[i].x2 - boxes[i].x1, boxes[i].y2 - boxes[i].y1 };
+    }
+}
+
+void view_frames_init(struct comp_view_frames* frames, struct buffer_pool* pool) {
+    memset(frames, 0, sizeof(*frames));
+    frames->pool = buffer_pool_ref(pool);
+    pixman_region32_init(&frames->damage);
+    frames->initialized = true;
+}
+
+void view_frames_finish(struct comp_view_frames* frames) {
+    if (!frames || !frames->initialized) return;
+
+    for (int i = 0; i < COMP_FRAME_SLOTS; i++) {
+        slot_unref(frames->slots[i]);
+        frames->slots[i] = NULL;
+        slot_unref(frames->thumbs[i]);
+        frames->thumbs[i] = NULL;
+    }
+    frames->latest = NULL;
+    frames->latest_thumb = NULL;
+    pixman_region32_fini(&frames->damage);
+    buffer_pool_unref(frames->pool);
+    frames->pool = NULL;
+    frames->initialized = false;
+}
+
+void view_frames_trim(struct comp_view_frames* frames) {
+    if (!frames || !frames->initialized) return;
+
+    for (int i = 0; i < COMP_FRAME_SLOTS; i++) {
+        slot_unref(frames->slots[i]);
+        frames->slots[i] = NULL;
+        slot_unref(frames->thumbs[i]);
+        frames->thumbs[i] = NULL;
+    }
+    frames->latest = NULL;
+    frames->latest_thumb = NULL;
+    frames->latest_direct = NULL;
+    /* Whatever the consumer kept is gone as well - no partial damage */
+    frames->out_width = 0;
+    frames->out_height = 0;
+    frames->out_downscale = 0;
+}
+
+void view_frames_damage(struct comp_view_frames* frames, pixman_region32_t* damage) {
+    if (!frames || !frames->initialized || !damage) return;
+
+    for (int i = 0; i < COMP_FRAME_SLOTS; i++) {
+        if (frames->slots[i]) {
+            pixman_region32_union(&frames->slots[i]->stale, &frames->slots[i]->stale, damage);
+        }
+    }
+    pixman_region32_union(&frames->damage, &frames->damage, damage);
+
+    int n_boxes = 0;
+    const pixman_box32_t* boxes = pixman_region32_rectangles(damage, &n_boxes);
+    for (int i = 0; i < COMP_FRAME_SLOTS; i++) {
+        struct comp_frame_slot* thumb = frames->thumbs[i];
+        if (!thumb) continue;
+        for (int j = 0; j < n_boxes; j++) {
+            struct comp_rect rect = rect_scale_down((struct comp_rect){
+                boxes[j].x1, boxes[j].y1, boxes[j].x2 - boxes[j].x1, boxes[j].y2 - boxes[j].y1 },
+                thumb->factor);
+            pixman_region32_union_rect(&thumb->stale, &thumb->stale,
+                                       rect.x, rect.y, (uint32_t)rect.width, (uint32_t)rect.height);
+        }
+    }
+    frames->dirty = true;
+}
+
+bool view_frames_acquire(struct comp_view_frames* frames, struct wlr_buffer* buffer,
+                         struct comp_frame* frame) {
+    if (!frames || !frames->initialized || !buffer || !frame) return false;
+
+    /* Nothing committed since last time - share the latest frame again,
+     * unless a direct or downscaled frame was handed out after it */
+    if (!frames->dirty && frames->latest && frames->latest->seq == frames->seq &&
+        frames->latest->width == (uint32_t)buffer->width &&
+        frames->latest->height == (uint32_t)buffer->height &&
+        !frames_out_changed(frames, frames->latest->width, frames->latest->height, 1)) {
+        frames_fill(frames, frames->latest, frame, false);
+        frames->last_copy_bytes = 0;
+        return true;
+    }
+
+    struct comp_frame_slot* slot = frames_pick_slot(frames->slots, frames->latest);
+    if (!slot) {
+        /* Consumer still holds every slot - damage is kept for the retry */
+        return false;
+    }
+
+    void* data;
+    uint32_t format;
+    size_t src_stride;
+    if (!wlr_buffer_begin_data_ptr_access(buffer, WLR_BUFFER_DATA_PTR_ACCESS_READ,
+                                           &data, &format, &src_stride)) {
+        return false;
+    }
+    if (!pixel_convert_supported(format)) {
+        wlr_buffer_end_data_ptr_access(buffer);
+        return false;
+    }
+
+    uint32_t width = (uint32_t)buffer->width;
+    uint32_t height = (uint32_t)buffer->height;
+    bool resized = !frames->latest || frames->latest->format != format ||
+                   frames_out_changed(frames, width, height, 1);
+
+    if (!slot_ensure_size(frames, slot, width, height)) {
+        wlr_buffer_end_data_ptr_access(buffer);
+        return false;
+    }
+    if (slot->format != format) {
+        /* Different conversion - nothing in the slot can be kept */
+        pixman_region32_union_rect(&slot->stale, &slot->stale, 0, 0, width, height);
+        slot->format = format;
+    }
+
+    frames->last_copy_bytes = slot_update(slot, data, src_stride, format);
+    wlr_buffer_end_data_ptr_access(buffer);
+
+    slot->seq = ++frames->seq;
+    frames->latest = slot;
+    frames->latest_direct = NULL;
+    frames->dirty = false;
+
+    if (resized) {
+        pixman_region32_fini(&frames->damage);
+        pixman_region32_init_rect(&frames->damage, 0, 0, width, height);
+    }
+    pixman_region32_intersect_rect(&frames->damage, &frames->damage, 0, 0, width, height);
+
+    frames_fill(frames, slot, frame, true);
+    pixman_region32_clear(&frames->damage);
+    return true;
+}
+
+bool view_frames_acquire_scaled(struct comp_view_frames* frames, struct wlr_buffer* buffer,
+                                uint32_t factor, struct comp_frame* frame) {
+    if (factor <= 1) return view_frames_acquire(frames, buffer, frame);
+    if (!frames || !frames->initialized || !buffer || !frame) return false;
+    if (factor > PIXEL_DOWNSCALE_MAX) factor = PIXEL_DOWNSCALE_MAX;
+
+    uint32_t width = ((uint32_t)buffer->width + factor - 1) / factor;
+    uint32_t height = ((uint32_t)buffer->height + factor - 1) / factor;
+    struct comp_frame_slot* prev = frames->latest_thumb;
+    struct comp_frame_slot* thumb = frames_pick_slot(frames->thumbs, prev);
+    if (!thumb) {
+        return false;
+    }
+
+    /* Whether damage against the consumer's copy can be told at all */
+    bool out_changed = !prev || prev->src_width != (uint32_t)buffer->width ||
+                       prev->src_height != (uint32_t)buffer->height ||
+                       frames_out_changed(frames, width, height, factor);
+
+    /* Take the ring's damage against the frame the consumer's came from */
+    uint32_t out_width = frames->out_width;
+    uint32_t out_height = frames->out_height;
+    uint32_t out_downscale = frames->out_downscale;
+    frames->out_width = prev ? prev->src_width : 0;
+    frames->out_height = prev ? prev->src_height : 0;
+    frames->out_downscale = 1;
+
+    struct comp_frame full;
+    if (!view_frames_acquire(frames, buffer, &full)) {
+        frames->out_width = out_width;
+        frames->out_height = out_height;
+        frames->out_downscale = out_downscale;
+        return false;
+    }
+    struct comp_frame_slot* src = full.handle;
+
+    if (!out_changed && full.n_damage == 0 && prev->seq == src->seq) {
+        /* Same frame as last time */
+        slot_unref(src);
+        frames_fill(frames, prev, frame, false);
+        return true;
+    }
+
+    if (!slot_ensure_size(frames, thumb, width, height)) {
+        slot_unref(src);
+        frames->out_width = out_width;
+        frames->out_height = out_height;
+        frames->out_downscale = out_downscale;
+        return false;
+    }
+    if (thumb->factor != factor || thumb->src_width != src->width ||
+        thumb->src_height != src->height) {
+        pixman_region32_union_rect(&thumb->stale, &thumb->stale, 0, 0, width, height);
+        thumb->factor = factor;
+        thumb->src_width = src->width;
+        thumb->src_height = src->height;
+    }
+    /* Commit damage is in already - this adds the ring starting over */
+    for (int i = 0; i < full.n_damage; i++) {
+        struct comp_rect rect = rect_scale_down(full.damage[i], factor);
+        pixman_region32_union_rect(&thumb->stale, &thumb->stale,
+                                   rect.x, rect.y, (uint32_t)rect.width, (uint32_t)rect.height);
+    }
+    pixman_region32_intersect_rect(&thumb->stale, &thumb->stale, 0, 0, width, height);
+
+    /* Filter whole blocks of the up-to-date full-size slot */
+    int n_boxes = 0;
+    const pixman_box32_t* boxes = pixman_region32_rectangles(&thumb->stale, &n_boxes);
+    uint64_t bytes = 0;
+    for (int i = 0; i < n_boxes; i++) {
+        uint32_t x = (uint32_t)boxes[i].x1 * factor;
+        uint32_t y = (uint32_t)boxes[i].y1 * factor;
+        uint32_t x2 = (uint32_t)boxes[i].x2 * factor;
+        uint32_t y2 = (uint32_t)boxes[i].y2 * factor;
+        if (x2 > src->width) x2 = src->width;
+        if (y2 > src->height) y2 = src->height;
+        pixel_downscale((uint8_t*)thumb->data + (size_t)boxes[i].y1 * thumb->stride +
+                            (size_t)boxes[i].x1 * 4,
+                        thumb->stride,
+                        (const uint8_t*)src->data + (size_t)y * src->stride + (size_t)x * 4,
+                        src->stride, x2 - x, y2 - y, factor);
+        bytes += (uint64_t)(boxes[i].x2 - boxes[i].x1) * (boxes[i].y2 - boxes[i].y1) * 4;
+    }
+    pixman_region32_clear(&thumb->stale);
+    frames->last_copy_bytes += bytes;
+
+    thumb->seq = src->seq;
+    frames->latest_thumb = thumb;
+    slot_unref(src);
+
+    frames_fill(frames, thumb, frame, false);
+    if (out_changed) {
+        frame->damage[0] = (struct comp_rect){ 0, 0, (int32_t)width, (int32_t)height };
+        frame->n_damage = 1;
+    } else {
+        for (int i = 0; i < full.n_damage; i++) {
+            frame->damage[frame->n_damage++] = rect_scale_down(full.damage[i], factor);
+        }
+    }
+    return true;
+}
+
+bool view_frames_acquire_direct(struct comp_view_frames* frames, struct wlr_buffer* buffer,
+                                struct buffer_sync* sync, struct comp_frame* frame) {
+    if (!frames || !frames->initialized || !buffer || !sync || !frame) return false;
+
+    /* Without locks of its own the client may already be drawing into it */
+    if (buffer->n_locks == 0) return false;
+
+    struct wlr_shm_attributes shm;
+    if (!wlr_buffer_get_shm(buffer, &shm) || shm.format != DRM_FORMAT_ARGB8888) {
+        return false;
+    }
+
+    /* The pool stays mapped as long as the buffer exists, which the lock
+     * sees to - the pointer outlives the access */
+    void* data;
+    uint32_t format;
+    size_t stride;
+    if (!wlr_buffer_begin_data_ptr_access(buffer, WLR_BUFFER_DATA_PTR_ACCESS_READ,
+                                           &data, &format, &stride)) {
+        return false;
+    }
+    wlr_buffer_end_data_ptr_access(buffer);
+    if ((stride & 3) != 0) {
+        /* Rows a QImage cannot describe */
+        return false;
+    }
+
+    struct comp_frame_slot* slot = slot_create();
+    if (!slot) return false;
+    slot->lock = buffer_sync_lock(sync, buffer);
+    if (!slot->lock) {
+        slot_unref(slot);
+        return false;
+    }
+    slot->data = data;
+    slot->width = (uint32_t)buffer->width;
+    slot->height = (uint32_t)buffer->height;
+    slot->stride = (uint32_t)stride;
+    slot->format = format;
+
+    /* Nothing committed since the last direct frame - same seq, no damage */
+    bool fresh = frames->dirty || !frames->latest_direct || frames->latest_direct != buffer ||
+                 frames_out_changed(frames, slot->width, slot->height, 1);
+    if (fresh) {
+        /* Damage since the last acquire of either kind; the ring's slots
+         * keep their own staleness */
+        if (frames_out_changed(frames, slot->width, slot->height, 1)) {
+            pixman_region32_fini(&frames->damage);
+            pixman_region32_init_rect(&frames->damage, 0, 0, slot->width, slot->height);
+        }
+        pixman_region32_intersect_rect(&frames->damage, &frames->damage, 0, 0,
+                                       slot->width, slot->height);
+        frames->seq++;
+    }
+    slot->seq = frames->seq;
+    frames->latest_direct = buffer;
+    frames->dirty = false;
+
+    /* The consumer's is the only reference */
+    frames_fill(frames, slot, frame, fresh);
+    slot_unref(slot);
+    if (fresh) pixman_region32_clear(&frames->damage);
+    frames->last_copy_bytes = 0;
+    return true;
+}
+
+void comp_frame_release(void* handle) {
+    slot_unref(handle);
+}
@@ -0,0 +1,102 @@
+/*
+ * view_model.cpp - List model of the compositor's views
+ *
+ * SPDX-License-Identifier: MIT
+ * Copyright (c) 2024
+ */
+#include "view_model.h"
+#include "compositor_wrapper.h"
+#include "frame_trace.h"
+
+ViewModel::ViewModel(CompositorWrapper* compositor)
+    : QAbstractListModel(compositor)
+    , m_compositor(compositor)
+{
+}
+
+int ViewModel::rowCount(const QModelIndex& parent) const {
+    if (parent.isValid()) return 0;
+    return m_compositor->viewCount();
+}
+
+int ViewModel::count() const {
+    return m_compositor->viewCount();
+}
+
+QVariant ViewModel::data(const QModelIndex& index, int role) const {
+    if (!checkIndex(index, CheckIndexOption::IndexIsValid | CheckIndexOption::ParentIsInvalid)) {
+        return QVariant();
+    }
+    
+    int row = index.row();
+    switch (role) {
+    case ViewIdRole:
+        return m_compositor->viewId(row);
+    case Qt::DisplayRole:
+    case TitleRole:
+        return m_compositor->viewTitle(row);
+    case GeometryRole:
+        return m_compositor->viewGeometry(row);
+    case FpsRole: {
+        struct frame_trace_stats stats;
+        frame_trace_get_stats(m_compositor->viewHandle(row), &stats);
+        return stats.fps;
+    }
+    }
+    return QVariant();
+}
+
+QHash<int, QByteArray> ViewModel::roleNames() const {
+    return {
+        { ViewIdRole, "viewId" },
+        { TitleRole, "title" },
+        { GeometryRole, "geometry" },
+        { FpsRole, "fps" },
+    };
+}
+
+int ViewModel::indexOf(int viewId) const {
+    return m_compositor->viewIndexOf(m_compositor->viewById(viewId));
+}
+
+int ViewModel::viewId(int row) const {
+    return m_compositor->viewId(row);
+}
+
+void ViewModel::beginInsertView(int row) {
+    beginInsertRows(QModelIndex(), row, row);
+}
+
+void ViewModel::endInsertView() {
+    endInsertRows();
+    emit countChanged();
+}
+
+void ViewModel::beginRemoveView(int row) {
+    beginRemoveRows(QModelIndex(), row, row);
+}
+
+void ViewModel::endRemoveView() {
+    endRemoveRows();
+    emit countChanged();
+}
+
+void ViewModel::beginResetViews() {
+    beginResetModel();
+}
+
+void ViewModel::endResetViews() {
+    endResetModel();
+    emit countChanged();
+}
+
+void ViewModel::viewChanged(int row, const QList<int>& roles) {
+    QModelIndex changed = index(row);
+    emit dataChanged(changed, changed, roles);
+}
+
+void ViewModel::frameRatesChanged() {
+    int rows = rowCount();
+    if (rows == 0) return;
+    emit dataChanged(index(0), index(rows - 1), { FpsRole });
+}
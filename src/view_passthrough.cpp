@@ -0,0 +1,398 @@
+/*
+ * view_passthrough.cpp - Subsurfaces of the Qt window for passed-through views
+ *
+ * SPDX-License-Identifier: MIT
+ * Copyright (c) 2024
+ */
+#include "view_passthrough.h"
+#include "compositor_core.h"
+#include "dmabuf_texture.h"
+
+#include <QGuiApplication>
+#include <QtGui/qguiapplication_platform.h>
+#include <qpa/qplatformnativeinterface.h>
+#include <QDebug>
+
+#include <wayland-client.h>
+#include "linux-dmabuf-unstable-v1-client-protocol.h"
+#include "viewporter-client-protocol.h"
+
+#include <climits>
+#include <cstring>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/dma-buf.h>
+
+/* A client buffer imported on the parent's connection */
+struct ViewPassthrough::Buffer {
+    ~Buffer();
+
+    ViewPassthrough* owner;         /* NULL once the passthrough is gone */
+    /* The client buffer: its first plane's dma-buf inode, and layout */
+    dev_t dev;
+    ino_t ino;
+    uint32_t width;
+    uint32_t height;
+    uint32_t format;
+    uint64_t modifier;
+    struct zwp_linux_buffer_params_v1* params = nullptr;   /* While importing */
+    struct wl_buffer* buffer = nullptr;
+    struct comp_buffer_lock* lock = nullptr;   /* Until the parent releases it */
+    bool attachOnCreate = false;
+};
+
+ViewPassthrough::Buffer::~Buffer() {
+    if (buffer) {
+        wl_buffer_destroy(buffer);
+    }
+    comp_buffer_unlock(lock, -1);
+}
+
+namespace {
+
+/* Parent globals beyond Qt's wl_compositor, bound once */
+struct ParentGlobals {
+    bool probed = false;
+    struct wl_display* display = nullptr;       /* Set once all are there */
+    struct wl_compositor* compositor = nullptr;
+    struct wl_subcompositor* subcompositor = nullptr;
+    struct wp_viewporter* viewporter = nullptr;
+    struct zwp_linux_dmabuf_v1* dmabuf = nullptr;
+};
+
+ParentGlobals s_globals;
+
+void handleGlobal(void* data, struct wl_registry* registry, uint32_t name,
+                  const char* interface, uint32_t version) {
+    ParentGlobals* globals = static_cast<ParentGlobals*>(data);
+    if (strcmp(interface, wl_subcompositor_interface.name) == 0) {
+        globals->subcompositor = static_cast<struct wl_subcompositor*>(
+            wl_registry_bind(registry, name, &wl_subcompositor_interface, 1));
+    } else if (strcmp(interface, wp_viewporter_interface.name) == 0) {
+        globals->viewporter = static_cast<struct wp_viewporter*>(
+            wl_registry_bind(registry, name, &wp_viewporter_interface, 1));
+    } else if (strcmp(interface, zwp_linux_dmabuf_v1_interface.name) == 0 && version >= 2) {
+        /* 2 for params.create, the asynchronous import */
+        globals->dmabuf = static_cast<struct zwp_linux_dmabuf_v1*>(
+            wl_registry_bind(registry, name, &zwp_linux_dmabuf_v1_interface, qMin(version, 3u)));
+    }
+}
+
+void handleGlobalRemove(void* data, struct wl_registry* registry, uint32_t name) {
+    Q_UNUSED(data);
+    Q_UNUSED(registry);
+    Q_UNUSED(name);
+}
+
+const ParentGlobals& parentGlobals() {
+    if (s_globals.probed) return s_globals;
+    s_globals.probed = true;
+
+    auto* wayland = qGuiApp->nativeInterface<QNativeInterface::QWaylandApplication>();
+    if (!wayland || !wayland->display() || !wayland->compositor()) return s_globals;
+    struct wl_display* display = wayland->display();
+
+    /* Bind on a queue of our own - Qt dispatches the default one and
+     * must not see our registry */
+    struct wl_event_queue* queue = wl_display_create_queue(display);
+    auto* wrapper = static_cast<struct wl_display*>(wl_proxy_create_wrapper(display));
+    wl_proxy_set_queue(reinterpret_cast<struct wl_proxy*>(wrapper), queue);
+    struct wl_registry* registry = wl_display_get_registry(wrapper);
+    static const struct wl_registry_listener listener = { handleGlobal, handleGlobalRemove };
+    wl_registry_add_listener(registry, &listener, &s_globals);
+    wl_display_roundtrip_queue(display, queue);
+    wl_registry_destroy(registry);
+    wl_proxy_wrapper_destroy(wrapper);
+
+    /* Buffers and callbacks are dispatched by Qt, on the GUI thread */
+    void* proxies[] = { s_globals.subcompositor, s_globals.viewporter, s_globals.dmabuf };
+    for (void* proxy : proxies) {
+        if (proxy) {
+            wl_proxy_set_queue(static_cast<struct wl_proxy*>(proxy), nullptr);
+        }
+    }
+    wl_event_queue_destroy(queue);
+
+    if (!s_globals.subcompositor || !s_globals.viewporter || !s_globals.dmabuf) {
+        qInfo() << "Passthrough unavailable: the parent compositor lacks"
+                << (!s_globals.subcompositor ? "wl_subcompositor" :
+                    !s_globals.viewporter ? "wp_viewporter" : "zwp_linux_dmabuf_v1 (v2)");
+        return s_globals;
+    }
+    s_globals.compositor = wayland->compositor();
+    s_globals.display = display;
+    return s_globals;
+}
+
+struct wl_surface* parentSurface(QWindow* window) {
+    QPlatformNativeInterface* native = QGuiApplication::platformNativeInterface();
+    if (!window || !window->handle() || !native) return nullptr;
+    return static_cast<struct wl_surface*>(native->nativeResourceForWindow("surface", window));
+}
+
+/* Let the parent wait for the client's rendering: add the acquire fence
+ * to the buffer's implicit fences. False if the kernel cannot (before
+ * 6.0). */
+bool importAcquireFence(const struct comp_dmabuf* dmabuf) {
+    struct dma_buf_import_sync_file request = {};
+    request.flags = DMA_BUF_SYNC_WRITE;
+    request.fd = dmabuf->acquire_fence;
+    for (int i = 0; i < dmabuf->n_planes; i++) {
+        if (ioctl(dmabuf->fd[i], DMA_BUF_IOCTL_IMPORT_SYNC_FILE, &request) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+bool ViewPassthrough::isSupported(QQuickWindow* window) {
+    if (!window || !QGuiApplication::platformName().startsWith(QLatin1String("wayland"))) {
+        return false;
+    }
+    return parentGlobals().display != nullptr;
+}
+
+ViewPassthrough::ViewPassthrough(QQuickWindow* window, QObject* parent)
+    : QObject(parent)
+    , m_window(window)
+{
+    const ParentGlobals& globals = parentGlobals();
+    m_parent = globals.display ? parentSurface(window) : nullptr;
+    if (!m_parent) return;
+
+    m_surface = wl_compositor_create_surface(globals.compositor);
+    m_subsurface = wl_subcompositor_get_subsurface(globals.subcompositor, m_surface, m_parent);
+    m_viewport = wp_viewporter_get_viewport(globals.viewporter, m_surface);
+
+    /* Over the window's content, synchronized until the first frame is
+     * in place (see frameDone) */
+    wl_subsurface_place_above(m_subsurface, m_parent);
+
+    /* Input goes to the window underneath */
+    struct wl_region* input = wl_compositor_create_region(globals.compositor);
+    wl_surface_set_input_region(m_surface, input);
+    wl_region_destroy(input);
+    wl_display_flush(globals.display);
+}
+
+ViewPassthrough::~ViewPassthrough() {
+    if (!m_surface) return;
+
+    if (m_frameCallback) {
+        wl_callback_destroy(m_frameCallback);
+    }
+    wp_viewport_destroy(m_viewport);
+    wl_subsurface_destroy(m_subsurface);
+    wl_surface_destroy(m_surface);
+
+    for (Buffer* buffer : m_buffers) {
+        /* Still importing - freed once the parent answers */
+        if (buffer->params) {
+            buffer->owner = nullptr;
+        } else {
+            delete buffer;
+        }
+    }
+    wl_display_flush(parentGlobals().display);
+}
+
+bool ViewPassthrough::isValid() const {
+    return m_surface && m_window && parentSurface(m_window) == m_parent;
+}
+
+void ViewPassthrough::setGeometry(const QRect& rect) {
+    if (!m_surface || rect.isEmpty() || rect == m_geometry) return;
+    m_geometry = rect;
+
+    /* The window's surface includes client-side decorations */
+    QMargins margins = m_window->frameMargins();
+    wl_subsurface_set_position(m_subsurface, rect.x() + margins.left(), rect.y() + margins.top());
+    wp_viewport_set_destination(m_viewport, rect.width(), rect.height());
+    updateOpaqueRegion();
+    wl_surface_commit(m_surface);
+
+    /* The position applies with the window's next commit */
+    m_window->update();
+    wl_display_flush(parentGlobals().display);
+}
+
+void ViewPassthrough::updateOpaqueRegion() {
+    QSize size = m_opaque ? m_geometry.size() : QSize();
+    if (size == m_opaqueSize) return;
+    m_opaqueSize = size;
+
+    struct wl_region* region = nullptr;
+    if (!size.isEmpty()) {
+        region = wl_compositor_create_region(parentGlobals().compositor);
+        wl_region_add(region, 0, 0, size.width(), size.height());
+    }
+    wl_surface_set_opaque_region(m_surface, region);
+    if (region) {
+        wl_region_destroy(region);
+    }
+}
+
+void ViewPassthrough::present(struct comp_dmabuf* dmabuf) {
+    /* Held until the parent releases the buffer */
+    struct comp_buffer_lock* lock = dmabuf->lock;
+    dmabuf->lock = nullptr;
+
+    struct stat st;
+    if (!isValid() || dmabuf->n_planes < 1 || fstat(dmabuf->fd[0], &st) != 0) {
+        comp_dmabuf_close(dmabuf);
+        comp_buffer_unlock(lock, -1);
+        return;
+    }
+
+    /* The parent knows nothing of explicit sync fences */
+    if (dmabuf->acquire_fence >= 0 && !importAcquireFence(dmabuf)) {
+        comp_fence_wait(dmabuf->acquire_fence, -1);
+    }
+
+    Buffer* buffer = nullptr;
+    for (Buffer* known : m_buffers) {
+        if (known->dev == st.st_dev && known->ino == st.st_ino &&
+            known->width == dmabuf->width && known->height == dmabuf->height &&
+            known->format == dmabuf->format && known->modifier == dmabuf->modifier) {
+            buffer = known;
+            break;
+        }
+    }
+
+    if (buffer) {
+        m_buffers.removeOne(buffer);
+    } else {
+        /* Make room - only buffers the parent has let go of */
+        for (int i = m_buffers.size() - 1; i >= 0 && m_buffers.size() >= kMaxBuffers; i--) {
+            Buffer* old = m_buffers.at(i);
+            if (!old->lock && !old->params) {
+                m_buffers.removeAt(i);
+                delete old;
+            }
+        }
+
+        const ParentGlobals& globals = parentGlobals();
+        buffer = new Buffer();
+        buffer->owner = this;
+        buffer->dev = st.st_dev;
+        buffer->ino = st.st_ino;
+        buffer->width = dmabuf->width;
+        buffer->height = dmabuf->height;
+        buffer->format = dmabuf->format;
+        buffer->modifier = dmabuf->modifier;
+        buffer->params = zwp_linux_dmabuf_v1_create_params(globals.dmabuf);
+        /* libwayland dups the fds, ours are closed below */
+        for (int i = 0; i < dmabuf->n_planes; i++) {
+            zwp_linux_buffer_params_v1_add(buffer->params, dmabuf->fd[i], uint32_t(i),
+                                           dmabuf->offset[i], dmabuf->stride[i],
+                                           uint32_t(dmabuf->modifier >> 32),
+                                           uint32_t(dmabuf->modifier & 0xffffffff));
+        }
+        static const struct zwp_linux_buffer_params_v1_listener listener = {
+            handleCreated,
+            handleFailed,
+        };
+        zwp_linux_buffer_params_v1_add_listener(buffer->params, &listener, buffer);
+        zwp_linux_buffer_params_v1_create(buffer->params, int32_t(dmabuf->width),
+                                          int32_t(dmabuf->height), dmabuf->format, 0);
+    }
+    m_buffers.prepend(buffer);
+    comp_dmabuf_close(dmabuf);
+
+    /* Shown again before the parent released it - one lock is enough */
+    comp_buffer_unlock(buffer->lock, -1);
+    buffer->lock = lock;
+
+    if (buffer->buffer) {
+        attach(buffer);
+    } else {
+        buffer->attachOnCreate = true;
+        wl_display_flush(parentGlobals().display);
+    }
+}
+
+void ViewPassthrough::attach(Buffer* buffer) {
+    m_opaque = !DmabufTexture::formatHasAlpha(buffer->format);
+    updateOpaqueRegion();
+
+    wl_surface_attach(m_surface, buffer->buffer, 0, 0);
+    wl_surface_damage_buffer(m_surface, 0, 0, INT32_MAX, INT32_MAX);
+    if (!m_frameCallback) {
+        m_frameCallback = wl_surface_frame(m_surface);
+        static const struct wl_callback_listener listener = { handleFrameDone };
+        wl_callback_add_listener(m_frameCallback, &listener, this);
+    }
+    wl_surface_commit(m_surface);
+
+    /* Still synchronized - shown with the window's next commit */
+    if (!m_desync) {
+        m_window->update();
+    }
+    wl_display_flush(parentGlobals().display);
+}
+
+void ViewPassthrough::bufferFailed(Buffer* buffer) {
+    qWarning() << "Passthrough: the parent compositor cannot import a"
+               << buffer->width << "x" << buffer->height << "buffer, format"
+               << Qt::hex << buffer->format << "modifier" << buffer->modifier;
+    m_buffers.removeOne(buffer);
+    delete buffer;
+    emit failed();
+}
+
+void ViewPassthrough::frameDone() {
+    /* In place - from now on frames go out with our own commits */
+    if (!m_desync) {
+        m_desync = true;
+        wl_subsurface_set_desync(m_subsurface);
+        wl_display_flush(parentGlobals().display);
+    }
+    emit presented();
+}
+
+void ViewPassthrough::handleCreated(void* data, struct zwp_linux_buffer_params_v1* params,
+                                    struct wl_buffer* wlBuffer) {
+    Buffer* buffer = static_cast<Buffer*>(data);
+    zwp_linux_buffer_params_v1_destroy(params);
+    buffer->params = nullptr;
+    buffer->buffer = wlBuffer;
+    if (!buffer->owner) {
+        delete buffer;
+        return;
+    }
+
+    static const struct wl_buffer_listener listener = { handleRelease };
+    wl_buffer_add_listener(wlBuffer, &listener, buffer);
+    if (buffer->attachOnCreate) {
+        buffer->attachOnCreate = false;
+        buffer->owner->attach(buffer);
+    }
+}
+
+void ViewPassthrough::handleFailed(void* data, struct zwp_linux_buffer_params_v1* params) {
+    Buffer* buffer = static_cast<Buffer*>(data);
+    zwp_linux_buffer_params_v1_destroy(params);
+    buffer->params = nullptr;
+    if (!buffer->owner) {
+        delete buffer;
+        return;
+    }
+    buffer->owner->bufferFailed(buffer);
+}
+
+void ViewPassthrough::handleRelease(void* data, struct wl_buffer* wlBuffer) {
+    Q_UNUSED(wlBuffer);
+    Buffer* buffer = static_cast<Buffer*>(data);
+    comp_buffer_unlock(buffer->lock, -1);
+    buffer->lock = nullptr;
+}
+
+void ViewPassthrough::handleFrameDone(void* data, struct wl_callback* callback, uint32_t time) {
+    Q_UNUSED(time);
+    ViewPassthrough* self = static_cast<ViewPassthrough*>(data);
+    wl_callback_destroy(callback);
+    self->m_frameCallback = nullptr;
+    self->frameDone();
+}
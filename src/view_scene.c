@@ -0,0 +1,206 @@
+/*
+ * view_scene.c - Offscreen composition of views with more than one surface
+ *
+ * The offscreen output is a headless one left out of the layout, so
+ * clients never see it as a wl_output. Its scale follows the output the
+ * view is shown on; wlr_scene derives the preferred buffer scale it sends
+ * from both scenes, and they have to agree.
+ *
+ * Renders are not driven by the headless frame clock but by the scene:
+ * damage makes wlroots schedule a frame on the output, and the frame
+ * handler composes right away and reports the result like a commit.
+ *
+ * SPDX-License-Identifier: MIT
+ * Copyright (c) 2024
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include "view_scene.h"
+#include "xdg_shell_handler.h"
+#include "output_handler.h"
+#include "frame_trace.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#include <wlr/types/wlr_buffer.h>
+#include <wlr/types/wlr_compositor.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/types/wlr_scene.h>
+#include <wlr/types/wlr_xdg_shell.h>
+#include <wlr/util/log.h>
+
+/* External accessors from compositor_core.c */
+extern struct comp_output_manager* comp_server_get_output_manager(struct comp_server* server);
+extern void comp_server_notify_view_frame_commit(struct comp_server* server, struct comp_view* view);
+extern void comp_server_notify_view_damage(struct comp_server* server, struct comp_view* view,
+                                           pixman_region32_t* damage);
+
+struct comp_view_scene {
+    struct comp_view* view;
+    struct wlr_scene* scene;
+    struct wlr_scene_tree* tree;            /* The view's xdg surface */
+    struct comp_output* output;             /* Offscreen, NULL once destroyed */
+    struct wlr_scene_output* scene_output;
+    struct wlr_buffer* buffer;              /* Last composed frame, locked */
+
+    struct wl_listener frame;
+    struct wl_listener output_destroy;
+};
+
+static void scene_detach_output(struct comp_view_scene* vscene) {
+    if (!vscene->output) return;
+
+    wl_list_remove(&vscene->frame.link);
+    wl_list_remove(&vscene->output_destroy.link);
+    vscene->output = NULL;
+    vscene->scene_output = NULL;  /* Destroyed along with the output */
+}
+
+/* Scene damage scheduled a frame - compose and hand it on like a commit */
+static void handle_frame(struct wl_listener* listener, void* data) {
+    struct comp_view_scene* vscene = wl_container_of(listener, vscene, frame);
+    (void)data;
+    struct comp_view* view = vscene->view;
+
+    pixman_region32_t damage;
+    pixman_region32_init(&damage);
+    if (view_scene_render(vscene, &damage)) {
+        /* Staging buffers re-copy only what the render changed */
+        view_frames_damage(&view->frames, &damage);
+        if (view->mapped) {
+            comp_server_notify_view_frame_commit(view->server, view);
+            comp_server_notify_view_damage(view->server, view, &damage);
+        }
+    }
+    pixman_region32_fini(&damage);
+}
+
+static void handle_output_destroy(struct wl_listener* listener, void* data) {
+    struct comp_view_scene* vscene = wl_container_of(listener, vscene, output_destroy);
+    (void)data;
+    scene_detach_output(vscene);
+}
+
+/* Scale the view is shown at */
+static float scene_scale(struct comp_view* view) {
+    struct comp_output* output = view->output ? view->output :
+        comp_output_manager_get_primary(comp_server_get_output_manager(view->server));
+    return output && output->scale > 0.0f ? output->scale : 1.0f;
+}
+
+struct comp_view_scene* view_scene_create(struct comp_view* view) {
+    if (!view || !view->xdg_toplevel) return NULL;
+
+    struct comp_view_scene* vscene = calloc(1, sizeof(*vscene));
+    if (!vscene) return NULL;
+    vscene->view = view;
+
+    vscene->scene = wlr_scene_create();
+    if (!vscene->scene) {
+        free(vscene);
+        return NULL;
+    }
+
+    /* Surface coordinates start at the frame origin, like the toplevel
+     * buffer handed out without a scene */
+    vscene->tree = wlr_scene_xdg_surface_create(&vscene->scene->tree, view->xdg_toplevel->base);
+
+    /* The size only matters until the first render resizes it */
+    struct wlr_surface* surface = view->xdg_toplevel->base->surface;
+    uint32_t width = surface->current.width > 0 ? (uint32_t)surface->current.width : 1;
+    uint32_t height = surface->current.height > 0 ? (uint32_t)surface->current.height : 1;
+    vscene->output = comp_output_manager_add_offscreen_output(
+        comp_server_get_output_manager(view->server), width, height);
+    if (vscene->output) {
+        vscene->scene_output = wlr_scene_output_create(vscene->scene, vscene->output->wlr_output);
+    }
+    if (!vscene->tree || !vscene->scene_output) {
+        wlr_log(WLR_ERROR, "Failed to set up the offscreen scene of a view");
+        if (vscene->output) comp_output_destroy(vscene->output);
+        wlr_scene_node_destroy(&vscene->scene->tree.node);
+        free(vscene);
+        return NULL;
+    }
+
+    vscene->frame.notify = handle_frame;
+    wl_signal_add(&vscene->output->wlr_output->events.frame, &vscene->frame);
+    vscene->output_destroy.notify = handle_output_destroy;
+    wl_signal_add(&vscene->output->wlr_output->events.destroy, &vscene->output_destroy);
+
+    /* Everything is damaged - the first frame comes by itself */
+    wlr_log(WLR_DEBUG, "View got an offscreen scene for its subsurfaces and popups");
+    return vscene;
+}
+
+void view_scene_destroy(struct comp_view_scene* vscene) {
+    if (!vscene) return;
+
+    struct comp_output* output = vscene->output;
+    scene_detach_output(vscene);
+    if (output) {
+        comp_output_destroy(output);
+    }
+    if (vscene->buffer) {
+        wlr_buffer_unlock(vscene->buffer);
+    }
+    wlr_scene_node_destroy(&vscene->scene->tree.node);
+    free(vscene);
+}
+
+struct wlr_scene_tree* view_scene_get_tree(struct comp_view_scene* vscene) {
+    return vscene ? vscene->tree : NULL;
+}
+
+bool view_scene_render(struct comp_view_scene* vscene, pixman_region32_t* damage) {
+    if (!vscene || !vscene->scene_output || !vscene->view->mapped) return false;
+
+    struct wlr_surface* surface = vscene->view->xdg_toplevel->base->surface;
+    if (surface->current.width <= 0 || surface->current.height <= 0) return false;
+
+    /* Follow the view's size - a new mode damages the whole output */
+    float scale = scene_scale(vscene->view);
+    uint32_t width = (uint32_t)ceilf(surface->current.width * scale);
+    uint32_t height = (uint32_t)ceilf(surface->current.height * scale);
+    if (!comp_output_set_size(vscene->output, width, height, scale)) {
+        return false;
+    }
+
+    if (!wlr_scene_output_needs_frame(vscene->scene_output)) {
+        return false;
+    }
+
+    uint64_t start = frame_trace_enabled() ? frame_trace_now_ns() : 0;
+
+    struct wlr_output_state state;
+    wlr_output_state_init(&state);
+    if (!wlr_scene_output_build_state(vscene->scene_output, &state, NULL) || !state.buffer) {
+        wlr_output_state_finish(&state);
+        return false;
+    }
+
+    if (state.committed & WLR_OUTPUT_STATE_DAMAGE) {
+        pixman_region32_copy(damage, &state.damage);
+    } else {
+        pixman_region32_union_rect(damage, damage, 0, 0, width, height);
+    }
+
+    if (vscene->buffer) {
+        wlr_buffer_unlock(vscene->buffer);
+    }
+    vscene->buffer = wlr_buffer_lock(state.buffer);
+
+    /* Committing clears the scene's pending damage and frees up the
+     * swapchain slot of the previous frame */
+    if (!wlr_output_commit_state(vscene->output->wlr_output, &state)) {
+        wlr_log(WLR_ERROR, "Failed to commit the offscreen output of a view");
+    }
+    wlr_output_state_finish(&state);
+
+    frame_trace_mark(vscene->view, FRAME_TRACE_RENDER, start, 0);
+    return true;
+}
+
+struct wlr_buffer* view_scene_get_buffer(struct comp_view_scene* vscene) {
+    return vscene ? vscene->buffer : NULL;
+}
@@ -0,0 +1,728 @@
+/*
+ * view_stream.c - VAAPI encoding of view DMA-BUFs through FFmpeg
+ *
+ * The pipeline is the one ffmpeg's kmsgrab uses: DRM PRIME frames mapped
+ * to VAAPI (hwmap), converted by scale_vaapi, encoded by h264_vaapi or
+ * hevc_vaapi. It is rebuilt when the frame size or format changes.
+ *
+ * VAAPI only finishes reading a surface when the work that depends on it
+ * does, so the client buffer stays locked until the encoder handed out
+ * the packet made from it.
+ *
+ * SPDX-License-Identifier: MIT
+ * Copyright (c) 2024
+ */
+#define _GNU_SOURCE
+
+#include "view_stream.h"
+#include "compositor_core.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <drm_fourcc.h>
+#include <wlr/util/log.h>
+
+#ifdef HAVE_FFMPEG
+#include <libavcodec/avcodec.h>
+#include <libavfilter/avfilter.h>
+#include <libavfilter/buffersink.h>
+#include <libavfilter/buffersrc.h>
+#include <libavformat/avformat.h>
+#include <libavutil/hwcontext.h>
+#include <libavutil/hwcontext_drm.h>
+#include <libavutil/opt.h>
+#endif
+
+/* How long the encoder waits for a client buffer to be ready */
+#define STREAM_FENCE_TIMEOUT_MS 100
+
+/* Damage covering at least this much of the frame is not a region */
+#define STREAM_ROI_MAX_COVERAGE 0.75
+
+struct view_stream {
+    struct view_stream_config config;
+    char render_node[64];
+    struct view_stream_sink sink;
+
+    pthread_t thread;
+    bool thread_started;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool quit;                          /* Guarded by lock */
+    bool has_frame;                     /* Guarded by lock */
+    struct comp_dmabuf frame;           /* Guarded by lock */
+    struct comp_rect damage[COMP_MAX_DAMAGE_RECTS];
+    int n_damage;
+    uint64_t time_ns;
+
+#ifdef HAVE_FFMPEG
+    /* Encoder thread only */
+    AVBufferRef* drm_device;
+    AVBufferRef* drm_frames;
+    AVFilterGraph* graph;
+    AVFilterContext* source;
+    AVFilterContext* sink_filter;
+    AVCodecContext* encoder;
+    uint32_t width, height, format;     /* Of the pipeline */
+    bool failed;                        /* Pipeline for these could not be set up */
+    int64_t last_pts;
+    uint64_t first_ns;
+#endif
+};
+
+/* Union a into the n rects of list, as one bounding box beyond the limit */
+static void damage_add(struct comp_rect* list, int* n, const struct comp_rect* a, int n_a) {
+    for (int i = 0; i < n_a; i++) {
+        if (*n < COMP_MAX_DAMAGE_RECTS) {
+            list[(*n)++] = a[i];
+            continue;
+        }
+        int32_t x1 = list[0].x, y1 = list[0].y;
+        int32_t x2 = list[0].x + list[0].width, y2 = list[0].y + list[0].height;
+        for (int j = 1; j < *n; j++) {
+            x1 = list[j].x < x1 ? list[j].x : x1;
+            y1 = list[j].y < y1 ? list[j].y : y1;
+            x2 = list[j].x + list[j].width > x2 ? list[j].x + list[j].width : x2;
+            y2 = list[j].y + list[j].height > y2 ? list[j].y + list[j].height : y2;
+        }
+        x1 = a[i].x < x1 ? a[i].x : x1;
+        y1 = a[i].y < y1 ? a[i].y : y1;
+        x2 = a[i].x + a[i].width > x2 ? a[i].x + a[i].width : x2;
+        y2 = a[i].y + a[i].height > y2 ? a[i].y + a[i].height : y2;
+        list[0] = (struct comp_rect){ x1, y1, x2 - x1, y2 - y1 };
+        *n = 1;
+    }
+}
+
+#ifdef HAVE_FFMPEG
+
+static enum AVPixelFormat drm_to_av_format(uint32_t format) {
+    switch (format) {
+        case DRM_FORMAT_ARGB8888: return AV_PIX_FMT_BGRA;
+        case DRM_FORMAT_XRGB8888: return AV_PIX_FMT_BGR0;
+        case DRM_FORMAT_ABGR8888: return AV_PIX_FMT_RGBA;
+        case DRM_FORMAT_XBGR8888: return AV_PIX_FMT_RGB0;
+        case DRM_FORMAT_NV12:     return AV_PIX_FMT_NV12;
+        default:                  return AV_PIX_FMT_NONE;
+    }
+}
+
+static void pipeline_destroy(struct view_stream* stream) {
+    avcodec_free_context(&stream->encoder);
+    avfilter_graph_free(&stream->graph);
+    stream->source = NULL;
+    stream->sink_filter = NULL;
+    av_buffer_unref(&stream->drm_frames);
+}
+
+static bool pipeline_create(struct view_stream* stream, const struct comp_dmabuf* frame) {
+    pipeline_destroy(stream);
+    stream->width = frame->width;
+    stream->height = frame->height;
+    stream->format = frame->format;
+    stream->failed = true;
+
+    enum AVPixelFormat sw_format = drm_to_av_format(frame->format);
+    if (sw_format == AV_PIX_FMT_NONE) {
+        wlr_log(WLR_ERROR, "Cannot stream DRM format 0x%08x", frame->format);
+        return false;
+    }
+
+    if (!stream->drm_device &&
+        av_hwdevice_ctx_create(&stream->drm_device, AV_HWDEVICE_TYPE_DRM,
+                               stream->render_node, NULL, 0) < 0) {
+        wlr_log(WLR_ERROR, "Failed to open %s for encoding", stream->render_node);
+        return false;
+    }
+
+    /* Describes the imported buffers - no pool, frames are never allocated */
+    stream->drm_frames = av_hwframe_ctx_alloc(stream->drm_device);
+    if (!stream->drm_frames) return false;
+    AVHWFramesContext* frames = (AVHWFramesContext*)stream->drm_frames->data;
+    frames->format = AV_PIX_FMT_DRM_PRIME;
+    frames->sw_format = sw_format;
+    frames->width = (int)frame->width;
+    frames->height = (int)frame->height;
+    if (av_hwframe_ctx_init(stream->drm_frames) < 0) {
+        wlr_log(WLR_ERROR, "Failed to set up DRM frames for encoding");
+        return false;
+    }
+
+    /* DRM PRIME -> VA surface -> NV12 on the video processor */
+    stream->graph = avfilter_graph_alloc();
+    if (!stream->graph) return false;
+
+    stream->source = avfilter_graph_alloc_filter(stream->graph,
+                                                 avfilter_get_by_name("buffer"), "in");
+    AVBufferSrcParameters* params = av_buffersrc_parameters_alloc();
+    if (!stream->source || !params) {
+        av_free(params);
+        return false;
+    }
+    params->format = AV_PIX_FMT_DRM_PRIME;
+    params->width = (int)frame->width;
+    params->height = (int)frame->height;
+    params->time_base = (AVRational){ 1, 1000000 };
+    params->hw_frames_ctx = stream->drm_frames;
+    int ret = av_buffersrc_parameters_set(stream->source, params);
+    av_free(params);
+    if (ret < 0 || avfilter_init_str(stream->source, NULL) < 0) {
+        return false;
+    }
+
+    if (avfilter_graph_create_filter(&stream->sink_filter, avfilter_get_by_name("buffersink"),
+                                     "out", NULL, NULL, stream->graph) < 0) {
+        return false;
+    }
+
+    AVFilterInOut* outputs = avfilter_inout_alloc();
+    AVFilterInOut* inputs = avfilter_inout_alloc();
+    if (outputs && inputs) {
+        outputs->name = av_strdup("in");
+        outputs->filter_ctx = stream->source;
+        inputs->name = av_strdup("out");
+        inputs->filter_ctx = stream->sink_filter;
+        ret = avfilter_graph_parse_ptr(stream->graph,
+                                       "hwmap=derive_device=vaapi,scale_vaapi=format=nv12",
+                                       &inputs, &outputs, NULL);
+        if (ret >= 0) {
+            ret = avfilter_graph_config(stream->graph, NULL);
+        }
+    } else {
+        ret = AVERROR(ENOMEM);
+    }
+    avfilter_inout_free(&inputs);
+    avfilter_inout_free(&outputs);
+    if (ret < 0) {
+        wlr_log(WLR_ERROR, "Failed to set up the VAAPI conversion: %s", av_err2str(ret));
+        return false;
+    }
+
+    const char* name = stream->config.codec == VIEW_STREAM_HEVC ? "hevc_vaapi" : "h264_vaapi";
+    const AVCodec* codec = avcodec_find_encoder_by_name(name);
+    if (!codec) {
+        wlr_log(WLR_ERROR, "FFmpeg has no %s encoder", name);
+        return false;
+    }
+
+    stream->encoder = avcodec_alloc_context3(codec);
+    if (!stream->encoder) return false;
+    AVCodecContext* enc = stream->encoder;
+    enc->width = av_buffersink_get_w(stream->sink_filter);
+    enc->height = av_buffersink_get_h(stream->sink_filter);
+    enc->pix_fmt = AV_PIX_FMT_VAAPI;
+    enc->hw_frames_ctx = av_buffer_ref(av_buffersink_get_hw_frames_ctx(stream->sink_filter));
+    enc->time_base = (AVRational){ 1, 1000000 };
+    enc->framerate = (AVRational){ 60, 1 };     /* Rate control hint, frames are variable */
+    enc->gop_size = stream->config.keyframe_interval > 0 ?
+                    (int)stream->config.keyframe_interval : 120;
+    enc->max_b_frames = 0;                      /* One packet per frame, no reordering */
+    if (stream->config.bitrate_kbps > 0) {
+        enc->bit_rate = (int64_t)stream->config.bitrate_kbps * 1000;
+    }
+    av_opt_set_int(enc->priv_data, "async_depth", 1, 0);
+
+    ret = avcodec_open2(enc, codec, NULL);
+    if (ret < 0) {
+        wlr_log(WLR_ERROR, "Failed to open %s: %s", name, av_err2str(ret));
+        return false;
+    }
+
+    if (stream->sink.start &&
+        !stream->sink.start(stream->sink.data, stream->config.codec,
+                            (uint32_t)enc->width, (uint32_t)enc->height)) {
+        wlr_log(WLR_ERROR, "Stream sink failed to start");
+        return false;
+    }
+
+    wlr_log(WLR_INFO, "Streaming %ux%u with %s", frame->width, frame->height, name);
+    stream->failed = false;
+    return true;
+}
+
+static void drm_descriptor_free(void* opaque, uint8_t* data) {
+    (void)opaque;
+    av_free(data);
+}
+
+/* Frame wrapping the DMA-BUF - the fds stay owned by frame */
+static AVFrame* frame_wrap(struct view_stream* stream, const struct comp_dmabuf* frame) {
+    AVDRMFrameDescriptor* desc = av_mallocz(sizeof(*desc));
+    AVFrame* av = av_frame_alloc();
+    if (!desc || !av) {
+        av_free(desc);
+        av_frame_free(&av);
+        return NULL;
+    }
+
+    desc->nb_objects = frame->n_planes;
+    desc->nb_layers = 1;
+    desc->layers[0].format = frame->format;
+    desc->layers[0].nb_planes = frame->n_planes;
+    for (int i = 0; i < frame->n_planes; i++) {
+        off_t size = lseek(frame->fd[i], 0, SEEK_END);
+        desc->objects[i].fd = frame->fd[i];
+        desc->objects[i].size = size > 0 ? (size_t)size : 0;
+        desc->objects[i].format_modifier = frame->modifier;
+        desc->layers[0].planes[i].object_index = i;
+        desc->layers[0].planes[i].offset = frame->offset[i];
+        desc->layers[0].planes[i].pitch = frame->stride[i];
+    }
+
+    av->format = AV_PIX_FMT_DRM_PRIME;
+    av->width = (int)frame->width;
+    av->height = (int)frame->height;
+    av->data[0] = (uint8_t*)desc;
+    av->buf[0] = av_buffer_create((uint8_t*)desc, sizeof(*desc), drm_descriptor_free, NULL, 0);
+    av->hw_frames_ctx = av_buffer_ref(stream->drm_frames);
+    if (!av->buf[0] || !av->hw_frames_ctx) {
+        if (!av->buf[0]) av_free(desc);
+        av_frame_free(&av);
+        return NULL;
+    }
+    return av;
+}
+
+/* Damage as regions of interest, unless it is most of the frame anyway */
+static void frame_add_roi(AVFrame* av, const struct comp_rect* damage, int n_damage) {
+    double area = 0.0;
+    for (int i = 0; i < n_damage; i++) {
+        area += (double)damage[i].width * damage[i].height;
+    }
+    if (n_damage == 0 || area >= STREAM_ROI_MAX_COVERAGE * av->width * av->height) {
+        return;
+    }
+
+    AVFrameSideData* side = av_frame_new_side_data(av, AV_FRAME_DATA_REGIONS_OF_INTEREST,
+                                                   n_damage * sizeof(AVRegionOfInterest));
+    if (!side) return;
+
+    AVRegionOfInterest* roi = (AVRegionOfInterest*)side->data;
+    for (int i = 0; i < n_damage; i++) {
+        roi[i] = (AVRegionOfInterest){
+            .self_size = sizeof(AVRegionOfInterest),
+            .top = damage[i].y,
+            .bottom = damage[i].y + damage[i].height,
+            .left = damage[i].x,
+            .right = damage[i].x + damage[i].width,
+            .qoffset = (AVRational){ -1, 10 },
+        };
+    }
+}
+
+static void receive_packets(struct view_stream* stream) {
+    AVPacket* packet = av_packet_alloc();
+    if (!packet) return;
+
+    while (avcodec_receive_packet(stream->encoder, packet) >= 0) {
+        if (stream->sink.packet) {
+            uint64_t pts_ns = stream->first_ns + (uint64_t)packet->pts * 1000;
+            stream->sink.packet(stream->sink.data, packet->data, (size_t)packet->size, pts_ns,
+                                (packet->flags & AV_PKT_FLAG_KEY) != 0);
+        }
+        av_packet_unref(packet);
+    }
+    av_packet_free(&packet);
+}
+
+static void stream_encode(struct view_stream* stream, const struct comp_dmabuf* frame,
+                          const struct comp_rect* damage, int n_damage, uint64_t time_ns) {
+    bool changed = frame->width != stream->width || frame->height != stream->height ||
+                   frame->format != stream->format;
+    if (changed || (!stream->encoder && !stream->failed)) {
+        if (stream->encoder) {
+            /* Packets of the old size before the next keyframe */
+            avcodec_send_frame(stream->encoder, NULL);
+            receive_packets(stream);
+        }
+        pipeline_create(stream, frame);
+    }
+    if (stream->failed) return;
+
+    /* A client this late is skipped over, not waited for */
+    if (frame->acquire_fence >= 0 &&
+        !comp_fence_wait(frame->acquire_fence, STREAM_FENCE_TIMEOUT_MS)) {
+        wlr_log(WLR_DEBUG, "Streamed buffer not ready after %d ms", STREAM_FENCE_TIMEOUT_MS);
+    }
+
+    AVFrame* source = frame_wrap(stream, frame);
+    if (!source) return;
+
+    /* Encoder time is microseconds since the first frame, always rising */
+    if (stream->first_ns == 0) {
+        stream->first_ns = time_ns;
+    }
+    int64_t pts = time_ns > stream->first_ns ? (int64_t)((time_ns - stream->first_ns) / 1000) : 0;
+    if (pts <= stream->last_pts) {
+        pts = stream->last_pts + 1;
+    }
+    stream->last_pts = pts;
+    source->pts = pts;
+
+    int ret = av_buffersrc_add_frame_flags(stream->source, source, 0);
+    av_frame_free(&source);
+    if (ret < 0) {
+        wlr_log(WLR_ERROR, "Failed to import a streamed frame: %s", av_err2str(ret));
+        return;
+    }
+
+    AVFrame* converted = av_frame_alloc();
+    if (!converted) return;
+    while (av_buffersink_get_frame(stream->sink_filter, converted) >= 0) {
+        frame_add_roi(converted, damage, n_damage);
+        ret = avcodec_send_frame(stream->encoder, converted);
+        av_frame_unref(converted);
+        if (ret < 0) {
+            wlr_log(WLR_ERROR, "Failed to encode a streamed frame: %s", av_err2str(ret));
+            break;
+        }
+        receive_packets(stream);
+    }
+    av_frame_free(&converted);
+}
+
+static void stream_finish(struct view_stream* stream) {
+    if (stream->encoder) {
+        avcodec_send_frame(stream->encoder, NULL);
+        receive_packets(stream);
+    }
+    pipeline_destroy(stream);
+    av_buffer_unref(&stream->drm_device);
+}
+
+#else
+
+static void stream_encode(struct view_stream* stream, const struct comp_dmabuf* frame,
+                          const struct comp_rect* damage, int n_damage, uint64_t time_ns) {
+    (void)stream;
+    (void)frame;
+    (void)damage;
+    (void)n_damage;
+    (void)time_ns;
+}
+
+static void stream_finish(struct view_stream* stream) {
+    (void)stream;
+}
+
+#endif /* HAVE_FFMPEG */
+
+static void* stream_thread(void* data) {
+    struct view_stream* stream = data;
+
+    pthread_mutex_lock(&stream->lock);
+    for (;;) {
+        while (!stream->has_frame && !stream->quit) {
+            pthread_cond_wait(&stream->cond, &stream->lock);
+        }
+        if (!stream->has_frame) break;
+
+        struct comp_dmabuf frame = stream->frame;
+        struct comp_rect damage[COMP_MAX_DAMAGE_RECTS];
+        int n_damage = stream->n_damage;
+        memcpy(damage, stream->damage, sizeof(damage));
+        uint64_t time_ns = stream->time_ns;
+        stream->has_frame = false;
+        stream->n_damage = 0;
+        pthread_mutex_unlock(&stream->lock);
+
+        stream_encode(stream, &frame, damage, n_damage, time_ns);
+        /* Hands the client its buffer back */
+        comp_dmabuf_close(&frame);
+
+        pthread_mutex_lock(&stream->lock);
+    }
+    pthread_mutex_unlock(&stream->lock);
+
+    stream_finish(stream);
+    return NULL;
+}
+
+struct view_stream* view_stream_create(const struct view_stream_config* config,
+                                       const struct view_stream_sink* sink) {
+#ifndef HAVE_FFMPEG
+    wlr_log(WLR_ERROR, "Built without FFmpeg - views cannot be streamed");
+    if (sink && sink->destroy) sink->destroy(sink->data);
+    return NULL;
+#endif
+
+    struct view_stream* stream = calloc(1, sizeof(*stream));
+    if (!stream) {
+        if (sink && sink->destroy) sink->destroy(sink->data);
+        return NULL;
+    }
+    stream->config = *config;
+    snprintf(stream->render_node, sizeof(stream->render_node), "%s",
+             config->render_node ? config->render_node : "/dev/dri/renderD128");
+    stream->config.render_node = stream->render_node;
+    stream->sink = *sink;
+    pthread_mutex_init(&stream->lock, NULL);
+    pthread_cond_init(&stream->cond, NULL);
+
+    if (pthread_create(&stream->thread, NULL, stream_thread, stream) != 0) {
+        wlr_log(WLR_ERROR, "Failed to start a stream encoder thread");
+        view_stream_destroy(stream);
+        return NULL;
+    }
+    stream->thread_started = true;
+    return stream;
+}
+
+void view_stream_destroy(struct view_stream* stream) {
+    if (!stream) return;
+
+    if (stream->thread_started) {
+        pthread_mutex_lock(&stream->lock);
+        stream->quit = true;
+        pthread_cond_signal(&stream->cond);
+        pthread_mutex_unlock(&stream->lock);
+        pthread_join(stream->thread, NULL);
+    }
+    if (stream->has_frame) {
+        comp_dmabuf_close(&stream->frame);
+    }
+
+    if (stream->sink.destroy) {
+        stream->sink.destroy(stream->sink.data);
+    }
+    pthread_cond_destroy(&stream->cond);
+    pthread_mutex_destroy(&stream->lock);
+    free(stream);
+}
+
+void view_stream_submit(struct view_stream* stream, struct comp_dmabuf* dmabuf,
+                        const struct comp_rect* damage, int n_damage, uint64_t time_ns) {
+    if (!stream || !dmabuf) return;
+
+    pthread_mutex_lock(&stream->lock);
+    if (stream->has_frame) {
+        /* Never encoded - its damage goes with the newer frame */
+        comp_dmabuf_close(&stream->frame);
+    }
+    stream->frame = *dmabuf;
+    stream->has_frame = true;
+    damage_add(stream->damage, &stream->n_damage, damage, n_damage);
+    stream->time_ns = time_ns;
+    pthread_cond_signal(&stream->cond);
+    pthread_mutex_unlock(&stream->lock);
+
+    /* The fds moved into the stream */
+    dmabuf->n_planes = 0;
+    dmabuf->acquire_fence = -1;
+    dmabuf->lock = NULL;
+}
+
+/* RTP sink - libavformat's RTP muxer packetizes the Annex B stream */
+
+#ifdef HAVE_FFMPEG
+
+struct rtp_sink {
+    char* url;
+    AVFormatContext* muxer;
+};
+
+static void rtp_close(struct rtp_sink* rtp) {
+    if (!rtp->muxer) return;
+
+    av_write_trailer(rtp->muxer);
+    avio_closep(&rtp->muxer->pb);
+    avformat_free_context(rtp->muxer);
+    rtp->muxer = NULL;
+}
+
+static bool rtp_start(void* data, enum view_stream_codec codec, uint32_t width, uint32_t height) {
+    struct rtp_sink* rtp = data;
+    rtp_close(rtp);
+
+    if (avformat_alloc_output_context2(&rtp->muxer, NULL, "rtp", rtp->url) < 0) {
+        return false;
+    }
+    AVStream* st = avformat_new_stream(rtp->muxer, NULL);
+    if (!st) {
+        avformat_free_context(rtp->muxer);
+        rtp->muxer = NULL;
+        return false;
+    }
+    st->codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
+    st->codecpar->codec_id = codec == VIEW_STREAM_HEVC ? AV_CODEC_ID_HEVC : AV_CODEC_ID_H264;
+    st->codecpar->width = (int)width;
+    st->codecpar->height = (int)height;
+    st->time_base = (AVRational){ 1, 90000 };
+
+    int ret = avio_open(&rtp->muxer->pb, rtp->url, AVIO_FLAG_WRITE);
+    if (ret >= 0) {
+        ret = avformat_write_header(rtp->muxer, NULL);
+    }
+    if (ret < 0) {
+        wlr_log(WLR_ERROR, "Failed to send RTP to %s: %s", rtp->url, av_err2str(ret));
+        avio_closep(&rtp->muxer->pb);
+        avformat_free_context(rtp->muxer);
+        rtp->muxer = NULL;
+        return false;
+    }
+
+    char sdp[2048];
+    if (av_sdp_create(&rtp->muxer, 1, sdp, sizeof(sdp)) == 0) {
+        wlr_log(WLR_INFO, "RTP stream to %s:\n%s", rtp->url, sdp);
+    }
+    return true;
+}
+
+static void rtp_packet(void* data, const uint8_t* bytes, size_t size, uint64_t pts_ns,
+                       bool keyframe) {
+    struct rtp_sink* rtp = data;
+    if (!rtp->muxer) return;
+
+    AVPacket* packet = av_packet_alloc();
+    if (!packet) return;
+    packet->data = (uint8_t*)bytes;
+    packet->size = (int)size;
+    packet->pts = av_rescale_q((int64_t)(pts_ns / 1000), (AVRational){ 1, 1000000 },
+                               rtp->muxer->streams[0]->time_base);
+    packet->dts = packet->pts;
+    packet->flags = keyframe ? AV_PKT_FLAG_KEY : 0;
+    /* Not interleaved - the packet is not ours to keep */
+    av_write_frame(rtp->muxer, packet);
+    av_packet_free(&packet);
+}
+
+static void rtp_destroy(void* data) {
+    struct rtp_sink* rtp = data;
+    rtp_close(rtp);
+    free(rtp->url);
+    free(rtp);
+}
+
+#endif /* HAVE_FFMPEG */
+
+/* Shared memory sink */
+
+struct shm_sink {
+    char name[64];
+    struct view_stream_shm_header* header;
+    size_t size;
+};
+
+static uint8_t* shm_records(struct shm_sink* shm) {
+    return (uint8_t*)(shm->header + 1);
+}
+
+static bool shm_start(void* data, enum view_stream_codec codec, uint32_t width, uint32_t height) {
+    struct shm_sink* shm = data;
+    shm->header->codec = codec;
+    shm->header->width = width;
+    shm->header->height = height;
+    return true;
+}
+
+static void shm_packet(void* data, const uint8_t* bytes, size_t size, uint64_t pts_ns,
+                       bool keyframe) {
+    struct shm_sink* shm = data;
+    struct view_stream_shm_header* header = shm->header;
+    uint64_t capacity = header->capacity;
+    uint64_t needed = sizeof(struct view_stream_shm_record) + ((size + 7) & ~(size_t)7);
+    if (needed > capacity / 2) {
+        wlr_log(WLR_ERROR, "Dropped a %zu byte packet, too big for the %s ring", size, shm->name);
+        return;
+    }
+
+    uint64_t head = header->head;
+    uint64_t pos = head % capacity;
+    if (pos + needed > capacity) {
+        /* Pad to the end - records never wrap */
+        struct view_stream_shm_record* pad = (struct view_stream_shm_record*)(shm_records(shm) + pos);
+        pad->size = 0;
+        pad->flags = 0;
+        pad->pts_ns = 0;
+        head += capacity - pos;
+        pos = 0;
+    }
+
+    struct view_stream_shm_record* record = (struct view_stream_shm_record*)(shm_records(shm) + pos);
+    record->size = (uint32_t)size;
+    record->flags = keyframe ? VIEW_STREAM_SHM_KEYFRAME : 0;
+    record->pts_ns = pts_ns;
+    memcpy(record + 1, bytes, size);
+
+    __atomic_store_n(&header->head, head + needed, __ATOMIC_RELEASE);
+}
+
+static void shm_destroy(void* data) {
+    struct shm_sink* shm = data;
+    munmap(shm->header, shm->size);
+    shm_unlink(shm->name);
+    free(shm);
+}
+
+static bool shm_open_sink(struct view_stream_sink* sink, const char* name) {
+    struct shm_sink* shm = calloc(1, sizeof(*shm));
+    if (!shm) return false;
+    snprintf(shm->name, sizeof(shm->name), "/%s", name);
+    shm->size = sizeof(struct view_stream_shm_header) + VIEW_STREAM_SHM_SIZE;
+
+    int fd = shm_open(shm->name, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0 || ftruncate(fd, (off_t)shm->size) < 0) {
+        wlr_log(WLR_ERROR, "Failed to create shared memory %s: %s", shm->name, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+            shm_unlink(shm->name);
+        }
+        free(shm);
+        return false;
+    }
+    shm->header = mmap(NULL, shm->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shm->header == MAP_FAILED) {
+        shm_unlink(shm->name);
+        free(shm);
+        return false;
+    }
+
+    shm->header->capacity = VIEW_STREAM_SHM_SIZE;
+    shm->header->head = 0;
+    __atomic_store_n(&shm->header->magic, VIEW_STREAM_SHM_MAGIC, __ATOMIC_RELEASE);
+
+    sink->start = shm_start;
+    sink->packet = shm_packet;
+    sink->destroy = shm_destroy;
+    sink->data = shm;
+    return true;
+}
+
+bool view_stream_sink_open(struct view_stream_sink* sink, const char* url) {
+    if (!sink || !url) return false;
+    memset(sink, 0, sizeof(*sink));
+
+    if (strncmp(url, "shm:", 4) == 0 && url[4] && !strchr(url + 4, '/')) {
+        return shm_open_sink(sink, url + 4);
+    }
+
+    if (strncmp(url, "rtp://", 6) == 0) {
+#ifdef HAVE_FFMPEG
+        struct rtp_sink* rtp = calloc(1, sizeof(*rtp));
+        if (!rtp || !(rtp->url = strdup(url))) {
+            free(rtp);
+            return false;
+        }
+        sink->start = rtp_start;
+        sink->packet = rtp_packet;
+        sink->destroy = rtp_destroy;
+        sink->data = rtp;
+        return true;
+#else
+        wlr_log(WLR_ERROR, "Built without FFmpeg - no RTP streaming");
+        return false;
+#endif
+    }
+
+    wlr_log(WLR_ERROR, "Unknown stream sink %s", url);
+    return false;
+}
@@ -0,0 +1,103 @@
+/*
+ * view_texture.cpp - Persistent scene graph texture with partial uploads
+ *
+ * SPDX-License-Identifier: MIT
+ * Copyright (c) 2024
+ */
+#include "view_texture.h"
+
+#include <rhi/qrhi.h>
+#include <QVarLengthArray>
+#include <QDebug>
+
+ViewTexture::ViewTexture() = default;
+
+ViewTexture::~ViewTexture() {
+    delete m_texture;
+}
+
+void ViewTexture::setImage(const QImage& image, const QRegion& damage) {
+    if (image.isNull()) return;
+
+    /* Shallow copy - keeps the staging slot pinned until uploaded */
+    m_pending = image;
+    m_pendingDamage += damage;
+    m_hasAlpha = image.hasAlphaChannel();
+
+    if (image.size() != m_size) {
+        m_size = image.size();
+        m_pendingDamage = QRegion(QRect(QPoint(0, 0), m_size));
+    }
+}
+
+qint64 ViewTexture::comparisonKey() const {
+    /* The key changes when the RHI texture is recreated (resize) */
+    if (m_texture) {
+        return qint64(qintptr(m_texture));
+    }
+    return qint64(qintptr(this));
+}
+
+QRhiTexture* ViewTexture::rhiTexture() const {
+    return m_texture;
+}
+
+QSize ViewTexture::textureSize() const {
+    return m_size;
+}
+
+bool ViewTexture::hasAlphaChannel() const {
+    return m_hasAlpha;
+}
+
+bool ViewTexture::hasMipmaps() const {
+    return false;
+}
+
+void ViewTexture::commitTextureOperations(QRhi* rhi, QRhiResourceUpdateBatch* resourceUpdates) {
+    if (m_pending.isNull() || !rhi || !resourceUpdates) return;
+
+    /* Client buffers are premultiplied BGRA in memory (ARGB32 on LE) */
+    bool bgra = rhi->isTextureFormatSupported(QRhiTexture::BGRA8);
+    QRhiTexture::Format format = bgra ? QRhiTexture::BGRA8 : QRhiTexture::RGBA8;
+
+    if (!m_texture || m_texture->pixelSize() != m_size || m_texture->format() != format) {
+        if (m_texture) {
+            /* May still be referenced by the frame in flight */
+            m_texture->deleteLater();
+        }
+        m_texture = rhi->newTexture(format, m_size);
+        if (!m_texture->create()) {
+            qWarning() << "ViewTexture: failed to create" << m_size << "texture";
+            delete m_texture;
+            m_texture = nullptr;
+            return;
+        }
+        m_pendingDamage = QRegion(QRect(QPoint(0, 0), m_size));
+    }
+
+    QImage source = m_pending;
+    if (!bgra) {
+        source = source.convertToFormat(QImage::Format_RGBA8888_Premultiplied);
+    }
+
+    /* One upload entry per damaged rectangle, clipped to the texture */
+    const QRegion damage = m_pendingDamage & QRect(QPoint(0, 0), m_size);
+    QVarLengthArray<QRhiTextureUploadEntry, 16> entries;
+    for (const QRect& rect : damage) {
+        QRhiTextureSubresourceUploadDescription sub(source);
+        sub.setSourceTopLeft(rect.topLeft());
+        sub.setSourceSize(rect.size());
+        sub.setDestinationTopLeft(rect.topLeft());
+        entries.append(QRhiTextureUploadEntry(0, 0, sub));
+    }
+
+    if (!entries.isEmpty()) {
+        QRhiTextureUploadDescription desc;
+        desc.setEntries(entries.cbegin(), entries.cend());
+        resourceUpdates->uploadTexture(m_texture, desc);
+    }
+
+    m_pending = QImage();
+    m_pendingDamage = QRegion();
+}
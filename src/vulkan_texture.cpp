@@ -0,0 +1,610 @@
+/*
+ * vulkan_texture.cpp - VkImage based DMA-BUF import for the scene graph
+ *
+ * SPDX-License-Identifier: MIT
+ * Copyright (c) 2024
+ */
+#include "vulkan_texture.h"
+#include "compositor_core.h"
+
+#include <QSGRendererInterface>
+#include <QtQuick/qsgtexture_platform.h>
+#include <QDebug>
+#include <rhi/qrhi.h>
+
+#include <drm_fourcc.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if QT_CONFIG(vulkan)
+#include <QVulkanFunctions>
+
+namespace {
+
+/* Imports replaced before the oldest is destroyed - more than the scene
+ * graph has frames in flight */
+constexpr size_t kRetiredImages = 3;
+
+struct VkContext {
+    VkDevice device = VK_NULL_HANDLE;
+    VkQueue queue = VK_NULL_HANDLE;
+    uint32_t queueFamily = 0;
+    QVulkanDeviceFunctions* functions = nullptr;
+    PFN_vkGetMemoryFdPropertiesKHR getMemoryFdProperties = nullptr;
+    /* NULL without VK_KHR_external_semaphore_fd - fences are waited on
+     * the CPU then */
+    PFN_vkImportSemaphoreFdKHR importSemaphoreFd = nullptr;
+    PFN_vkGetSemaphoreFdKHR getSemaphoreFd = nullptr;
+};
+
+/* Device and queue of the window's scene graph. The extension entry
+ * points are NULL unless the device was created with
+ * requiredDeviceExtensions(). */
+bool vkContext(QQuickWindow* window, VkContext* ctx) {
+    QSGRendererInterface* rif = window ? window->rendererInterface() : nullptr;
+    if (!rif || rif->graphicsApi() != QSGRendererInterface::Vulkan) return false;
+
+    QVulkanInstance* instance = window->vulkanInstance();
+    auto device = static_cast<VkDevice*>(
+        rif->getResource(window, QSGRendererInterface::DeviceResource));
+    auto queue = static_cast<VkQueue*>(
+        rif->getResource(window, QSGRendererInterface::CommandQueueResource));
+    auto rhi = static_cast<QRhi*>(rif->getResource(window, QSGRendererInterface::RhiResource));
+    if (!instance || !device || *device == VK_NULL_HANDLE || !queue || !rhi) return false;
+
+    auto handles = static_cast<const QRhiVulkanNativeHandles*>(rhi->nativeHandles());
+    if (!handles) return false;
+
+    QVulkanFunctions* f = instance->functions();
+    ctx->device = *device;
+    ctx->queue = *queue;
+    ctx->queueFamily = uint32_t(handles->gfxQueueFamilyIdx);
+    ctx->functions = instance->deviceFunctions(*device);
+    ctx->getMemoryFdProperties = reinterpret_cast<PFN_vkGetMemoryFdPropertiesKHR>(
+        f->vkGetDeviceProcAddr(*device, "vkGetMemoryFdPropertiesKHR"));
+    ctx->importSemaphoreFd = reinterpret_cast<PFN_vkImportSemaphoreFdKHR>(
+        f->vkGetDeviceProcAddr(*device, "vkImportSemaphoreFdKHR"));
+    ctx->getSemaphoreFd = reinterpret_cast<PFN_vkGetSemaphoreFdKHR>(
+        f->vkGetDeviceProcAddr(*device, "vkGetSemaphoreFdKHR"));
+    if (!ctx->importSemaphoreFd || !ctx->getSemaphoreFd) {
+        ctx->importSemaphoreFd = nullptr;
+        ctx->getSemaphoreFd = nullptr;
+    }
+    return ctx->functions && ctx->getMemoryFdProperties;
+}
+
+/* Move an image between the client (the foreign queue family) and ours.
+ * The barrier also orders against everything else on the queue, so
+ * semaphore waits in its batch cover the scene graph's later frames. */
+void recordOwnership(QVulkanDeviceFunctions* df, VkCommandBuffer cmd, VkImage image,
+                     uint32_t queueFamily, bool acquire) {
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    df->vkBeginCommandBuffer(cmd, &beginInfo);
+
+    VkImageMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.image = image;
+    barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+    if (acquire) {
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_FOREIGN_EXT;
+        barrier.dstQueueFamilyIndex = queueFamily;
+    } else {
+        barrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+        barrier.srcQueueFamilyIndex = queueFamily;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_FOREIGN_EXT;
+    }
+    df->vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                             VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0,
+                             0, nullptr, 0, nullptr, 1, &barrier);
+    df->vkEndCommandBuffer(cmd);
+}
+
+/* Formats wlroots and GPU clients hand out. X formats are sampled with
+ * whatever is in the padding, which the opaque texture never blends. */
+VkFormat vkFormat(uint32_t format, bool* hasAlpha) {
+    switch (format) {
+    case DRM_FORMAT_ARGB8888:
+        *hasAlpha = true;
+        return VK_FORMAT_B8G8R8A8_UNORM;
+    case DRM_FORMAT_XRGB8888:
+        *hasAlpha = false;
+        return VK_FORMAT_B8G8R8A8_UNORM;
+    case DRM_FORMAT_ABGR8888:
+        *hasAlpha = true;
+        return VK_FORMAT_R8G8B8A8_UNORM;
+    case DRM_FORMAT_XBGR8888:
+        *hasAlpha = false;
+        return VK_FORMAT_R8G8B8A8_UNORM;
+    case DRM_FORMAT_ARGB2101010:
+        *hasAlpha = true;
+        return VK_FORMAT_A2R10G10B10_UNORM_PACK32;
+    case DRM_FORMAT_XRGB2101010:
+        *hasAlpha = false;
+        return VK_FORMAT_A2R10G10B10_UNORM_PACK32;
+    case DRM_FORMAT_ABGR2101010:
+        *hasAlpha = true;
+        return VK_FORMAT_A2B10G10R10_UNORM_PACK32;
+    case DRM_FORMAT_ABGR16161616F:
+        *hasAlpha = true;
+        return VK_FORMAT_R16G16B16A16_SFLOAT;
+    default:
+        return VK_FORMAT_UNDEFINED;
+    }
+}
+
+/* Whether an image with the modifier can be sampled from imported memory */
+bool modifierImportable(QVulkanFunctions* f, VkPhysicalDevice physicalDevice, VkFormat format,
+                        uint64_t modifier) {
+    VkPhysicalDeviceImageDrmFormatModifierInfoEXT modifierInfo = {};
+    modifierInfo.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_IMAGE_DRM_FORMAT_MODIFIER_INFO_EXT;
+    modifierInfo.drmFormatModifier = modifier;
+    modifierInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    VkPhysicalDeviceExternalImageFormatInfo externalInfo = {};
+    externalInfo.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_IMAGE_FORMAT_INFO;
+    externalInfo.pNext = &modifierInfo;
+    externalInfo.handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_DMA_BUF_BIT_EXT;
+
+    VkPhysicalDeviceImageFormatInfo2 formatInfo = {};
+    formatInfo.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_IMAGE_FORMAT_INFO_2;
+    formatInfo.pNext = &externalInfo;
+    formatInfo.format = format;
+    formatInfo.type = VK_IMAGE_TYPE_2D;
+    formatInfo.tiling = VK_IMAGE_TILING_DRM_FORMAT_MODIFIER_EXT;
+    formatInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT;
+
+    VkExternalImageFormatProperties externalProperties = {};
+    externalProperties.sType = VK_STRUCTURE_TYPE_EXTERNAL_IMAGE_FORMAT_PROPERTIES;
+    VkImageFormatProperties2 properties = {};
+    properties.sType = VK_STRUCTURE_TYPE_IMAGE_FORMAT_PROPERTIES_2;
+    properties.pNext = &externalProperties;
+
+    if (f->vkGetPhysicalDeviceImageFormatProperties2(physicalDevice, &formatInfo,
+                                                     &properties) != VK_SUCCESS) {
+        return false;
+    }
+    return externalProperties.externalMemoryProperties.externalMemoryFeatures &
+           VK_EXTERNAL_MEMORY_FEATURE_IMPORTABLE_BIT;
+}
+
+/* Planes of one buffer (e.g. AMD DCC metadata) can be bound as a single
+ * allocation; separate buffers per plane would need a disjoint image */
+bool planesShareBuffer(const struct comp_dmabuf* dmabuf) {
+    struct stat first;
+    if (fstat(dmabuf->fd[0], &first) != 0) return false;
+    for (int i = 1; i < dmabuf->n_planes; i++) {
+        struct stat plane;
+        if (fstat(dmabuf->fd[i], &plane) != 0 || plane.st_ino != first.st_ino) {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+#endif
+
+VulkanTexture::VulkanTexture() = default;
+
+VulkanTexture::~VulkanTexture() {
+    delete m_texture;
+    m_texture = nullptr;
+
+#if QT_CONFIG(vulkan)
+    if (m_device == VK_NULL_HANDLE) return;
+
+    /* The last frames may still sample these - only happens when the view
+     * goes away or the scene graph is torn down */
+    releaseCurrent();
+    m_functions->vkDeviceWaitIdle(m_device);
+    for (const Image& image : m_retired) {
+        destroyImage(image);
+    }
+    m_retired.clear();
+    destroyImage(m_current);
+    if (m_releaseSemaphore != VK_NULL_HANDLE) {
+        m_functions->vkDestroySemaphore(m_device, m_releaseSemaphore, nullptr);
+    }
+    if (m_commandPool != VK_NULL_HANDLE) {
+        m_functions->vkDestroyCommandPool(m_device, m_commandPool, nullptr);
+    }
+#endif
+}
+
+QByteArrayList VulkanTexture::requiredDeviceExtensions() {
+    /* The KHR ones are core since Vulkan 1.1/1.2, Qt skips what the
+     * device does not list */
+    return {
+        "VK_KHR_external_memory_fd",
+        "VK_EXT_external_memory_dma_buf",
+        "VK_EXT_image_drm_format_modifier",
+        "VK_EXT_queue_family_foreign",
+        "VK_KHR_image_format_list",
+        "VK_KHR_bind_memory2",
+        "VK_KHR_sampler_ycbcr_conversion",
+        "VK_KHR_external_semaphore_fd",
+    };
+}
+
+bool VulkanTexture::isSupported(QQuickWindow* window) {
+#if QT_CONFIG(vulkan)
+    VkContext ctx;
+    return vkContext(window, &ctx);
+#else
+    Q_UNUSED(window);
+    return false;
+#endif
+}
+
+QList<comp_dmabuf_format> VulkanTexture::importFormats(QQuickWindow* window) {
+    QList<comp_dmabuf_format> formats;
+#if QT_CONFIG(vulkan)
+    VkContext ctx;
+    if (!vkContext(window, &ctx)) return formats;
+
+    QSGRendererInterface* rif = window->rendererInterface();
+    auto physicalDevice = static_cast<VkPhysicalDevice*>(
+        rif->getResource(window, QSGRendererInterface::PhysicalDeviceResource));
+    if (!physicalDevice || *physicalDevice == VK_NULL_HANDLE) return formats;
+    QVulkanFunctions* f = window->vulkanInstance()->functions();
+
+    static const uint32_t drmFormats[] = {
+        DRM_FORMAT_ARGB8888, DRM_FORMAT_XRGB8888, DRM_FORMAT_ABGR8888, DRM_FORMAT_XBGR8888,
+        DRM_FORMAT_ARGB2101010, DRM_FORMAT_XRGB2101010, DRM_FORMAT_ABGR2101010,
+        DRM_FORMAT_ABGR16161616F,
+    };
+    for (uint32_t drmFormat : drmFormats) {
+        bool hasAlpha;
+        VkFormat format = vkFormat(drmFormat, &hasAlpha);
+
+        VkDrmFormatModifierPropertiesListEXT modifierList = {};
+        modifierList.sType = VK_STRUCTURE_TYPE_DRM_FORMAT_MODIFIER_PROPERTIES_LIST_EXT;
+        VkFormatProperties2 properties = {};
+        properties.sType = VK_STRUCTURE_TYPE_FORMAT_PROPERTIES_2;
+        properties.pNext = &modifierList;
+        f->vkGetPhysicalDeviceFormatProperties2(*physicalDevice, format, &properties);
+        if (modifierList.drmFormatModifierCount == 0) continue;
+
+        QList<VkDrmFormatModifierPropertiesEXT> modifiers(modifierList.drmFormatModifierCount);
+        modifierList.pDrmFormatModifierProperties = modifiers.data();
+        f->vkGetPhysicalDeviceFormatProperties2(*physicalDevice, format, &properties);
+
+        for (uint32_t i = 0; i < modifierList.drmFormatModifierCount; i++) {
+            const VkDrmFormatModifierPropertiesEXT& mod = modifiers[i];
+            if (!(mod.drmFormatModifierTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT) ||
+                mod.drmFormatModifierPlaneCount > COMP_DMABUF_MAX_PLANES ||
+                !modifierImportable(f, *physicalDevice, format, mod.drmFormatModifier)) {
+                continue;
+            }
+            formats.append({ drmFormat, mod.drmFormatModifier });
+        }
+    }
+#else
+    Q_UNUSED(window);
+#endif
+    return formats;
+}
+
+#if QT_CONFIG(vulkan)
+void VulkanTexture::destroyImage(const Image& image) {
+    if (image.commands[0] != VK_NULL_HANDLE) {
+        m_functions->vkFreeCommandBuffers(m_device, m_commandPool, 2, image.commands);
+    }
+    if (image.acquire != VK_NULL_HANDLE) {
+        m_functions->vkDestroySemaphore(m_device, image.acquire, nullptr);
+    }
+    if (image.image != VK_NULL_HANDLE) {
+        m_functions->vkDestroyImage(m_device, image.image, nullptr);
+    }
+    if (image.memory != VK_NULL_HANDLE) {
+        m_functions->vkFreeMemory(m_device, image.memory, nullptr);
+    }
+}
+
+bool VulkanTexture::ensureSyncObjects() {
+    if (m_commandPool == VK_NULL_HANDLE) {
+        VkCommandPoolCreateInfo poolInfo = {};
+        poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+        poolInfo.queueFamilyIndex = m_queueFamily;
+        VkResult result = m_functions->vkCreateCommandPool(m_device, &poolInfo, nullptr,
+                                                           &m_commandPool);
+        if (result != VK_SUCCESS) {
+            qWarning() << "Vulkan DMA-BUF import: vkCreateCommandPool failed, result" << result;
+            return false;
+        }
+    }
+
+    if (m_releaseSemaphore == VK_NULL_HANDLE && m_getSemaphoreFd) {
+        VkExportSemaphoreCreateInfo exportInfo = {};
+        exportInfo.sType = VK_STRUCTURE_TYPE_EXPORT_SEMAPHORE_CREATE_INFO;
+        exportInfo.handleTypes = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_SYNC_FD_BIT;
+
+        VkSemaphoreCreateInfo semaphoreInfo = {};
+        semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+        semaphoreInfo.pNext = &exportInfo;
+        if (m_functions->vkCreateSemaphore(m_device, &semaphoreInfo, nullptr,
+                                           &m_releaseSemaphore) != VK_SUCCESS) {
+            /* Release with queue idles instead */
+            m_releaseSemaphore = VK_NULL_HANDLE;
+            m_getSemaphoreFd = nullptr;
+        }
+    }
+    return true;
+}
+
+void VulkanTexture::releaseCurrent() {
+    if (m_current.image == VK_NULL_HANDLE) {
+        comp_buffer_unlock(m_lock, -1);
+        m_lock = nullptr;
+        return;
+    }
+
+    /* Hand the image back to the client after every frame submitted so
+     * far, the ones that sampled it included */
+    recordOwnership(m_functions, m_current.commands[1], m_current.image, m_queueFamily, false);
+
+    VkSubmitInfo submit = {};
+    submit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit.commandBufferCount = 1;
+    submit.pCommandBuffers = &m_current.commands[1];
+    if (m_releaseSemaphore != VK_NULL_HANDLE) {
+        submit.signalSemaphoreCount = 1;
+        submit.pSignalSemaphores = &m_releaseSemaphore;
+    }
+    VkResult result = m_functions->vkQueueSubmit(m_queue, 1, &submit, VK_NULL_HANDLE);
+
+    int fence = -1;
+    if (result == VK_SUCCESS && m_releaseSemaphore != VK_NULL_HANDLE) {
+        /* Exporting a sync_file also resets the semaphore for the next one */
+        VkSemaphoreGetFdInfoKHR getInfo = {};
+        getInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_GET_FD_INFO_KHR;
+        getInfo.semaphore = m_releaseSemaphore;
+        getInfo.handleType = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_SYNC_FD_BIT;
+        if (m_getSemaphoreFd(m_device, &getInfo, &fence) != VK_SUCCESS) {
+            fence = -1;
+        }
+    }
+    if (fence < 0) {
+        m_functions->vkQueueWaitIdle(m_queue);
+    }
+
+    comp_buffer_unlock(m_lock, fence);
+    m_lock = nullptr;
+}
+#endif
+
+bool VulkanTexture::import(struct comp_dmabuf* dmabuf, QQuickWindow* window) {
+    if (!dmabuf) return false;
+
+#if QT_CONFIG(vulkan)
+    VkContext ctx;
+    bool hasAlpha = false;
+    VkFormat format = vkFormat(dmabuf->format, &hasAlpha);
+
+    /* Vulkan has no implicit modifiers, and one device per texture */
+    if (!vkContext(window, &ctx) || format == VK_FORMAT_UNDEFINED ||
+        dmabuf->n_planes <= 0 || dmabuf->n_planes > COMP_DMABUF_MAX_PLANES ||
+        dmabuf->modifier == DRM_FORMAT_MOD_INVALID || !planesShareBuffer(dmabuf) ||
+        (m_device != VK_NULL_HANDLE && m_device != ctx.device)) {
+        comp_dmabuf_close(dmabuf);
+        return false;
+    }
+    QVulkanDeviceFunctions* df = ctx.functions;
+
+    VkSubresourceLayout planes[COMP_DMABUF_MAX_PLANES] = {};
+    for (int i = 0; i < dmabuf->n_planes; i++) {
+        planes[i].offset = dmabuf->offset[i];
+        planes[i].rowPitch = dmabuf->stride[i];
+    }
+
+    VkImageDrmFormatModifierExplicitCreateInfoEXT modifierInfo = {};
+    modifierInfo.sType = VK_STRUCTURE_TYPE_IMAGE_DRM_FORMAT_MODIFIER_EXPLICIT_CREATE_INFO_EXT;
+    modifierInfo.drmFormatModifier = dmabuf->modifier;
+    modifierInfo.drmFormatModifierPlaneCount = uint32_t(dmabuf->n_planes);
+    modifierInfo.pPlaneLayouts = planes;
+
+    VkExternalMemoryImageCreateInfo externalInfo = {};
+    externalInfo.sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_IMAGE_CREATE_INFO;
+    externalInfo.pNext = &modifierInfo;
+    externalInfo.handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_DMA_BUF_BIT_EXT;
+
+    VkImageCreateInfo imageInfo = {};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.pNext = &externalInfo;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.format = format;
+    imageInfo.extent = { dmabuf->width, dmabuf->height, 1 };
+    imageInfo.mipLevels = 1;
+    imageInfo.arrayLayers = 1;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.tiling = VK_IMAGE_TILING_DRM_FORMAT_MODIFIER_EXT;
+    imageInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT;
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    /* The pixels come with the ownership transfer from the client's
+     * (foreign) queue, not with the initial layout */
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    m_device = ctx.device;
+    m_functions = df;
+    m_queue = ctx.queue;
+    m_queueFamily = ctx.queueFamily;
+    m_getSemaphoreFd = ctx.getSemaphoreFd;
+
+    /* Both stay with us past comp_dmabuf_close() */
+    int acquireFence = dmabuf->acquire_fence;
+    dmabuf->acquire_fence = -1;
+    struct comp_buffer_lock* lock = dmabuf->lock;
+    dmabuf->lock = nullptr;
+
+    Image imported;
+    auto fail = [&](const char* what, VkResult result) {
+        qWarning() << "Vulkan DMA-BUF import:" << what << "failed, result" << result;
+        if (imported.commands[0] != VK_NULL_HANDLE) {
+            df->vkFreeCommandBuffers(ctx.device, m_commandPool, 2, imported.commands);
+        }
+        if (imported.acquire != VK_NULL_HANDLE) df->vkDestroySemaphore(ctx.device, imported.acquire, nullptr);
+        if (imported.image != VK_NULL_HANDLE) df->vkDestroyImage(ctx.device, imported.image, nullptr);
+        if (imported.memory != VK_NULL_HANDLE) df->vkFreeMemory(ctx.device, imported.memory, nullptr);
+        if (acquireFence >= 0) close(acquireFence);
+        comp_buffer_unlock(lock, -1);
+        comp_dmabuf_close(dmabuf);
+        return false;
+    };
+
+    VkResult result = df->vkCreateImage(ctx.device, &imageInfo, nullptr, &imported.image);
+    if (result != VK_SUCCESS) {
+        return fail("vkCreateImage", result);
+    }
+
+    VkMemoryFdPropertiesKHR fdProperties = {};
+    fdProperties.sType = VK_STRUCTURE_TYPE_MEMORY_FD_PROPERTIES_KHR;
+    result = ctx.getMemoryFdProperties(ctx.device, VK_EXTERNAL_MEMORY_HANDLE_TYPE_DMA_BUF_BIT_EXT,
+                                       dmabuf->fd[0], &fdProperties);
+    if (result != VK_SUCCESS) {
+        return fail("vkGetMemoryFdPropertiesKHR", result);
+    }
+
+    VkMemoryRequirements requirements;
+    df->vkGetImageMemoryRequirements(ctx.device, imported.image, &requirements);
+    uint32_t memoryTypes = requirements.memoryTypeBits & fdProperties.memoryTypeBits;
+    if (!memoryTypes) {
+        return fail("finding a memory type", VK_ERROR_FORMAT_NOT_SUPPORTED);
+    }
+
+    /* A successful import takes over the fd it was given */
+    int fd = dup(dmabuf->fd[0]);
+    if (fd < 0) {
+        return fail("dup", VK_ERROR_TOO_MANY_OBJECTS);
+    }
+
+    VkImportMemoryFdInfoKHR importInfo = {};
+    importInfo.sType = VK_STRUCTURE_TYPE_IMPORT_MEMORY_FD_INFO_KHR;
+    importInfo.handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_DMA_BUF_BIT_EXT;
+    importInfo.fd = fd;
+
+    VkMemoryDedicatedAllocateInfo dedicatedInfo = {};
+    dedicatedInfo.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO;
+    dedicatedInfo.pNext = &importInfo;
+    dedicatedInfo.image = imported.image;
+
+    VkMemoryAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.pNext = &dedicatedInfo;
+    allocInfo.allocationSize = requirements.size;
+    allocInfo.memoryTypeIndex = uint32_t(__builtin_ctz(memoryTypes));
+
+    result = df->vkAllocateMemory(ctx.device, &allocInfo, nullptr, &imported.memory);
+    if (result != VK_SUCCESS) {
+        close(fd);
+        return fail("vkAllocateMemory", result);
+    }
+
+    result = df->vkBindImageMemory(ctx.device, imported.image, imported.memory, 0);
+    if (result != VK_SUCCESS) {
+        return fail("vkBindImageMemory", result);
+    }
+
+    if (!ensureSyncObjects()) {
+        return fail("creating sync objects", VK_ERROR_INITIALIZATION_FAILED);
+    }
+
+    VkCommandBufferAllocateInfo commandInfo = {};
+    commandInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    commandInfo.commandPool = m_commandPool;
+    commandInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    commandInfo.commandBufferCount = 2;
+    result = df->vkAllocateCommandBuffers(ctx.device, &commandInfo, imported.commands);
+    if (result != VK_SUCCESS) {
+        imported.commands[0] = imported.commands[1] = VK_NULL_HANDLE;
+        return fail("vkAllocateCommandBuffers", result);
+    }
+
+    /* Sampling waits for the client's rendering on the GPU: the acquire
+     * fence becomes a semaphore the ownership transfer waits on */
+    if (acquireFence >= 0 && ctx.importSemaphoreFd) {
+        VkSemaphoreCreateInfo semaphoreInfo = {};
+        semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+        if (df->vkCreateSemaphore(ctx.device, &semaphoreInfo, nullptr,
+                                  &imported.acquire) == VK_SUCCESS) {
+            VkImportSemaphoreFdInfoKHR semaphoreImport = {};
+            semaphoreImport.sType = VK_STRUCTURE_TYPE_IMPORT_SEMAPHORE_FD_INFO_KHR;
+            semaphoreImport.semaphore = imported.acquire;
+            semaphoreImport.flags = VK_SEMAPHORE_IMPORT_TEMPORARY_BIT;
+            semaphoreImport.handleType = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_SYNC_FD_BIT;
+            semaphoreImport.fd = acquireFence;
+            if (ctx.importSemaphoreFd(ctx.device, &semaphoreImport) == VK_SUCCESS) {
+                /* Vulkan owns the fd now */
+                acquireFence = -1;
+            } else {
+                df->vkDestroySemaphore(ctx.device, imported.acquire, nullptr);
+                imported.acquire = VK_NULL_HANDLE;
+            }
+        }
+    }
+    if (acquireFence >= 0) {
+        comp_fence_wait(acquireFence, -1);
+        close(acquireFence);
+        acquireFence = -1;
+    }
+
+    recordOwnership(df, imported.commands[0], imported.image, ctx.queueFamily, true);
+
+    const VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+    VkSubmitInfo submit = {};
+    submit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    if (imported.acquire != VK_NULL_HANDLE) {
+        submit.waitSemaphoreCount = 1;
+        submit.pWaitSemaphores = &imported.acquire;
+        submit.pWaitDstStageMask = &waitStage;
+    }
+    submit.commandBufferCount = 1;
+    submit.pCommandBuffers = &imported.commands[0];
+    result = df->vkQueueSubmit(ctx.queue, 1, &submit, VK_NULL_HANDLE);
+    if (result != VK_SUCCESS) {
+        return fail("vkQueueSubmit", result);
+    }
+
+    /* The memory holds its own reference to the buffer - our fds are done */
+    comp_dmabuf_close(dmabuf);
+
+    /* The previous image may still be sampled by a frame in flight; the
+     * client gets it back once those are done */
+    if (m_current.image != VK_NULL_HANDLE || m_lock) {
+        releaseCurrent();
+    }
+    if (m_current.image != VK_NULL_HANDLE) {
+        m_retired.push_back(m_current);
+    }
+    while (m_retired.size() > kRetiredImages) {
+        destroyImage(m_retired.front());
+        m_retired.pop_front();
+    }
+    m_current = imported;
+    m_lock = lock;
+
+    /* A QSGTexture wraps one VkImage, so every import needs a new one;
+     * the scene graph defers releasing the old wrapper itself */
+    delete m_texture;
+    QQuickWindow::CreateTextureOptions options;
+    if (hasAlpha) {
+        options |= QQuickWindow::TextureHasAlphaChannel;
+    }
+    m_size = QSize(int(dmabuf->width), int(dmabuf->height));
+    m_texture = QNativeInterface::QSGVulkanTexture::fromNative(
+        imported.image, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, window, m_size, options);
+
+    return m_texture != nullptr;
+#else
+    Q_UNUSED(window);
+    comp_dmabuf_close(dmabuf);
+    return false;
+#endif
+}
@@ -14,11 +14,16 @@
 #include "xdg_shell_handler.h"
 #include "compositor_core.h"
 #include "seat_handler.h"
+#include "output_handler.h"
+#include "frame_trace.h"
+#include "view_scene.h"
+#include "view_stream.h"
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 
+#include <wlr/types/wlr_compositor.h>
 #include <wlr/types/wlr_xdg_shell.h>
 #include <wlr/types/wlr_xdg_decoration_v1.h>
 #include <wlr/types/wlr_scene.h>
@@ -32,6 +37,15 @@ extern struct comp_seat* comp_server_get_seat(struct comp_server* server);
 extern struct wl_list* comp_server_get_views(struct comp_server* server);
 extern void comp_server_notify_view_added(struct comp_server* server, struct comp_view* view);
 extern void comp_server_notify_view_removed(struct comp_server* server, struct comp_view* view);
+extern void comp_server_notify_view_title(struct comp_server* server, struct comp_view* view);
+extern void comp_server_notify_view_commit(struct comp_server* server, struct comp_view* view);
+extern void comp_server_notify_view_frame_commit(struct comp_server* server, struct comp_view* view);
+extern bool comp_server_has_per_view_outputs(struct comp_server* server);
+extern struct comp_output_manager* comp_server_get_output_manager(struct comp_server* server);
+extern struct buffer_pool* comp_server_get_buffer_pool(struct comp_server* server);
+extern void comp_server_update_view_feedback(struct comp_server* server, struct comp_view* view);
+extern void comp_server_get_initial_view_size(struct comp_server* server, uint32_t* width,
+                                              uint32_t* height, float* scale);
 
 /* Forward declarations */
 static void handle_xdg_toplevel_map(struct wl_listener* listener, void* data);
@@ -43,6 +57,9 @@ static void handle_xdg_toplevel_request_resize(struct wl_listener* listener, voi
 static void handle_xdg_toplevel_request_maximize(struct wl_listener* listener, void* data);
 static void handle_xdg_toplevel_request_fullscreen(struct wl_listener* listener, void* data);
 static void handle_xdg_toplevel_set_title(struct wl_listener* listener, void* data);
+static void handle_xdg_toplevel_set_app_id(struct wl_listener* listener, void* data);
+static void handle_xdg_surface_ack_configure(struct wl_listener* listener, void* data);
+static void handle_new_subsurface(struct wl_listener* listener, void* data);
 
 /* Remove all listeners for a view - safe with flag */
 static void view_remove_listeners(struct comp_view* view) {
@@ -57,10 +74,26 @@ static void view_remove_listeners(struct comp_view* view) {
     wl_list_remove(&view->request_maximize.link);
     wl_list_remove(&view->request_fullscreen.link);
     wl_list_remove(&view->set_title.link);
+    wl_list_remove(&view->set_app_id.link);
+    wl_list_remove(&view->ack_configure.link);
+    wl_list_remove(&view->new_subsurface.link);
     
     view->listeners_active = false;
 }
 
+/* More than the toplevel surface to show - compose the view offscreen.
+ * Waits for the map if need be, the scene wants a surface with content. */
+static void view_ensure_scene(struct comp_view* view) {
+    if (view->scene) return;
+    if (!view->mapped) {
+        view->wants_scene = true;
+        return;
+    }
+    
+    view->scene = view_scene_create(view);
+    view->trees.offscreen = view_scene_get_tree(view->scene);
+}
+
 /* Handle new XDG toplevel */
 static void handle_new_xdg_toplevel(struct wl_listener* listener, void* data) {
     struct comp_xdg_shell* shell = wl_container_of(listener, shell, new_xdg_toplevel);
@@ -82,6 +115,26 @@ static void handle_new_xdg_toplevel(struct wl_listener* listener, void* data) {
     view->scene_tree = NULL;  /* Created at map time! */
     view->x = 50;  /* Default position */
     view->y = 50;
+    view->trees.view = view;
+    toplevel->base->data = &view->trees;
+    view_frames_init(&view->frames, comp_server_get_buffer_pool(shell->server));
+    
+    /* Own output from the start, so the client already gets its scale
+     * with the first configure. Sized like the initial configure. */
+    if (comp_server_has_per_view_outputs(shell->server)) {
+        uint32_t width, height;
+        float scale;
+        comp_server_get_initial_view_size(shell->server, &width, &height, &scale);
+        uint32_t pixel_width = (uint32_t)(width * scale + 0.5f);
+        uint32_t pixel_height = (uint32_t)(height * scale + 0.5f);
+        view->output = comp_output_manager_add_view_output(
+            comp_server_get_output_manager(shell->server), view, pixel_width, pixel_height);
+        if (!view->output) {
+            wlr_log(WLR_ERROR, "Failed to create output for view, sharing the scene");
+        } else if (scale != 1.0f) {
+            comp_output_set_size(view->output, pixel_width, pixel_height, scale);
+        }
+    }
     
     /* Setup listeners */
     view->map.notify = handle_xdg_toplevel_map;
@@ -111,11 +164,23 @@ static void handle_new_xdg_toplevel(struct wl_listener* listener, void* data) {
     view->set_title.notify = handle_xdg_toplevel_set_title;
     wl_signal_add(&toplevel->events.set_title, &view->set_title);
     
+    view->set_app_id.notify = handle_xdg_toplevel_set_app_id;
+    wl_signal_add(&toplevel->events.set_app_id, &view->set_app_id);
+    
+    view->ack_configure.notify = handle_xdg_surface_ack_configure;
+    wl_signal_add(&toplevel->base->events.ack_configure, &view->ack_configure);
+    
+    view->new_subsurface.notify = handle_new_subsurface;
+    wl_signal_add(&toplevel->base->surface->events.new_subsurface, &view->new_subsurface);
+    
     view->listeners_active = true;
     
     /* Add to server view list */
     wl_list_insert(comp_server_get_views(shell->server), &view->link);
     
+    /* Before the client allocates its first buffer */
+    comp_server_update_view_feedback(shell->server, view);
+    
     /* wlroots 0.19: Do NOT call wlr_xdg_surface_schedule_configure here!
      * The surface is not yet initialized. Configure will be sent automatically
      * after the client's first commit, or we send it in the commit handler
@@ -143,12 +208,17 @@ static void handle_xdg_toplevel_map(struct wl_listener* listener, void* data) {
     
     /* Store view pointer in scene node data */
     view->scene_tree->node.data = view;
+    view->trees.main = view->scene_tree;
     
     /* Set position */
     wlr_scene_node_set_position(&view->scene_tree->node, view->x, view->y);
     
     view->mapped = true;
     
+    if (view->wants_scene) {
+        view_ensure_scene(view);
+    }
+    
     /* Focus the new view */
     comp_view_focus(view);
     
@@ -170,6 +240,7 @@ static void handle_xdg_toplevel_unmap(struct wl_listener* listener, void* data)
     
     /* Reset keyboard focus if this view had it */
     struct comp_seat* seat = comp_server_get_seat(view->server);
+    comp_seat_forget_view(seat, view);
     if (seat && seat->seat) {
         struct wlr_surface* focused = seat->seat->keyboard_state.focused_surface;
         if (focused && focused == view->xdg_toplevel->base->surface) {
@@ -186,19 +257,41 @@ static void handle_xdg_toplevel_commit(struct wl_listener* listener, void* data)
     /* wlroots 0.19: After initial_commit, the surface is initialized
      * and we can send configure events */
     if (view->xdg_toplevel->base->initial_commit) {
-        if (!view->pending_configure) {
-            /* Send initial configure - use fullscreen to avoid ALL decorations */
-            wlr_xdg_toplevel_set_size(view->xdg_toplevel, 640, 480);
-            wlr_xdg_toplevel_set_fullscreen(view->xdg_toplevel, true);
-            wlr_xdg_toplevel_set_activated(view->xdg_toplevel, true);
-            view->pending_configure = true;
-            wlr_log(WLR_DEBUG, "Sent initial configure (640x480 fullscreen) after initial_commit");
+        /* Size of the item expected to show it, unless one was asked for */
+        if (!view->requested_width || !view->requested_height) {
+            float scale;
+            comp_server_get_initial_view_size(view->server, &view->requested_width,
+                                              &view->requested_height, &scale);
         }
+        
+        /* Send initial configure - use fullscreen to avoid ALL decorations */
+        wlr_xdg_toplevel_set_fullscreen(view->xdg_toplevel, true);
+        wlr_xdg_toplevel_set_activated(view->xdg_toplevel, true);
+        view->pending_serial = wlr_xdg_toplevel_set_size(view->xdg_toplevel,
+            view->requested_width, view->requested_height);
+        view->pending_configure = true;
+        view->configured_width = view->requested_width;
+        view->configured_height = view->requested_height;
+        wlr_log(WLR_DEBUG, "Sent initial configure (%ux%u fullscreen) after initial_commit",
+                view->requested_width, view->requested_height);
     }
     
+    struct wlr_surface* surface = view->xdg_toplevel->base->surface;
+    if (view->mapped && pixman_region32_not_empty(&surface->buffer_damage)) {
+        frame_trace_mark(view, FRAME_TRACE_COMMIT, 0, 0);
+    }
+    
+    /* With a scene of its own the render reports what changed instead -
+     * subsurfaces and popups commit without the toplevel */
+    if (view->scene) return;
+    
+    /* Staging buffers re-copy only what the client damaged */
+    view_frames_damage(&view->frames, &surface->buffer_damage);
+    
     /* Notify that a frame was committed - trigger render */
     if (view->mapped) {
-        comp_server_notify_frame_commit(view->server);
+        comp_server_notify_view_frame_commit(view->server, view);
+        comp_server_notify_view_commit(view->server, view);
     }
 }
 
@@ -217,6 +310,19 @@ static void handle_xdg_toplevel_destroy(struct wl_listener* listener, void* data
     
     /* Scene tree is automatically destroyed with surface */
     
+    if (view->output) {
+        comp_output_destroy(view->output);
+    }
+    
+    view_stream_destroy(view->stream);
+    view_scene_destroy(view->scene);
+    view->xdg_toplevel->base->data = NULL;
+    
+    /* Frames still held by Qt keep their slot alive until released */
+    view_frames_finish(&view->frames);
+    frame_trace_forget_view(view);
+    comp_seat_forget_view(comp_server_get_seat(view->server), view);
+    
     free(view);
 }
 
@@ -255,12 +361,89 @@ static void handle_xdg_toplevel_request_fullscreen(struct wl_listener* listener,
     wlr_xdg_surface_schedule_configure(view->xdg_toplevel->base);
 }
 
+/* A subsurface - the toplevel buffer alone no longer shows the view */
+static void handle_new_subsurface(struct wl_listener* listener, void* data) {
+    struct comp_view* view = wl_container_of(listener, view, new_subsurface);
+    (void)data;
+    view_ensure_scene(view);
+}
+
+/* Client acked a configure - the next merged size may go out */
+static void handle_xdg_surface_ack_configure(struct wl_listener* listener, void* data) {
+    struct comp_view* view = wl_container_of(listener, view, ack_configure);
+    struct wlr_xdg_surface_configure* configure = data;
+    
+    /* Acking an older configure doesn't count, serials may wrap */
+    if (!view->pending_configure || (int32_t)(configure->serial - view->pending_serial) < 0) {
+        return;
+    }
+    view->pending_configure = false;
+    comp_view_flush_configure(view);
+}
+
+/* Send the merged size request */
+void comp_view_flush_configure(struct comp_view* view) {
+    if (!view || !view->xdg_toplevel || !view->xdg_toplevel->base->initialized) return;
+    if (view->pending_configure) return;
+    if (!view->requested_width || !view->requested_height) return;
+    if (view->requested_width == view->configured_width &&
+        view->requested_height == view->configured_height) {
+        return;
+    }
+    
+    view->pending_serial = wlr_xdg_toplevel_set_size(view->xdg_toplevel,
+        view->requested_width, view->requested_height);
+    view->pending_configure = true;
+    view->configured_width = view->requested_width;
+    view->configured_height = view->requested_height;
+}
+
 /* Handle title change */
 static void handle_xdg_toplevel_set_title(struct wl_listener* listener, void* data) {
     struct comp_view* view = wl_container_of(listener, view, set_title);
     (void)data;
     wlr_log(WLR_DEBUG, "Title changed to: %s",
             view->xdg_toplevel->title ? view->xdg_toplevel->title : "(null)");
+    comp_server_notify_view_title(view->server, view);
+}
+
+/* Handle app id change - only capture tools list it */
+static void handle_xdg_toplevel_set_app_id(struct wl_listener* listener, void* data) {
+    struct comp_view* view = wl_container_of(listener, view, set_app_id);
+    (void)data;
+    comp_server_notify_view_title(view->server, view);
+}
+
+/* Popup's first commit - it maps only after a configure, kept inside
+ * the view since nothing outside of it is shown */
+static void handle_popup_commit(struct wl_listener* listener, void* data) {
+    struct comp_surface_trees* trees = wl_container_of(listener, trees, commit);
+    (void)data;
+    
+    struct wlr_xdg_popup* popup = trees->popup;
+    if (!popup->base->initial_commit) return;
+    
+    /* In toplevel coordinates, which start at the window geometry */
+    struct wlr_xdg_surface* toplevel = trees->view->xdg_toplevel->base;
+    struct wlr_box box = {
+        .x = -toplevel->current.geometry.x,
+        .y = -toplevel->current.geometry.y,
+        .width = toplevel->surface->current.width,
+        .height = toplevel->surface->current.height,
+    };
+    wlr_xdg_popup_unconstrain_from_box(popup, &box);
+    wlr_xdg_surface_schedule_configure(popup->base);
+}
+
+static void handle_popup_destroy(struct wl_listener* listener, void* data) {
+    struct comp_surface_trees* trees = wl_container_of(listener, trees, destroy);
+    (void)data;
+    
+    /* The scene trees go away with the surface by themselves */
+    wl_list_remove(&trees->commit.link);
+    wl_list_remove(&trees->destroy.link);
+    trees->popup->base->data = NULL;
+    free(trees);
 }
 
 /* Handle new popup */
@@ -285,11 +468,36 @@ static void handle_new_xdg_popup(struct wl_listener* listener, void* data) {
         return;
     }
     
-    /* Create popup scene tree - wlroots handles positioning */
-    struct wlr_scene_tree* parent_tree = parent_xdg->data;
-    if (parent_tree) {
-        wlr_scene_xdg_surface_create(parent_tree, popup->base);
+    struct comp_surface_trees* parent = parent_xdg->data;
+    if (!parent) {
+        wlr_log(WLR_ERROR, "Popup parent is not shown anywhere");
+        return;
     }
+    
+    struct comp_surface_trees* trees = calloc(1, sizeof(*trees));
+    if (!trees) {
+        wlr_log(WLR_ERROR, "Failed to allocate popup");
+        return;
+    }
+    trees->view = parent->view;
+    trees->popup = popup;
+    popup->base->data = trees;
+    
+    /* Only the view's own scene shows it in its frames */
+    view_ensure_scene(parent->view);
+    
+    /* Create popup scene trees - wlroots handles positioning */
+    if (parent->main) {
+        trees->main = wlr_scene_xdg_surface_create(parent->main, popup->base);
+    }
+    if (parent->offscreen) {
+        trees->offscreen = wlr_scene_xdg_surface_create(parent->offscreen, popup->base);
+    }
+    
+    trees->commit.notify = handle_popup_commit;
+    wl_signal_add(&popup->base->surface->events.commit, &trees->commit);
+    trees->destroy.notify = handle_popup_destroy;
+    wl_signal_add(&popup->base->events.destroy, &trees->destroy);
 }
 
 /* Handle new decoration request */